@@ -78,10 +78,170 @@ float distance_triangle
 
 /*--------------------------------------------------------------------------*/
 
-vec2 min_idx(vec2 lhs, vec2 rhs)
+float distance_primitive
+
+    (vec3 p,    /* point to measure from */
+     uint prim) /* world primitive, spheres tagged with BVH_SPHERE_BIT */
+     
+/*
+    Returns the distance from p to a world primitive, signed for spheres.
+*/
+
+{
+    if ((prim & BVH_SPHERE_BIT) != 0)
+    {
+        Sphere sphere = spheres[prim & ~BVH_SPHERE_BIT];
+        return sphere.radius * distance_sphere((p - sphere.origin) / sphere.radius);
+    }
+    
+    Triangle tri = triangles[prim];
+    return distance_triangle(p, tri.vert0.xyz, tri.vert1.xyz, tri.vert2.xyz);
+    
+} /* distance_primitive */
+
+/*--------------------------------------------------------------------------*/
+
+float distance_box
+
+    (vec3 p,        /* point to measure from */
+     vec3 box_min,  /* lower corner */
+     vec3 box_max)  /* upper corner */
+     
+{
+    return length(max(max(box_min - p, p - box_max), 0.0));
+    
+} /* distance_box */
+
+/*--------------------------------------------------------------------------*/
+
+float distance_scene_linear
+
+    (vec3 p) /* point to measure from */
+    
+/*
+    Returns the distance from p to the closest sphere or world triangle, 
+    testing every one of them.
+*/
+
+{
+    float dist = INF;
+    for (int j=0; j<spheres.length(); ++j)
+        dist = min(dist, distance_primitive(p, uint(j) | BVH_SPHERE_BIT));
+    for (int j=0; j<triangles.length(); ++j)
+        dist = min(dist, distance_primitive(p, uint(j)));
+    return dist;
+    
+} /* distance_scene_linear */
+
+/*--------------------------------------------------------------------------*/
+
+float distance_scene_bvh
+
+    (vec3 p) /* point to measure from */
+    
+/*
+    Same as distance_scene_linear, but only visits the nodes of the world 
+    BVH that are closer than the closest primitive found so far, nearest 
+    child first. The boxes only bound the unsigned distance, so inside a 
+    sphere every box around p is visited. 
+*/
+
+{
+    uint stack[BVH_STACK_SIZE];
+    float stack_dist[BVH_STACK_SIZE];
+    int stack_size = 0;
+    uint node_idx = 0;
+    float closest = INF;
+    
+    while (true)
+    {
+        BvhNode node = bvh_nodes[node_idx];
+        if ((node.right_or_count & BVH_LEAF_BIT) != 0)
+        {
+            uint count = node.right_or_count & ~BVH_LEAF_BIT;
+            for (uint i = 0; i < count; i++)
+                closest = min(closest, distance_primitive(p, bvh_indices[node.left_or_first + i]));
+        }
+        else
+        {
+            uint near = node.left_or_first;
+            uint far = node.right_or_count;
+            float near_dist = distance_box(p, bvh_nodes[near].aabb_min, bvh_nodes[near].aabb_max);
+            float far_dist = distance_box(p, bvh_nodes[far].aabb_min, bvh_nodes[far].aabb_max);
+            if (far_dist < near_dist)
+            {
+                uint swap_idx = near; near = far; far = swap_idx;
+                float swap_dist = near_dist; near_dist = far_dist; far_dist = swap_dist;
+            }
+            if (near_dist <= max(closest, 0.0))
+            {
+                if (far_dist <= max(closest, 0.0))
+                {
+                    stack_dist[stack_size] = far_dist;
+                    stack[stack_size++] = far;
+                }
+                node_idx = near;
+                continue;
+            }
+        }
+        
+        /* entries pushed before closest shrank may be out of reach by now */
+        while (stack_size > 0 && stack_dist[stack_size - 1] > max(closest, 0.0)) stack_size--;
+        if (stack_size == 0) break;
+        node_idx = stack[--stack_size];
+    }
+    
+    return closest;
+    
+} /* distance_scene_bvh */
+
+/*--------------------------------------------------------------------------*/
+
+float distance_scene
+
+    (vec3 p) /* point to measure from */
+    
+/*
+    Returns a lower bound of the distance from p to the world primitives, 
+    which is all a sphere tracer needs to step safely. 
+    
+    Uses the brick map baked by SdfBrickMap if there is one. Outside of 
+    its grid the distance to the grid plus the one brick of margin the 
+    bake leaves around the geometry is a bound. Cells without a brick 
+    store a bound that holds anywhere inside them. Bricks are filtered 
+    by the texture unit, and the filtered distance of samples spaced a 
+    voxel apart is off by at most the voxel diagonal, so that is taken 
+    off. Once that leaves less than a voxel the exact distance is 
+    evaluated, which is what decides a hit. 
+*/
+
 {
-    return lhs.x<rhs.x ? lhs : rhs;
-}
+    if (sdf_dims.x == 0) return distance_scene_linear(p);
+    
+    vec3 grid = (p - sdf_origin) / sdf_brick_extent;
+    vec3 grid_max = vec3(sdf_dims);
+    if (any(lessThan(grid, vec3(0))) || any(greaterThanEqual(grid, grid_max)))
+        return distance_box(p, sdf_origin, sdf_origin + grid_max * sdf_brick_extent) 
+               + sdf_brick_extent;
+    
+    ivec3 cell_idx = ivec3(grid);
+    SdfCell cell = sdf_cells[(cell_idx.z * sdf_dims.y + cell_idx.y) * sdf_dims.x + cell_idx.x];
+    if (cell.brick == SDF_EMPTY_BRICK) return cell.distance;
+    
+    uvec3 slot = uvec3(cell.brick % SDF_ATLAS_BRICKS, 
+                       (cell.brick / SDF_ATLAS_BRICKS) % SDF_ATLAS_BRICKS, 
+                       cell.brick / (SDF_ATLAS_BRICKS * SDF_ATLAS_BRICKS));
+    vec3 texel = vec3(slot * SDF_BRICK_SIZE) + 0.5 
+                 + (grid - vec3(cell_idx)) * float(SDF_BRICK_SIZE - 1);
+    float voxel = sdf_brick_extent / float(SDF_BRICK_SIZE - 1);
+    float dist = textureLod(sdf_atlas, texel / vec3(textureSize(sdf_atlas, 0)), 0).r 
+                 - sqrt(3.0) * voxel;
+    
+    return dist > voxel ? dist : distance_scene_bvh(p);
+    
+} /* distance_scene */
+
+/*--------------------------------------------------------------------------*/
 
 float intersect_scene_st
 
@@ -91,35 +251,19 @@ float intersect_scene_st
 	 out IsectM info) /* intersection data */
      
 /*
-    Intersect scene using sphere tracing.
+    Intersect scene using sphere tracing. Each step goes through 
+    distance_scene, far from the surface that is one lookup of the brick 
+    map instead of a distance per primitive.
 */ 
      
 {
     float t = mint;
     vec3 p = ray.origin + t*ray.direction;
     int i;
-    vec2 s_radius_idx = vec2(INF,-1);
-    vec2 t_radius_idx = vec2(INF,-1);
     float min_radius;
     for (i=0; i<MARCH_ITER; ++i)
     {
-        for (int j=0; j<spheres.length(); ++j)
-        {
-            Sphere sphere = spheres[j];
-            vec3 p_tform = (p - sphere.origin)/sphere.radius;
-            float dist = sphere.radius * distance_sphere(p_tform);
-            s_radius_idx = min_idx(s_radius_idx, vec2(dist, j));
-        }
-        
-        t_radius_idx = vec2(INF, -1);
-        for (int j=0; j<triangles.length(); ++j)
-        {
-            Triangle tri = triangles[j];
-            float dist = distance_triangle(p, tri.vert0.xyz, tri.vert1.xyz, tri.vert2.xyz);
-            t_radius_idx = min_idx(t_radius_idx, vec2(dist, j));
-        }
-        
-        min_radius = min(s_radius_idx.x, t_radius_idx.x);
+        min_radius = distance_scene(p);
         if (min_radius < MARCH_EPS || min_radius > maxt)
         {
             info.t = t;
@@ -18,10 +18,8 @@
 	- Profile whether intersect_any vs intersect is slower/faster.
 	- Add uvs for texturing.
 	- Use mat4 or mat3 + vec3 for sphere data (allows ellipsoids).
-	- Bring this further to instancing.
 	- Add material data from intersection.
 	
-	- Add aabb intersection.
 	- Add torus intersection.
 	- Add cylinder intersection.
 	- Add disk intersection.
@@ -411,52 +409,1531 @@ bool intersect_triangle_fast
 
 /*--------------------------------------------------------------------------*/
 
-bool intersect_scene_any
+vec2 intersect_aabb
+
+	(Ray  ray,     /* ray for the intersection */
+	 vec3 inv_dir, /* 1/ray.direction, computed once per traversal */
+	 vec3 bmin,    /* lower corner of the box */
+	 vec3 bmax)    /* upper corner of the box */
+
+/*
+	Returns the coordinates (tnear, tfar) at which the ray enters and 
+	leaves the axis aligned box [bmin, bmax] (slab test). The ray 
+	misses the box when tnear > tfar.
+*/
+
+{
+	vec3 t0 = (bmin - ray.origin) * inv_dir;
+	vec3 t1 = (bmax - ray.origin) * inv_dir;
+	vec3 t_small = min(t0, t1);
+	vec3 t_big = max(t0, t1);
+	
+	float tnear = max(max(t_small.x, t_small.y), t_small.z);
+	float tfar = min(min(t_big.x, t_big.y), t_big.z);
+	
+	return vec2(tnear, tfar);
+	
+} /* intersect_aabb */
+
+/*--------------------------------------------------------------------------*/
+
+bool bvh_visit
+
+	(vec2  span, /* (tnear, tfar) from intersect_aabb */
+	 float mint, /* lower bound for t */
+	 float maxt) /* upper bound for t */
+	 
+/*
+	Returns true if the box span overlaps (mint, maxt).
+*/
+	 
+{
+	return span.x <= span.y && mint < span.y && span.x < maxt;
+	
+} /* bvh_visit */
+
+/*--------------------------------------------------------------------------*/
+
+float intersect_triangle_hit
+
+	(Ray         ray,  /* ray for the intersection */
+	 TriangleHit tri,  /* triangle from triangle_hits or mesh_triangle_hits */
+	 float       mint, /* lower bound for t */
+	 float       maxt) /* upper bound for t */
+	 
+/*
+	Returns the coordinate of the intersection with a triangle in 
+	(mint, maxt), or INF. The rows of tri transform the ray into the 
+	space of the unit triangle (0,0,0), (1,0,0), (0,1,0), where it hits 
+	the plane z = 0 and x, y of the hit are the barycentric coordinates 
+	(Woop et al. 2004). The transform is affine, so t is the same as 
+	along the untransformed ray.
+	
+	Accepts the same hits as intersect_triangle_fast, but with the edges, 
+	the normal and the inverse determinant computed once at upload 
+	instead of for every ray. A degenerate triangle has z = 1 everywhere 
+	and is never hit.
+*/
+	 
+{
+	/* plane of the triangle first, most rays stop here */
+	float t = -(dot(tri.row2.xyz, ray.origin) + tri.row2.w) / dot(tri.row2.xyz, ray.direction);
+	if (!(mint < t && t < maxt)) return INF;
+	
+	/* barycentric coordinates of the hit */
+	vec3 p = ray.origin + t*ray.direction;
+	float u = dot(tri.row0.xyz, p) + tri.row0.w;
+	float v = dot(tri.row1.xyz, p) + tri.row1.w;
+	
+	return 0<u && 0<v && u+v<1 ? t : INF;
+	
+} /* intersect_triangle_hit */
+
+/*--------------------------------------------------------------------------*/
+
+float intersect_sphere_hit
+
+	(Ray       ray,    /* ray for the intersection */
+	 SphereHit sphere, /* sphere from sphere_hits */
+	 float     mint,   /* lower bound for t */
+	 float     maxt)   /* upper bound for t */
+	 
+/*
+	Same test as intersect_sphere on the ray moved into the space of the 
+	unit sphere, but only returns the coordinate along the ray, or INF. 
+	The ray is scaled by the inverse radius computed at upload.
+*/
+	 
+{
+	vec3 o = (ray.origin - sphere.center) * sphere.inv_radius;
+	vec3 d = ray.direction * sphere.inv_radius;
+	
+	/* A*t^2 - 2*B*t + C = 0 */
+	float A = dot(d, d);
+	float B = -dot(d, o);
+	float C = dot(o, o) - 1;
+	
+	/* discriminant, no roots if negative */
+	float D = B*B-A*C;
+	if (D < 0) return INF;
+	D = sqrt(D);
+	
+	/* the nearer root first, the farther one from inside the sphere */
+	float t1 = (B-D)/A;
+	float t2 = (B+D)/A;
+	
+	return mint < t1 && t1 < maxt ? t1 : (mint < t2 && t2 < maxt ? t2 : INF);
+	
+} /* intersect_sphere_hit */
+
+/*--------------------------------------------------------------------------*/
+
+BvhNode bvh_node
+
+	(uint tree, /* BVH_WORLD or BVH_MESH */
+	 uint idx)  /* node index */
+	 
+/*
+	Fetches a node of the hierarchy over the world primitives or of one of 
+	the mesh hierarchies. tree is a constant at every call site, so the 
+	branch folds away.
+*/
+	 
+{
+	return tree == BVH_MESH ? blas_nodes[idx] : bvh_nodes[idx];
+	
+} /* bvh_node */
+
+/*--------------------------------------------------------------------------*/
+
+uint bvh_parent
+
+	(uint tree, /* BVH_WORLD or BVH_MESH */
+	 uint idx)  /* node index, not a root */
+	 
+{
+	return tree == BVH_MESH ? blas_parents[idx] : bvh_parents[idx];
+	
+} /* bvh_parent */
+
+/*--------------------------------------------------------------------------*/
+
+bool bvh_left_near
+
+	(vec2 span_l, /* (tnear, tfar) of the left child */
+	 vec2 span_r) /* (tnear, tfar) of the right child */
+	 
+/*
+	Decides which child is visited first. The descent and bvh_climb have to 
+	agree on it, so both go through here. The entry points do not depend 
+	on closest_t, the decision is the same however often it is repeated.
+*/
+	 
+{
+	return span_l.x <= span_r.x;
+	
+} /* bvh_left_near */
+
+/*--------------------------------------------------------------------------*/
+
+uint bvh_climb
+
+	(Ray   ray,      /* ray of the traversal */
+	 vec3  inv_dir,  /* 1/ray.direction */
+	 uint  tree,     /* BVH_WORLD or BVH_MESH */
+	 uint  root,     /* node the traversal started from */
+	 uint  node_idx, /* node whose subtree is done */
+	 float mint,     /* lower bound for t */
+	 float maxt)     /* current upper bound for t */
+	 
+/*
+	Finds the next node of a traversal without looking at a stack. Climbs 
+	the parent links from node_idx and returns the far child of the first 
+	ancestor that was entered through its near child, if the ray still 
+	reaches it, or BVH_NONE once the root is passed. 
+	
+	In depth first order every far child of such an ancestor comes after 
+	node_idx, and every other ancestor is already done, so this visits 
+	exactly what a stack would still hold (Hapala et al. 2011, "Efficient 
+	Stack-less BVH Traversal for Ray Tracing"). The price is two more box 
+	tests per level climbed.
+*/
+	 
+{
+	while (node_idx != root)
+	{
+		uint parent = bvh_parent(tree, node_idx);
+		BvhNode node = bvh_node(tree, parent);
+		uint left = node.left_or_first;
+		uint right = node.right_or_count;
+		BvhNode left_node = bvh_node(tree, left);
+		BvhNode right_node = bvh_node(tree, right);
+		vec2 span_l = intersect_aabb(ray, inv_dir, left_node.aabb_min, left_node.aabb_max);
+		vec2 span_r = intersect_aabb(ray, inv_dir, right_node.aabb_min, right_node.aabb_max);
+		bool left_near = bvh_left_near(span_l, span_r);
+		
+		if (node_idx == (left_near ? left : right) && 
+			bvh_visit(left_near ? span_r : span_l, mint, maxt))
+			return left_near ? right : left;
+		
+		node_idx = parent;
+	}
+	
+	return BVH_NONE;
+	
+} /* bvh_climb */
+
+/*--------------------------------------------------------------------------*/
+
+uint short_stack_slot
+
+	(uint top) /* position in the ring of this invocation */
+	 
+/*
+	Entries of one invocation are GROUP_INVOCATIONS apart, so neighbouring 
+	invocations use neighbouring banks.
+*/
+	 
+{
+	return (top % uint(BVH_SHORT_STACK_SIZE)) * uint(GROUP_INVOCATIONS) + gl_LocalInvocationIndex;
+	
+} /* short_stack_slot */
+
+/*--------------------------------------------------------------------------*/
+
+void short_stack_push
+
+	(inout uint top,     /* pushes minus pops */
+	 inout int  size,    /* valid entries, at most BVH_SHORT_STACK_SIZE */
+	 inout bool dropped, /* set once an entry was overwritten */
+	 uint       node)    /* node to push */
+	 
+/*
+	Pushes onto the ring of this invocation in shared memory. A full ring 
+	overwrites its oldest entry, bvh_climb finds it again later.
+*/
+	 
+{
+	bvh_short_stack[short_stack_slot(top)] = node;
+	top++;
+	dropped = dropped || size == BVH_SHORT_STACK_SIZE;
+	size = min(size + 1, BVH_SHORT_STACK_SIZE);
+	
+} /* short_stack_push */
+
+/*--------------------------------------------------------------------------*/
+
+uint short_stack_pop
+
+	(inout uint top,  /* pushes minus pops */
+	 inout int  size) /* valid entries, must not be 0 */
+	 
+{
+	top--;
+	size--;
+	return bvh_short_stack[short_stack_slot(top)];
+	
+} /* short_stack_pop */
+
+/*--------------------------------------------------------------------------*/
+
+uint bvh_primitive_index
+
+	(uint tree, /* BVH_WORLD or BVH_MESH */
+	 uint idx)  /* entry referenced by a leaf */
+	 
+/*
+	Returns the primitive referenced by a leaf. For BVH_MESH this is a 
+	mesh triangle, i.e. a triple of mesh_indices and an entry of 
+	mesh_triangle_hits. For BVH_WORLD it is an index into triangles, or 
+	into spheres if tagged with BVH_SPHERE_BIT.
+*/
+	 
+{
+	return tree == BVH_MESH ? blas_indices[idx] : bvh_indices[idx];
+	
+} /* bvh_primitive_index */
+
+/*--------------------------------------------------------------------------*/
+
+vec3 decode_octahedral
+
+	(uint bits) /* two snorm16 components, see encode_octahedral */
+	 
+/*
+	Unfolds a direction stored on the octahedron, not normalized.
+*/
+	 
+{
+	vec2 e = unpackSnorm2x16(bits);
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	
+	/* the lower half is folded over the diagonals of the square */
+	float fold = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -fold : fold;
+	n.y += n.y >= 0.0 ? -fold : fold;
+	return n;
+	
+} /* decode_octahedral */
+
+/*--------------------------------------------------------------------------*/
+
+vec3 mesh_vertex_position
+
+	(uint idx) /* vertex referenced by mesh_indices */
+	 
+/*
+	Position of a mesh vertex in mesh space. The mesh space of a quantized 
+	mesh is its grid, see Mesh::quantize, so decoding is a conversion.
+*/
+	 
+{
+	if (MESH_QUANTIZED)
+	{
+		QuantizedVertex q = mesh_quantized_vertices[idx];
+		return vec3(q.position_xy & 0xFFFFu, q.position_xy >> 16, q.position_z & 0xFFFFu);
+	}
+	return mesh_vertices[idx].position;
+	
+} /* mesh_vertex_position */
+
+/*--------------------------------------------------------------------------*/
+
+vec3 mesh_vertex_normal
+
+	(uint idx) /* vertex referenced by mesh_indices */
+	 
+/*
+	Normal of a mesh vertex in mesh space, not normalized.
+*/
+	 
+{
+	if (MESH_QUANTIZED)
+		return decode_octahedral(mesh_quantized_vertices[idx].normal);
+	return mesh_vertices[idx].normal;
+	
+} /* mesh_vertex_normal */
+
+/*--------------------------------------------------------------------------*/
+
+vec2 mesh_vertex_uv
+
+	(uint idx) /* vertex referenced by mesh_indices */
+	 
+{
+	if (MESH_QUANTIZED)
+		return unpackHalf2x16(mesh_quantized_vertices[idx].uv);
+	return vec2(mesh_vertices[idx].u, mesh_vertices[idx].v);
+	
+} /* mesh_vertex_uv */
+
+/*--------------------------------------------------------------------------*/
+
+vec3 mesh_normal
+
+	(uint tri_idx, /* mesh triangle that was hit */
+	 vec3 pos)     /* hit point in mesh space */
+	 
+/*
+	Returns the vertex normals of a mesh triangle interpolated at pos, in 
+	mesh space and not normalized.
+*/
+	 
+{
+	uint ia = mesh_indices[3 * tri_idx + 0];
+	uint ib = mesh_indices[3 * tri_idx + 1];
+	uint ic = mesh_indices[3 * tri_idx + 2];
+	vec3 a = mesh_vertex_position(ia);
+	vec3 b = mesh_vertex_position(ib);
+	vec3 c = mesh_vertex_position(ic);
+	
+	/* barycentric coordinates from the areas of the sub triangles */
+	vec3 n = cross(b - a, c - a);
+	float inv_area = 1.0 / dot(n, n);
+	float u = dot(cross(c - b, pos - b), n) * inv_area;
+	float v = dot(cross(a - c, pos - c), n) * inv_area;
+	return u * mesh_vertex_normal(ia) + v * mesh_vertex_normal(ib) + 
+		   (1.0 - u - v) * mesh_vertex_normal(ic);
+	
+} /* mesh_normal */
+
+/*--------------------------------------------------------------------------*/
+
+float mesh_texture_lod
+
+	(uint tri_idx,  /* mesh triangle that was hit */
+	 int  tex,      /* index into textures */
+	 Ray  mesh_ray, /* the ray in mesh space */
+	 float t)       /* hit distance along mesh_ray */
+	 
+/*
+	Mip level of tex for a hit on a mesh triangle, after the ray cones of 
+	Akenine-Moller et al. The cone of a camera ray widens by the angle of 
+	one pixel, its footprint at the hit is compared with the number of 
+	texels per unit of area the uvs of the triangle map onto it. Rays 
+	after a bounce are treated as if they left the camera, which only 
+	underestimates their footprint, so the result errs on the sharp side.
+*/
+	 
+{
+	uint ia = mesh_indices[3 * tri_idx + 0];
+	uint ib = mesh_indices[3 * tri_idx + 1];
+	uint ic = mesh_indices[3 * tri_idx + 2];
+	vec3 a = mesh_vertex_position(ia);
+	vec3 n = cross(mesh_vertex_position(ib) - a, mesh_vertex_position(ic) - a);
+	vec2 size = vec2(textureSize(MATERIAL_TEXTURE(tex), 0));
+	vec2 uv_a = mesh_vertex_uv(ia) * size;
+	vec2 e1 = mesh_vertex_uv(ib) * size - uv_a;
+	vec2 e2 = mesh_vertex_uv(ic) * size - uv_a;
+	float texel_area = abs(e1.x * e2.y - e1.y * e2.x);
+	float area = length(n);
+	
+	/* pixel footprint, the mesh space of an instance can be scaled */
+	float dir_length = length(mesh_ray.direction);
+	float width = t * dir_length * cam.params.y / float(dim.x);
+	float cos_theta = abs(dot(mesh_ray.direction, n)) / (dir_length * area);
+	float lod = 0.5 * log2(texel_area / area) + log2(width / max(cos_theta, 0.01));
+	return max(lod, 0.0);
+	
+} /* mesh_texture_lod */
+
+/*--------------------------------------------------------------------------*/
+
+void apply_mesh_textures
+
+	(Material  mat,      /* of the mesh */
+	 uint      tri_idx,  /* mesh triangle that was hit */
+	 Ray       mesh_ray, /* the ray in mesh space */
+	 float     t,        /* hit distance along mesh_ray */
+	 inout vec3 albedo,
+	 inout vec3 emission)
+	 
+/*
+	Scales albedo and emission by the textures of mat at the hit point.
+*/
+	 
+{
+	int albedo_tex = int(mat.data.y);
+	int emission_tex = int(mat.data.z);
+	if (albedo_tex < 0 && emission_tex < 0)
+		return;
+	
+	/* barycentric coordinates like in mesh_normal */
+	vec3 pos = mesh_ray.origin + t * mesh_ray.direction;
+	uint ia = mesh_indices[3 * tri_idx + 0];
+	uint ib = mesh_indices[3 * tri_idx + 1];
+	uint ic = mesh_indices[3 * tri_idx + 2];
+	vec3 a = mesh_vertex_position(ia);
+	vec3 b = mesh_vertex_position(ib);
+	vec3 c = mesh_vertex_position(ic);
+	vec3 n = cross(b - a, c - a);
+	float inv_area = 1.0 / dot(n, n);
+	float u = dot(cross(c - b, pos - b), n) * inv_area;
+	float v = dot(cross(a - c, pos - c), n) * inv_area;
+	vec2 uv = u * mesh_vertex_uv(ia) + v * mesh_vertex_uv(ib) + 
+			  (1.0 - u - v) * mesh_vertex_uv(ic);
+	
+	if (albedo_tex >= 0)
+		albedo *= textureLod(MATERIAL_TEXTURE(albedo_tex), uv, 
+							 mesh_texture_lod(tri_idx, albedo_tex, mesh_ray, t)).rgb;
+	if (emission_tex >= 0)
+		emission *= textureLod(MATERIAL_TEXTURE(emission_tex), uv, 
+							   mesh_texture_lod(tri_idx, emission_tex, mesh_ray, t)).rgb;
+	
+} /* apply_mesh_textures */
+
+/*--------------------------------------------------------------------------*/
+
+TriangleHit bvh_triangle_hit
+
+	(uint tree,    /* BVH_WORLD or BVH_MESH */
+	 uint tri_idx) /* index returned by bvh_primitive_index */
+	 
+{
+	return tree == BVH_MESH ? mesh_triangle_hits[tri_idx] : triangle_hits[tri_idx];
+	
+} /* bvh_triangle_hit */
+
+/*--------------------------------------------------------------------------*/
+
+float intersect_primitive_t
+
+	(Ray   ray,  /* ray for the intersection */
+	 uint  tree, /* BVH_WORLD or BVH_MESH */
+	 uint  prim, /* index returned by bvh_primitive_index */
+	 float mint, /* lower bound for t */
+	 float maxt) /* upper bound for t */
+	 
+/*
+	Returns the coordinate of the intersection with a primitive referenced 
+	by a leaf in (mint, maxt), or INF. Only the world hierarchy 
+	references spheres.
+*/
+	 
+{
+	if (tree == BVH_WORLD && (prim & BVH_SPHERE_BIT) != 0)
+		return intersect_sphere_hit(ray, sphere_hits[prim & ~BVH_SPHERE_BIT], mint, maxt);
+	
+	/* quantized meshes have no hit data, their vertices are decoded instead */
+	if (tree == BVH_MESH && MESH_QUANTIZED)
+	{
+		Isect temp_isect;
+		intersect_triangle_fast(ray, 
+								mesh_vertex_position(mesh_indices[3 * prim + 0]), 
+								mesh_vertex_position(mesh_indices[3 * prim + 1]), 
+								mesh_vertex_position(mesh_indices[3 * prim + 2]), 
+								mint, maxt, temp_isect);
+		return temp_isect.t;
+	}
+	
+	return intersect_triangle_hit(ray, bvh_triangle_hit(tree, prim), mint, maxt);
+	
+} /* intersect_primitive_t */
+
+/*--------------------------------------------------------------------------*/
+
+bool intersect_primitive_any
+
+	(Ray   ray,  /* ray for the intersection */
+	 uint  tree, /* BVH_WORLD or BVH_MESH */
+	 uint  prim, /* index returned by bvh_primitive_index */
+	 float mint, /* lower bound for t */
+	 float maxt) /* upper bound for t */
+	 
+/*
+	Returns true if a primitive referenced by a leaf is intersected in 
+	(mint, maxt). Uses the same tests as intersect_primitive_t, so a 
+	shadow ray agrees with the closest hit about what it hits.
+*/
+	 
+{
+	return intersect_primitive_t(ray, tree, prim, mint, maxt) < INF;
+	
+} /* intersect_primitive_any */
+
+/*--------------------------------------------------------------------------*/
+
+uint intersect_bvh
+
+	(Ray         ray,       /* ray for the intersection */
+	 uint        tree,      /* BVH_WORLD or BVH_MESH */
+	 uint        root,      /* node to start from */
+	 float       mint,      /* lower bound for t */
+	 inout float closest_t) /* upper bound for t, updated on intersection */
+	 
+/*
+	Traverses a BVH and returns the closest primitive intersected in 
+	(mint, closest_t) as returned by bvh_primitive_index, or BVH_NONE. 
+	closest_t is updated to the coordinate of that intersection.
+	
+	Children are visited near first so that closest_t shrinks early and 
+	culls the far subtrees. Where the far child is kept depends on 
+	BVH_STACK_MODE: a per invocation stack of BVH_STACK_SIZE (the builder 
+	limits the depth to that), nowhere at all (bvh_climb), or a short 
+	ring in shared memory that falls back to bvh_climb when it overflowed.
+*/
+	 
+{
+	vec3 inv_dir = 1.0 / ray.direction;
+	uint stack[BVH_STACK_SIZE];
+	int stack_size = 0;
+	uint stack_top = 0;
+	bool dropped = false;
+	uint node_idx = root;
+	uint closest_prim = BVH_NONE;
+	
+	while (true)
+	{
+		BvhNode node = bvh_node(tree, node_idx);
+		if ((node.right_or_count & BVH_LEAF_BIT) != 0)
+		{
+			uint count = node.right_or_count & ~BVH_LEAF_BIT;
+			for (uint i = 0; i < count; i++)
+			{
+				uint prim = bvh_primitive_index(tree, node.left_or_first + i);
+				float t = intersect_primitive_t(ray, tree, prim, mint, closest_t);
+				if (t < closest_t)
+				{
+					closest_t = t;
+					closest_prim = prim;
+				}
+			}
+		}
+		else
+		{
+			uint left = node.left_or_first;
+			uint right = node.right_or_count;
+			BvhNode left_node = bvh_node(tree, left);
+			BvhNode right_node = bvh_node(tree, right);
+			vec2 span_l = intersect_aabb(ray, inv_dir, 
+										 left_node.aabb_min, 
+										 left_node.aabb_max);
+			vec2 span_r = intersect_aabb(ray, inv_dir, 
+										 right_node.aabb_min, 
+										 right_node.aabb_max);
+			bool visit_l = bvh_visit(span_l, mint, closest_t);
+			bool visit_r = bvh_visit(span_r, mint, closest_t);
+			
+			if (visit_l && visit_r)
+			{
+				bool left_near = bvh_left_near(span_l, span_r);
+				uint far = left_near ? right : left;
+				if (BVH_STACK_MODE == BVH_STACK_LOCAL)
+					stack[stack_size++] = far;
+				else if (BVH_STACK_MODE == BVH_STACK_SHARED)
+					short_stack_push(stack_top, stack_size, dropped, far);
+				node_idx = left_near ? left : right;
+				continue;
+			}
+			if (visit_l || visit_r)
+			{
+				node_idx = visit_l ? left : right;
+				continue;
+			}
+		}
+		
+		if (stack_size > 0)
+		{
+			node_idx = BVH_STACK_MODE == BVH_STACK_LOCAL ? stack[--stack_size] 
+			                                             : short_stack_pop(stack_top, stack_size);
+			continue;
+		}
+		if (BVH_STACK_MODE == BVH_STACK_LOCAL || 
+			(BVH_STACK_MODE == BVH_STACK_SHARED && !dropped)) break;
+		node_idx = bvh_climb(ray, inv_dir, tree, root, node_idx, mint, closest_t);
+		if (node_idx == BVH_NONE) break;
+	}
+	
+	return closest_prim;
+	
+} /* intersect_bvh */
+
+/*--------------------------------------------------------------------------*/
+
+bool intersect_bvh_any
+
+	(Ray   ray,  /* ray for the intersection */
+	 uint  tree, /* BVH_WORLD or BVH_MESH */
+	 uint  root, /* node to start from */
+	 float mint, /* lower bound for t */
+	 float maxt) /* upper bound for t */
+	 
+/*
+	Returns true if any primitive in the BVH is intersected in 
+	(mint, maxt). Stops at the first intersection found and never 
+	computes more than the coordinate of a hit. 
+	
+	Visits and keeps the children like intersect_bvh. The near child is 
+	the one most likely to hold the occluder for shadow and AO rays, 
+	which mostly start on a surface and end on a light or at a short 
+	distance, so taking it first ends most rays after a few nodes.
+*/
+	 
+{
+	vec3 inv_dir = 1.0 / ray.direction;
+	uint stack[BVH_STACK_SIZE];
+	int stack_size = 0;
+	uint stack_top = 0;
+	bool dropped = false;
+	uint node_idx = root;
+	
+	while (true)
+	{
+		BvhNode node = bvh_node(tree, node_idx);
+		if ((node.right_or_count & BVH_LEAF_BIT) != 0)
+		{
+			uint count = node.right_or_count & ~BVH_LEAF_BIT;
+			for (uint i = 0; i < count; i++)
+			{
+				uint prim = bvh_primitive_index(tree, node.left_or_first + i);
+				
+				/* early out */
+				if (intersect_primitive_any(ray, tree, prim, mint, maxt)) return true;
+			}
+		}
+		else
+		{
+			uint left = node.left_or_first;
+			uint right = node.right_or_count;
+			BvhNode left_node = bvh_node(tree, left);
+			BvhNode right_node = bvh_node(tree, right);
+			vec2 span_l = intersect_aabb(ray, inv_dir, 
+										 left_node.aabb_min, 
+										 left_node.aabb_max);
+			vec2 span_r = intersect_aabb(ray, inv_dir, 
+										 right_node.aabb_min, 
+										 right_node.aabb_max);
+			bool visit_l = bvh_visit(span_l, mint, maxt);
+			bool visit_r = bvh_visit(span_r, mint, maxt);
+			
+			if (visit_l && visit_r)
+			{
+				bool left_near = bvh_left_near(span_l, span_r);
+				uint far = left_near ? right : left;
+				if (BVH_STACK_MODE == BVH_STACK_LOCAL)
+					stack[stack_size++] = far;
+				else if (BVH_STACK_MODE == BVH_STACK_SHARED)
+					short_stack_push(stack_top, stack_size, dropped, far);
+				node_idx = left_near ? left : right;
+				continue;
+			}
+			if (visit_l || visit_r)
+			{
+				node_idx = visit_l ? left : right;
+				continue;
+			}
+		}
+		
+		if (stack_size > 0)
+		{
+			node_idx = BVH_STACK_MODE == BVH_STACK_LOCAL ? stack[--stack_size] 
+			                                             : short_stack_pop(stack_top, stack_size);
+			continue;
+		}
+		if (BVH_STACK_MODE == BVH_STACK_LOCAL || 
+			(BVH_STACK_MODE == BVH_STACK_SHARED && !dropped)) break;
+		node_idx = bvh_climb(ray, inv_dir, tree, root, node_idx, mint, maxt);
+		if (node_idx == BVH_NONE) break;
+	}
+	
+	return false;
+	
+} /* intersect_bvh_any */
+
+/*--------------------------------------------------------------------------*/
+
+uint wide_bvh_byte
+
+	(uint words[WIDE_BVH_WIDTH / 4], /* packed bytes, one per child */
+	 uint child)                     /* child slot */
+	 
+{
+	return (words[child / 4] >> (8 * (child % 4))) & 0xFFu;
+	
+} /* wide_bvh_byte */
+
+/*--------------------------------------------------------------------------*/
+
+vec2 intersect_wide_bvh_child
+
+	(Ray         ray,     /* ray for the intersection */
+	 vec3        inv_dir, /* 1/ray.direction, computed once per traversal */
+	 WideBvhNode node,    /* node holding the quantized child boxes */
+	 vec3        scale,   /* cell size of the child grid of the node */
+	 uint        child)   /* child slot */
+	 
+/*
+	Decodes the 8 bit box of a child and returns the span from 
+	intersect_aabb. The planes of each axis are packed in 
+	WIDE_BVH_WIDTH / 4 consecutive words.
+*/
+	 
+{
+	const uint planes = WIDE_BVH_WIDTH / 4;
+	uint word = child / 4;
+	uint shift = 8 * (child % 4);
+	uvec3 qmin = uvec3(node.bounds[word], 
+					   node.bounds[planes + word], 
+					   node.bounds[2 * planes + word]);
+	uvec3 qmax = uvec3(node.bounds[3 * planes + word], 
+					   node.bounds[4 * planes + word], 
+					   node.bounds[5 * planes + word]);
+	vec3 bmin = node.origin + vec3((qmin >> shift) & 0xFFu) * scale;
+	vec3 bmax = node.origin + vec3((qmax >> shift) & 0xFFu) * scale;
+	
+	return intersect_aabb(ray, inv_dir, bmin, bmax);
+	
+} /* intersect_wide_bvh_child */
+
+/*--------------------------------------------------------------------------*/
+
+vec3 wide_bvh_scale
+
+	(uint exponents) /* biased exponents of the node, 8 bits per axis */
+	
+/*
+	The cell sizes are powers of two, so they are built directly from 
+	their exponent bits.
+*/
+	
+{
+	return vec3(uintBitsToFloat((exponents & 0xFFu) << 23), 
+				uintBitsToFloat(((exponents >> 8) & 0xFFu) << 23), 
+				uintBitsToFloat(((exponents >> 16) & 0xFFu) << 23));
+	
+} /* wide_bvh_scale */
+
+/*--------------------------------------------------------------------------*/
+
+uint intersect_wide_bvh
+
+	(Ray         ray,       /* ray for the intersection */
+	 float       mint,      /* lower bound for t */
+	 inout float closest_t) /* upper bound for t, updated on intersection */
+	 
+/*
+	Same as intersect_bvh over the world primitives, using the wide BVH. 
+	One node fetch gives the boxes of all WIDE_BVH_WIDTH children, which 
+	are tested together. Leaf children are intersected right away, the 
+	nearest interior child is visited next and the others go on the 
+	stack with their entry distance, so entries that the closest hit has 
+	moved in front of are dropped when popped. The stack is always a per 
+	invocation one, BVH_STACK_MODE only applies to the binary BVHs.
+*/
+	 
+{
+	vec3 inv_dir = 1.0 / ray.direction;
+	uint stack[WIDE_BVH_STACK_SIZE];
+	float stack_t[WIDE_BVH_STACK_SIZE];
+	int stack_size = 0;
+	uint node_idx = 0;
+	uint closest_prim = BVH_NONE;
+	
+	while (true)
+	{
+		WideBvhNode node = wide_bvh_nodes[node_idx];
+		vec3 scale = wide_bvh_scale(node.exponents);
+		uint prim = node.prim_base;
+		uint next = BVH_NONE;
+		float next_t = INF;
+		
+		for (uint i = 0; i < WIDE_BVH_WIDTH; i++)
+		{
+			uint meta = wide_bvh_byte(node.child_meta, i);
+			if (meta == 0) continue;
+			
+			vec2 span = intersect_wide_bvh_child(ray, inv_dir, node, scale, i);
+			bool visit = bvh_visit(span, mint, closest_t);
+			if ((meta & WIDE_BVH_INTERIOR) == 0)
+			{
+				for (uint j = 0; visit && j < meta; j++)
+				{
+					uint leaf_prim = wide_bvh_indices[prim + j];
+					float t = intersect_primitive_t(ray, BVH_WORLD, leaf_prim, mint, closest_t);
+					if (t < closest_t)
+					{
+						closest_t = t;
+						closest_prim = leaf_prim;
+					}
+				}
+				/* the leaves of a node reference consecutive ranges */
+				prim += meta;
+			}
+			else if (visit)
+			{
+				uint child = node.child_base + (meta & ~WIDE_BVH_INTERIOR);
+				if (span.x < next_t)
+				{
+					if (next != BVH_NONE)
+					{
+						stack_t[stack_size] = next_t;
+						stack[stack_size++] = next;
+					}
+					next = child;
+					next_t = span.x;
+				}
+				else
+				{
+					stack_t[stack_size] = span.x;
+					stack[stack_size++] = child;
+				}
+			}
+		}
+		
+		if (next != BVH_NONE)
+		{
+			node_idx = next;
+			continue;
+		}
+		
+		while (stack_size > 0 && stack_t[stack_size - 1] >= closest_t) stack_size--;
+		if (stack_size == 0) break;
+		node_idx = stack[--stack_size];
+	}
+	
+	return closest_prim;
+	
+} /* intersect_wide_bvh */
+
+/*--------------------------------------------------------------------------*/
+
+bool intersect_wide_bvh_any
+
+	(Ray   ray,  /* ray for the intersection */
+	 float mint, /* lower bound for t */
+	 float maxt) /* upper bound for t */
+	 
+/*
+	Returns true if any world primitive is intersected in (mint, maxt), 
+	using the wide BVH. Stops at the first intersection found. 
+	
+	The interior children of a node are pushed sorted by entry distance, 
+	nearest on top, so the traversal runs front to back like 
+	intersect_bvh_any. There is no closest_t to cull against, the sort 
+	only decides what is looked at first. At most WIDE_BVH_WIDTH entries 
+	are sorted, the insertion runs in registers.
+*/
+	 
+{
+	vec3 inv_dir = 1.0 / ray.direction;
+	uint stack[WIDE_BVH_STACK_SIZE];
+	float stack_t[WIDE_BVH_STACK_SIZE];
+	int stack_size = 0;
+	uint node_idx = 0;
+	
+	while (true)
+	{
+		WideBvhNode node = wide_bvh_nodes[node_idx];
+		vec3 scale = wide_bvh_scale(node.exponents);
+		uint prim = node.prim_base;
+		int node_base = stack_size;
+		
+		for (uint i = 0; i < WIDE_BVH_WIDTH; i++)
+		{
+			uint meta = wide_bvh_byte(node.child_meta, i);
+			if (meta == 0) continue;
+			
+			vec2 span = intersect_wide_bvh_child(ray, inv_dir, node, scale, i);
+			bool visit = bvh_visit(span, mint, maxt);
+			if ((meta & WIDE_BVH_INTERIOR) == 0)
+			{
+				for (uint j = 0; visit && j < meta; j++)
+				{
+					/* early out */
+					if (intersect_primitive_any(ray, BVH_WORLD, wide_bvh_indices[prim + j], 
+												mint, maxt)) return true;
+				}
+				prim += meta;
+			}
+			else if (visit)
+			{
+				/* far entries sink below the new one */
+				int slot = stack_size++;
+				while (slot > node_base && stack_t[slot - 1] < span.x)
+				{
+					stack[slot] = stack[slot - 1];
+					stack_t[slot] = stack_t[slot - 1];
+					slot--;
+				}
+				stack[slot] = node.child_base + (meta & ~WIDE_BVH_INTERIOR);
+				stack_t[slot] = span.x;
+			}
+		}
+		
+		if (stack_size == 0) break;
+		node_idx = stack[--stack_size];
+	}
+	
+	return false;
+	
+} /* intersect_wide_bvh_any */
+
+/*--------------------------------------------------------------------------*/
+
+uint intersect_triangles_linear
+
+	(Ray         ray,       /* ray for the intersection */
+	 float       mint,      /* lower bound for t */
+	 inout float closest_t) /* upper bound for t, updated on intersection */
+	 
+/*
+	Returns the closest world triangle intersected in (mint, closest_t), 
+	or BVH_NONE, testing every one of them.
+*/
+	 
+{
+	uint closest_prim = BVH_NONE;
+	for (int i = 0; i < triangle_hits.length(); i++)
+	{
+		float t = intersect_triangle_hit(ray, triangle_hits[i], mint, closest_t);
+		if (t < closest_t)
+		{
+			closest_t = t;
+			closest_prim = uint(i);
+		}
+	}
+	
+	return closest_prim;
+	
+} /* intersect_triangles_linear */
+
+/*--------------------------------------------------------------------------*/
+
+bool intersect_triangles_linear_any
 
 	(Ray   ray,  /* ray for the intersection */
 	 float mint, /* lower bound for t */
 	 float maxt) /* upper bound for t */
 	 
+{
+	for (int i = 0; i < triangle_hits.length(); i++)
+	{
+		/* early out */
+		if (intersect_triangle_hit(ray, triangle_hits[i], mint, maxt) < INF) return true;
+	}
+	
+	return false;
+	
+} /* intersect_triangles_linear_any */
+
+/*--------------------------------------------------------------------------*/
+
+uint intersect_primitives_linear
+
+	(Ray         ray,       /* ray for the intersection */
+	 float       mint,      /* lower bound for t */
+	 inout float closest_t) /* upper bound for t, updated on intersection */
+	 
 /*
-	Returns true if there is an intersection with any primitive in the 
-	scene in (mint, maxt). 
+	Same as intersect_bvh over the world primitives, testing every one of 
+	them. Kept as the baseline the hierarchies are measured against.
+*/
+	 
+{
+	uint closest_prim = BVH_NONE;
+	for (int i = 0; i < sphere_hits.length(); i++)
+	{
+		float t = intersect_sphere_hit(ray, sphere_hits[i], mint, closest_t);
+		if (t < closest_t)
+		{
+			closest_t = t;
+			closest_prim = uint(i) | BVH_SPHERE_BIT;
+		}
+	}
+	uint closest_tri = intersect_triangles_linear(ray, mint, closest_t);
 	
-	Note: this intersection routine has an early out through an `if`, idk 
-	if it does more bad than good in the sense of divergence, but 
-	it allows skipping any check after the first intersection. 
+	return closest_tri != BVH_NONE ? closest_tri : closest_prim;
+	
+} /* intersect_primitives_linear */
+
+/*--------------------------------------------------------------------------*/
+
+bool intersect_primitives_linear_any
+
+	(Ray   ray,  /* ray for the intersection */
+	 float mint, /* lower bound for t */
+	 float maxt) /* upper bound for t */
+	 
+{
+	for (int i = 0; i < sphere_hits.length(); i++)
+	{
+		/* early out */
+		if (intersect_sphere_hit(ray, sphere_hits[i], mint, maxt) < INF) return true;
+	}
+	
+	return intersect_triangles_linear_any(ray, mint, maxt);
+	
+} /* intersect_primitives_linear_any */
+
+/*--------------------------------------------------------------------------*/
+
+bool sphere_grid_enter
+
+	(Ray       ray,       /* ray for the intersection */
+	 vec3      inv_dir,   /* 1/ray.direction */
+	 float     mint,      /* lower bound for t */
+	 float     maxt,      /* upper bound for t */
+	 out ivec3 cell,      /* first cell on the ray */
+	 out ivec3 cell_step, /* -1, 0 or 1 per axis */
+	 out vec3  t_next,    /* coordinate of the next cell boundary per axis */
+	 out vec3  t_delta,   /* coordinate between two boundaries per axis */
+	 out float t_leave)   /* coordinate where the ray leaves the grid */
+	 
+/*
+	Sets up the 3D-DDA of the sphere grid (Amanatides and Woo 1987, "A 
+	Fast Voxel Traversal Algorithm for Ray Tracing"). Returns false if 
+	the ray misses the grid in (mint, maxt) or there is no grid.
+*/
+	 
+{
+	if (grid_cell_count == 0) return false;
+	
+	vec3 grid_max = grid_origin + vec3(grid_dims) * grid_cell_size;
+	vec2 span = intersect_aabb(ray, inv_dir, grid_origin, grid_max);
+	if (!bvh_visit(span, mint, maxt)) return false;
+	
+	float t = max(span.x, mint);
+	vec3 p = (ray.origin + t * ray.direction - grid_origin) / grid_cell_size;
+	cell = clamp(ivec3(floor(p)), ivec3(0), grid_dims - 1);
+	cell_step = ivec3(sign(ray.direction));
+	t_delta = abs(grid_cell_size * inv_dir);
+	
+	/* axes the ray is parallel to are never crossed */
+	vec3 next_plane = grid_origin + (vec3(cell) + max(vec3(cell_step), 0.0)) * grid_cell_size;
+	t_next = mix((next_plane - ray.origin) * inv_dir, vec3(INF), equal(cell_step, ivec3(0)));
+	t_leave = span.y;
+	return true;
+	
+} /* sphere_grid_enter */
+
+/*--------------------------------------------------------------------------*/
+
+bool sphere_grid_advance
+
+	(inout ivec3 cell,      /* cell to leave */
+	 ivec3       cell_step, /* from sphere_grid_enter */
+	 inout vec3  t_next,    /* from sphere_grid_enter */
+	 vec3        t_delta)   /* from sphere_grid_enter */
+	 
+/*
+	Steps into the neighbour through the nearest boundary. Returns false 
+	once that leaves the grid.
+*/
+	 
+{
+	int axis = t_next.x <= t_next.y && t_next.x <= t_next.z ? 0 : (t_next.y <= t_next.z ? 1 : 2);
+	cell[axis] += cell_step[axis];
+	t_next[axis] += t_delta[axis];
+	return cell[axis] >= 0 && cell[axis] < grid_dims[axis];
+	
+} /* sphere_grid_advance */
+
+/*--------------------------------------------------------------------------*/
+
+uint intersect_sphere_grid
+
+	(Ray         ray,       /* ray for the intersection */
+	 float       mint,      /* lower bound for t */
+	 inout float closest_t) /* upper bound for t, updated on intersection */
+	 
+/*
+	Returns the closest sphere intersected in (mint, closest_t), tagged 
+	with BVH_SPHERE_BIT, or BVH_NONE, walking the cells of the sphere 
+	grid along the ray. 
+	
+	A sphere is referenced by every cell it overlaps, including the cell 
+	of each point of its surface. So once the closest hit lies in front 
+	of the exit of the current cell, the cells after it cannot hold a 
+	closer one and the walk stops.
 */
 	 
 {
-	/* intersect spheres */
-	for (int i = 0; i < spheres.length(); i++)
+	vec3 inv_dir = 1.0 / ray.direction;
+	ivec3 cell, cell_step;
+	vec3 t_next, t_delta;
+	float t_leave;
+	if (!sphere_grid_enter(ray, inv_dir, mint, closest_t, 
+						   cell, cell_step, t_next, t_delta, t_leave)) return BVH_NONE;
+	
+	uint closest_prim = BVH_NONE;
+	while (true)
 	{
-		Sphere sphere = spheres[i];
+		uint cell_idx = uint((cell.z * grid_dims.y + cell.y) * grid_dims.x + cell.x);
+		uint start = grid_starts[cell_idx];
+		uint count = grid_counts[cell_idx];
+		for (uint i = 0; i < count; i++)
+		{
+			uint sphere_idx = grid_refs[start + i];
+			float t = intersect_sphere_hit(ray, sphere_hits[sphere_idx], mint, closest_t);
+			if (t < closest_t)
+			{
+				closest_t = t;
+				closest_prim = sphere_idx | BVH_SPHERE_BIT;
+			}
+		}
 		
-		/* inverse transform on the ray, needs to be changed to 3x3/4x4 mat */
-		Ray temp_ray;
-		temp_ray.origin = (ray.origin - sphere.origin)/sphere.radius;
-		temp_ray.direction = ray.direction / sphere.radius;
+		float t_exit = min(t_next.x, min(t_next.y, t_next.z));
+		if (closest_t <= t_exit || t_exit >= t_leave) break;
+		if (!sphere_grid_advance(cell, cell_step, t_next, t_delta)) break;
+	}
+	
+	return closest_prim;
+	
+} /* intersect_sphere_grid */
+
+/*--------------------------------------------------------------------------*/
+
+bool intersect_sphere_grid_any
+
+	(Ray   ray,  /* ray for the intersection */
+	 float mint, /* lower bound for t */
+	 float maxt) /* upper bound for t */
+	 
+/*
+	Returns true if any sphere is intersected in (mint, maxt), walking 
+	the sphere grid front to back. Stops at the first intersection found.
+*/
+	 
+{
+	vec3 inv_dir = 1.0 / ray.direction;
+	ivec3 cell, cell_step;
+	vec3 t_next, t_delta;
+	float t_leave;
+	if (!sphere_grid_enter(ray, inv_dir, mint, maxt, 
+						   cell, cell_step, t_next, t_delta, t_leave)) return false;
+	
+	while (true)
+	{
+		uint cell_idx = uint((cell.z * grid_dims.y + cell.y) * grid_dims.x + cell.x);
+		uint start = grid_starts[cell_idx];
+		uint count = grid_counts[cell_idx];
+		for (uint i = 0; i < count; i++)
+		{
+			/* early out */
+			if (intersect_sphere_hit(ray, sphere_hits[grid_refs[start + i]], mint, maxt) < INF)
+				return true;
+		}
 		
-		/* early out */
-		if (intersect_sphere_any(temp_ray, mint, maxt))
-			return true;
+		float t_exit = min(t_next.x, min(t_next.y, t_next.z));
+		if (maxt <= t_exit || t_exit >= t_leave) break;
+		if (!sphere_grid_advance(cell, cell_step, t_next, t_delta)) break;
+	}
+	
+	return false;
+	
+} /* intersect_sphere_grid_any */
+
+/*--------------------------------------------------------------------------*/
+
+uint intersect_world
+
+	(Ray         ray,       /* ray for the intersection */
+	 float       mint,      /* lower bound for t */
+	 inout float closest_t) /* upper bound for t, updated on intersection */
+	 
+/*
+	Returns the closest sphere or world triangle intersected in 
+	(mint, closest_t), or BVH_NONE, with the structure picked by 
+	render_settings.traversal_mode. Spheres are tagged with BVH_SPHERE_BIT. 
+	Every call is one traced ray. The sphere grid is meant for particle 
+	scenes, the world triangles are tested one by one next to it.
+*/
+	 
+{
+	ray_count++;
+	switch (render_settings.traversal_mode)
+	{
+	case TRAVERSAL_LINEAR:
+		return intersect_primitives_linear(ray, mint, closest_t);
+	case TRAVERSAL_BINARY:
+		return intersect_bvh(ray, BVH_WORLD, 0, mint, closest_t);
+	case TRAVERSAL_GRID:
+	{
+		/* the grid only holds the spheres */
+		uint closest_tri = intersect_triangles_linear(ray, mint, closest_t);
+		uint closest_sphere = intersect_sphere_grid(ray, mint, closest_t);
+		return closest_sphere != BVH_NONE ? closest_sphere : closest_tri;
+	}
+	default:
+		return intersect_wide_bvh(ray, mint, closest_t);
+	}
+	
+} /* intersect_world */
+
+/*--------------------------------------------------------------------------*/
+
+bool intersect_world_any
+
+	(Ray   ray,  /* ray for the intersection */
+	 float mint, /* lower bound for t */
+	 float maxt) /* upper bound for t */
+	 
+{
+	ray_count++;
+	switch (render_settings.traversal_mode)
+	{
+	case TRAVERSAL_LINEAR:
+		return intersect_primitives_linear_any(ray, mint, maxt);
+	case TRAVERSAL_BINARY:
+		return intersect_bvh_any(ray, BVH_WORLD, 0, mint, maxt);
+	case TRAVERSAL_GRID:
+		return intersect_sphere_grid_any(ray, mint, maxt) || 
+			   intersect_triangles_linear_any(ray, mint, maxt);
+	default:
+		return intersect_wide_bvh_any(ray, mint, maxt);
+	}
+	
+} /* intersect_world_any */
+
+/*--------------------------------------------------------------------------*/
+
+Ray transform_ray
+
+	(Ray      ray,      /* ray in world space */
+	 Instance instance) /* instance whose mesh space the ray is moved to */
+	 
+/*
+	Moves the ray into the space of the mesh placed by the instance. The 
+	direction is not normalized, so t is the same in both spaces and can 
+	be compared against hits in world space.
+*/
+	 
+{
+	Ray result;
+	vec4 o = vec4(ray.origin, 1);
+	result.origin = vec3(dot(instance.world_to_object[0], o), 
+						 dot(instance.world_to_object[1], o), 
+						 dot(instance.world_to_object[2], o));
+	result.direction = vec3(dot(instance.world_to_object[0].xyz, ray.direction), 
+							dot(instance.world_to_object[1].xyz, ray.direction), 
+							dot(instance.world_to_object[2].xyz, ray.direction));
+	return result;
+	
+} /* transform_ray */
+
+/*--------------------------------------------------------------------------*/
+
+vec3 transform_normal
+
+	(vec3     normal,   /* normal in mesh space */
+	 Instance instance) /* instance placing the mesh */
+	 
+/*
+	Moves a normal from mesh space to world space with the inverse 
+	transpose of the instance transform (not normalized).
+*/
+	 
+{
+	return mat3(instance.world_to_object[0].xyz, 
+				instance.world_to_object[1].xyz, 
+				instance.world_to_object[2].xyz) * normal;
+	
+} /* transform_normal */
+
+/*--------------------------------------------------------------------------*/
+
+bool instance_resident
+
+	(Instance instance) /* instance reached by a traversal */
+	 
+/*
+	With streamed meshes, flags the cluster of the instance as reached, 
+	so it is paged in or kept in the pool. Returns false while the 
+	cluster is outside the pool, the ray then passes through it.
+*/
+	 
+{
+	if (!MESH_STREAMING)
+		return true;
+	
+	/* every writer stores the same value, the test saves most of the writes */
+	if (cluster_feedback[instance.cluster] == 0u)
+		cluster_feedback[instance.cluster] = 1u;
+	return instance.blas_root != BVH_NONE;
+	
+} /* instance_resident */
+
+/*--------------------------------------------------------------------------*/
+
+uint intersect_instances
+
+	(Ray         ray,       /* ray for the intersection */
+	 float       mint,      /* lower bound for t */
+	 inout float closest_t, /* upper bound for t, updated on intersection */
+	 out uint    hit_inst)  /* instance of the returned triangle */
+	 
+/*
+	Traverses the top level hierarchy over the instances, and the mesh 
+	hierarchy of every instance reached in the space of its mesh. Returns 
+	the closest mesh triangle (see bvh_primitive_index) intersected in 
+	(mint, closest_t), or BVH_NONE.
+*/
+	 
+{
+	vec3 inv_dir = 1.0 / ray.direction;
+	uint stack[BVH_STACK_SIZE];
+	int stack_size = 0;
+	uint node_idx = 0;
+	uint closest_tri = BVH_NONE;
+	hit_inst = BVH_NONE;
+	
+	while (true)
+	{
+		BvhNode node = tlas_nodes[node_idx];
+		if ((node.right_or_count & BVH_LEAF_BIT) != 0)
+		{
+			uint count = node.right_or_count & ~BVH_LEAF_BIT;
+			for (uint i = 0; i < count; i++)
+			{
+				uint inst_idx = node.left_or_first + i;
+				Instance instance = instances[inst_idx];
+				if (!instance_resident(instance))
+					continue;
+				uint tri_idx = intersect_bvh(transform_ray(ray, instance), 
+											 BVH_MESH, 
+											 instance.blas_root, 
+											 mint, closest_t);
+				if (tri_idx != BVH_NONE)
+				{
+					closest_tri = tri_idx;
+					hit_inst = inst_idx;
+				}
+			}
+		}
+		else
+		{
+			uint left = node.left_or_first;
+			uint right = node.right_or_count;
+			vec2 span_l = intersect_aabb(ray, inv_dir, 
+										 tlas_nodes[left].aabb_min, 
+										 tlas_nodes[left].aabb_max);
+			vec2 span_r = intersect_aabb(ray, inv_dir, 
+										 tlas_nodes[right].aabb_min, 
+										 tlas_nodes[right].aabb_max);
+			bool visit_l = bvh_visit(span_l, mint, closest_t);
+			bool visit_r = bvh_visit(span_r, mint, closest_t);
+			
+			if (visit_l && visit_r)
+			{
+				bool left_near = span_l.x <= span_r.x;
+				stack[stack_size++] = left_near ? right : left;
+				node_idx = left_near ? left : right;
+				continue;
+			}
+			if (visit_l || visit_r)
+			{
+				node_idx = visit_l ? left : right;
+				continue;
+			}
+		}
+		
+		if (stack_size == 0) break;
+		node_idx = stack[--stack_size];
 	}
 	
-	/* intersect triangles */
-	for (int i = 0; i < triangles.length(); i++)
+	return closest_tri;
+	
+} /* intersect_instances */
+
+/*--------------------------------------------------------------------------*/
+
+bool intersect_instances_any
+
+	(Ray   ray,  /* ray for the intersection */
+	 float mint, /* lower bound for t */
+	 float maxt) /* upper bound for t */
+	 
+/*
+	Returns true if any triangle of any instance is intersected in 
+	(mint, maxt). Stops at the first intersection found. Instances are 
+	visited near first like in intersect_bvh_any.
+*/
+	 
+{
+	vec3 inv_dir = 1.0 / ray.direction;
+	uint stack[BVH_STACK_SIZE];
+	int stack_size = 0;
+	uint node_idx = 0;
+	
+	while (true)
 	{
-		Triangle tri = triangles[i];
+		BvhNode node = tlas_nodes[node_idx];
+		if ((node.right_or_count & BVH_LEAF_BIT) != 0)
+		{
+			uint count = node.right_or_count & ~BVH_LEAF_BIT;
+			for (uint i = 0; i < count; i++)
+			{
+				Instance instance = instances[node.left_or_first + i];
+				if (!instance_resident(instance))
+					continue;
+				
+				/* early out */
+				if (intersect_bvh_any(transform_ray(ray, instance), 
+									  BVH_MESH, 
+									  instance.blas_root, 
+									  mint, maxt)) return true;
+			}
+		}
+		else
+		{
+			uint left = node.left_or_first;
+			uint right = node.right_or_count;
+			vec2 span_l = intersect_aabb(ray, inv_dir, 
+										 tlas_nodes[left].aabb_min, 
+										 tlas_nodes[left].aabb_max);
+			vec2 span_r = intersect_aabb(ray, inv_dir, 
+										 tlas_nodes[right].aabb_min, 
+										 tlas_nodes[right].aabb_max);
+			bool visit_l = bvh_visit(span_l, mint, maxt);
+			bool visit_r = bvh_visit(span_r, mint, maxt);
+			
+			if (visit_l && visit_r)
+			{
+				bool left_near = bvh_left_near(span_l, span_r);
+				stack[stack_size++] = left_near ? right : left;
+				node_idx = left_near ? left : right;
+				continue;
+			}
+			if (visit_l || visit_r)
+			{
+				node_idx = visit_l ? left : right;
+				continue;
+			}
+		}
 		
-		/* early out */
-		if (intersect_triangle_any(ray, 
-								   tri.vert0.xyz, 
-								   tri.vert1.xyz, 
-								   tri.vert2.xyz, 
-								   mint, maxt)) return true;
+		if (stack_size == 0) break;
+		node_idx = stack[--stack_size];
 	}
 	
 	return false;
 	
+} /* intersect_instances_any */
+
+/*--------------------------------------------------------------------------*/
+
+bool intersect_scene_any
+
+	(Ray   ray,  /* ray for the intersection */
+	 float mint, /* lower bound for t */
+	 float maxt) /* upper bound for t */
+	 
+/*
+	Returns true if there is an intersection with any primitive in the 
+	scene in (mint, maxt). 
+	
+	Note: this intersection routine has an early out through an `if`, idk 
+	if it does more bad than good in the sense of divergence, but 
+	it allows skipping any check after the first intersection. 
+*/
+	 
+{
+	/* intersect spheres and triangles */
+	if (intersect_world_any(ray, mint, maxt))
+		return true;
+	
+	/* intersect mesh instances */
+	return intersect_instances_any(ray, mint, maxt);
+	
 } /* intersect_scene_any */
 
 /*--------------------------------------------------------------------------*/
@@ -473,53 +1950,43 @@ bool intersect_scene
 	info.t = closest_t;
 	info.pos = vec3(0);
 	info.normal = vec3(0);
-	Isect temp_isect;
-
-	/* intersect spheres */
-	for (int i = 0; i < spheres.length(); i++)
+	/* intersect spheres and triangles, full intersection data only for the closest */
+	uint prim = intersect_world(ray, mint, closest_t);
+	if (prim != BVH_NONE && (prim & BVH_SPHERE_BIT) != 0)
 	{
-		Sphere sphere = spheres[i];
-		
-		/* inverse transform on the ray, needs to be changed to 3x3/4x4 mat */
-		Ray temp_ray;
-		temp_ray.origin = (ray.origin - sphere.origin) / sphere.radius;
-		temp_ray.direction = ray.direction / sphere.radius;
-		
-        /*
-            g(x) = 0, x \in S
-            M(x) \in M(S) -> g(M^{-1}(x)) = 0 -> x \in S
-            
-        */
-        
-		//intersect_sphere(temp_ray, mint, closest_t, temp_isect);
-        intersect_sphere(temp_ray, mint, closest_t, temp_isect);
-		if (temp_isect.t<closest_t)
-		{
-			info = temp_isect;
-			Material mat = materials[int(sphere.mat_id.x)];
-			info.mat = convert_old_material(mat);
-		}
-		closest_t = min(temp_isect.t, closest_t);
+		Sphere sphere = spheres[prim & ~BVH_SPHERE_BIT];
+		info.t = closest_t;
+		info.normal = ray.origin + closest_t * ray.direction - sphere.origin;
+		info.uv = vec2(0);
+		Material mat = materials[int(sphere.mat_id.x)];
+		info.mat = convert_old_material(mat);
 	}
-
-	/* intersect triangles */
-	for (int i = 0; i < triangles.length(); i++)
+	else if (prim != BVH_NONE)
 	{
-		Triangle triangle = triangles[i];
-		intersect_triangle_fast(ray, 
-								triangle.vert0.xyz, 
-								triangle.vert1.xyz, 
-								triangle.vert2.xyz, 
-								mint, 
-								closest_t, 
-								temp_isect);
-		if (temp_isect.t<closest_t)
-		{
-			info = temp_isect;
-			Material mat = materials[int(triangle.mat_id.x)];
-			info.mat = convert_old_material(mat);
-		}
-		closest_t = min(temp_isect.t, closest_t);
+		Triangle triangle = triangles[prim];
+		info.t = closest_t;
+		info.normal = cross(triangle.vert1.xyz - triangle.vert0.xyz, 
+							triangle.vert2.xyz - triangle.vert0.xyz);
+		info.uv = vec2(0);
+		Material mat = materials[int(triangle.mat_id.x)];
+		info.mat = convert_old_material(mat);
+	}
+	
+	/* intersect mesh instances, the hit is computed in mesh space */
+	uint inst_idx;
+	uint tri_idx = intersect_instances(ray, mint, closest_t, inst_idx);
+	if (tri_idx != BVH_NONE)
+	{
+		Instance instance = instances[inst_idx];
+		Ray mesh_ray = transform_ray(ray, instance);
+		info.t = closest_t;
+		info.uv = vec2(0);
+		vec3 normal = mesh_normal(tri_idx, mesh_ray.origin + closest_t * mesh_ray.direction);
+		info.normal = transform_normal(normal, instance);
+		Material mat = materials[instance.material];
+		info.mat = convert_old_material(mat);
+		apply_mesh_textures(mat, tri_idx, mesh_ray, closest_t, info.mat.base_color, 
+							info.mat.emissive);
 	}
 	
 	info.normal = closest_t<INF? normalize(info.normal) : vec3(0);
@@ -719,82 +2186,49 @@ bool intersect_scene
 
 /*--------------------------------------------------------------------------*/
 
-bool intersect_spheres(Ray ray, inout Record record)
+bool intersect_primitives(Ray ray, inout Record record)
 {
-    float lowest = record.distance;
-    for (int i = 0; i < spheres.length(); i++)
+    float closest_t = record.distance < 0 ? INF : record.distance;
+    uint prim = intersect_world(ray, RAY_MIN_DIST, closest_t);
+    if (prim != BVH_NONE && (prim & BVH_SPHERE_BIT) != 0)
     {
-        Sphere sphere = spheres[i];
-        vec3 oc = ray.origin - sphere.origin;
-        float b = dot(oc, ray.direction);
-        float c = dot(oc, oc) - sphere.radius * sphere.radius;
-        float delta = b * b - c;
-
-        if (delta > 0.0f)
-        {
-            delta = sqrt(delta);
-            float t0 = (-b - delta);
-            float t1 = (-b + delta);
-            float distance = min(t0, t1);
-            if (!(t0 < 0 || t1 < 0) && RAY_MIN_DIST < distance && (distance < lowest || lowest < 0))
-            {
-                lowest = distance;
-                record.hit = true;
-                record.distance = distance;
-                record.intersection = ray.origin + ray.direction * distance;
-                record.normal = normalize(record.intersection - sphere.origin);
-                record.mat = materials[int(sphere.mat_id.x)];
-                record.albedo = materials[int(sphere.mat_id.x)].albedo.xyz;
-                record.emission = materials[int(sphere.mat_id).x].emission.xyz;
-            }
-        }
+        Sphere sphere = spheres[prim & ~BVH_SPHERE_BIT];
+        record.intersection = ray.origin + ray.direction * closest_t;
+        record.distance = closest_t;
+        record.normal = normalize(record.intersection - sphere.origin);
+        record.hit = true;
+        record.mat = materials[int(sphere.mat_id.x)];
+        record.albedo = materials[int(sphere.mat_id.x)].albedo.xyz;
+        record.emission = materials[int(sphere.mat_id.x)].emission.xyz;
+    }
+    else if (prim != BVH_NONE)
+    {
+        Triangle triangle = triangles[prim];
+        record.intersection = ray.origin + ray.direction * closest_t;
+        record.distance = closest_t;
+        record.normal = vec3(triangle.vert0.w, triangle.vert1.w, triangle.vert2.w);
+        record.hit = true;
+        record.mat = materials[int(triangle.mat_id.x)];
+        record.albedo = materials[int(triangle.mat_id.x)].albedo.xyz;
+        record.emission = materials[int(triangle.mat_id).x].emission.xyz;
     }
-    return lowest > 0;
-}
-
 
-bool intersect_triangles(Ray ray, inout Record record)
-{
-    float lowest = record.distance;
-    for(int i = 0; i < triangles.length(); i++){
-        Triangle triangle = triangles[i];
-
-        vec3 o = triangle.vert0.xyz;
-        vec3 e0 = triangle.vert1.xyz - o;
-        vec3 e1 = triangle.vert2.xyz - o;
-        vec3 intersectionMat[3] = {ray.direction * -1, e0, e1};
-
-        vec3 c01 = cross(intersectionMat[0], intersectionMat[1]);
-        vec3 c12 = cross(intersectionMat[1],intersectionMat[2]);
-        vec3 c20 = cross(intersectionMat[2], intersectionMat[0]);
-
-        float det = dot(intersectionMat[0], c12);
-        float inverseDet = 1.0f / det;
-
-        vec3 inverseTransposedMat[3] = { c12*inverseDet, c20*inverseDet, c01*inverseDet };
-
-        vec3 dir = ray.origin - o;
-        vec3 tuv = vec3(
-        dot(inverseTransposedMat[0], dir),
-        dot(inverseTransposedMat[1], dir),
-        dot(inverseTransposedMat[2], dir));
-
-        if(0 < tuv.x && 0.0f < tuv.y && 0.0f < tuv.z && tuv.y + tuv.z < 1.0f){
-            float t = tuv.x;
-            if((RAY_MIN_DIST < t && (t < lowest || lowest < 0)))
-            {
-                lowest = t;
-                record.intersection = ray.origin + ray.direction * t;
-                record.distance = t;
-                record.normal = vec3(triangle.vert0.w, triangle.vert1.w, triangle.vert2.w);
-                record.hit = true;
-                record.mat = materials[int(triangle.mat_id.x)];
-                record.albedo = materials[int(triangle.mat_id.x)].albedo.xyz;
-                record.emission = materials[int(triangle.mat_id).x].emission.xyz;
-                //            rec.u = tuv.y * vertices[1].u + tuv.z * vertices[2].u + (1.0f - tuv.y - tuv.z) * vertices[0].u;
-                //            rec.v = tuv.y * vertices[1].v + tuv.z * vertices[2].v + (1.0f - tuv.y - tuv.z) * vertices[0].v;
-            }
-        }
+    uint inst_idx;
+    uint tri_idx = intersect_instances(ray, RAY_MIN_DIST, closest_t, inst_idx);
+    if (tri_idx != BVH_NONE)
+    {
+        Ray mesh_ray = transform_ray(ray, instances[inst_idx]);
+        int mat_idx = instances[inst_idx].material;
+        vec3 normal = mesh_normal(tri_idx, mesh_ray.origin + closest_t * mesh_ray.direction);
+        record.intersection = ray.origin + ray.direction * closest_t;
+        record.distance = closest_t;
+        record.normal = normalize(transform_normal(normal, instances[inst_idx]));
+        record.hit = true;
+        record.mat = materials[mat_idx];
+        record.albedo = materials[mat_idx].albedo.xyz;
+        record.emission = materials[mat_idx].emission.xyz;
+        apply_mesh_textures(record.mat, tri_idx, mesh_ray, closest_t, record.albedo,
+                            record.emission);
     }
-    return lowest > 0;
+    return record.distance > 0;
 }
\ No newline at end of file
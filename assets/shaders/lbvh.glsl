@@ -0,0 +1,141 @@
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+/*                                                                          */
+/*                                                                          */
+/*                         LINEAR BVH CONSTRUCTION                          */
+/*                                                                          */
+/*                                                                          */
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+
+/*
+	Shared by the lbvh_*.comp passes, which rebuild the BVH over the 
+	sphere and triangle buffers on the GPU (Karras 2012, "Maximizing Parallelism in the 
+	Construction of BVHs, Octrees, and k-d Trees"):
+	
+	1. lbvh_centroid_bounds  bounds of the primitive centroids
+	2. lbvh_morton           30 bit Morton code of every centroid
+	3. lbvh_radix_*          sort the codes, 4 passes of 8 bits
+	4. lbvh_hierarchy        one interior node per adjacent pair of keys
+	5. lbvh_fit_bounds       bounds from the leaves up to the root
+	
+	Interior nodes are stored in [0, n - 1), leaves in [n - 1, 2n - 1) so 
+	the root is always node 0. The nodes use the same BvhNode layout as the 
+	CPU builder, leaf i references entry i of the sorted values, which is 
+	bound as bvh_indices by the path tracer. Primitives [0, triangle_count) 
+	are the triangles, the rest are the spheres, whose values are tagged 
+	with BVH_SPHERE_BIT like the indices of the CPU builder.
+	
+	Only core storage buffer atomics are used, no subgroup operations or 
+	float atomics, so the passes also run on software drivers (lavapipe).
+*/
+
+/*--------------------------------------------------------------------------*/
+
+#define BVH_LEAF_BIT 0x80000000u
+#define BVH_NONE 0xFFFFFFFFu
+#define BVH_SPHERE_BIT 0x80000000u
+#define FLT_MAX 3.402823466e+38
+#define LBVH_GROUP_SIZE 256
+#define LBVH_RADIX_BITS 8
+#define LBVH_RADIX_SIZE 256u /* one digit per invocation in the radix passes */
+
+#include "structs.glsl"
+
+layout(local_size_x = LBVH_GROUP_SIZE) in;
+
+layout(push_constant) uniform LbvhParams
+{
+    uint primitive_count; /* triangles followed by spheres */
+    uint block_count;     /* workgroups of LBVH_GROUP_SIZE over the primitives */
+    uint shift;           /* radix passes, lowest bit of the current digit */
+    uint triangle_count;
+}
+params;
+
+layout(std430, binding = 0) readonly buffer Triangles { Triangle triangles[]; };
+layout(std430, binding = 1) buffer KeysIn { uint keys_in[]; };
+layout(std430, binding = 2) buffer ValuesIn { uint values_in[]; };
+layout(std430, binding = 3) buffer KeysOut { uint keys_out[]; };
+layout(std430, binding = 4) buffer ValuesOut { uint values_out[]; };
+layout(std430, binding = 5) buffer Histogram { uint histogram[]; };
+layout(std430, binding = 6) buffer SceneBounds 
+{ 
+    uint centroid_min[4]; /* xyz in the encoding of float_to_ordered, w unused */
+    uint centroid_max[4];
+};
+layout(std430, binding = 7) coherent buffer BvhNodes { BvhNode bvh_nodes[]; };
+layout(std430, binding = 8) buffer Parents { uint parents[]; };
+layout(std430, binding = 9) buffer Visits { uint visits[]; };
+layout(std430, binding = 10) readonly buffer Spheres { Sphere spheres[]; };
+
+/*--------------------------------------------------------------------------*/
+
+#include "ordered_float.glsl"
+
+/*--------------------------------------------------------------------------*/
+
+vec3 triangle_centroid
+
+	(Triangle tri) /* triangle from the triangle buffer */
+	
+{
+	return (tri.vert0.xyz + tri.vert1.xyz + tri.vert2.xyz) / 3.0;
+	
+} /* triangle_centroid */
+
+/*--------------------------------------------------------------------------*/
+
+uint primitive_value
+
+	(uint idx) /* primitive in [0, primitive_count) */
+	
+/*
+	Index stored in the leaves for a primitive, tagged for spheres.
+*/
+	
+{
+	return idx < params.triangle_count ? idx 
+	                                   : (idx - params.triangle_count) | BVH_SPHERE_BIT;
+	
+} /* primitive_value */
+
+/*--------------------------------------------------------------------------*/
+
+vec3 primitive_centroid
+
+	(uint value) /* index returned by primitive_value */
+	
+{
+	if ((value & BVH_SPHERE_BIT) != 0)
+		return spheres[value & ~BVH_SPHERE_BIT].origin;
+	return triangle_centroid(triangles[value]);
+	
+} /* primitive_centroid */
+
+/*--------------------------------------------------------------------------*/
+
+void primitive_bounds
+
+	(uint     value,    /* index returned by primitive_value */
+	 out vec3 bounds_min, 
+	 out vec3 bounds_max)
+	
+{
+	if ((value & BVH_SPHERE_BIT) != 0)
+	{
+		Sphere sphere = spheres[value & ~BVH_SPHERE_BIT];
+		bounds_min = sphere.origin - vec3(sphere.radius);
+		bounds_max = sphere.origin + vec3(sphere.radius);
+		return;
+	}
+	
+	Triangle tri = triangles[value];
+	bounds_min = min(tri.vert0.xyz, min(tri.vert1.xyz, tri.vert2.xyz));
+	bounds_max = max(tri.vert0.xyz, max(tri.vert1.xyz, tri.vert2.xyz));
+	
+} /* primitive_bounds */
+
+/*--------------------------------------------------------------------------*/
@@ -0,0 +1,40 @@
+/*--------------------------------------------------------------------------*/
+
+/*
+	Float bounds reduced with uint atomics, shared by the lbvh_*.comp and 
+	sphere_grid_*.comp passes.
+*/
+
+/*--------------------------------------------------------------------------*/
+
+uint float_to_ordered
+
+	(float f) /* value to encode */
+	
+/*
+	Maps a float to a uint with the same ordering, so atomicMin/atomicMax 
+	on uints can be used for float bounds.
+*/
+	
+{
+	uint u = floatBitsToUint(f);
+	return (u & 0x80000000u) != 0 ? ~u : u | 0x80000000u;
+	
+} /* float_to_ordered */
+
+/*--------------------------------------------------------------------------*/
+
+float ordered_to_float
+
+	(uint u) /* value encoded with float_to_ordered */
+	
+/*
+	Inverse of float_to_ordered.
+*/
+	
+{
+	return uintBitsToFloat((u & 0x80000000u) != 0 ? u & ~0x80000000u : ~u);
+	
+} /* ordered_to_float */
+
+/*--------------------------------------------------------------------------*/
@@ -0,0 +1,98 @@
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+/*                                                                          */
+/*                                                                          */
+/*                       UNIFORM GRID OVER THE SPHERES                      */
+/*                                                                          */
+/*                                                                          */
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+
+/*
+	Shared by the sphere_grid_*.comp passes, which sort the spheres into a 
+	uniform grid with a counting sort, for scenes made of many spheres of 
+	similar size where the grid is cheaper to build than a BVH:
+	
+	1. sphere_grid_bounds   bounds of the spheres and their largest radius
+	2. sphere_grid_setup    cell size and resolution, one invocation
+	3. sphere_grid_count    references per cell
+	4. sphere_grid_scan     first reference of every cell, clears the counts
+	5. sphere_grid_scatter  references in cell order, counts them again
+	
+	A sphere is referenced by every cell its bounding box overlaps. The 
+	cells are at least as large as the largest sphere, so that is never 
+	more than 8 cells. Cell c references the spheres 
+	grid_refs[grid_starts[c] .. grid_starts[c] + grid_counts[c]). The 
+	path tracer walks the cells along a ray with a 3D-DDA, see 
+	intersect_sphere_grid.
+*/
+
+/*--------------------------------------------------------------------------*/
+
+#define FLT_MAX 3.402823466e+38
+#define GRID_GROUP_SIZE 256
+#define GRID_CELLS_PER_SPHERE 2.0 /* target cell count relative to the sphere count */
+
+#include "structs.glsl"
+
+layout(local_size_x = GRID_GROUP_SIZE) in;
+
+layout(push_constant) uniform GridParams
+{
+	uint sphere_count;
+	uint block_count;   /* workgroups of GRID_GROUP_SIZE over the spheres */
+	uint cell_capacity; /* cells the buffers hold */
+	uint pad;
+}
+params;
+
+layout(std430, binding = 0) readonly buffer Spheres { Sphere spheres[]; };
+layout(std430, binding = 1) buffer SphereGrid
+{
+	uint grid_bounds_min[4]; /* xyz in the encoding of float_to_ordered, w unused */
+	uint grid_bounds_max[4]; /* w: largest radius */
+	vec3 grid_origin;
+	float grid_cell_size;
+	ivec3 grid_dims;
+	uint grid_cell_count;
+};
+layout(std430, binding = 2) buffer GridStarts { uint grid_starts[]; };
+layout(std430, binding = 3) buffer GridCounts { uint grid_counts[]; };
+layout(std430, binding = 4) buffer GridRefs { uint grid_refs[]; };
+
+/*--------------------------------------------------------------------------*/
+
+#include "ordered_float.glsl"
+
+/*--------------------------------------------------------------------------*/
+
+void sphere_cells
+
+	(uint      idx,  /* sphere in [0, sphere_count) */
+	 out ivec3 lo,   /* first cell overlapped on every axis */
+	 out ivec3 hi)   /* last cell overlapped on every axis */
+	
+{
+	Sphere sphere = spheres[idx];
+	ivec3 last = grid_dims - 1;
+	lo = clamp(ivec3(floor((sphere.origin - sphere.radius - grid_origin) / grid_cell_size)), 
+			   ivec3(0), last);
+	hi = clamp(ivec3(floor((sphere.origin + sphere.radius - grid_origin) / grid_cell_size)), 
+			   ivec3(0), last);
+	
+} /* sphere_cells */
+
+/*--------------------------------------------------------------------------*/
+
+uint grid_cell_index
+
+	(ivec3 cell) /* cell coordinates inside grid_dims */
+	
+{
+	return uint((cell.z * grid_dims.y + cell.y) * grid_dims.x + cell.x);
+	
+} /* grid_cell_index */
+
+/*--------------------------------------------------------------------------*/
@@ -13,6 +13,72 @@ struct Triangle
     vec4 mat_id;
 };
 
+/* rows of the transform into the space of the unit triangle, see intersect_triangle_hit */
+struct TriangleHit
+{
+    vec4 row0;
+    vec4 row1;
+    vec4 row2;
+};
+
+struct SphereHit
+{
+    vec3  center;
+    float inv_radius;
+};
+
+struct Vertex
+{
+    vec3  position;
+    float u;
+    vec3  normal;
+    float v;
+};
+
+/* see QuantizedVertex in geometry.h, decoded by the mesh_vertex_* fetches */
+struct QuantizedVertex
+{
+    uint position_xy; /* grid steps over the bounds of the mesh, 16 bits per axis */
+    uint position_z;  /* low 16 bits, the others are padding */
+    uint normal;      /* octahedral, 16 bit snorm per component */
+    uint uv;          /* half floats */
+};
+
+struct BvhNode
+{
+    vec3 aabb_min;
+    uint left_or_first;  /* interior: left child, leaf: first entry in bvh_indices */
+    vec3 aabb_max;
+    uint right_or_count; /* interior: right child, leaf: BVH_LEAF_BIT | count */
+};
+
+#ifdef WIDE_BVH_WIDTH
+struct WideBvhNode
+{
+    vec3 origin;
+    uint exponents;  /* biased float exponents of the child grid cell size, 8 bits per axis */
+    uint child_base; /* first interior child in wide_bvh_nodes */
+    uint prim_base;  /* first entry of the leaf children in wide_bvh_indices */
+    uint child_meta[WIDE_BVH_WIDTH / 4]; /* byte per child: 0 empty, 0x80 | n interior, leaf size */
+    uint bounds[WIDE_BVH_WIDTH * 6 / 4]; /* min xyz then max xyz planes, 8 bits per child */
+};
+#endif
+
+struct Instance
+{
+    vec4 world_to_object[3]; /* rows of the 3x4 transform into mesh space */
+    uint blas_root;          /* root of the mesh BVH in blas_nodes */
+    int  material;           /* of the mesh, unless the placement overrides it */
+    uint cluster;            /* of a streamed mesh, index into cluster_feedback */
+    uint pad0;
+};
+
+struct SdfCell
+{
+    uint  brick;    /* slot in sdf_atlas, or SDF_EMPTY_BRICK */
+    float distance; /* without a brick: bound of the distance anywhere in the cell */
+};
+
 struct Ray
 {
     vec3 origin;
@@ -26,8 +92,8 @@ struct Material
     vec4 data;
     /*
     data.x = Type (Glass, Lambert, Dynamic)
-    data.y = Glass Refractive Index OR Dynamic difusse
-    data.z = Dynamic reflectiveness
+    data.y = albedo texture, -1 for none
+    data.z = emission texture, -1 for none
     data.w = Unused
     */
 };
@@ -1,2 +1,4 @@
 @echo off
 for %%i in (*.vert *.frag *.comp) do "glslangValidator.exe" -V "%%~i" -o "%%~i.spv" -I"."
+rem for devices without VK_EXT_descriptor_indexing, see RVPT::texture_indexing
+"glslangValidator.exe" -V compute_pass.comp -DSINGLE_TEXTURE -o compute_pass_single_texture.comp.spv -I"."
@@ -3,3 +3,5 @@ for filename in *.{vert,frag,tesc,tese,geom,comp}; do
     [ -e "$filename" ] || continue
     glslangValidator -V "$filename" -o "$filename.spv" -I"."
 done
+# for devices without VK_EXT_descriptor_indexing, see RVPT::texture_indexing
+glslangValidator -V compute_pass.comp -DSINGLE_TEXTURE -o compute_pass_single_texture.comp.spv -I"."
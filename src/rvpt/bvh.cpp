@@ -0,0 +1,904 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <optional>
+
+#include "thread_pool.h"
+
+void AABB::expand(glm::vec3 point)
+{
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+}
+
+void AABB::expand(AABB const& other)
+{
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+}
+
+bool AABB::empty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+
+glm::vec3 AABB::centroid() const { return (min + max) * 0.5f; }
+
+glm::vec3 AABB::extent() const { return empty() ? glm::vec3(0) : max - min; }
+
+float AABB::surface_area() const
+{
+    glm::vec3 e = extent();
+    return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+AABB triangle_bounds(Triangle const& triangle)
+{
+    AABB bounds;
+    bounds.expand(glm::vec3(triangle.vertex0));
+    bounds.expand(glm::vec3(triangle.vertex1));
+    bounds.expand(glm::vec3(triangle.vertex2));
+    return bounds;
+}
+
+AABB sphere_bounds(Sphere const& sphere)
+{
+    return AABB{sphere.origin - glm::vec3(sphere.radius), sphere.origin + glm::vec3(sphere.radius)};
+}
+
+std::vector<uint32_t> bvh_parents(std::vector<BvhNode> const& nodes)
+{
+    std::vector<uint32_t> parents(nodes.size(), BVH_NONE);
+    for (uint32_t i = 0; i < nodes.size(); i++)
+    {
+        if (nodes[i].is_leaf()) continue;
+        parents[nodes[i].left_or_first] = i;
+        parents[nodes[i].right_or_count] = i;
+    }
+    return parents;
+}
+
+namespace
+{
+constexpr uint32_t MAX_BINS = 64;
+// ranges with at least this many primitives are binned and partitioned with parallel loops
+constexpr uint32_t PARALLEL_RANGE_THRESHOLD = 1u << 16;
+constexpr size_t PARALLEL_GRAIN_SIZE = 1u << 14;
+// ranges with fewer primitives are built start to finish by a single task
+constexpr uint32_t SERIAL_SUBTREE_THRESHOLD = 1u << 12;
+
+struct Split
+{
+    int axis = -1;
+    uint32_t bin = 0;
+    float cost = std::numeric_limits<float>::max();
+    AABB left;
+    AABB right;
+};
+
+struct RangeBounds
+{
+    AABB bounds;
+    AABB centroid_bounds;
+
+    void merge(RangeBounds const& other)
+    {
+        bounds.expand(other.bounds);
+        centroid_bounds.expand(other.centroid_bounds);
+    }
+};
+
+struct Bins
+{
+    std::array<std::array<AABB, MAX_BINS>, 3> bounds{};
+    std::array<std::array<uint32_t, MAX_BINS>, 3> counts{};
+
+    void merge(Bins const& other)
+    {
+        for (int axis = 0; axis < 3; axis++)
+            for (uint32_t bin = 0; bin < MAX_BINS; bin++)
+            {
+                bounds[axis][bin].expand(other.bounds[axis][bin]);
+                counts[axis][bin] += other.counts[axis][bin];
+            }
+    }
+};
+
+// Bin of value when [lo, hi] is divided into bin_count equal bins, hi must be larger than lo
+uint32_t bin_index(float value, float lo, float hi, uint32_t bin_count)
+{
+    float scale = static_cast<float>(bin_count) / (hi - lo);
+    auto bin = static_cast<uint32_t>(std::max((value - lo) * scale, 0.0f));
+    return std::min(bin, bin_count - 1);
+}
+
+// Finds the cheapest plane between the bins of one axis and stores it in best if it beats it.
+// left_counts[bin] primitives lie left of every plane above the bin and right_counts[bin] right of
+// every plane below it. Both are the same for object splits, spatial splits count the references
+// that straddle bins where they enter and where they leave.
+void sweep_bins(int axis, std::array<AABB, MAX_BINS> const& bin_bounds,
+                std::array<uint32_t, MAX_BINS> const& left_counts,
+                std::array<uint32_t, MAX_BINS> const& right_counts, float parent_area,
+                BvhBuildSettings const& settings, Split& best)
+{
+    // sweep from the right to get the bounds/count of everything right of each plane
+    std::array<AABB, MAX_BINS> right_bounds{};
+    std::array<uint32_t, MAX_BINS> right_count{};
+    AABB right;
+    uint32_t right_total = 0;
+    for (uint32_t bin = settings.bin_count - 1; bin > 0; bin--)
+    {
+        right.expand(bin_bounds[bin]);
+        right_total += right_counts[bin];
+        right_bounds[bin] = right;
+        right_count[bin] = right_total;
+    }
+
+    AABB left;
+    uint32_t left_total = 0;
+    for (uint32_t bin = 1; bin < settings.bin_count; bin++)
+    {
+        left.expand(bin_bounds[bin - 1]);
+        left_total += left_counts[bin - 1];
+        if (left_total == 0 || right_count[bin] == 0) continue;
+
+        float cost = settings.traversal_cost +
+                     settings.intersection_cost *
+                         (left.surface_area() * static_cast<float>(left_total) +
+                          right_bounds[bin].surface_area() * static_cast<float>(right_count[bin])) /
+                         parent_area;
+        if (cost < best.cost)
+        {
+            best.axis = axis;
+            best.bin = bin;
+            best.cost = cost;
+            best.left = left;
+            best.right = right_bounds[bin];
+        }
+    }
+}
+
+// Top levels of the hierarchy built by tasks. A subtree is either an interior node with two
+// further subtrees, or a depth first block of nodes built by one task with block local indices.
+struct Subtree
+{
+    BvhNode node;
+    std::unique_ptr<Subtree> left;
+    std::unique_ptr<Subtree> right;
+    std::vector<BvhNode> nodes;
+};
+
+class BinnedSahBuilder
+{
+public:
+    BinnedSahBuilder(std::vector<AABB> const& prim_bounds, BvhBuildSettings const& build_settings,
+                     std::vector<uint32_t>& indices, ThreadPool& pool)
+        : settings(build_settings), indices(indices), pool(pool), prim_bounds(prim_bounds)
+    {
+        settings.bin_count = std::clamp(settings.bin_count, 2u, MAX_BINS);
+        settings.max_leaf_size = std::max(settings.max_leaf_size, 1u);
+
+        prim_centroids.resize(prim_bounds.size());
+        scratch.resize(prim_bounds.size());
+        pool.parallel_for(prim_bounds.size(), PARALLEL_GRAIN_SIZE, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) prim_centroids[i] = prim_bounds[i].centroid();
+        });
+    }
+
+    std::vector<BvhNode> build()
+    {
+        Subtree root;
+        ThreadPool::TaskGroup group;
+        build_task(0, static_cast<uint32_t>(indices.size()), 0, root, group);
+        pool.wait(group);
+
+        std::vector<BvhNode> nodes;
+        nodes.reserve(2 * indices.size());
+        flatten(root, nodes);
+        return nodes;
+    }
+
+private:
+    BvhBuildSettings settings;
+    std::vector<uint32_t>& indices;
+    ThreadPool& pool;
+
+    std::vector<AABB> const& prim_bounds;
+    std::vector<glm::vec3> prim_centroids;
+    // partition target, tasks only touch the part belonging to their own range
+    std::vector<uint32_t> scratch;
+
+    // Runs func(chunk, begin, end) over [begin, end), in parallel for large ranges. Chunks are
+    // fixed by the range, not by the thread count, so merging in chunk order is deterministic.
+    template <typename Func>
+    void for_chunks(uint32_t begin, uint32_t end, Func&& func) const
+    {
+        size_t count = end - begin;
+        if (count < PARALLEL_RANGE_THRESHOLD)
+        {
+            func(size_t(0), size_t(begin), size_t(end));
+            return;
+        }
+        pool.parallel_for(count, PARALLEL_GRAIN_SIZE, [&](size_t chunk_begin, size_t chunk_end) {
+            func(chunk_begin / PARALLEL_GRAIN_SIZE, begin + chunk_begin, begin + chunk_end);
+        });
+    }
+
+    size_t chunk_count(uint32_t begin, uint32_t end) const
+    {
+        size_t count = end - begin;
+        if (count < PARALLEL_RANGE_THRESHOLD) return 1;
+        return (count + PARALLEL_GRAIN_SIZE - 1) / PARALLEL_GRAIN_SIZE;
+    }
+
+    RangeBounds range_bounds(uint32_t begin, uint32_t end) const
+    {
+        std::vector<RangeBounds> chunks(chunk_count(begin, end));
+        for_chunks(begin, end, [&](size_t chunk, size_t chunk_begin, size_t chunk_end) {
+            for (size_t i = chunk_begin; i < chunk_end; i++)
+            {
+                chunks[chunk].bounds.expand(prim_bounds[indices[i]]);
+                chunks[chunk].centroid_bounds.expand(prim_centroids[indices[i]]);
+            }
+        });
+        RangeBounds result;
+        for (auto& chunk : chunks) result.merge(chunk);
+        return result;
+    }
+
+    static bool axis_is_flat(AABB const& centroid_bounds, int axis)
+    {
+        return centroid_bounds.max[axis] - centroid_bounds.min[axis] <= 0.0f;
+    }
+
+    uint32_t bin_of(glm::vec3 centroid, AABB const& centroid_bounds, int axis) const
+    {
+        return bin_index(centroid[axis], centroid_bounds.min[axis], centroid_bounds.max[axis],
+                         settings.bin_count);
+    }
+
+    Bins bin_range(uint32_t begin, uint32_t end, AABB const& centroid_bounds) const
+    {
+        std::vector<Bins> chunks(chunk_count(begin, end));
+        for_chunks(begin, end, [&](size_t chunk, size_t chunk_begin, size_t chunk_end) {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                if (axis_is_flat(centroid_bounds, axis)) continue;
+                for (size_t i = chunk_begin; i < chunk_end; i++)
+                {
+                    uint32_t bin = bin_of(prim_centroids[indices[i]], centroid_bounds, axis);
+                    chunks[chunk].bounds[axis][bin].expand(prim_bounds[indices[i]]);
+                    chunks[chunk].counts[axis][bin]++;
+                }
+            }
+        });
+        for (size_t chunk = 1; chunk < chunks.size(); chunk++) chunks[0].merge(chunks[chunk]);
+        return chunks[0];
+    }
+
+    Split find_split(Bins const& bins, AABB const& bounds, AABB const& centroid_bounds) const
+    {
+        Split best;
+        float parent_area = bounds.surface_area();
+        if (parent_area <= 0.0f) return best;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (axis_is_flat(centroid_bounds, axis)) continue;
+            sweep_bins(axis, bins.bounds[axis], bins.counts[axis], bins.counts[axis], parent_area,
+                       settings, best);
+        }
+        return best;
+    }
+
+    // Stable partition, so the serial and the parallel path produce the same order
+    uint32_t partition(uint32_t begin, uint32_t end, Split const& split,
+                       AABB const& centroid_bounds)
+    {
+        auto goes_left = [&](uint32_t prim) {
+            return bin_of(prim_centroids[prim], centroid_bounds, split.axis) < split.bin;
+        };
+
+        size_t chunks = chunk_count(begin, end);
+        if (chunks == 1)
+        {
+            auto it = std::stable_partition(indices.begin() + begin, indices.begin() + end,
+                                            goes_left);
+            return static_cast<uint32_t>(it - indices.begin());
+        }
+
+        std::vector<size_t> left_counts(chunks);
+        for_chunks(begin, end, [&](size_t chunk, size_t chunk_begin, size_t chunk_end) {
+            for (size_t i = chunk_begin; i < chunk_end; i++)
+                if (goes_left(indices[i])) left_counts[chunk]++;
+        });
+
+        std::vector<size_t> left_offsets(chunks), right_offsets(chunks);
+        size_t left_total = 0;
+        for (size_t chunk = 0; chunk < chunks; chunk++)
+        {
+            left_offsets[chunk] = left_total;
+            left_total += left_counts[chunk];
+        }
+        size_t right_total = left_total;
+        for (size_t chunk = 0; chunk < chunks; chunk++)
+        {
+            right_offsets[chunk] = right_total;
+            right_total += std::min<size_t>(PARALLEL_GRAIN_SIZE,
+                                            end - begin - chunk * PARALLEL_GRAIN_SIZE) -
+                           left_counts[chunk];
+        }
+
+        for_chunks(begin, end, [&](size_t chunk, size_t chunk_begin, size_t chunk_end) {
+            size_t left_out = begin + left_offsets[chunk];
+            size_t right_out = begin + right_offsets[chunk];
+            for (size_t i = chunk_begin; i < chunk_end; i++)
+            {
+                if (goes_left(indices[i]))
+                    scratch[left_out++] = indices[i];
+                else
+                    scratch[right_out++] = indices[i];
+            }
+        });
+        for_chunks(begin, end, [&](size_t, size_t chunk_begin, size_t chunk_end) {
+            std::copy(scratch.begin() + chunk_begin, scratch.begin() + chunk_end,
+                      indices.begin() + chunk_begin);
+        });
+        return begin + static_cast<uint32_t>(left_total);
+    }
+
+    // Returns where to split [begin, end), or nothing if the range becomes a leaf
+    std::optional<uint32_t> choose_split(uint32_t begin, uint32_t end, uint32_t depth,
+                                         RangeBounds const& range)
+    {
+        uint32_t count = end - begin;
+        if (count <= 1 || depth + 1 >= settings.max_depth) return {};
+
+        Bins bins = bin_range(begin, end, range.centroid_bounds);
+        Split split = find_split(bins, range.bounds, range.centroid_bounds);
+        float leaf_cost = settings.intersection_cost * static_cast<float>(count);
+        if (count <= settings.max_leaf_size && (split.axis < 0 || split.cost >= leaf_cost))
+            return {};
+
+        uint32_t mid = begin + count / 2;
+        if (split.axis >= 0)
+        {
+            mid = partition(begin, end, split, range.centroid_bounds);
+            // all centroids landed on one side, fall back to a median split
+            if (mid == begin || mid == end) mid = begin + count / 2;
+        }
+        return mid;
+    }
+
+    static BvhNode make_node(RangeBounds const& range)
+    {
+        BvhNode node;
+        node.aabb_min = range.bounds.min;
+        node.aabb_max = range.bounds.max;
+        return node;
+    }
+
+    static void make_leaf(BvhNode& node, uint32_t first, uint32_t count)
+    {
+        node.left_or_first = first;
+        node.right_or_count = BVH_LEAF_BIT | count;
+    }
+
+    uint32_t build_serial(uint32_t begin, uint32_t end, uint32_t depth, std::vector<BvhNode>& out)
+    {
+        RangeBounds range = range_bounds(begin, end);
+        uint32_t node_index = static_cast<uint32_t>(out.size());
+        out.push_back(make_node(range));
+
+        auto mid = choose_split(begin, end, depth, range);
+        if (!mid)
+        {
+            make_leaf(out[node_index], begin, end - begin);
+            return node_index;
+        }
+
+        uint32_t left = build_serial(begin, *mid, depth + 1, out);
+        uint32_t right = build_serial(*mid, end, depth + 1, out);
+        out[node_index].left_or_first = left;
+        out[node_index].right_or_count = right;
+        return node_index;
+    }
+
+    void build_task(uint32_t begin, uint32_t end, uint32_t depth, Subtree& subtree,
+                    ThreadPool::TaskGroup& group)
+    {
+        if (end - begin < SERIAL_SUBTREE_THRESHOLD)
+        {
+            build_serial(begin, end, depth, subtree.nodes);
+            return;
+        }
+
+        RangeBounds range = range_bounds(begin, end);
+        auto mid = choose_split(begin, end, depth, range);
+        if (!mid)
+        {
+            subtree.nodes.push_back(make_node(range));
+            make_leaf(subtree.nodes.back(), begin, end - begin);
+            return;
+        }
+
+        subtree.node = make_node(range);
+        subtree.left = std::make_unique<Subtree>();
+        subtree.right = std::make_unique<Subtree>();
+        Subtree* left = subtree.left.get();
+        Subtree* right = subtree.right.get();
+        uint32_t split = *mid;
+        pool.run(group, [this, begin, split, depth, left, &group] {
+            build_task(begin, split, depth + 1, *left, group);
+        });
+        pool.run(group, [this, split, end, depth, right, &group] {
+            build_task(split, end, depth + 1, *right, group);
+        });
+    }
+
+    // Lays the subtrees out depth first, which is the same order build_serial produces
+    static uint32_t flatten(Subtree const& subtree, std::vector<BvhNode>& out)
+    {
+        auto base = static_cast<uint32_t>(out.size());
+        if (!subtree.nodes.empty())
+        {
+            for (auto node : subtree.nodes)
+            {
+                if (!node.is_leaf())
+                {
+                    node.left_or_first += base;
+                    node.right_or_count += base;
+                }
+                out.push_back(node);
+            }
+            return base;
+        }
+
+        out.push_back(subtree.node);
+        uint32_t left = flatten(*subtree.left, out);
+        uint32_t right = flatten(*subtree.right, out);
+        out[base].left_or_first = left;
+        out[base].right_or_count = right;
+        return base;
+    }
+};
+
+struct Reference
+{
+    uint32_t prim;  // triangles first, then spheres
+    AABB bounds;  // the part of the primitive this reference covers
+};
+
+AABB intersect(AABB const& a, AABB const& b)
+{
+    return AABB{glm::max(a.min, b.min), glm::min(a.max, b.max)};
+}
+
+// Cuts the part of a triangle covered by ref at a plane, giving the bounds on either side
+void split_reference(Triangle const& triangle, Reference const& ref, int axis, float position,
+                     AABB& left, AABB& right)
+{
+    left = AABB{};
+    right = AABB{};
+    glm::vec3 vertices[3] = {glm::vec3(triangle.vertex0), glm::vec3(triangle.vertex1),
+                             glm::vec3(triangle.vertex2)};
+    for (int i = 0; i < 3; i++)
+    {
+        glm::vec3 a = vertices[i];
+        glm::vec3 b = vertices[(i + 1) % 3];
+        if (a[axis] <= position) left.expand(a);
+        if (a[axis] >= position) right.expand(a);
+        // the edge crosses the plane
+        if ((a[axis] < position && position < b[axis]) ||
+            (b[axis] < position && position < a[axis]))
+        {
+            glm::vec3 p = a + (b - a) * ((position - a[axis]) / (b[axis] - a[axis]));
+            p[axis] = position;
+            left.expand(p);
+            right.expand(p);
+        }
+    }
+    left.max[axis] = position;
+    right.min[axis] = position;
+    left = intersect(left, ref.bounds);
+    right = intersect(right, ref.bounds);
+}
+
+// Moves the indices of the spheres, which follow the triangles during the build, to their own
+// range tagged with BVH_SPHERE_BIT
+void tag_spheres(std::vector<uint32_t>& indices, uint32_t triangle_count)
+{
+    for (auto& index : indices)
+        if (index >= triangle_count) index = (index - triangle_count) | BVH_SPHERE_BIT;
+}
+
+// Bounds of an entry of BVH::primitive_indices
+AABB primitive_bounds(std::vector<Triangle> const& triangles, std::vector<Sphere> const& spheres,
+                      uint32_t index)
+{
+    if (index & BVH_SPHERE_BIT) return sphere_bounds(spheres[index & ~BVH_SPHERE_BIT]);
+    return triangle_bounds(triangles[index]);
+}
+
+// Builds a spatial split BVH (Stich et al., "Spatial Splits in Bounding Volume Hierarchies"). Next
+// to the binned object splits, nodes can be split at a plane that cuts straddling triangles, whose
+// references then go to both children with their bounds clipped to either side. Spatial splits are
+// only tried where the children of the best object split overlap, and stop once the budget of
+// duplicated references is used up. The build is serial, it is meant for static geometry.
+// Spheres are cut by clipping their box at the plane.
+class SpatialSplitBuilder
+{
+public:
+    SpatialSplitBuilder(std::vector<Triangle> const& triangles, std::vector<Sphere> const& spheres,
+                        BvhBuildSettings const& build_settings)
+        : settings(build_settings), triangles(triangles), spheres(spheres)
+    {
+        settings.bin_count = std::clamp(settings.bin_count, 2u, MAX_BINS);
+        settings.max_leaf_size = std::max(settings.max_leaf_size, 1u);
+        duplicates_left = static_cast<size_t>(std::max(settings.spatial_split_budget, 0.0f) *
+                                              static_cast<float>(primitive_count()));
+    }
+
+    std::vector<BvhNode> build(std::vector<uint32_t>& indices)
+    {
+        std::vector<Reference> refs(primitive_count());
+        AABB root;
+        for (uint32_t i = 0; i < refs.size(); i++)
+        {
+            refs[i] = Reference{i, i < triangles.size()
+                                       ? triangle_bounds(triangles[i])
+                                       : sphere_bounds(spheres[i - triangles.size()])};
+            root.expand(refs[i].bounds);
+        }
+        min_overlap_area = settings.spatial_split_alpha * root.surface_area();
+
+        indices.clear();
+        indices.reserve(refs.size());
+        nodes.reserve(2 * refs.size());
+        build_node(refs, 0, indices);
+        tag_spheres(indices, static_cast<uint32_t>(triangles.size()));
+        return std::move(nodes);
+    }
+
+private:
+    BvhBuildSettings settings;
+    std::vector<Triangle> const& triangles;
+    std::vector<Sphere> const& spheres;
+    std::vector<BvhNode> nodes;
+    size_t duplicates_left = 0;
+    float min_overlap_area = 0.0f;
+
+    size_t primitive_count() const { return triangles.size() + spheres.size(); }
+
+    void split_at(Reference const& ref, int axis, float position, AABB& left, AABB& right) const
+    {
+        if (ref.prim < triangles.size())
+        {
+            split_reference(triangles[ref.prim], ref, axis, position, left, right);
+            return;
+        }
+        left = ref.bounds;
+        left.max[axis] = std::min(left.max[axis], position);
+        right = ref.bounds;
+        right.min[axis] = std::max(right.min[axis], position);
+    }
+
+    Split find_object_split(std::vector<Reference> const& refs, AABB const& bounds,
+                            AABB const& centroid_bounds) const
+    {
+        Split best;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (centroid_bounds.max[axis] <= centroid_bounds.min[axis]) continue;
+            std::array<AABB, MAX_BINS> bin_bounds{};
+            std::array<uint32_t, MAX_BINS> counts{};
+            for (auto const& ref : refs)
+            {
+                uint32_t bin = bin_index(ref.bounds.centroid()[axis], centroid_bounds.min[axis],
+                                         centroid_bounds.max[axis], settings.bin_count);
+                bin_bounds[bin].expand(ref.bounds);
+                counts[bin]++;
+            }
+            sweep_bins(axis, bin_bounds, counts, counts, bounds.surface_area(), settings, best);
+        }
+        return best;
+    }
+
+    float plane_position(AABB const& bounds, int axis, uint32_t bin) const
+    {
+        float extent = bounds.max[axis] - bounds.min[axis];
+        return bounds.min[axis] + extent * static_cast<float>(bin) /
+                                      static_cast<float>(settings.bin_count);
+    }
+
+    Split find_spatial_split(std::vector<Reference> const& refs, AABB const& bounds) const
+    {
+        Split best;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (bounds.max[axis] <= bounds.min[axis]) continue;
+            std::array<AABB, MAX_BINS> bin_bounds{};
+            std::array<uint32_t, MAX_BINS> entries{};
+            std::array<uint32_t, MAX_BINS> exits{};
+            for (auto const& ref : refs)
+            {
+                uint32_t first = bin_index(ref.bounds.min[axis], bounds.min[axis],
+                                           bounds.max[axis], settings.bin_count);
+                uint32_t last = bin_index(ref.bounds.max[axis], bounds.min[axis],
+                                          bounds.max[axis], settings.bin_count);
+                entries[first]++;
+                exits[last]++;
+
+                // chop the reference into the bins it spans
+                Reference rest = ref;
+                for (uint32_t bin = first; bin < last; bin++)
+                {
+                    AABB left, right;
+                    split_at(rest, axis, plane_position(bounds, axis, bin + 1), left, right);
+                    bin_bounds[bin].expand(left);
+                    rest.bounds = right;
+                }
+                bin_bounds[last].expand(rest.bounds);
+            }
+            sweep_bins(axis, bin_bounds, entries, exits, bounds.surface_area(), settings, best);
+        }
+        return best;
+    }
+
+    void partition_object(std::vector<Reference> const& refs, Split const& split,
+                          AABB const& centroid_bounds, std::vector<Reference>& left,
+                          std::vector<Reference>& right) const
+    {
+        for (auto const& ref : refs)
+        {
+            uint32_t bin =
+                bin_index(ref.bounds.centroid()[split.axis], centroid_bounds.min[split.axis],
+                          centroid_bounds.max[split.axis], settings.bin_count);
+            (bin < split.bin ? left : right).push_back(ref);
+        }
+    }
+
+    void partition_spatial(std::vector<Reference> const& refs, Split const& split,
+                           AABB const& bounds, std::vector<Reference>& left,
+                           std::vector<Reference>& right)
+    {
+        int axis = split.axis;
+        float position = plane_position(bounds, axis, split.bin);
+
+        std::vector<Reference> straddling;
+        for (auto const& ref : refs)
+        {
+            if (ref.bounds.max[axis] <= position)
+                left.push_back(ref);
+            else if (ref.bounds.min[axis] >= position)
+                right.push_back(ref);
+            else
+                straddling.push_back(ref);
+        }
+
+        // a straddling reference is only split if that is cheaper than moving it to one side
+        // ("reference unsplitting"), the counts include every straddling reference
+        AABB left_bounds = split.left;
+        AABB right_bounds = split.right;
+        auto left_count = static_cast<float>(left.size() + straddling.size());
+        auto right_count = static_cast<float>(right.size() + straddling.size());
+        for (auto const& ref : straddling)
+        {
+            AABB left_part, right_part;
+            split_at(ref, axis, position, left_part, right_part);
+
+            AABB left_union = left_bounds;
+            left_union.expand(ref.bounds);
+            AABB right_union = right_bounds;
+            right_union.expand(ref.bounds);
+            float split_cost = left_bounds.surface_area() * left_count +
+                               right_bounds.surface_area() * right_count;
+            float left_cost = left_union.surface_area() * left_count +
+                              right_bounds.surface_area() * (right_count - 1.0f);
+            float right_cost = left_bounds.surface_area() * (left_count - 1.0f) +
+                               right_union.surface_area() * right_count;
+
+            bool can_split = duplicates_left > 0 && !left_part.empty() && !right_part.empty();
+            if (can_split && split_cost < left_cost && split_cost < right_cost)
+            {
+                left.push_back(Reference{ref.prim, left_part});
+                right.push_back(Reference{ref.prim, right_part});
+                duplicates_left--;
+            }
+            else if (left_cost <= right_cost)
+            {
+                left.push_back(ref);
+                left_bounds = left_union;
+                right_count -= 1.0f;
+            }
+            else
+            {
+                right.push_back(ref);
+                right_bounds = right_union;
+                left_count -= 1.0f;
+            }
+        }
+    }
+
+    uint32_t build_node(std::vector<Reference>& refs, uint32_t depth,
+                        std::vector<uint32_t>& indices)
+    {
+        AABB bounds, centroid_bounds;
+        for (auto const& ref : refs)
+        {
+            bounds.expand(ref.bounds);
+            centroid_bounds.expand(ref.bounds.centroid());
+        }
+
+        auto node_index = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+        nodes[node_index].aabb_min = bounds.min;
+        nodes[node_index].aabb_max = bounds.max;
+
+        auto count = static_cast<uint32_t>(refs.size());
+        std::vector<Reference> left, right;
+        if (count > 1 && depth + 1 < settings.max_depth && bounds.surface_area() > 0.0f)
+        {
+            Split object = find_object_split(refs, bounds, centroid_bounds);
+            Split spatial;
+            if (duplicates_left > 0 &&
+                (object.axis < 0 ||
+                 intersect(object.left, object.right).surface_area() > min_overlap_area))
+                spatial = find_spatial_split(refs, bounds);
+
+            float leaf_cost = settings.intersection_cost * static_cast<float>(count);
+            float best_cost = std::min(object.cost, spatial.cost);
+            if (count > settings.max_leaf_size || best_cost < leaf_cost)
+            {
+                if (spatial.axis >= 0 && spatial.cost < object.cost)
+                    partition_spatial(refs, spatial, bounds, left, right);
+                else if (object.axis >= 0)
+                    partition_object(refs, object, centroid_bounds, left, right);
+            }
+        }
+        if (left.empty() || right.empty())
+        {
+            left.clear();
+            right.clear();
+            // same fallback as the object split builder, the references are split in half
+            if (count > settings.max_leaf_size && depth + 1 < settings.max_depth)
+            {
+                left.assign(refs.begin(), refs.begin() + count / 2);
+                right.assign(refs.begin() + count / 2, refs.end());
+            }
+        }
+
+        if (left.empty())
+        {
+            nodes[node_index].left_or_first = static_cast<uint32_t>(indices.size());
+            nodes[node_index].right_or_count = BVH_LEAF_BIT | count;
+            for (auto const& ref : refs) indices.push_back(ref.prim);
+            return node_index;
+        }
+
+        // the children keep their own copies, free this level before descending
+        std::vector<Reference>().swap(refs);
+        uint32_t left_child = build_node(left, depth + 1, indices);
+        uint32_t right_child = build_node(right, depth + 1, indices);
+        nodes[node_index].left_or_first = left_child;
+        nodes[node_index].right_or_count = right_child;
+        return node_index;
+    }
+};
+}  // namespace
+
+void BVH::build(std::vector<Triangle> const& triangles, std::vector<Sphere> const& spheres,
+                BvhBuildSettings const& build_settings)
+{
+    if (build_settings.quality == BvhQuality::high && !(triangles.empty() && spheres.empty()))
+    {
+        settings = build_settings;
+        primitive_count = static_cast<uint32_t>(triangles.size() + spheres.size());
+        SpatialSplitBuilder builder(triangles, spheres, settings);
+        nodes = builder.build(primitive_indices);
+        optimize(settings.treelet_passes);
+        return;
+    }
+
+    // the spheres follow the triangles, their indices are tagged once the build is done
+    std::vector<AABB> prim_bounds(triangles.size() + spheres.size());
+    ThreadPool pool(build_settings.thread_count);
+    pool.parallel_for(triangles.size(), PARALLEL_GRAIN_SIZE, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) prim_bounds[i] = triangle_bounds(triangles[i]);
+    });
+    for (size_t i = 0; i < spheres.size(); i++)
+        prim_bounds[triangles.size() + i] = sphere_bounds(spheres[i]);
+    build(prim_bounds, build_settings, pool);
+    tag_spheres(primitive_indices, static_cast<uint32_t>(triangles.size()));
+}
+
+void BVH::build(std::vector<Triangle> const& triangles, BvhBuildSettings const& build_settings)
+{
+    build(triangles, {}, build_settings);
+}
+
+void BVH::build(std::vector<AABB> const& prim_bounds, BvhBuildSettings const& build_settings)
+{
+    ThreadPool pool(build_settings.thread_count);
+    build(prim_bounds, build_settings, pool);
+}
+
+void BVH::build(std::vector<AABB> const& prim_bounds, BvhBuildSettings const& build_settings,
+                ThreadPool& pool)
+{
+    settings = build_settings;
+    primitive_count = static_cast<uint32_t>(prim_bounds.size());
+    nodes.clear();
+    primitive_indices.resize(prim_bounds.size());
+    for (uint32_t i = 0; i < primitive_indices.size(); i++) primitive_indices[i] = i;
+
+    if (prim_bounds.empty())
+    {
+        // keep a single empty leaf around so the GPU buffers are never zero sized
+        nodes.emplace_back();
+        nodes.back().right_or_count = BVH_LEAF_BIT;
+        initial_sah_cost = 0.0f;
+        build_sah_cost = 0.0f;
+        return;
+    }
+
+    BinnedSahBuilder builder(prim_bounds, settings, primitive_indices, pool);
+    nodes = builder.build();
+    optimize(settings.treelet_passes, pool);
+}
+
+bool BVH::refit(std::vector<Triangle> const& triangles)
+{
+    return refit(triangles, {});
+}
+
+bool BVH::refit(std::vector<Triangle> const& triangles, std::vector<Sphere> const& spheres)
+{
+    if (triangles.size() + spheres.size() != primitive_count)
+    {
+        build(triangles, spheres, settings);
+        return true;
+    }
+
+    // reorder_nodes() stores children after their parent, so walking backwards visits them first
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        auto& node = nodes[i];
+        AABB bounds;
+        if (node.is_leaf())
+        {
+            for (uint32_t k = 0; k < node.primitive_count(); k++)
+                bounds.expand(primitive_bounds(triangles, spheres,
+                                               primitive_indices[node.left_or_first + k]));
+        }
+        else
+        {
+            bounds = nodes[node.left_or_first].bounds();
+            bounds.expand(nodes[node.right_or_count].bounds());
+        }
+        node.aabb_min = bounds.min;
+        node.aabb_max = bounds.max;
+    }
+
+    if (sah_cost() <= build_sah_cost * settings.max_sah_growth) return false;
+    build(triangles, spheres, settings);
+    return true;
+}
+
+float BVH::sah_cost() const
+{
+    if (nodes.empty()) return 0.0f;
+    float root_area = nodes[0].bounds().surface_area();
+    if (root_area <= 0.0f) return 0.0f;
+
+    float cost = 0.0f;
+    for (auto& node : nodes)
+    {
+        float relative_area = node.bounds().surface_area() / root_area;
+        if (node.is_leaf())
+            cost += settings.intersection_cost * static_cast<float>(node.primitive_count()) *
+                    relative_area;
+        else
+            cost += settings.traversal_cost * relative_area;
+    }
+    return cost;
+}
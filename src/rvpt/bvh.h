@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "geometry.h"
+
+class ThreadPool;
+
+// Set in BvhNode::right_or_count when the node is a leaf
+const uint32_t BVH_LEAF_BIT = 0x80000000u;
+const uint32_t BVH_NONE = 0xFFFFFFFFu;
+// Set in BVH::primitive_indices for entries that reference a sphere instead of a triangle
+const uint32_t BVH_SPHERE_BIT = 0x80000000u;
+
+struct AABB
+{
+    glm::vec3 min{std::numeric_limits<float>::max()};
+    glm::vec3 max{-std::numeric_limits<float>::max()};
+
+    void expand(glm::vec3 point);
+    void expand(AABB const& other);
+
+    bool empty() const;
+    glm::vec3 centroid() const;
+    glm::vec3 extent() const;
+    float surface_area() const;
+};
+
+// Flattened node, laid out to match the BvhNode struct in structs.glsl (32 bytes). Aligned to its
+// size, so two siblings side by side share one 64 byte cache line if the left one is at an even
+// index, see BVH::reorder_nodes().
+struct alignas(32) BvhNode
+{
+    glm::vec3 aabb_min{};
+    uint32_t left_or_first = 0;  // interior: index of the left child, leaf: first primitive index
+    glm::vec3 aabb_max{};
+    uint32_t right_or_count = 0;  // interior: index of the right child, leaf: BVH_LEAF_BIT | count
+
+    bool is_leaf() const { return (right_or_count & BVH_LEAF_BIT) != 0; }
+    uint32_t primitive_count() const { return right_or_count & ~BVH_LEAF_BIT; }
+    AABB bounds() const { return AABB{aabb_min, aabb_max}; }
+
+    // An empty leaf no traversal reaches, fills the slot after a root so its siblings start at an
+    // even index
+    static BvhNode padding()
+    {
+        BvhNode node;
+        node.right_or_count = BVH_LEAF_BIT;
+        return node;
+    }
+};
+
+enum class BvhQuality
+{
+    fast,  // binned object splits, built in parallel
+    high,  // object and spatial splits (SBVH), slower serial build of a tighter hierarchy
+};
+
+struct BvhBuildSettings
+{
+    uint32_t bin_count = 16;
+    uint32_t max_leaf_size = 4;
+    uint32_t max_depth = 64;  // must not exceed BVH_STACK_SIZE in the shaders
+    float traversal_cost = 1.0f;
+    float intersection_cost = 1.0f;
+    // threads used by the build, 0 uses every hardware thread. The result does not depend on it.
+    uint32_t thread_count = 0;
+    // refit() rebuilds once the SAH cost exceeds the cost after the last build by this factor
+    float max_sah_growth = 1.5f;
+    // spatial splits are only used for triangles and spheres, arbitrary boxes always get a fast
+    // build
+    BvhQuality quality = BvhQuality::fast;
+    // references to primitives cut by spatial splits, at most this fraction of the primitive count
+    float spatial_split_budget = 0.3f;
+    // spatial splits are only tried where the children of the best object split overlap by more
+    // than this fraction of the root surface area
+    float spatial_split_alpha = 1e-5f;
+    // rounds of treelet restructuring after the build, 0 keeps the hierarchy as built
+    uint32_t treelet_passes = 3;
+    // levels at the top of the hierarchy that are stored breadth first in one block, see
+    // BVH::reorder_nodes()
+    uint32_t hot_levels = 6;
+};
+
+AABB triangle_bounds(Triangle const& triangle);
+AABB sphere_bounds(Sphere const& sphere);
+
+// Parent of every node for traversals without a stack, BVH_NONE for roots. Works on any array of
+// nodes whose interior nodes reference their children by index, e.g. several BVHs back to back.
+std::vector<uint32_t> bvh_parents(std::vector<BvhNode> const& nodes);
+
+class BVH
+{
+public:
+    // Builds a binned SAH hierarchy over the triangles and spheres. The primitives themselves are
+    // not reordered, leaves reference them through primitive_indices, where spheres are tagged
+    // with BVH_SPHERE_BIT. With BvhQuality::high a primitive can be referenced by several leaves.
+    // The top levels are binned and partitioned with parallel loops, smaller subtrees are built as
+    // independent tasks. Every decision only depends on the primitives of a node, so the output is
+    // identical for any thread count.
+    void build(std::vector<Triangle> const& triangles, std::vector<Sphere> const& spheres,
+               BvhBuildSettings const& settings = {});
+    // Same, over triangles only
+    void build(std::vector<Triangle> const& triangles, BvhBuildSettings const& settings = {});
+    // Same, over arbitrary primitives given by their bounds
+    void build(std::vector<AABB> const& prim_bounds, BvhBuildSettings const& settings = {});
+
+    // Updates the node bounds to moved primitives without touching the topology, for animated
+    // geometry. Falls back to a full build if the primitive count changed or the SAH cost grew past
+    // settings.max_sah_growth. Returns true if the hierarchy was rebuilt.
+    // Leaves are refit to whole primitives, so the clipped bounds of spatial splits are lost.
+    bool refit(std::vector<Triangle> const& triangles, std::vector<Sphere> const& spheres);
+    bool refit(std::vector<Triangle> const& triangles);
+
+    // Restructures the treelet of up to 7 leaves below every interior node into the topology with
+    // the lowest SAH cost, bottom up, passes times (Karras and Aila 2013, "Fast Parallel
+    // Construction of High-Quality Bounding Volume Hierarchies"). Leaves are kept as they are and
+    // no treelet grows past settings.max_depth. Ends with reorder_nodes(). build() calls it with
+    // settings.treelet_passes.
+    void optimize(uint32_t passes);
+    // Stores the top settings.hot_levels levels breadth first at the start of nodes, so the nodes
+    // every ray visits share a few cache lines, and each subtree below depth first. Both children
+    // of a node are always next to each other and after their parent. The root stays at 0 and is
+    // followed by BvhNode::padding(), so every left child is at an even index and shares a cache
+    // line with its sibling. The leaves reference primitive_indices in the same order.
+    void reorder_nodes();
+
+    // Expected cost of a random ray, normalized to the surface area of the root
+    float sah_cost() const;
+
+    BvhBuildSettings settings;
+    float build_sah_cost = 0.0f;
+    float initial_sah_cost = 0.0f;  // cost as built, before optimize()
+    uint32_t primitive_count = 0;  // primitives the hierarchy was built over
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> primitive_indices;
+
+private:
+    void build(std::vector<AABB> const& prim_bounds, BvhBuildSettings const& settings,
+               ThreadPool& pool);
+    void optimize(uint32_t passes, ThreadPool& pool);
+};
@@ -0,0 +1,186 @@
+#include "bvh_cache.h"
+
+#include <cstring>
+
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <utility>
+
+#include <fmt/core.h>
+
+#include "mapped_file.h"
+
+namespace
+{
+constexpr char CACHE_MAGIC[8] = {'R', 'V', 'P', 'T', 'B', 'V', 'H', '\0'};
+// bump whenever the layout of the file, Vertex, BvhNode or the builders change
+constexpr uint32_t CACHE_VERSION = 4;
+constexpr uint64_t HASH_PRIME = 0x100000001b3ull;
+
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t primitive_count;
+    uint64_t key;
+    uint64_t vertex_count;
+    uint64_t node_count;
+    uint64_t mesh_index_count;  // three per triangle
+    uint64_t index_count;  // entries of BVH::primitive_indices
+    float build_sah_cost;
+    int32_t material_id;
+};
+static_assert(sizeof(CacheHeader) % 16 == 0, "arrays after the header must stay aligned");
+
+size_t array_bytes(uint64_t count, size_t element_size)
+{
+    return static_cast<size_t>(count) * element_size;
+}
+
+template <typename T>
+void hash_value(uint64_t& hash, T const& value)
+{
+    hash = hash_bytes(&value, sizeof(T), hash);
+}
+}  // namespace
+
+uint64_t hash_bytes(void const* data, size_t size, uint64_t seed)
+{
+    auto bytes = static_cast<uint8_t const*>(data);
+    uint64_t hash = seed;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * HASH_PRIME;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++) hash = (hash ^ bytes[i]) * HASH_PRIME;
+    // final avalanche, so keys that differ in a few bits land in different entries
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+BvhCache::BvhCache(std::string directory) : directory(std::move(directory)) {}
+
+uint64_t BvhCache::make_key(uint64_t content_hash, BvhBuildSettings const& settings,
+                            uint64_t extra)
+{
+    // the fields are hashed one by one to stay clear of padding, thread_count and max_sah_growth
+    // do not change what build() produces
+    uint64_t key = content_hash;
+    hash_value(key, CACHE_VERSION);
+    hash_value(key, extra);
+    hash_value(key, settings.bin_count);
+    hash_value(key, settings.max_leaf_size);
+    hash_value(key, settings.max_depth);
+    hash_value(key, settings.traversal_cost);
+    hash_value(key, settings.intersection_cost);
+    hash_value(key, settings.quality);
+    hash_value(key, settings.spatial_split_budget);
+    hash_value(key, settings.spatial_split_alpha);
+    hash_value(key, settings.treelet_passes);
+    hash_value(key, settings.hot_levels);
+    return key;
+}
+
+std::string BvhCache::entry_path(uint64_t key) const
+{
+    return fmt::format("{}/{:016x}.bvh", directory, key);
+}
+
+bool BvhCache::load(uint64_t key, BvhBuildSettings const& settings, Mesh& mesh) const
+{
+    MappedFile file;
+    if (!file.open(entry_path(key))) return false;
+
+    CacheHeader header;
+    if (file.size() < sizeof(CacheHeader)) return false;
+    std::memcpy(&header, file.data(), sizeof(CacheHeader));
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header.version != CACHE_VERSION || header.key != key)
+        return false;
+
+    size_t vertex_bytes = array_bytes(header.vertex_count, sizeof(Vertex));
+    size_t node_bytes = array_bytes(header.node_count, sizeof(BvhNode));
+    size_t mesh_index_bytes = array_bytes(header.mesh_index_count, sizeof(uint32_t));
+    size_t index_bytes = array_bytes(header.index_count, sizeof(uint32_t));
+    if (file.size() !=
+        sizeof(CacheHeader) + vertex_bytes + node_bytes + mesh_index_bytes + index_bytes)
+    {
+        fmt::print("[{}: {}] ignoring truncated cache entry {}\n", "WARNING", "BVH-CACHE",
+                   entry_path(key));
+        return false;
+    }
+
+    // the arrays of 4 byte elements come last, so every array stays aligned to its element
+    uint8_t const* cursor = file.data() + sizeof(CacheHeader);
+    mesh.vertices.resize(header.vertex_count);
+    std::memcpy(mesh.vertices.data(), cursor, vertex_bytes);
+    cursor += vertex_bytes;
+
+    mesh.bvh.nodes.resize(header.node_count);
+    std::memcpy(mesh.bvh.nodes.data(), cursor, node_bytes);
+    cursor += node_bytes;
+
+    mesh.indices.resize(header.mesh_index_count);
+    std::memcpy(mesh.indices.data(), cursor, mesh_index_bytes);
+    cursor += mesh_index_bytes;
+
+    mesh.bvh.primitive_indices.resize(header.index_count);
+    std::memcpy(mesh.bvh.primitive_indices.data(), cursor, index_bytes);
+
+    mesh.bvh.settings = settings;
+    mesh.bvh.primitive_count = header.primitive_count;
+    mesh.bvh.build_sah_cost = header.build_sah_cost;
+    mesh.bvh.initial_sah_cost = header.build_sah_cost;
+    mesh.material_id = header.material_id;
+    return true;
+}
+
+bool BvhCache::store(uint64_t key, Mesh const& mesh) const
+{
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) return false;
+
+    CacheHeader header{};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.primitive_count = mesh.bvh.primitive_count;
+    header.key = key;
+    header.vertex_count = mesh.vertices.size();
+    header.node_count = mesh.bvh.nodes.size();
+    header.mesh_index_count = mesh.indices.size();
+    header.index_count = mesh.bvh.primitive_indices.size();
+    header.build_sah_cost = mesh.bvh.build_sah_cost;
+    header.material_id = mesh.material_id;
+
+    // written next to the entry and renamed, so a concurrent start never maps half a file
+    std::string path = entry_path(key);
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        auto write = [&](void const* data, size_t size) {
+            out.write(static_cast<char const*>(data), static_cast<std::streamsize>(size));
+        };
+        write(&header, sizeof(header));
+        write(mesh.vertices.data(), array_bytes(header.vertex_count, sizeof(Vertex)));
+        write(mesh.bvh.nodes.data(), array_bytes(header.node_count, sizeof(BvhNode)));
+        write(mesh.indices.data(), array_bytes(header.mesh_index_count, sizeof(uint32_t)));
+        write(mesh.bvh.primitive_indices.data(),
+              array_bytes(header.index_count, sizeof(uint32_t)));
+        if (!out) return false;
+    }
+    std::filesystem::rename(temp_path, path, error);
+    if (error)
+    {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+
+#include "bvh.h"
+#include "instancing.h"
+
+// 64 bit FNV-1a style hash that consumes 8 bytes per step, fast enough to hash source assets on
+// every start. Not meant to resist collisions on purpose.
+uint64_t hash_bytes(void const* data, size_t size, uint64_t seed = 0xcbf29ce484222325ull);
+
+// Directory of prebuilt meshes. An entry holds the vertices, indices and BVH of one mesh, keyed by
+// the hash of its source file and everything else that affects the result, so a changed asset or
+// build setting simply misses. Entries are memory mapped on load, which makes a hit cost about as
+// much as copying the buffers, no parsing and no build.
+class BvhCache
+{
+public:
+    explicit BvhCache(std::string directory);
+
+    // extra covers inputs that are baked into the mesh, e.g. the material id
+    static uint64_t make_key(uint64_t content_hash, BvhBuildSettings const& settings,
+                             uint64_t extra = 0);
+
+    // Fills mesh from the entry for key. Returns false on a miss or an unreadable entry.
+    bool load(uint64_t key, BvhBuildSettings const& settings, Mesh& mesh) const;
+    // Writes the entry for key, replacing an existing one. Returns false if it could not be
+    // written, the cache is only an optimization so callers are free to ignore that.
+    bool store(uint64_t key, Mesh const& mesh) const;
+
+    std::string entry_path(uint64_t key) const;
+
+private:
+    std::string directory;
+};
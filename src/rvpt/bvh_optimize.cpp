@@ -0,0 +1,282 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+
+#include "thread_pool.h"
+
+namespace
+{
+// leaves of a treelet, 7 is where Karras and Aila found the quality to level off
+constexpr uint32_t TREELET_LEAVES = 7;
+constexpr uint32_t TREELET_SUBSETS = 1u << TREELET_LEAVES;
+// subtrees rooted this deep are restructured by tasks of their own, the levels above by the caller
+constexpr uint32_t PARALLEL_DEPTH = 6;
+
+class TreeletOptimizer
+{
+public:
+    TreeletOptimizer(std::vector<BvhNode>& nodes, BvhBuildSettings const& settings,
+                     ThreadPool& pool)
+        : nodes(nodes), settings(settings), pool(pool), costs(nodes.size()), heights(nodes.size())
+    {
+    }
+
+    void run_pass()
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> frontier;
+        collect_frontier(0, 0, frontier);
+
+        ThreadPool::TaskGroup group;
+        for (auto [node, depth] : frontier)
+            pool.run(group, [this, node = node, depth = depth] {
+                optimize_subtree(node, depth, BVH_NONE);
+            });
+        pool.wait(group);
+
+        optimize_subtree(0, 0, PARALLEL_DEPTH);
+    }
+
+private:
+    std::vector<BvhNode>& nodes;
+    BvhBuildSettings const& settings;
+    ThreadPool& pool;
+    // SAH cost of every subtree without the normalization to the root area, and its height
+    std::vector<float> costs;
+    std::vector<uint32_t> heights;
+
+    void collect_frontier(uint32_t node, uint32_t depth,
+                          std::vector<std::pair<uint32_t, uint32_t>>& frontier) const
+    {
+        if (depth == PARALLEL_DEPTH || nodes[node].is_leaf())
+        {
+            frontier.emplace_back(node, depth);
+            return;
+        }
+        collect_frontier(nodes[node].left_or_first, depth + 1, frontier);
+        collect_frontier(nodes[node].right_or_count, depth + 1, frontier);
+    }
+
+    float area(uint32_t node) const { return nodes[node].bounds().surface_area(); }
+
+    // Restructures every treelet of the subtree bottom up, subtrees at stop_depth are already done
+    void optimize_subtree(uint32_t node, uint32_t depth, uint32_t stop_depth)
+    {
+        if (depth == stop_depth) return;
+        BvhNode const& current = nodes[node];
+        if (current.is_leaf())
+        {
+            costs[node] = settings.intersection_cost *
+                          static_cast<float>(current.primitive_count()) * area(node);
+            heights[node] = 0;
+            return;
+        }
+        optimize_subtree(current.left_or_first, depth + 1, stop_depth);
+        optimize_subtree(current.right_or_count, depth + 1, stop_depth);
+        update(node);
+        restructure(node, depth);
+    }
+
+    void update(uint32_t node)
+    {
+        uint32_t left = nodes[node].left_or_first;
+        uint32_t right = nodes[node].right_or_count;
+        costs[node] = settings.traversal_cost * area(node) + costs[left] + costs[right];
+        heights[node] = 1 + std::max(heights[left], heights[right]);
+    }
+
+    // Finds the topology of the treelet below root with the lowest SAH cost by dynamic programming
+    // over the subsets of its leaves and rebuilds the treelet with it, reusing its interior nodes
+    void restructure(uint32_t root, uint32_t depth)
+    {
+        // grow the treelet by opening the leaf with the largest surface area
+        std::array<uint32_t, TREELET_LEAVES> leaves;
+        std::array<uint32_t, TREELET_LEAVES - 1> interior;
+        uint32_t leaf_count = 2;
+        uint32_t interior_count = 0;
+        leaves[0] = nodes[root].left_or_first;
+        leaves[1] = nodes[root].right_or_count;
+        while (leaf_count < TREELET_LEAVES)
+        {
+            int largest = -1;
+            float largest_area = -1.0f;
+            for (uint32_t i = 0; i < leaf_count; i++)
+            {
+                if (nodes[leaves[i]].is_leaf() || area(leaves[i]) <= largest_area) continue;
+                largest = static_cast<int>(i);
+                largest_area = area(leaves[i]);
+            }
+            if (largest < 0) break;
+            uint32_t opened = leaves[largest];
+            interior[interior_count++] = opened;
+            leaves[largest] = nodes[opened].left_or_first;
+            leaves[leaf_count++] = nodes[opened].right_or_count;
+        }
+        // two leaves only have a single topology
+        if (leaf_count < 3) return;
+
+        uint32_t full = (1u << leaf_count) - 1;
+        std::array<AABB, TREELET_SUBSETS> bounds;
+        std::array<float, TREELET_SUBSETS> cost;
+        std::array<uint32_t, TREELET_SUBSETS> height;
+        std::array<uint32_t, TREELET_SUBSETS> split;
+        for (uint32_t subset = 1; subset <= full; subset++)
+        {
+            uint32_t lowest = subset & (~subset + 1);
+            auto leaf = static_cast<uint32_t>(std::bitset<32>(lowest - 1).count());
+            bounds[subset] = subset == lowest ? AABB{} : bounds[subset ^ lowest];
+            bounds[subset].expand(nodes[leaves[leaf]].bounds());
+            if (subset == lowest)
+            {
+                cost[subset] = costs[leaves[leaf]];
+                height[subset] = heights[leaves[leaf]];
+                continue;
+            }
+
+            // every partition once, the side holding the lowest leaf goes left
+            float best = std::numeric_limits<float>::max();
+            uint32_t rest = subset ^ lowest;
+            for (uint32_t part = rest;; part = (part - 1) & rest)
+            {
+                uint32_t left = part | lowest;
+                if (left != subset)
+                {
+                    float partition_cost = cost[left] + cost[subset ^ left];
+                    if (partition_cost < best)
+                    {
+                        best = partition_cost;
+                        split[subset] = left;
+                    }
+                }
+                if (part == 0) break;
+            }
+            cost[subset] = settings.traversal_cost * bounds[subset].surface_area() + best;
+            height[subset] = 1 + std::max(height[split[subset]], height[subset ^ split[subset]]);
+        }
+
+        // keep the old treelet unless the new one is measurably cheaper and within the depth limit
+        if (cost[full] >= costs[root] * (1.0f - 1e-5f) ||
+            depth + height[full] + 1 > settings.max_depth)
+            return;
+
+        uint32_t next_interior = 0;
+        rebuild(full, root, leaves, interior, next_interior, bounds, split);
+    }
+
+    uint32_t rebuild(uint32_t subset, uint32_t node,
+                     std::array<uint32_t, TREELET_LEAVES> const& leaves,
+                     std::array<uint32_t, TREELET_LEAVES - 1> const& interior,
+                     uint32_t& next_interior, std::array<AABB, TREELET_SUBSETS> const& bounds,
+                     std::array<uint32_t, TREELET_SUBSETS> const& split)
+    {
+        if ((subset & (subset - 1)) == 0) return leaves[std::bitset<32>(subset - 1).count()];
+
+        // single leaves are returned as they are, every other subset takes a free interior node
+        auto child = [&](uint32_t child_subset) {
+            uint32_t child_node =
+                (child_subset & (child_subset - 1)) != 0 ? interior[next_interior++] : BVH_NONE;
+            return rebuild(child_subset, child_node, leaves, interior, next_interior, bounds,
+                           split);
+        };
+        uint32_t left = child(split[subset]);
+        uint32_t right = child(subset ^ split[subset]);
+
+        nodes[node].aabb_min = bounds[subset].min;
+        nodes[node].aabb_max = bounds[subset].max;
+        nodes[node].left_or_first = left;
+        nodes[node].right_or_count = right;
+        update(node);
+        return node;
+    }
+};
+}  // namespace
+
+void BVH::optimize(uint32_t passes)
+{
+    ThreadPool pool(settings.thread_count);
+    optimize(passes, pool);
+}
+
+void BVH::optimize(uint32_t passes, ThreadPool& pool)
+{
+    initial_sah_cost = sah_cost();
+    if (passes > 0 && nodes.size() > 1)
+    {
+        TreeletOptimizer optimizer(nodes, settings, pool);
+        for (uint32_t pass = 0; pass < passes; pass++) optimizer.run_pass();
+    }
+    reorder_nodes();
+    build_sah_cost = sah_cost();
+}
+
+void BVH::reorder_nodes()
+{
+    if (nodes.size() <= 1) return;
+
+    std::vector<uint32_t> order;
+    order.reserve(nodes.size());
+    order.push_back(0);
+
+    // the top levels breadth first, both children of a node next to each other
+    size_t level_begin = 0;
+    for (uint32_t level = 0; level + 1 < settings.hot_levels; level++)
+    {
+        size_t level_end = order.size();
+        for (size_t i = level_begin; i < level_end; i++)
+        {
+            BvhNode const& node = nodes[order[i]];
+            if (node.is_leaf()) continue;
+            order.push_back(node.left_or_first);
+            order.push_back(node.right_or_count);
+        }
+        level_begin = level_end;
+    }
+
+    // every subtree below depth first, again with siblings side by side
+    size_t top_end = order.size();
+    std::vector<uint32_t> stack;
+    for (size_t i = level_begin; i < top_end; i++)
+    {
+        stack.push_back(order[i]);
+        while (!stack.empty())
+        {
+            BvhNode const& node = nodes[stack.back()];
+            stack.pop_back();
+            if (node.is_leaf()) continue;
+            order.push_back(node.left_or_first);
+            order.push_back(node.right_or_count);
+            stack.push_back(node.right_or_count);
+            stack.push_back(node.left_or_first);
+        }
+    }
+
+    // the padding after the root moves every pair to an even index
+    auto slot = [](uint32_t i) { return i == 0 ? 0 : i + 1; };
+    std::vector<uint32_t> new_index(nodes.size());
+    for (uint32_t i = 0; i < order.size(); i++) new_index[order[i]] = slot(i);
+
+    // the leaves are laid out in the same order, so neighbouring leaves read neighbouring indices
+    std::vector<BvhNode> reordered(order.size() + 1, BvhNode::padding());
+    std::vector<uint32_t> reordered_indices;
+    reordered_indices.reserve(primitive_indices.size());
+    for (uint32_t i = 0; i < order.size(); i++)
+    {
+        BvhNode node = nodes[order[i]];
+        if (node.is_leaf())
+        {
+            auto first = primitive_indices.begin() + node.left_or_first;
+            node.left_or_first = static_cast<uint32_t>(reordered_indices.size());
+            reordered_indices.insert(reordered_indices.end(), first,
+                                     first + node.primitive_count());
+        }
+        else
+        {
+            node.left_or_first = new_index[node.left_or_first];
+            node.right_or_count = new_index[node.right_or_count];
+        }
+        reordered[slot(i)] = node;
+    }
+    nodes = std::move(reordered);
+    primitive_indices = std::move(reordered_indices);
+}
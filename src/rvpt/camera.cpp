@@ -37,6 +37,12 @@ void Camera::rotate(glm::vec3 rotation)
     this->rotation += rotation;
     if (vertical_view_angle_clamp) this->rotation.y = glm::clamp(this->rotation.y, -90.f, 90.f);
 }
+void Camera::set_position(glm::vec3 position) { translation = position; }
+void Camera::set_rotation(glm::vec3 in_rotation)
+{
+    rotation = in_rotation;
+    if (vertical_view_angle_clamp) rotation.y = glm::clamp(rotation.y, -90.f, 90.f);
+}
 void Camera::set_fov(float in_fov) { fov = in_fov; }
 
 float Camera::get_fov() { return fov; }
@@ -16,6 +16,9 @@ public:
 
     void move(glm::vec3 translation);
     void rotate(glm::vec3 rotation);
+    // absolute, unlike move() and rotate(), e.g. for the camera of a scene description
+    void set_position(glm::vec3 position);
+    void set_rotation(glm::vec3 rotation);
 
     void set_fov(float fov);
     float get_fov();
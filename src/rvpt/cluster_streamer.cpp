@@ -0,0 +1,340 @@
+#include "cluster_streamer.h"
+
+#include <cassert>
+
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+
+#include <fmt/core.h>
+
+namespace
+{
+// Copies the subtree below root with the triangles and vertices it references, renumbered in the
+// order they are reached. Triangles referenced by several leaves after spatial splits are copied
+// once.
+Cluster extract_cluster(Mesh const& mesh, uint32_t root)
+{
+    Cluster cluster;
+    std::unordered_map<uint32_t, uint32_t> local_triangles;
+    std::unordered_map<uint32_t, uint32_t> local_vertices;
+    auto add_triangle = [&](uint32_t triangle) {
+        auto [it, inserted] = local_triangles.try_emplace(
+            triangle, static_cast<uint32_t>(cluster.triangle_count()));
+        if (!inserted) return it->second;
+        for (uint32_t corner = 0; corner < 3; corner++)
+        {
+            uint32_t vertex = mesh.indices[3 * triangle + corner];
+            auto [local, new_vertex] =
+                local_vertices.try_emplace(vertex, static_cast<uint32_t>(cluster.vertex_count()));
+            if (new_vertex)
+            {
+                if (mesh.quantized())
+                    cluster.quantized_vertices.push_back(mesh.quantized_vertices[vertex]);
+                else
+                    cluster.vertices.push_back(mesh.vertices[vertex]);
+            }
+            cluster.indices.push_back(local->second);
+        }
+        return it->second;
+    };
+
+    // depth first, both children are appended next to each other before either is visited. The
+    // padding after the root keeps the pairs at even indices, see BVH::reorder_nodes().
+    cluster.nodes.push_back(mesh.bvh.nodes[root]);
+    if (!mesh.bvh.nodes[root].is_leaf()) cluster.nodes.push_back(BvhNode::padding());
+    std::vector<std::pair<uint32_t, uint32_t>> stack = {{root, 0}};  // mesh node, cluster node
+    while (!stack.empty())
+    {
+        auto [source, target] = stack.back();
+        stack.pop_back();
+        BvhNode node = mesh.bvh.nodes[source];
+        if (node.is_leaf())
+        {
+            auto first = static_cast<uint32_t>(cluster.primitive_indices.size());
+            for (uint32_t i = 0; i < node.primitive_count(); i++)
+                cluster.primitive_indices.push_back(
+                    add_triangle(mesh.bvh.primitive_indices[node.left_or_first + i]));
+            node.left_or_first = first;
+        }
+        else
+        {
+            auto left = static_cast<uint32_t>(cluster.nodes.size());
+            cluster.nodes.push_back(mesh.bvh.nodes[node.left_or_first]);
+            cluster.nodes.push_back(mesh.bvh.nodes[node.right_or_count]);
+            stack.emplace_back(node.right_or_count, left + 1);
+            stack.emplace_back(node.left_or_first, left);
+            node.left_or_first = left;
+            node.right_or_count = left + 1;
+        }
+        cluster.nodes[target] = node;
+    }
+
+    cluster.parents = bvh_parents(cluster.nodes);
+    // quantized triangles are tested from their decoded vertices
+    if (!mesh.quantized())
+        cluster.triangle_hits = make_triangle_hits(cluster.vertices, cluster.indices);
+    return cluster;
+}
+}  // namespace
+
+size_t Cluster::memory() const
+{
+    return vertices.size() * sizeof(Vertex) + quantized_vertices.size() * sizeof(QuantizedVertex) +
+           indices.size() * sizeof(uint32_t) + triangle_hits.size() * sizeof(TriangleHit) +
+           nodes.size() * sizeof(BvhNode) +
+           (primitive_indices.size() + parents.size()) * sizeof(uint32_t);
+}
+
+std::vector<Cluster> make_clusters(Mesh const& mesh, uint32_t max_triangles)
+{
+    std::vector<Cluster> clusters;
+    auto const& nodes = mesh.bvh.nodes;
+    if (nodes.empty() || mesh.indices.empty()) return clusters;
+
+    // the subtree sizes, children come after their parent in preorder, so summing it backwards
+    // sees them first
+    std::vector<uint32_t> preorder;
+    std::vector<uint32_t> stack = {0};
+    while (!stack.empty())
+    {
+        uint32_t index = stack.back();
+        stack.pop_back();
+        preorder.push_back(index);
+        if (nodes[index].is_leaf()) continue;
+        stack.push_back(nodes[index].right_or_count);
+        stack.push_back(nodes[index].left_or_first);
+    }
+    std::vector<uint32_t> references(nodes.size(), 0);
+    for (auto it = preorder.rbegin(); it != preorder.rend(); ++it)
+    {
+        BvhNode const& node = nodes[*it];
+        references[*it] = node.is_leaf() ? node.primitive_count()
+                                         : references[node.left_or_first] +
+                                               references[node.right_or_count];
+    }
+
+    // left to right, so neighboring clusters of the mesh get neighboring ids
+    stack = {0};
+    while (!stack.empty())
+    {
+        uint32_t index = stack.back();
+        stack.pop_back();
+        if (nodes[index].is_leaf() || references[index] <= max_triangles)
+        {
+            clusters.push_back(extract_cluster(mesh, index));
+            continue;
+        }
+        stack.push_back(nodes[index].right_or_count);
+        stack.push_back(nodes[index].left_or_first);
+    }
+    return clusters;
+}
+
+void ClusterStreamer::add_meshes(std::vector<Mesh> const& new_meshes)
+{
+    ClusterSlotLayout grown = slot_layout;
+    for (size_t i = meshes.size(); i < new_meshes.size(); i++)
+    {
+        Mesh const& mesh = new_meshes[i];
+        assert(clusters.empty() || mesh.quantized() == quantized());
+        auto mesh_clusters = make_clusters(mesh, settings.cluster_triangles);
+        meshes.push_back(MeshClusters{static_cast<uint32_t>(clusters.size()),
+                                      static_cast<uint32_t>(mesh_clusters.size()),
+                                      mesh.material_id, mesh.quantization});
+        for (auto& cluster : mesh_clusters)
+        {
+            grown.vertices =
+                std::max(grown.vertices, static_cast<uint32_t>(cluster.vertex_count()));
+            grown.triangles =
+                std::max(grown.triangles, static_cast<uint32_t>(cluster.triangle_count()));
+            grown.nodes = std::max(grown.nodes, static_cast<uint32_t>(cluster.nodes.size()));
+            grown.primitive_indices = std::max(
+                grown.primitive_indices, static_cast<uint32_t>(cluster.primitive_indices.size()));
+            clusters.push_back(std::move(cluster));
+            cluster_slots.push_back(CLUSTER_NONE);
+        }
+    }
+
+    bool layout_grew = grown.vertices != slot_layout.vertices ||
+                       grown.triangles != slot_layout.triangles ||
+                       grown.nodes != slot_layout.nodes ||
+                       grown.primitive_indices != slot_layout.primitive_indices;
+    if (layout_grew || pool.size() != settings.pool_slots)
+    {
+        slot_layout = grown;
+        reset_pool();
+    }
+}
+
+void ClusterStreamer::set_instances(std::vector<MeshInstance> const& mesh_instances,
+                                    BvhBuildSettings const& bvh_settings)
+{
+    // a leaf per cluster of every instance, the rays of quantized meshes are moved straight onto
+    // their grid
+    struct ClusterPlacement
+    {
+        glm::mat4 transform;
+        uint32_t cluster;
+        int material;
+    };
+    std::vector<ClusterPlacement> placements;
+    std::vector<AABB> bounds;
+    for (auto const& instance : mesh_instances)
+    {
+        MeshClusters const& mesh = meshes.at(instance.mesh);
+        glm::mat4 transform = instance.transform * mesh.quantization;
+        int material =
+            instance.material_override >= 0 ? instance.material_override : mesh.material_id;
+        for (uint32_t i = 0; i < mesh.cluster_count; i++)
+        {
+            uint32_t cluster = mesh.first_cluster + i;
+            placements.push_back(ClusterPlacement{transform, cluster, material});
+            bounds.push_back(transform_bounds(clusters[cluster].nodes[0].bounds(), transform));
+        }
+    }
+    cluster_tlas.build(bounds, bvh_settings);
+
+    // ordered like the leaves, so they can reference the instances without an index buffer
+    cluster_instances.clear();
+    std::vector<uint32_t> instance_counts(clusters.size(), 0);
+    for (auto index : cluster_tlas.primitive_indices)
+    {
+        ClusterPlacement const& placement = placements[index];
+        uint32_t slot = cluster_slots[placement.cluster];
+        uint32_t root = slot == CLUSTER_NONE ? CLUSTER_NONE : slot * slot_layout.nodes;
+        cluster_instances.emplace_back(placement.transform, root, placement.material);
+        cluster_instances.back().cluster = placement.cluster;
+        instance_counts[placement.cluster]++;
+    }
+
+    instance_starts.assign(clusters.size() + 1, 0);
+    for (size_t c = 0; c < clusters.size(); c++)
+        instance_starts[c + 1] = instance_starts[c] + instance_counts[c];
+    instance_lists.resize(cluster_instances.size());
+    std::vector<uint32_t> filled(instance_starts.begin(), instance_starts.end() - 1);
+    for (uint32_t i = 0; i < cluster_instances.size(); i++)
+        instance_lists[filled[cluster_instances[i].cluster]++] = i;
+    generation++;
+}
+
+bool ClusterStreamer::update(uint32_t const* reached, size_t count)
+{
+    update_count++;
+    std::vector<uint32_t> missing;
+    count = std::min(count, clusters.size());
+    for (uint32_t cluster = 0; cluster < count; cluster++)
+    {
+        if (reached[cluster] == 0) continue;
+        if (cluster_slots[cluster] != CLUSTER_NONE)
+            last_used[cluster_slots[cluster]] = update_count;
+        else
+            missing.push_back(cluster);
+    }
+    if (missing.empty()) return false;
+
+    // free slots were never used, so they come first, then the least recently used ones. Slots
+    // reached by this frame are kept, the rays need them as much as the missing clusters.
+    std::vector<uint32_t> candidates;
+    for (uint32_t slot = 0; slot < pool.size(); slot++)
+        if (last_used[slot] != update_count) candidates.push_back(slot);
+    if (candidates.size() < missing.size() && !reported_overflow)
+    {
+        fmt::print("[{}: {}] a frame reaches more than the {} clusters of the pool, some stay "
+                   "missing\n",
+                   "WARNING", "STREAMING", pool.size());
+        reported_overflow = true;
+    }
+    size_t uploads = std::min({missing.size(), candidates.size(),
+                               static_cast<size_t>(settings.uploads_per_frame)});
+    if (uploads == 0) return false;
+    std::partial_sort(candidates.begin(), candidates.begin() + uploads, candidates.end(),
+                      [&](uint32_t a, uint32_t b) { return last_used[a] < last_used[b]; });
+
+    for (size_t i = 0; i < uploads; i++) assign(candidates[i], missing[i]);
+    generation++;
+    return true;
+}
+
+bool ClusterStreamer::quantized() const
+{
+    return !clusters.empty() && !clusters[0].quantized_vertices.empty();
+}
+
+size_t ClusterStreamer::geometry_memory() const
+{
+    size_t memory = 0;
+    for (auto const& cluster : clusters) memory += cluster.memory();
+    return memory;
+}
+
+size_t ClusterStreamer::resident_memory() const
+{
+    size_t memory = 0;
+    for (auto cluster : pool)
+        if (cluster != CLUSTER_NONE) memory += clusters[cluster].memory();
+    return memory;
+}
+
+ClusterSlotData ClusterStreamer::slot_data(uint32_t slot) const
+{
+    Cluster const& cluster = clusters[pool[slot]];
+    uint32_t vertex_base = slot * slot_layout.vertices;
+    uint32_t triangle_base = slot * slot_layout.triangles;
+    uint32_t node_base = slot * slot_layout.nodes;
+    uint32_t index_base = slot * slot_layout.primitive_indices;
+
+    ClusterSlotData data;
+    data.indices.reserve(cluster.indices.size());
+    for (auto index : cluster.indices) data.indices.push_back(index + vertex_base);
+    data.nodes = cluster.nodes;
+    for (auto& node : data.nodes)
+    {
+        if (node.is_leaf())
+        {
+            node.left_or_first += index_base;
+        }
+        else
+        {
+            node.left_or_first += node_base;
+            node.right_or_count += node_base;
+        }
+    }
+    data.primitive_indices.reserve(cluster.primitive_indices.size());
+    for (auto index : cluster.primitive_indices)
+        data.primitive_indices.push_back(index + triangle_base);
+    data.parents.reserve(cluster.parents.size());
+    for (auto parent : cluster.parents)
+        data.parents.push_back(parent == BVH_NONE ? BVH_NONE : parent + node_base);
+    return data;
+}
+
+void ClusterStreamer::reset_pool()
+{
+    pool.assign(settings.pool_slots, CLUSTER_NONE);
+    last_used.assign(settings.pool_slots, 0);
+    std::fill(cluster_slots.begin(), cluster_slots.end(), CLUSTER_NONE);
+    for (auto& instance : cluster_instances) instance.blas_root = CLUSTER_NONE;
+    layout_generation++;
+    generation++;
+}
+
+void ClusterStreamer::assign(uint32_t slot, uint32_t cluster)
+{
+    auto set_root = [&](uint32_t id, uint32_t root) {
+        // clusters added since the last set_instances() have no instances yet
+        if (id + 1 >= instance_starts.size()) return;
+        for (uint32_t i = instance_starts[id]; i < instance_starts[id + 1]; i++)
+            cluster_instances[instance_lists[i]].blas_root = root;
+    };
+    uint32_t evicted = pool[slot];
+    if (evicted != CLUSTER_NONE)
+    {
+        cluster_slots[evicted] = CLUSTER_NONE;
+        set_root(evicted, CLUSTER_NONE);
+    }
+    pool[slot] = cluster;
+    cluster_slots[cluster] = slot;
+    last_used[slot] = update_count;
+    set_root(cluster, slot * slot_layout.nodes);
+}
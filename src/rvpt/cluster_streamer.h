@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "geometry.h"
+#include "hit_geometry.h"
+#include "instancing.h"
+
+// Slot or cluster that is not there, the same value as BVH_NONE so a blas_root of it marks an
+// instance whose cluster is outside the pool
+const uint32_t CLUSTER_NONE = 0xFFFFFFFFu;
+
+struct ClusterStreamingSettings
+{
+    // triangle references per cluster at most, unless a single BVH leaf has more
+    uint32_t cluster_triangles = 4096;
+    // clusters the GPU pool holds, every slot has room for the largest cluster
+    uint32_t pool_slots = 256;
+    // clusters paged in per update() at most, bounds the time spent copying in one frame
+    uint32_t uploads_per_frame = 32;
+};
+
+// A subtree of a mesh BVH with the triangles and vertices its leaves reference, numbered from 0
+// so it can be copied into any slot of the pool. Either vertices or quantized_vertices is used,
+// like in Mesh.
+struct Cluster
+{
+    std::vector<Vertex> vertices;
+    std::vector<QuantizedVertex> quantized_vertices;
+    std::vector<uint32_t> indices;           // three per triangle, into the vertices
+    std::vector<TriangleHit> triangle_hits;  // empty for quantized meshes
+    std::vector<BvhNode> nodes;              // the root first
+    std::vector<uint32_t> primitive_indices;
+    std::vector<uint32_t> parents;
+
+    size_t vertex_count() const { return vertices.size() + quantized_vertices.size(); }
+    size_t triangle_count() const { return indices.size() / 3; }
+    size_t memory() const;
+};
+
+// Cuts the BVH of mesh into the largest subtrees with at most max_triangles triangle references,
+// so every cluster is a spatially compact piece of the mesh. Empty for a mesh without triangles.
+std::vector<Cluster> make_clusters(Mesh const& mesh, uint32_t max_triangles);
+
+// Room of every slot of the pool in elements of the mesh buffers, enough for the largest cluster
+struct ClusterSlotLayout
+{
+    uint32_t vertices = 1;
+    uint32_t triangles = 1;
+    uint32_t nodes = 1;
+    uint32_t primitive_indices = 1;
+};
+
+// The parts of a cluster that reference other elements, offset to its slot like InstanceBvh
+// offsets every mesh. Vertices and hit data are copied as they are.
+struct ClusterSlotData
+{
+    std::vector<uint32_t> indices;
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> primitive_indices;
+    std::vector<uint32_t> parents;
+};
+
+// Keeps the meshes as clusters in host memory and decides which of them live in a fixed pool of
+// GPU slots, for scenes whose geometry does not fit the GPU. The instance hierarchy has a leaf
+// for every cluster of every instance and is always complete, only the clusters are paged.
+//
+// The traversal flags every cluster it reaches. update() takes the flags of a finished frame:
+// reached clusters count as used, missing ones are paged into free slots or in place of the least
+// recently used ones. Until then the rays pass through them, so new geometry shows up a frame or
+// two after it is first seen.
+class ClusterStreamer
+{
+public:
+    ClusterStreamingSettings settings;
+
+    // Clusters the meshes from mesh_count() on, the ones before were added by an earlier call.
+    // The clusters keep their own copy, so the geometry of the meshes can be released afterwards.
+    // Either all meshes are quantized or none. If a cluster outgrows the slot layout, the layout
+    // grows and the pool is emptied.
+    void add_meshes(std::vector<Mesh> const& meshes);
+    // Rebuilds the instance hierarchy over every cluster of every instance
+    void set_instances(std::vector<MeshInstance> const& mesh_instances,
+                       BvhBuildSettings const& bvh_settings);
+
+    // Takes one flag per cluster of the traversal of a finished frame, fewer flags than clusters
+    // are fine. Returns whether clusters were paged in.
+    bool update(uint32_t const* reached, size_t count);
+
+    size_t mesh_count() const { return meshes.size(); }
+    size_t cluster_count() const { return clusters.size(); }
+    Cluster const& cluster(uint32_t id) const { return clusters[id]; }
+    bool quantized() const;
+    // Bytes of all clusters in host memory, and of the part of the GPU pool that holds clusters
+    size_t geometry_memory() const;
+    size_t resident_memory() const;
+
+    ClusterSlotLayout const& layout() const { return slot_layout; }
+    // cluster in every slot of the pool, CLUSTER_NONE for free slots
+    std::vector<uint32_t> const& slots() const { return pool; }
+    // the cluster of slot, offset to the slot
+    ClusterSlotData slot_data(uint32_t slot) const;
+    // bumped whenever the layout grows, the slots then have to be written again from scratch
+    uint32_t layout_version() const { return layout_generation; }
+    // bumped whenever the slots, the instances or the hierarchy change
+    uint32_t version() const { return generation; }
+
+    // leaves index instances directly, like InstanceBvh::tlas
+    BVH const& tlas() const { return cluster_tlas; }
+    // Instance::cluster is set, blas_root is CLUSTER_NONE while the cluster is outside the pool
+    std::vector<Instance> const& instances() const { return cluster_instances; }
+
+private:
+    struct MeshClusters
+    {
+        uint32_t first_cluster;
+        uint32_t cluster_count;
+        int material_id;
+        glm::mat4 quantization;
+    };
+
+    void reset_pool();
+    void assign(uint32_t slot, uint32_t cluster);
+
+    std::vector<MeshClusters> meshes;
+    std::vector<Cluster> clusters;
+    ClusterSlotLayout slot_layout;
+    uint32_t layout_generation = 0;
+    uint32_t generation = 0;
+
+    std::vector<uint32_t> pool;           // cluster per slot
+    std::vector<uint64_t> last_used;      // update() that last reached the cluster per slot
+    std::vector<uint32_t> cluster_slots;  // slot per cluster
+    uint64_t update_count = 0;
+    bool reported_overflow = false;
+
+    BVH cluster_tlas;
+    std::vector<Instance> cluster_instances;
+    // instances of every cluster, instance_lists[instance_starts[c]..instance_starts[c + 1]]
+    std::vector<uint32_t> instance_starts;
+    std::vector<uint32_t> instance_lists;
+};
@@ -33,3 +33,42 @@ struct Triangle
     glm::vec4 vertex2{};
     glm::vec4 material_id{};
 };
+
+// Vertex of an indexed mesh, laid out to match the Vertex struct in structs.glsl (32 bytes)
+struct Vertex
+{
+    glm::vec3 position{};
+    float u = 0.0f;
+    glm::vec3 normal{};
+    float v = 0.0f;
+};
+
+// Vertex of a quantized mesh, laid out to match the QuantizedVertex struct in structs.glsl
+// (16 bytes). The position is on a grid of 2^16 steps per axis over the bounds of the mesh, the
+// normal is octahedral with 16 bit snorm components and the uv are half floats.
+struct QuantizedVertex
+{
+    uint16_t position[3]{};
+    uint16_t padding = 0;
+    uint32_t normal = 0;
+    uint32_t uv = 0;
+};
+
+// Placement of a mesh in the scene, laid out to match the Instance struct in structs.glsl
+struct Instance
+{
+    explicit Instance(glm::mat4 const& transform, uint32_t blas_root, int material)
+        : blas_root(blas_root), material(material)
+    {
+        // the shaders take the rows of the 3x4 world to object transform
+        glm::mat4 inverse = glm::inverse(transform);
+        for (int row = 0; row < 3; row++)
+            world_to_object[row] =
+                glm::vec4(inverse[0][row], inverse[1][row], inverse[2][row], inverse[3][row]);
+    }
+    glm::vec4 world_to_object[3]{};
+    uint32_t blas_root = 0;
+    int32_t material = 0;  // of the mesh, unless the placement overrides it
+    uint32_t cluster = 0;  // of a streamed mesh, see ClusterStreamer
+    uint32_t padding = 0;
+};
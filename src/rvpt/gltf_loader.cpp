@@ -0,0 +1,462 @@
+#include "gltf_loader.h"
+
+#include <cstring>
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+
+#include "mapped_file.h"
+
+namespace
+{
+constexpr uint32_t GLB_MAGIC = 0x46546C67;  // "glTF"
+constexpr uint32_t GLB_VERSION = 2;
+constexpr uint32_t CHUNK_JSON = 0x4E4F534A;
+constexpr uint32_t CHUNK_BIN = 0x004E4942;
+
+constexpr int COMPONENT_BYTE = 5120;
+constexpr int COMPONENT_UNSIGNED_BYTE = 5121;
+constexpr int COMPONENT_SHORT = 5122;
+constexpr int COMPONENT_UNSIGNED_SHORT = 5123;
+constexpr int COMPONENT_UNSIGNED_INT = 5125;
+constexpr int COMPONENT_FLOAT = 5126;
+constexpr int MODE_TRIANGLES = 4;
+
+// nodes nested deeper are rejected, so the recursion over them is bounded
+constexpr int MAX_NODE_DEPTH = 256;
+
+using json = nlohmann::json;
+
+// invalid or unsupported content, reported by load_glb()
+struct GltfError : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+uint32_t read_u32(uint8_t const* data)
+{
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// Elements of an accessor in the binary chunk
+struct AccessorView
+{
+    uint8_t const* data = nullptr;
+    size_t count = 0;
+    size_t stride = 0;
+    int component_type = COMPONENT_FLOAT;
+    size_t components = 1;
+    bool normalized = false;
+
+    // component c of element i, converted like the spec says for normalized integers
+    float component(size_t i, size_t c) const
+    {
+        uint8_t const* p = data + i * stride;
+        switch (component_type)
+        {
+            case COMPONENT_BYTE:
+            {
+                auto value = static_cast<float>(reinterpret_cast<int8_t const*>(p)[c]);
+                return normalized ? std::max(value / 127.0f, -1.0f) : value;
+            }
+            case COMPONENT_UNSIGNED_BYTE:
+            {
+                auto value = static_cast<float>(p[c]);
+                return normalized ? value / 255.0f : value;
+            }
+            case COMPONENT_SHORT:
+            {
+                int16_t raw;
+                std::memcpy(&raw, p + 2 * c, sizeof(raw));
+                auto value = static_cast<float>(raw);
+                return normalized ? std::max(value / 32767.0f, -1.0f) : value;
+            }
+            case COMPONENT_UNSIGNED_SHORT:
+            {
+                uint16_t raw;
+                std::memcpy(&raw, p + 2 * c, sizeof(raw));
+                auto value = static_cast<float>(raw);
+                return normalized ? value / 65535.0f : value;
+            }
+            case COMPONENT_UNSIGNED_INT:
+                return static_cast<float>(read_u32(p + 4 * c));
+            default:
+            {
+                float value;
+                std::memcpy(&value, p + 4 * c, sizeof(value));
+                return value;
+            }
+        }
+    }
+
+    glm::vec3 vec3(size_t i) const
+    {
+        return glm::vec3(component(i, 0), component(i, 1), component(i, 2));
+    }
+
+    uint32_t index(size_t i) const
+    {
+        uint8_t const* p = data + i * stride;
+        if (component_type == COMPONENT_UNSIGNED_BYTE) return p[0];
+        if (component_type == COMPONENT_UNSIGNED_SHORT)
+        {
+            uint16_t value;
+            std::memcpy(&value, p, sizeof(value));
+            return value;
+        }
+        return read_u32(p);
+    }
+};
+
+size_t component_size(int component_type)
+{
+    switch (component_type)
+    {
+        case COMPONENT_BYTE:
+        case COMPONENT_UNSIGNED_BYTE:
+            return 1;
+        case COMPONENT_SHORT:
+        case COMPONENT_UNSIGNED_SHORT:
+            return 2;
+        case COMPONENT_UNSIGNED_INT:
+        case COMPONENT_FLOAT:
+            return 4;
+        default:
+            throw GltfError(fmt::format("unknown component type {}", component_type));
+    }
+}
+
+size_t component_count(std::string const& type)
+{
+    if (type == "SCALAR") return 1;
+    if (type == "VEC2") return 2;
+    if (type == "VEC3") return 3;
+    if (type == "VEC4") return 4;
+    throw GltfError(fmt::format("unsupported accessor type {}", type));
+}
+
+class GlbReader
+{
+public:
+    GlbReader(json const& document, uint8_t const* bin, size_t bin_size)
+        : document(document), bin(bin), bin_size(bin_size)
+    {
+    }
+
+    // Checks that the accessor lies inside of the binary chunk and has at least min_components
+    AccessorView accessor(size_t index, size_t min_components) const
+    {
+        json const& accessor = document.at("accessors").at(index);
+        if (accessor.contains("sparse"))
+            throw GltfError(fmt::format("accessor {} is sparse, which is not supported", index));
+        if (!accessor.contains("bufferView"))
+            throw GltfError(fmt::format("accessor {} has no buffer view", index));
+
+        AccessorView view;
+        view.count = accessor.at("count").get<size_t>();
+        view.component_type = accessor.at("componentType").get<int>();
+        view.components = component_count(accessor.at("type").get<std::string>());
+        view.normalized = accessor.value("normalized", false);
+        if (view.components < min_components)
+            throw GltfError(fmt::format("accessor {} has too few components", index));
+
+        json const& buffer_view =
+            document.at("bufferViews").at(accessor.at("bufferView").get<size_t>());
+        auto buffer = buffer_view.value("buffer", size_t{0});
+        if (buffer != 0 || document.at("buffers").at(0).contains("uri") || bin == nullptr)
+            throw GltfError("only the binary chunk of the .glb is supported as a buffer");
+
+        size_t element_size = component_size(view.component_type) * view.components;
+        auto view_offset = buffer_view.value("byteOffset", size_t{0});
+        auto view_length = buffer_view.at("byteLength").get<size_t>();
+        auto offset = accessor.value("byteOffset", size_t{0});
+        view.stride = buffer_view.value("byteStride", element_size);
+        if (view_offset > bin_size || view_length > bin_size - view_offset ||
+            (view.count > 0 && (offset > view_length || view.stride < element_size ||
+                                (view.count - 1) > (view_length - offset) / view.stride ||
+                                offset + (view.count - 1) * view.stride + element_size >
+                                    view_length)))
+            throw GltfError(
+                fmt::format("accessor {} reaches outside of its buffer view or the file", index));
+        view.data = bin + view_offset + offset;
+        return view;
+    }
+
+private:
+    json const& document;
+    uint8_t const* bin;
+    size_t bin_size;
+};
+
+Material make_material(json const& material)
+{
+    glm::vec4 albedo(1.0f, 1.0f, 1.0f, 1.5f);
+    glm::vec4 emission(0.0f);
+    float metallic = 1.0f;
+    float roughness = 1.0f;
+    float transmission = 0.0f;
+    if (material.contains("pbrMetallicRoughness"))
+    {
+        json const& pbr = material.at("pbrMetallicRoughness");
+        if (pbr.contains("baseColorFactor"))
+        {
+            auto factor = pbr.at("baseColorFactor").get<std::vector<float>>();
+            for (size_t i = 0; i < 3 && i < factor.size(); i++)
+                albedo[static_cast<int>(i)] = factor[i];
+        }
+        metallic = pbr.value("metallicFactor", 1.0f);
+        roughness = pbr.value("roughnessFactor", 1.0f);
+    }
+    float emissive_strength = 1.0f;
+    json const empty = json::object();
+    json const& extensions = material.contains("extensions") ? material.at("extensions") : empty;
+    if (extensions.contains("KHR_materials_emissive_strength"))
+        emissive_strength =
+            extensions.at("KHR_materials_emissive_strength").value("emissiveStrength", 1.0f);
+    if (material.contains("emissiveFactor"))
+    {
+        auto factor = material.at("emissiveFactor").get<std::vector<float>>();
+        for (size_t i = 0; i < 3 && i < factor.size(); i++)
+            emission[static_cast<int>(i)] = factor[i] * emissive_strength;
+    }
+    if (extensions.contains("KHR_materials_transmission"))
+        transmission =
+            extensions.at("KHR_materials_transmission").value("transmissionFactor", 0.0f);
+    // the dielectric reads its index of refraction from the alpha of the albedo
+    if (extensions.contains("KHR_materials_ior"))
+        albedo.w = extensions.at("KHR_materials_ior").value("ior", 1.5f);
+
+    Material::Type type = Material::Type::LAMBERT;
+    if (transmission >= 0.5f)
+        type = Material::Type::DIELECTRIC;
+    else if (metallic >= 0.5f && roughness < 0.5f)
+        type = Material::Type::MIRROR;
+    return Material(albedo, emission, type);
+}
+
+glm::mat4 node_transform(json const& node)
+{
+    if (node.contains("matrix"))
+    {
+        auto values = node.at("matrix").get<std::vector<float>>();
+        if (values.size() != 16) throw GltfError("node matrix without 16 values");
+        glm::mat4 matrix(1.0f);
+        for (int column = 0; column < 4; column++)
+            for (int row = 0; row < 4; row++)
+                matrix[column][row] = values[static_cast<size_t>(4 * column + row)];
+        return matrix;
+    }
+    std::vector<float> translation = node.value("translation", std::vector<float>{0, 0, 0});
+    std::vector<float> rotation = node.value("rotation", std::vector<float>{0, 0, 0, 1});
+    std::vector<float> scale = node.value("scale", std::vector<float>{1, 1, 1});
+    if (translation.size() != 3 || rotation.size() != 4 || scale.size() != 3)
+        throw GltfError("node with a malformed translation, rotation or scale");
+
+    // T * R * S, the rotation is a unit quaternion x, y, z, w
+    float x = rotation[0], y = rotation[1], z = rotation[2], w = rotation[3];
+    glm::mat4 matrix(1.0f);
+    matrix[0] = glm::vec4(1 - 2 * (y * y + z * z), 2 * (x * y + w * z), 2 * (x * z - w * y), 0) *
+                scale[0];
+    matrix[1] = glm::vec4(2 * (x * y - w * z), 1 - 2 * (x * x + z * z), 2 * (y * z + w * x), 0) *
+                scale[1];
+    matrix[2] = glm::vec4(2 * (x * z + w * y), 2 * (y * z - w * x), 1 - 2 * (x * x + y * y), 0) *
+                scale[2];
+    matrix[3] = glm::vec4(translation[0], translation[1], translation[2], 1);
+    return matrix;
+}
+
+// The indexed mesh of a triangle primitive, its material id is that of the file
+Mesh make_mesh(GlbReader const& reader, json const& primitive)
+{
+    json const& attributes = primitive.at("attributes");
+    if (!attributes.contains("POSITION")) throw GltfError("primitive without positions");
+    AccessorView positions = reader.accessor(attributes.at("POSITION").get<size_t>(), 3);
+
+    Mesh mesh;
+    mesh.vertices.resize(positions.count);
+    for (size_t i = 0; i < positions.count; i++) mesh.vertices[i].position = positions.vec3(i);
+    bool has_normals = attributes.contains("NORMAL");
+    if (has_normals)
+    {
+        AccessorView normals = reader.accessor(attributes.at("NORMAL").get<size_t>(), 3);
+        if (normals.count != positions.count) throw GltfError("normal count mismatch");
+        for (size_t i = 0; i < normals.count; i++) mesh.vertices[i].normal = normals.vec3(i);
+    }
+    if (attributes.contains("TEXCOORD_0"))
+    {
+        AccessorView uvs = reader.accessor(attributes.at("TEXCOORD_0").get<size_t>(), 2);
+        if (uvs.count != positions.count) throw GltfError("uv count mismatch");
+        for (size_t i = 0; i < uvs.count; i++)
+        {
+            mesh.vertices[i].u = uvs.component(i, 0);
+            mesh.vertices[i].v = uvs.component(i, 1);
+        }
+    }
+
+    if (primitive.contains("indices"))
+    {
+        AccessorView indices = reader.accessor(primitive.at("indices").get<size_t>(), 1);
+        if (indices.component_type != COMPONENT_UNSIGNED_BYTE &&
+            indices.component_type != COMPONENT_UNSIGNED_SHORT &&
+            indices.component_type != COMPONENT_UNSIGNED_INT)
+            throw GltfError("indices that are not unsigned integers");
+        mesh.indices.resize(indices.count - indices.count % 3);
+        for (size_t i = 0; i < mesh.indices.size(); i++)
+        {
+            mesh.indices[i] = indices.index(i);
+            if (mesh.indices[i] >= positions.count) throw GltfError("index past the vertices");
+        }
+    }
+    else
+    {
+        mesh.indices.resize(positions.count - positions.count % 3);
+        for (size_t i = 0; i < mesh.indices.size(); i++)
+            mesh.indices[i] = static_cast<uint32_t>(i);
+    }
+    if (!has_normals) mesh.compute_normals();
+    return mesh;
+}
+
+void add_node(json const& document, size_t node_index, glm::mat4 const& parent,
+              std::vector<std::vector<uint32_t>> const& mesh_primitives, SceneData& scene,
+              std::vector<bool>& on_path, int depth)
+{
+    if (depth > MAX_NODE_DEPTH) throw GltfError("node hierarchy is too deep");
+    json const& node = document.at("nodes").at(node_index);
+    // a node that is its own ancestor would be instanced forever
+    if (on_path.at(node_index)) throw GltfError("node hierarchy is cyclic");
+    on_path[node_index] = true;
+    glm::mat4 transform = parent * node_transform(node);
+    if (node.contains("mesh"))
+        for (uint32_t mesh : mesh_primitives.at(node.at("mesh").get<size_t>()))
+            scene.mesh_instances.push_back(MeshInstance{mesh, transform, -1});
+    if (node.contains("children"))
+        for (auto const& child : node.at("children"))
+            add_node(document, child.get<size_t>(), transform, mesh_primitives, scene, on_path,
+                     depth + 1);
+    on_path[node_index] = false;
+}
+}  // namespace
+
+bool load_glb(std::string const& path, SceneData& scene)
+{
+    MappedFile file;
+    if (!file.open(path))
+    {
+        fmt::print("[{}: {}] unable to open {}\n", "ERROR", "MODEL-LOADING", path);
+        return false;
+    }
+
+    // header, then a JSON chunk and an optional binary chunk, all lengths little endian
+    uint8_t const* data = file.data();
+    size_t size = file.size();
+    if (size < 20 || read_u32(data) != GLB_MAGIC || read_u32(data + 4) != GLB_VERSION ||
+        read_u32(data + 16) != CHUNK_JSON || read_u32(data + 12) > size - 20)
+    {
+        fmt::print("[{}: {}] {} is not a binary glTF 2.0 file\n", "ERROR", "MODEL-LOADING", path);
+        return false;
+    }
+    size_t json_size = read_u32(data + 12);
+    uint8_t const* json_data = data + 20;
+    uint8_t const* bin = nullptr;
+    size_t bin_size = 0;
+    size_t bin_header = 20 + ((json_size + 3) & ~size_t{3});
+    if (bin_header + 8 <= size && read_u32(data + bin_header + 4) == CHUNK_BIN)
+    {
+        bin = data + bin_header + 8;
+        bin_size = std::min<size_t>(read_u32(data + bin_header), size - bin_header - 8);
+    }
+
+    // appended at the end of scene, so nothing is added if the file turns out to be broken
+    SceneData loaded;
+    try
+    {
+        json document = json::parse(json_data, json_data + json_size);
+        GlbReader reader(document, bin, bin_size);
+
+        auto material_base = static_cast<int>(scene.materials.size());
+        if (document.contains("materials"))
+            for (auto const& material : document.at("materials"))
+                loaded.materials.push_back(make_material(material));
+        // for primitives without a material
+        int default_material = -1;
+
+        auto mesh_base = static_cast<uint32_t>(scene.meshes.size());
+        std::vector<std::vector<uint32_t>> mesh_primitives;
+        if (document.contains("meshes"))
+            for (auto const& gltf_mesh : document.at("meshes"))
+            {
+                mesh_primitives.emplace_back();
+                for (auto const& primitive : gltf_mesh.at("primitives"))
+                {
+                    if (primitive.value("mode", MODE_TRIANGLES) != MODE_TRIANGLES) continue;
+                    Mesh mesh = make_mesh(reader, primitive);
+                    if (mesh.indices.empty()) continue;
+                    if (primitive.contains("material"))
+                    {
+                        auto material = primitive.at("material").get<size_t>();
+                        if (material >= loaded.materials.size())
+                            throw GltfError("primitive with a missing material");
+                        mesh.material_id = material_base + static_cast<int>(material);
+                    }
+                    else
+                    {
+                        if (default_material < 0)
+                        {
+                            default_material =
+                                material_base + static_cast<int>(loaded.materials.size());
+                            loaded.materials.push_back(make_material(json::object()));
+                        }
+                        mesh.material_id = default_material;
+                    }
+                    mesh_primitives.back().push_back(
+                        mesh_base + static_cast<uint32_t>(loaded.meshes.size()));
+                    loaded.meshes.push_back(std::move(mesh));
+                }
+            }
+
+        // the default scene, or every node that is no child of another one
+        std::vector<size_t> roots;
+        if (document.contains("scenes") && !document.at("scenes").empty())
+        {
+            json const& gltf_scene = document.at("scenes").at(document.value("scene", size_t{0}));
+            if (gltf_scene.contains("nodes"))
+                for (auto const& node : gltf_scene.at("nodes")) roots.push_back(node.get<size_t>());
+        }
+        else if (document.contains("nodes"))
+        {
+            std::vector<bool> is_child(document.at("nodes").size(), false);
+            for (auto const& node : document.at("nodes"))
+                if (node.contains("children"))
+                    for (auto const& child : node.at("children"))
+                        is_child.at(child.get<size_t>()) = true;
+            for (size_t i = 0; i < is_child.size(); i++)
+                if (!is_child[i]) roots.push_back(i);
+        }
+        std::vector<bool> on_path(document.contains("nodes") ? document.at("nodes").size() : 0);
+        for (size_t root : roots)
+            add_node(document, root, glm::mat4(1.0f), mesh_primitives, loaded, on_path, 0);
+    }
+    catch (std::exception const& error)
+    {
+        fmt::print("[{}: {}] {}: {}\n", "ERROR", "MODEL-LOADING", path, error.what());
+        return false;
+    }
+
+    size_t triangle_count = 0;
+    for (auto const& mesh : loaded.meshes) triangle_count += mesh.triangle_count();
+    fmt::print("[{}: {}] {}: {} meshes with {} triangles, {} instances, {} materials\n", "INFO",
+               "MODEL-LOADING", path, loaded.meshes.size(), triangle_count,
+               loaded.mesh_instances.size(), loaded.materials.size());
+    scene.materials.insert(scene.materials.end(), loaded.materials.begin(), loaded.materials.end());
+    for (auto& mesh : loaded.meshes) scene.meshes.push_back(std::move(mesh));
+    scene.mesh_instances.insert(scene.mesh_instances.end(), loaded.mesh_instances.begin(),
+                                loaded.mesh_instances.end());
+    return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+
+#include "scene_file.h"
+
+// Adds the meshes, node placements and materials of a binary glTF 2.0 (.glb) file to scene.
+// The file is memory mapped and every accessor is read straight from the mapped binary chunk into
+// the vertices and indices of the meshes, whatever its component type and stride. Each triangle
+// primitive becomes a mesh of its own, as a mesh has a single material, and every node that
+// references a glTF mesh adds an instance of each of its primitives with the node's world
+// transform. The metallic-roughness factors map onto the closest material type: transmissive
+// materials become dielectrics with their KHR_materials_ior, smooth metals become mirrors and
+// everything else is lambert, textures are ignored. Normals are computed if a primitive has none.
+// The material ids are those of scene.materials, which the file appends to.
+// Returns false and prints the reason if the file is not a valid .glb or references buffers outside
+// of it.
+bool load_glb(std::string const& path, SceneData& scene);
@@ -0,0 +1,213 @@
+#include "gpu_bvh_builder.h"
+
+#include <algorithm>
+#include <string>
+
+#include "bvh.h"
+
+namespace
+{
+// must match lbvh.glsl
+constexpr uint32_t LBVH_GROUP_SIZE = 256;
+constexpr uint32_t LBVH_RADIX_BITS = 8;
+constexpr uint32_t LBVH_RADIX_SIZE = 1u << LBVH_RADIX_BITS;
+constexpr uint32_t MORTON_CODE_BITS = 30;
+
+struct LbvhParams
+{
+    uint32_t primitive_count;
+    uint32_t block_count;
+    uint32_t shift;
+    uint32_t triangle_count;
+};
+
+void compute_barrier(VkCommandBuffer command_buffer, VkPipelineStageFlags src_stage,
+                     VkAccessFlags src_access)
+{
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(command_buffer, src_stage, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK::FLAGS_NONE, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+}  // namespace
+
+GpuBvhBuilder::GpuBvhBuilder(VkDevice device, VK::PipelineBuilder& pipeline_builder,
+                             VK::MemoryAllocator& memory_allocator, uint32_t max_frames_in_flight)
+    : device(device),
+      pipeline_builder(pipeline_builder),
+      memory_allocator(memory_allocator),
+      pool(device,
+           {
+               {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+               {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+               {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+               {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+               {4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+               {5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+               {6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+               {7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+               {8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+               {9, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+               {10, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+           },
+           max_frames_in_flight * 2, "lbvh_descriptor_pool")
+{
+    pipeline_layout = pipeline_builder.create_layout(
+        {pool.layout()}, {{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(LbvhParams)}},
+        "lbvh_pipeline_layout");
+
+    auto create_pipeline = [&](std::string const& name) {
+        VK::ComputePipelineDetails details;
+        details.name = name + "_compute_pipeline";
+        details.pipeline_layout = pipeline_layout;
+        details.compute_shader = name + ".comp.spv";
+        return pipeline_builder.create_pipeline(details);
+    };
+    pipelines.centroid_bounds = create_pipeline("lbvh_centroid_bounds");
+    pipelines.morton = create_pipeline("lbvh_morton");
+    pipelines.radix_histogram = create_pipeline("lbvh_radix_histogram");
+    pipelines.radix_scan = create_pipeline("lbvh_radix_scan");
+    pipelines.radix_scatter = create_pipeline("lbvh_radix_scatter");
+    pipelines.hierarchy = create_pipeline("lbvh_hierarchy");
+    pipelines.fit_bounds = create_pipeline("lbvh_fit_bounds");
+}
+
+void GpuBvhBuilder::add_frame(VK::Buffer const& triangle_buffer, uint32_t triangle_count,
+                              VK::Buffer const& sphere_buffer, uint32_t sphere_count)
+{
+    std::string index = std::to_string(frames.size());
+    uint32_t primitive_count = triangle_count + sphere_count;
+    // keep every buffer non zero sized, even without primitives
+    VkDeviceSize count = std::max(primitive_count, 1u);
+    uint32_t block_count = std::max((primitive_count + LBVH_GROUP_SIZE - 1) / LBVH_GROUP_SIZE, 1u);
+
+    auto create_buffer = [&](std::string const& name, VkDeviceSize size) {
+        return VK::Buffer(device, memory_allocator, name + "_" + index,
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                          size, VK::MemoryUsage::gpu);
+    };
+
+    auto keys = create_buffer("lbvh_keys", sizeof(uint32_t) * count);
+    auto values = create_buffer("lbvh_values", sizeof(uint32_t) * count);
+    auto sort_keys = create_buffer("lbvh_sort_keys", sizeof(uint32_t) * count);
+    auto sort_values = create_buffer("lbvh_sort_values", sizeof(uint32_t) * count);
+    auto histogram =
+        create_buffer("lbvh_histogram", sizeof(uint32_t) * LBVH_RADIX_SIZE * block_count);
+    auto scene_bounds = create_buffer("lbvh_scene_bounds", sizeof(uint32_t) * 8);
+    auto nodes = create_buffer("lbvh_nodes", sizeof(BvhNode) * (2 * count - 1));
+    auto parents = create_buffer("lbvh_parents", sizeof(uint32_t) * (2 * count - 1));
+    auto visits = create_buffer("lbvh_visits", sizeof(uint32_t) * count);
+
+    auto descriptor_set = pool.allocate("lbvh_descriptor_set_" + index);
+    auto swapped_descriptor_set = pool.allocate("lbvh_swapped_descriptor_set_" + index);
+
+    auto make_descriptors = [&](VK::Buffer const& keys_in, VK::Buffer const& values_in,
+                                VK::Buffer const& keys_out, VK::Buffer const& values_out) {
+        std::vector<VK::DescriptorUseVector> descriptors;
+        descriptors.push_back(std::vector{triangle_buffer.descriptor_info()});
+        descriptors.push_back(std::vector{keys_in.descriptor_info()});
+        descriptors.push_back(std::vector{values_in.descriptor_info()});
+        descriptors.push_back(std::vector{keys_out.descriptor_info()});
+        descriptors.push_back(std::vector{values_out.descriptor_info()});
+        descriptors.push_back(std::vector{histogram.descriptor_info()});
+        descriptors.push_back(std::vector{scene_bounds.descriptor_info()});
+        descriptors.push_back(std::vector{nodes.descriptor_info()});
+        descriptors.push_back(std::vector{parents.descriptor_info()});
+        descriptors.push_back(std::vector{visits.descriptor_info()});
+        descriptors.push_back(std::vector{sphere_buffer.descriptor_info()});
+        return descriptors;
+    };
+    pool.update_descriptor_sets(descriptor_set,
+                                make_descriptors(keys, values, sort_keys, sort_values));
+    pool.update_descriptor_sets(swapped_descriptor_set,
+                                make_descriptors(sort_keys, sort_values, keys, values));
+
+    frames.push_back(Frame{primitive_count, triangle_count, block_count, std::move(keys),
+                           std::move(values), std::move(sort_keys), std::move(sort_values),
+                           std::move(histogram), std::move(scene_bounds), std::move(nodes),
+                           std::move(parents), std::move(visits), descriptor_set,
+                           swapped_descriptor_set});
+}
+
+void GpuBvhBuilder::record(VkCommandBuffer command_buffer, uint32_t frame_index)
+{
+    auto& frame = frames.at(frame_index);
+
+    if (frame.primitive_count == 0)
+    {
+        // same single empty leaf the CPU builder emits for an empty scene
+        vkCmdFillBuffer(command_buffer, frame.nodes.get(), 0, sizeof(BvhNode) - sizeof(uint32_t),
+                        0);
+        vkCmdFillBuffer(command_buffer, frame.nodes.get(), sizeof(BvhNode) - sizeof(uint32_t),
+                        sizeof(uint32_t), BVH_LEAF_BIT);
+        compute_barrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_ACCESS_TRANSFER_WRITE_BIT);
+        return;
+    }
+
+    // centroid bounds start out inverted, the visit counters at zero
+    vkCmdFillBuffer(command_buffer, frame.scene_bounds.get(), 0, sizeof(uint32_t) * 4,
+                    0xFFFFFFFFu);
+    vkCmdFillBuffer(command_buffer, frame.scene_bounds.get(), sizeof(uint32_t) * 4,
+                    sizeof(uint32_t) * 4, 0);
+    vkCmdFillBuffer(command_buffer, frame.visits.get(), 0, VK_WHOLE_SIZE, 0);
+    compute_barrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+    frame.descriptor_set.bind(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0);
+    push_params(command_buffer, frame, 0);
+    dispatch(command_buffer, pipelines.centroid_bounds, frame.block_count);
+    dispatch(command_buffer, pipelines.morton, frame.block_count);
+
+    // an even number of passes leaves the sorted keys and values where they started
+    for (uint32_t shift = 0; shift < MORTON_CODE_BITS; shift += LBVH_RADIX_BITS)
+    {
+        bool swapped = (shift / LBVH_RADIX_BITS) % 2 == 1;
+        auto& set = swapped ? frame.swapped_descriptor_set : frame.descriptor_set;
+        set.bind(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0);
+        push_params(command_buffer, frame, shift);
+        dispatch(command_buffer, pipelines.radix_histogram, frame.block_count);
+        dispatch(command_buffer, pipelines.radix_scan, 1);
+        dispatch(command_buffer, pipelines.radix_scatter, frame.block_count);
+    }
+
+    frame.descriptor_set.bind(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0);
+    push_params(command_buffer, frame, 0);
+    dispatch(command_buffer, pipelines.hierarchy, frame.block_count);
+    dispatch(command_buffer, pipelines.fit_bounds, frame.block_count);
+}
+
+VK::Buffer const& GpuBvhBuilder::node_buffer(uint32_t frame_index) const
+{
+    return frames.at(frame_index).nodes;
+}
+
+VK::Buffer const& GpuBvhBuilder::index_buffer(uint32_t frame_index) const
+{
+    return frames.at(frame_index).values;
+}
+
+VK::Buffer const& GpuBvhBuilder::parent_buffer(uint32_t frame_index) const
+{
+    return frames.at(frame_index).parents;
+}
+
+void GpuBvhBuilder::dispatch(VkCommandBuffer command_buffer, VK::ComputePipelineHandle pipeline,
+                             uint32_t group_count)
+{
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      pipeline_builder.get_pipeline(pipeline));
+    vkCmdDispatch(command_buffer, group_count, 1, 1);
+    // every pass consumes the output of the previous one
+    compute_barrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+void GpuBvhBuilder::push_params(VkCommandBuffer command_buffer, Frame const& frame,
+                                uint32_t shift)
+{
+    LbvhParams params{frame.primitive_count, frame.block_count, shift, frame.triangle_count};
+    vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(LbvhParams), &params);
+}
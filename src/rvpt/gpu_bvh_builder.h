@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+
+#include "vk_util.h"
+
+// Rebuilds the BVH over the triangle and sphere buffers with compute shaders (see lbvh.glsl), for
+// triangles that change every frame. The nodes and indices use the same layout as the CPU BVH so
+// the path tracer can bind either.
+class GpuBvhBuilder
+{
+public:
+    GpuBvhBuilder(VkDevice device, VK::PipelineBuilder& pipeline_builder,
+                  VK::MemoryAllocator& memory_allocator, uint32_t max_frames_in_flight);
+
+    // Creates the resources of one frame in flight, building over the first triangle_count
+    // triangles and sphere_count spheres
+    void add_frame(VK::Buffer const& triangle_buffer, uint32_t triangle_count,
+                   VK::Buffer const& sphere_buffer, uint32_t sphere_count);
+
+    // Records the build, afterwards the node and index buffers are ready for compute shaders
+    void record(VkCommandBuffer command_buffer, uint32_t frame_index);
+
+    VK::Buffer const& node_buffer(uint32_t frame_index) const;
+    VK::Buffer const& index_buffer(uint32_t frame_index) const;
+    // parent of every node, the root's entry is undefined
+    VK::Buffer const& parent_buffer(uint32_t frame_index) const;
+
+private:
+    struct Pipelines
+    {
+        VK::ComputePipelineHandle centroid_bounds;
+        VK::ComputePipelineHandle morton;
+        VK::ComputePipelineHandle radix_histogram;
+        VK::ComputePipelineHandle radix_scan;
+        VK::ComputePipelineHandle radix_scatter;
+        VK::ComputePipelineHandle hierarchy;
+        VK::ComputePipelineHandle fit_bounds;
+    };
+
+    struct Frame
+    {
+        uint32_t primitive_count;  // triangles followed by spheres
+        uint32_t triangle_count;
+        uint32_t block_count;
+
+        VK::Buffer keys;
+        VK::Buffer values;  // sorted primitive indices once the build is done
+        VK::Buffer sort_keys;
+        VK::Buffer sort_values;
+        VK::Buffer histogram;
+        VK::Buffer scene_bounds;
+        VK::Buffer nodes;
+        VK::Buffer parents;
+        VK::Buffer visits;
+
+        // the radix sort ping pongs between the two, the other passes only use the first
+        VK::DescriptorSet descriptor_set;
+        VK::DescriptorSet swapped_descriptor_set;
+    };
+
+    VkDevice device;
+    VK::PipelineBuilder& pipeline_builder;
+    VK::MemoryAllocator& memory_allocator;
+
+    VK::DescriptorPool pool;
+    VkPipelineLayout pipeline_layout;
+    Pipelines pipelines;
+
+    std::vector<Frame> frames;
+
+    void dispatch(VkCommandBuffer command_buffer, VK::ComputePipelineHandle pipeline,
+                  uint32_t group_count);
+    void push_params(VkCommandBuffer command_buffer, Frame const& frame, uint32_t shift);
+};
@@ -0,0 +1,164 @@
+#include "gpu_sphere_grid.h"
+
+#include <algorithm>
+#include <string>
+
+namespace
+{
+// must match sphere_grid.glsl
+constexpr uint32_t GRID_GROUP_SIZE = 256;
+// the setup pass aims for 2 cells per sphere, the rest is slack for the rounding of the resolution
+constexpr uint32_t GRID_CELL_CAPACITY_PER_SPHERE = 4;
+// cells are at least as large as the largest sphere, so a sphere overlaps 8 cells at most
+constexpr uint32_t GRID_MAX_CELLS_PER_SPHERE = 8;
+// bounds as ordered uints, origin, cell size, resolution and cell count
+constexpr VkDeviceSize GRID_HEADER_SIZE = sizeof(uint32_t) * 16;
+
+struct GridParams
+{
+    uint32_t sphere_count;
+    uint32_t block_count;
+    uint32_t cell_capacity;
+    uint32_t pad;
+};
+
+void compute_barrier(VkCommandBuffer command_buffer, VkPipelineStageFlags src_stage,
+                     VkAccessFlags src_access)
+{
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(command_buffer, src_stage, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK::FLAGS_NONE, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+}  // namespace
+
+GpuSphereGrid::GpuSphereGrid(VkDevice device, VK::PipelineBuilder& pipeline_builder,
+                             VK::MemoryAllocator& memory_allocator, uint32_t max_frames_in_flight)
+    : device(device),
+      pipeline_builder(pipeline_builder),
+      memory_allocator(memory_allocator),
+      pool(device,
+           {
+               {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+               {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+               {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+               {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+               {4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+           },
+           max_frames_in_flight, "sphere_grid_descriptor_pool")
+{
+    pipeline_layout = pipeline_builder.create_layout(
+        {pool.layout()}, {{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GridParams)}},
+        "sphere_grid_pipeline_layout");
+
+    auto create_pipeline = [&](std::string const& name) {
+        VK::ComputePipelineDetails details;
+        details.name = name + "_compute_pipeline";
+        details.pipeline_layout = pipeline_layout;
+        details.compute_shader = name + ".comp.spv";
+        return pipeline_builder.create_pipeline(details);
+    };
+    pipelines.bounds = create_pipeline("sphere_grid_bounds");
+    pipelines.setup = create_pipeline("sphere_grid_setup");
+    pipelines.count = create_pipeline("sphere_grid_count");
+    pipelines.scan = create_pipeline("sphere_grid_scan");
+    pipelines.scatter = create_pipeline("sphere_grid_scatter");
+}
+
+void GpuSphereGrid::add_frame(VK::Buffer const& sphere_buffer, uint32_t sphere_count)
+{
+    std::string index = std::to_string(frames.size());
+    // keep every buffer non zero sized, even without spheres
+    VkDeviceSize count = std::max(sphere_count, 1u);
+    uint32_t block_count = std::max((sphere_count + GRID_GROUP_SIZE - 1) / GRID_GROUP_SIZE, 1u);
+    uint32_t cell_capacity = GRID_CELL_CAPACITY_PER_SPHERE * static_cast<uint32_t>(count);
+
+    auto create_buffer = [&](std::string const& name, VkDeviceSize size) {
+        return VK::Buffer(device, memory_allocator, name + "_" + index,
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                          size, VK::MemoryUsage::gpu);
+    };
+
+    auto grid = create_buffer("sphere_grid_header", GRID_HEADER_SIZE);
+    auto starts = create_buffer("sphere_grid_starts", sizeof(uint32_t) * cell_capacity);
+    auto counts = create_buffer("sphere_grid_counts", sizeof(uint32_t) * cell_capacity);
+    auto references = create_buffer("sphere_grid_references",
+                                     sizeof(uint32_t) * GRID_MAX_CELLS_PER_SPHERE * count);
+
+    auto descriptor_set = pool.allocate("sphere_grid_descriptor_set_" + index);
+    std::vector<VK::DescriptorUseVector> descriptors;
+    descriptors.push_back(std::vector{sphere_buffer.descriptor_info()});
+    descriptors.push_back(std::vector{grid.descriptor_info()});
+    descriptors.push_back(std::vector{starts.descriptor_info()});
+    descriptors.push_back(std::vector{counts.descriptor_info()});
+    descriptors.push_back(std::vector{references.descriptor_info()});
+    pool.update_descriptor_sets(descriptor_set, descriptors);
+
+    frames.push_back(Frame{sphere_count, block_count, cell_capacity, std::move(grid),
+                           std::move(starts), std::move(counts), std::move(references),
+                           descriptor_set});
+}
+
+void GpuSphereGrid::record(VkCommandBuffer command_buffer, uint32_t frame_index)
+{
+    auto& frame = frames.at(frame_index);
+
+    if (frame.sphere_count == 0)
+    {
+        // a cell count of 0 tells the path tracer to skip the grid
+        vkCmdFillBuffer(command_buffer, frame.grid.get(), 0, VK_WHOLE_SIZE, 0);
+        compute_barrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_ACCESS_TRANSFER_WRITE_BIT);
+        return;
+    }
+
+    // bounds start out inverted, the counts at zero
+    vkCmdFillBuffer(command_buffer, frame.grid.get(), 0, sizeof(uint32_t) * 4, 0xFFFFFFFFu);
+    vkCmdFillBuffer(command_buffer, frame.grid.get(), sizeof(uint32_t) * 4, sizeof(uint32_t) * 4,
+                    0);
+    vkCmdFillBuffer(command_buffer, frame.counts.get(), 0, VK_WHOLE_SIZE, 0);
+    compute_barrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+    frame.descriptor_set.bind(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0);
+    GridParams params{frame.sphere_count, frame.block_count, frame.cell_capacity, 0};
+    vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(GridParams), &params);
+    dispatch(command_buffer, pipelines.bounds, frame.block_count);
+    dispatch(command_buffer, pipelines.setup, 1);
+    dispatch(command_buffer, pipelines.count, frame.block_count);
+    dispatch(command_buffer, pipelines.scan, 1);
+    dispatch(command_buffer, pipelines.scatter, frame.block_count);
+}
+
+VK::Buffer const& GpuSphereGrid::grid_buffer(uint32_t frame_index) const
+{
+    return frames.at(frame_index).grid;
+}
+
+VK::Buffer const& GpuSphereGrid::start_buffer(uint32_t frame_index) const
+{
+    return frames.at(frame_index).starts;
+}
+
+VK::Buffer const& GpuSphereGrid::count_buffer(uint32_t frame_index) const
+{
+    return frames.at(frame_index).counts;
+}
+
+VK::Buffer const& GpuSphereGrid::reference_buffer(uint32_t frame_index) const
+{
+    return frames.at(frame_index).references;
+}
+
+void GpuSphereGrid::dispatch(VkCommandBuffer command_buffer, VK::ComputePipelineHandle pipeline,
+                             uint32_t group_count)
+{
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      pipeline_builder.get_pipeline(pipeline));
+    vkCmdDispatch(command_buffer, group_count, 1, 1);
+    // every pass consumes the output of the previous one
+    compute_barrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_WRITE_BIT);
+}
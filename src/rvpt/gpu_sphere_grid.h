@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+
+#include "vk_util.h"
+
+// Sorts the spheres into a uniform grid with compute shaders (see sphere_grid.glsl), an
+// alternative to the BVH for scenes of many similar sized spheres, e.g. particle data. The grid is
+// rebuilt from the sphere buffer every time it is recorded, so moving spheres need no extra work.
+class GpuSphereGrid
+{
+public:
+    GpuSphereGrid(VkDevice device, VK::PipelineBuilder& pipeline_builder,
+                  VK::MemoryAllocator& memory_allocator, uint32_t max_frames_in_flight);
+
+    // Creates the resources of one frame in flight, gridding the first sphere_count spheres
+    void add_frame(VK::Buffer const& sphere_buffer, uint32_t sphere_count);
+
+    // Records the build, afterwards the grid buffers are ready for compute shaders
+    void record(VkCommandBuffer command_buffer, uint32_t frame_index);
+
+    // SphereGrid header: bounds, origin, cell size and resolution
+    VK::Buffer const& grid_buffer(uint32_t frame_index) const;
+    // first reference of every cell
+    VK::Buffer const& start_buffer(uint32_t frame_index) const;
+    // references of every cell
+    VK::Buffer const& count_buffer(uint32_t frame_index) const;
+    // sphere indices in cell order
+    VK::Buffer const& reference_buffer(uint32_t frame_index) const;
+
+private:
+    struct Pipelines
+    {
+        VK::ComputePipelineHandle bounds;
+        VK::ComputePipelineHandle setup;
+        VK::ComputePipelineHandle count;
+        VK::ComputePipelineHandle scan;
+        VK::ComputePipelineHandle scatter;
+    };
+
+    struct Frame
+    {
+        uint32_t sphere_count;
+        uint32_t block_count;
+        uint32_t cell_capacity;
+
+        VK::Buffer grid;
+        VK::Buffer starts;
+        VK::Buffer counts;
+        VK::Buffer references;
+
+        VK::DescriptorSet descriptor_set;
+    };
+
+    VkDevice device;
+    VK::PipelineBuilder& pipeline_builder;
+    VK::MemoryAllocator& memory_allocator;
+
+    VK::DescriptorPool pool;
+    VkPipelineLayout pipeline_layout;
+    Pipelines pipelines;
+
+    std::vector<Frame> frames;
+
+    void dispatch(VkCommandBuffer command_buffer, VK::ComputePipelineHandle pipeline,
+                  uint32_t group_count);
+};
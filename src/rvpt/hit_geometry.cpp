@@ -0,0 +1,65 @@
+#include "hit_geometry.h"
+
+#include <cmath>
+
+TriangleHit make_triangle_hit(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2)
+{
+    // the unit triangle maps to world space by the columns (e0, e1, n) and the translation v0.
+    // With n the unnormalized face normal the determinant is dot(n, n) and the rows of the
+    // inverse are cross products, no general 3x3 inverse needed
+    glm::vec3 e0 = v1 - v0;
+    glm::vec3 e1 = v2 - v0;
+    glm::vec3 n = glm::cross(e0, e1);
+    float det = glm::dot(n, n);
+
+    TriangleHit hit;
+    if (!(det > 0.0f) || !std::isfinite(1.0f / det))
+    {
+        // z is 1 along every ray, its plane is never crossed
+        hit.rows[2] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        return hit;
+    }
+    float inv_det = 1.0f / det;
+    glm::vec3 row0 = glm::cross(e1, n) * inv_det;
+    glm::vec3 row1 = glm::cross(n, e0) * inv_det;
+    glm::vec3 row2 = n * inv_det;
+    hit.rows[0] = glm::vec4(row0, -glm::dot(row0, v0));
+    hit.rows[1] = glm::vec4(row1, -glm::dot(row1, v0));
+    hit.rows[2] = glm::vec4(row2, -glm::dot(row2, v0));
+    return hit;
+}
+
+SphereHit make_sphere_hit(Sphere const& sphere)
+{
+    return SphereHit{sphere.origin, 1.0f / sphere.radius};
+}
+
+std::vector<TriangleHit> make_triangle_hits(std::vector<Triangle> const& triangles)
+{
+    std::vector<TriangleHit> hits;
+    hits.reserve(triangles.size());
+    for (auto const& tri : triangles)
+        hits.push_back(make_triangle_hit(glm::vec3(tri.vertex0), glm::vec3(tri.vertex1),
+                                         glm::vec3(tri.vertex2)));
+    return hits;
+}
+
+std::vector<TriangleHit> make_triangle_hits(std::vector<Vertex> const& vertices,
+                                            std::vector<uint32_t> const& indices)
+{
+    std::vector<TriangleHit> hits;
+    hits.reserve(indices.size() / 3);
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        hits.push_back(make_triangle_hit(vertices[indices[i]].position,
+                                         vertices[indices[i + 1]].position,
+                                         vertices[indices[i + 2]].position));
+    return hits;
+}
+
+std::vector<SphereHit> make_sphere_hits(std::vector<Sphere> const& spheres)
+{
+    std::vector<SphereHit> hits;
+    hits.reserve(spheres.size());
+    for (auto const& sphere : spheres) hits.push_back(make_sphere_hit(sphere));
+    return hits;
+}
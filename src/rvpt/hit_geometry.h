@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "geometry.h"
+
+// Triangle in the form the hit tests read, laid out to match the TriangleHit struct in structs.glsl
+// (48 bytes). The rows of the affine transform from world space into the space of the unit
+// triangle (0,0,0), (1,0,0), (0,1,0) (Woop et al. 2004, "RPU: A Programmable Ray Processing Unit
+// for Realtime Ray Tracing"). A ray in that space hits the plane where z is 0, x and y of the hit
+// are the barycentric coordinates, and t is the same as along the untransformed ray.
+struct TriangleHit
+{
+    glm::vec4 rows[3]{};
+};
+
+// Sphere in the form the hit tests read, laid out to match the SphereHit struct in structs.glsl
+// (16 bytes). The ray is scaled into the space of the unit sphere with a multiplication.
+struct SphereHit
+{
+    glm::vec3 center{};
+    float inv_radius = 0.0f;
+};
+
+// A degenerate triangle gets a transform that no ray hits
+TriangleHit make_triangle_hit(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2);
+SphereHit make_sphere_hit(Sphere const& sphere);
+
+std::vector<TriangleHit> make_triangle_hits(std::vector<Triangle> const& triangles);
+// Of indexed triangles, three indices per triangle
+std::vector<TriangleHit> make_triangle_hits(std::vector<Vertex> const& vertices,
+                                            std::vector<uint32_t> const& indices);
+std::vector<SphereHit> make_sphere_hits(std::vector<Sphere> const& spheres);
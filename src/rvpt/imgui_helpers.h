@@ -1,28 +1,42 @@
 #pragma once
 
+#include <cstdint>
+
 #include <string>
 
 #include <imgui.h>
 
+// disabled_modes has the bit of every mode that is shown grayed out and cannot be chosen
 template <std::size_t count>
 inline void dropdown_helper(const char* unique_identifier, int& cur_mode,
-                            const char* (&mode_names)[count])
+                            const char* (&mode_names)[count], uint32_t disabled_modes = 0)
 {
     ImGuiStyle& style = ImGui::GetStyle();
     float w = ImGui::CalcItemWidth();
     float spacing = style.ItemInnerSpacing.x;
     float button_sz = ImGui::GetFrameHeight();
+    auto enabled = [disabled_modes](int mode) { return (disabled_modes & (1u << mode)) == 0; };
 
     std::string left_arrow_name = std::string("##") + unique_identifier + "_l_arrow";
     if (ImGui::ArrowButton(left_arrow_name.c_str(), ImGuiDir_Left))
     {
-        cur_mode = (cur_mode - 1 + count) % count;
+        int mode = cur_mode;
+        do
+        {
+            mode = static_cast<int>((mode - 1 + count) % count);
+        } while (!enabled(mode) && mode != cur_mode);
+        cur_mode = mode;
     }
     ImGui::SameLine(0, style.ItemInnerSpacing.x);
     std::string right_arrow_name = std::string("##") + unique_identifier + "_r_arrow";
     if (ImGui::ArrowButton(right_arrow_name.c_str(), ImGuiDir_Right))
     {
-        cur_mode = (cur_mode + 1 + count) % count;
+        int mode = cur_mode;
+        do
+        {
+            mode = static_cast<int>((mode + 1 + count) % count);
+        } while (!enabled(mode) && mode != cur_mode);
+        cur_mode = mode;
     }
     ImGui::SameLine(0, style.ItemInnerSpacing.x);
     std::string custom_combo_name = std::string("##") + unique_identifier + "_custom_combo";
@@ -32,7 +46,8 @@ inline void dropdown_helper(const char* unique_identifier, int& cur_mode,
         for (int n = 0; n < count; n++)
         {
             bool is_selected = (mode_names[cur_mode] == mode_names[n]);
-            if (ImGui::Selectable(mode_names[n], is_selected))
+            if (ImGui::Selectable(mode_names[n], is_selected,
+                                  enabled(n) ? 0 : ImGuiSelectableFlags_Disabled))
             {
                 cur_mode = n;
             }
@@ -0,0 +1,256 @@
+#include "instancing.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace
+{
+// Corner of a triangle, two corners share a vertex if their positions and normals are equal
+struct Corner
+{
+    glm::vec3 position;
+    glm::vec3 normal;
+
+    bool operator==(Corner const& other) const
+    {
+        return position == other.position && normal == other.normal;
+    }
+};
+
+struct CornerHash
+{
+    size_t operator()(Corner const& corner) const
+    {
+        uint32_t bits[6];
+        std::memcpy(bits, &corner, sizeof(bits));
+        size_t hash = 0;
+        for (uint32_t word : bits) hash = (hash ^ word) * 0x100000001b3ull;
+        return hash;
+    }
+};
+
+// steps of the quantization grid per axis
+constexpr float QUANTIZATION_STEPS = 65535.0f;
+
+float sign_not_zero(float x) { return x >= 0.0f ? 1.0f : -1.0f; }
+
+// Unit vector to 2 snorm16 components on the octahedron folded into the unit square, decoded by
+// decode_octahedral in intersection.glsl
+uint32_t encode_octahedral(glm::vec3 n)
+{
+    float length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (length == 0.0f) return glm::packSnorm2x16(glm::vec2(0.0f));
+    n /= length;
+    glm::vec2 e(n.x, n.y);
+    if (n.z < 0.0f)
+        e = glm::vec2((1.0f - std::abs(n.y)) * sign_not_zero(n.x),
+                      (1.0f - std::abs(n.x)) * sign_not_zero(n.y));
+    return glm::packSnorm2x16(e);
+}
+}  // namespace
+
+std::vector<Triangle> Mesh::triangles() const
+{
+    assert(!quantized());
+    std::vector<Triangle> result;
+    result.reserve(triangle_count());
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        result.emplace_back(vertices[indices[i]].position, vertices[indices[i + 1]].position,
+                            vertices[indices[i + 2]].position, material_id);
+    return result;
+}
+
+void Mesh::compute_normals()
+{
+    for (auto& vertex : vertices) vertex.normal = glm::vec3(0.0f);
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        Vertex& a = vertices[indices[i]];
+        Vertex& b = vertices[indices[i + 1]];
+        Vertex& c = vertices[indices[i + 2]];
+        // the length of the cross product is twice the area
+        glm::vec3 normal = glm::cross(b.position - a.position, c.position - a.position);
+        a.normal += normal;
+        b.normal += normal;
+        c.normal += normal;
+    }
+    for (auto& vertex : vertices)
+        if (glm::dot(vertex.normal, vertex.normal) > 0.0f)
+            vertex.normal = glm::normalize(vertex.normal);
+}
+
+void Mesh::quantize()
+{
+    if (quantized() || vertices.empty()) return;
+
+    AABB bounds;
+    for (auto const& vertex : vertices) bounds.expand(vertex.position);
+    // a flat mesh still needs an invertible grid
+    glm::vec3 step = glm::max(bounds.extent(), glm::vec3(1e-6f)) / QUANTIZATION_STEPS;
+    auto to_grid = [&](glm::vec3 p) { return (p - bounds.min) / step; };
+
+    quantized_vertices.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        Vertex const& vertex = vertices[i];
+        QuantizedVertex& quantized = quantized_vertices[i];
+        glm::vec3 grid = glm::clamp(glm::round(to_grid(vertex.position)), glm::vec3(0.0f),
+                                    glm::vec3(QUANTIZATION_STEPS));
+        for (int axis = 0; axis < 3; axis++)
+            quantized.position[axis] = static_cast<uint16_t>(grid[axis]);
+        // the instance transforms normals with the inverse transpose of quantization as well, so
+        // they are stored scaled by its transpose to come out unchanged
+        quantized.normal = encode_octahedral(vertex.normal * step);
+        quantized.uv = glm::packHalf2x16(glm::vec2(vertex.u, vertex.v));
+    }
+
+    // rounding moves every point of a triangle by at most half a step per axis, the boxes grow
+    // by that and are rounded outwards to whole steps
+    for (auto& node : bvh.nodes)
+    {
+        node.aabb_min = glm::max(glm::floor(to_grid(node.aabb_min) - 0.5f), glm::vec3(0.0f));
+        node.aabb_max = glm::min(glm::ceil(to_grid(node.aabb_max) + 0.5f),
+                                 glm::vec3(QUANTIZATION_STEPS));
+    }
+
+    quantization = glm::mat4(1.0f);
+    quantization[0][0] = step.x;
+    quantization[1][1] = step.y;
+    quantization[2][2] = step.z;
+    quantization[3] = glm::vec4(bounds.min, 1.0f);
+
+    vertices.clear();
+    vertices.shrink_to_fit();
+}
+
+AABB transform_bounds(AABB const& bounds, glm::mat4 const& transform)
+{
+    if (bounds.empty()) return bounds;
+
+    AABB result;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::vec3 point{corner & 1 ? bounds.max.x : bounds.min.x,
+                        corner & 2 ? bounds.max.y : bounds.min.y,
+                        corner & 4 ? bounds.max.z : bounds.min.z};
+        result.expand(glm::vec3(transform * glm::vec4(point, 1.0f)));
+    }
+    return result;
+}
+
+Mesh make_mesh(std::vector<Triangle> const& triangles)
+{
+    Mesh mesh;
+    if (!triangles.empty()) mesh.material_id = static_cast<int>(triangles[0].material_id.x);
+
+    std::unordered_map<Corner, uint32_t, CornerHash> shared;
+    mesh.indices.reserve(3 * triangles.size());
+    for (auto const& triangle : triangles)
+    {
+        glm::vec3 normal{triangle.vertex0.w, triangle.vertex1.w, triangle.vertex2.w};
+        for (glm::vec4 const& corner : {triangle.vertex0, triangle.vertex1, triangle.vertex2})
+        {
+            auto [it, inserted] = shared.try_emplace(Corner{glm::vec3(corner), normal},
+                                                     static_cast<uint32_t>(mesh.vertices.size()));
+            if (inserted)
+            {
+                Vertex vertex;
+                vertex.position = glm::vec3(corner);
+                vertex.normal = normal;
+                mesh.vertices.push_back(vertex);
+            }
+            mesh.indices.push_back(it->second);
+        }
+    }
+    return mesh;
+}
+
+void InstanceBvh::build(std::vector<Mesh> const& meshes,
+                        std::vector<MeshInstance> const& mesh_instances,
+                        BvhBuildSettings const& settings)
+{
+    mesh_vertices.clear();
+    mesh_quantized_vertices.clear();
+    mesh_indices.clear();
+    blas_nodes.clear();
+    blas_indices.clear();
+    mesh_roots.clear();
+
+    for (auto& mesh : meshes)
+    {
+        // keeps the siblings of every mesh at even indices
+        if (blas_nodes.size() % 2 != 0) blas_nodes.push_back(BvhNode::padding());
+        auto node_base = static_cast<uint32_t>(blas_nodes.size());
+        auto index_base = static_cast<uint32_t>(blas_indices.size());
+        auto triangle_base = static_cast<uint32_t>(mesh_indices.size() / 3);
+        assert(mesh.quantized() == meshes[0].quantized());
+        auto vertex_base =
+            static_cast<uint32_t>(mesh_vertices.size() + mesh_quantized_vertices.size());
+
+        for (auto node : mesh.bvh.nodes)
+        {
+            if (node.is_leaf())
+            {
+                node.left_or_first += index_base;
+            }
+            else
+            {
+                node.left_or_first += node_base;
+                node.right_or_count += node_base;
+            }
+            blas_nodes.push_back(node);
+        }
+        for (auto index : mesh.bvh.primitive_indices) blas_indices.push_back(index + triangle_base);
+        mesh_vertices.insert(mesh_vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+        mesh_quantized_vertices.insert(mesh_quantized_vertices.end(),
+                                       mesh.quantized_vertices.begin(),
+                                       mesh.quantized_vertices.end());
+        for (auto index : mesh.indices) mesh_indices.push_back(index + vertex_base);
+        mesh_roots.push_back(node_base);
+    }
+
+    blas_parents = bvh_parents(blas_nodes);
+    // quantized triangles are tested from their decoded vertices
+    mesh_triangle_hits.clear();
+    if (mesh_quantized_vertices.empty())
+        mesh_triangle_hits = make_triangle_hits(mesh_vertices, mesh_indices);
+    set_instances(meshes, mesh_instances, settings);
+}
+
+void InstanceBvh::set_instances(std::vector<Mesh> const& meshes,
+                                std::vector<MeshInstance> const& mesh_instances,
+                                BvhBuildSettings const& settings)
+{
+    assert(mesh_roots.size() == meshes.size());
+    std::vector<AABB> instance_bounds;
+    for (auto& instance : mesh_instances)
+    {
+        auto& mesh = meshes.at(instance.mesh);
+        instance_bounds.push_back(
+            transform_bounds(mesh.bvh.nodes[0].bounds(), instance.transform * mesh.quantization));
+    }
+    tlas.build(instance_bounds, settings);
+
+    // ordered like the leaves, so they can reference the instances without an index buffer
+    instances.clear();
+    for (auto index : tlas.primitive_indices)
+    {
+        auto& instance = mesh_instances[index];
+        int material = instance.material_override >= 0 ? instance.material_override
+                                                       : meshes[instance.mesh].material_id;
+        // the rays of quantized meshes are moved straight onto their grid
+        instances.emplace_back(instance.transform * meshes[instance.mesh].quantization,
+                               mesh_roots[instance.mesh], material);
+    }
+}
+
+size_t InstanceBvh::geometry_memory() const
+{
+    return mesh_vertices.size() * sizeof(Vertex) +
+           mesh_quantized_vertices.size() * sizeof(QuantizedVertex) +
+           mesh_indices.size() * sizeof(uint32_t) + mesh_triangle_hits.size() * sizeof(TriangleHit);
+}
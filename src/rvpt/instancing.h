@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "geometry.h"
+#include "hit_geometry.h"
+
+// Indexed triangles in object space with their own BVH, the bottom level of the instancing
+// hierarchy. Corners share their vertices, a closed mesh needs about a third of the memory of the
+// same triangles as Triangle. The BVH leaves reference triangles, i.e. triples of indices.
+struct Mesh
+{
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;  // three per triangle
+    int material_id = 0;
+    BVH bvh;
+    // Replace vertices once quantize() ran, the positions and the BVH are then in the space of the
+    // quantization grid, which quantization maps back to object space
+    std::vector<QuantizedVertex> quantized_vertices;
+    glm::mat4 quantization{1.0f};
+
+    size_t triangle_count() const { return indices.size() / 3; }
+    bool quantized() const { return !quantized_vertices.empty(); }
+    // The triangles with their face normals, e.g. to build the BVH from. Empty once quantized.
+    std::vector<Triangle> triangles() const;
+    // Area weighted vertex normals, for sources without normals
+    void compute_normals();
+    // Halves the memory of the vertices and drops the need for mesh_triangle_hits, see
+    // QuantizedVertex. Must run after the BVH is built, its boxes are moved onto the grid and
+    // widened so they still contain the rounded triangles.
+    void quantize();
+};
+
+// Indexes unindexed triangles. Corners with the same position and face normal share a vertex, so
+// the shading stays flat. The material of the mesh is the one of the first triangle.
+Mesh make_mesh(std::vector<Triangle> const& triangles);
+
+// Box around the 8 transformed corners of bounds, empty bounds stay empty
+AABB transform_bounds(AABB const& bounds, glm::mat4 const& transform);
+
+struct MeshInstance
+{
+    uint32_t mesh;
+    glm::mat4 transform;    // object to world, only the upper 3x4 part is used
+    int material_override;  // replaces the material of the mesh when not negative
+};
+
+// Two level hierarchy over mesh instances, flattened into the arrays the shaders read. Memory
+// scales with the unique meshes, an instance only adds a transform and a top level leaf. Either
+// all meshes are quantized or none.
+class InstanceBvh
+{
+public:
+    void build(std::vector<Mesh> const& meshes, std::vector<MeshInstance> const& mesh_instances,
+               BvhBuildSettings const& settings = {});
+    // Rebuilds only the top level over other placements of the meshes build() flattened, e.g.
+    // when instances switch to another level of detail
+    void set_instances(std::vector<Mesh> const& meshes,
+                       std::vector<MeshInstance> const& mesh_instances,
+                       BvhBuildSettings const& settings = {});
+
+    // every mesh back to back, the indices already offset to the vertices of their mesh
+    std::vector<Vertex> mesh_vertices;
+    std::vector<uint32_t> mesh_indices;
+    // what the hit tests read of the mesh triangles, indexed like them. Empty for quantized
+    // meshes, their triangles are tested from the decoded vertices.
+    std::vector<TriangleHit> mesh_triangle_hits;
+    // instead of mesh_vertices for quantized meshes
+    std::vector<QuantizedVertex> mesh_quantized_vertices;
+
+    // Bytes of the vertices, indices and hit data of the meshes
+    size_t geometry_memory() const;
+    // every mesh BVH back to back, node and triangle indices already offset
+    std::vector<BvhNode> blas_nodes;
+    std::vector<uint32_t> blas_indices;
+    std::vector<uint32_t> blas_parents;
+
+    // over the world bounds of the instances, leaves index instances directly
+    BVH tlas;
+    std::vector<Instance> instances;
+
+private:
+    // node of the root of every mesh in blas_nodes
+    std::vector<uint32_t> mesh_roots;
+};
@@ -5,67 +5,10 @@
 #include <imgui.h>
 #include <fmt/core.h>
 #include "rvpt.h"
-
-#define TINYOBJLOADER_IMPLEMENTATION  // define this in only *one* .cc
-#include "tinyobjloader/tiny_obj_loader.h"
-
-void load_model(RVPT& rvpt, std::string inputfile, int material_id)
-{
-    rvpt.get_asset_path(inputfile);
-
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-
-    std::string warn;
-    std::string err;
-
-    bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, inputfile.c_str());
-
-    if (!warn.empty())
-    {
-        fmt::print("[{}: {}] {}\n", "WARNING", "MODEL-LOADING", warn);
-    }
-
-    if (!err.empty())
-    {
-        fmt::print("[{}: {}] {}\n", "ERROR", "MODEL-LOADING", err);
-        exit(-1);
-    }
-
-    // Loop over shapes
-    for (size_t s = 0; s < shapes.size(); s++)
-    {
-        // Loop over faces(polygon)
-        size_t index_offset = 0;
-        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++)
-        {
-            unsigned char fv = shapes[s].mesh.num_face_vertices[f];
-
-            // Loop over vertices in the face.
-            if (fv != 3)
-            {
-                fmt::print("Shape had a face with more than 3 vertices, skipping");
-                continue;
-            }
-            glm::vec3 vertices[3];
-
-            for (size_t v = 0; v < fv; v++)
-            {
-                tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-                vertices[v].x = attrib.vertices[3 * idx.vertex_index + 0];
-                vertices[v].y = attrib.vertices[3 * idx.vertex_index + 1];
-                vertices[v].z = attrib.vertices[3 * idx.vertex_index + 2];
-            }
-            index_offset += fv;
-
-            rvpt.add_triangle(Triangle(vertices[0], vertices[1], vertices[2], material_id));
-
-            // per-face material
-            shapes[s].mesh.material_ids[f];
-        }
-    }
-}
+#include "bvh_cache.h"
+#include "gltf_loader.h"
+#include "mapped_file.h"
+#include "scene_loader.h"
 
 void update_camera(Window& window, RVPT& rvpt)
 {
@@ -91,7 +34,9 @@ void update_camera(Window& window, RVPT& rvpt)
     rvpt.scene_camera.rotate(rotation);
 }
 
-int main()
+// Renders the demo scene, or the scene description, scene file or .glb model given as the first
+// argument
+int main(int argc, char** argv)
 {
     Window::Settings settings;
     settings.width = 1024;
@@ -100,17 +45,33 @@ int main()
 
     RVPT rvpt(window);
 
-    load_model(rvpt, "models/rabbit.obj", 1);
-
-    // Setup Demo Scene
-    rvpt.add_material(
-        Material(glm::vec4(1, 1, 1, 0), glm::vec4(0.1, 0.4, 0.6, 0), Material::Type::LAMBERT));
-    rvpt.add_sphere(Sphere(glm::vec3(0, -100, 0), 100.f, 0));
-    rvpt.add_material(Material(glm::vec4(1.0, 1.0, 1.0, 0), glm::vec4(0), Material::Type::LAMBERT));
+    std::string cache_directory = "cache";
+    rvpt.get_asset_path(cache_directory);
+    BvhCache bvh_cache(cache_directory);
+    // loads the models of a scene description while the device comes up and the first frames
+    // render
+    SceneLoader scene_loader(&bvh_cache);
 
-    rvpt.add_material(
-        Material(glm::vec4(1.0, 1.0, 1.0, 0), glm::vec4(0, 0, 0, 1), Material::Type::DIELECTRIC));
-    rvpt.add_sphere(Sphere(glm::vec3(0, 5, 5), 1.f, 2));
+    std::string scene_path = argc > 1 ? argv[1] : "";
+    if (scene_path.empty())
+    {
+        scene_path = "scenes/demo.json";
+        rvpt.get_asset_path(scene_path);
+    }
+    if (has_extension(scene_path, ".json"))
+    {
+        if (!scene_loader.load(rvpt, scene_path)) return 1;
+    }
+    else if (has_extension(scene_path, ".glb"))
+    {
+        SceneData scene;
+        if (!load_glb(scene_path, scene)) return 1;
+        rvpt.add_scene(std::move(scene));
+    }
+    else
+    {
+        if (!rvpt.load_scene(scene_path)) return 1;
+    }
 
     bool rvpt_init_ret = rvpt.initialize();
     if (!rvpt_init_ret)
@@ -153,6 +114,7 @@ int main()
             window.set_mouse_window_lock(!window.is_mouse_locked_to_window());
         }
 
+        scene_loader.add_loaded(rvpt);
         update_camera(window, rvpt);
         ImGui::NewFrame();
         rvpt.update_imgui();
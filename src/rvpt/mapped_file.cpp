@@ -0,0 +1,120 @@
+#include "mapped_file.h"
+
+#include <filesystem>
+#include <utility>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() { close(); }
+
+MappedFile::MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this == &other) return *this;
+    close();
+    opened = std::exchange(other.opened, false);
+    mapping = std::exchange(other.mapping, nullptr);
+    length = std::exchange(other.length, 0);
+#if defined(_WIN32)
+    file_handle = std::exchange(other.file_handle, nullptr);
+    mapping_handle = std::exchange(other.mapping_handle, nullptr);
+#endif
+    return *this;
+}
+
+#if defined(_WIN32)
+bool MappedFile::open(std::string const& path)
+{
+    close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size))
+    {
+        CloseHandle(file);
+        return false;
+    }
+    file_handle = file;
+    opened = true;
+    length = static_cast<size_t>(file_size.QuadPart);
+    if (length == 0) return true;
+
+    mapping_handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_handle != nullptr)
+        mapping = static_cast<uint8_t const*>(
+            MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    if (mapping == nullptr)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (mapping != nullptr) UnmapViewOfFile(mapping);
+    if (mapping_handle != nullptr) CloseHandle(mapping_handle);
+    if (file_handle != nullptr) CloseHandle(file_handle);
+    mapping = nullptr;
+    mapping_handle = nullptr;
+    file_handle = nullptr;
+    length = 0;
+    opened = false;
+}
+#else
+bool MappedFile::open(std::string const& path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    length = static_cast<size_t>(info.st_size);
+    if (length > 0)
+    {
+        void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED)
+        {
+            ::close(fd);
+            length = 0;
+            return false;
+        }
+        mapping = static_cast<uint8_t const*>(address);
+    }
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+    opened = true;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (mapping != nullptr) munmap(const_cast<uint8_t*>(mapping), length);
+    mapping = nullptr;
+    length = 0;
+    opened = false;
+}
+#endif
+
+bool has_extension(std::string const& path, char const* extension)
+{
+    return std::filesystem::path(path).extension() == extension;
+}
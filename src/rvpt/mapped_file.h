@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+
+// Read only memory mapping of a whole file. The pages are loaded by the OS on first access, so
+// opening a large file is cheap and only the parts that are read cost any IO.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(MappedFile const& other) = delete;
+    MappedFile& operator=(MappedFile const& other) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    // Returns false if the file does not exist or could not be mapped. Empty files map to a
+    // nullptr data() with a size() of 0.
+    bool open(std::string const& path);
+    void close();
+
+    bool is_open() const { return opened; }
+    uint8_t const* data() const { return mapping; }
+    size_t size() const { return length; }
+
+private:
+    bool opened = false;
+    uint8_t const* mapping = nullptr;
+    size_t length = 0;
+#if defined(_WIN32)
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+};
+
+// Whether the file name of path ends in extension, e.g. ".glb"
+bool has_extension(std::string const& path, char const* extension);
@@ -14,11 +14,15 @@ struct Material
         MIRROR,
         DIELECTRIC
     };
-    explicit Material(glm::vec4 albedo, glm::vec4 emission, Type type)
+    // the textures are indices of RVPT::add_texture(), they scale albedo and emission on meshes
+    explicit Material(glm::vec4 albedo, glm::vec4 emission, Type type, int albedo_texture = -1,
+                      int emission_texture = -1)
         : albedo(albedo), emission(emission)
     {
         data = glm::vec4();
         data.x = (float)type;
+        data.y = (float)albedo_texture;
+        data.z = (float)emission_texture;
     }
     glm::vec4 albedo{};
     glm::vec4 emission{};
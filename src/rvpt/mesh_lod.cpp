@@ -0,0 +1,593 @@
+#include "mesh_lod.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <limits>
+#include <tuple>
+
+#include <fmt/core.h>
+#include <glm/gtc/constants.hpp>
+
+#include "thread_pool.h"
+
+namespace
+{
+// weight of the planes holding borders and seams in place, relative to the area weighted planes
+// of the triangles
+constexpr double BORDER_WEIGHT = 10.0;
+// a collapse is rejected if it turns a triangle by more than about 80 degrees
+constexpr double MIN_NORMAL_COSINE = 0.2;
+// a level is kept only if it has fewer triangles than this fraction of the level before
+constexpr double MIN_LEVEL_REDUCTION = 0.9;
+constexpr uint32_t NO_VERTEX = std::numeric_limits<uint32_t>::max();
+constexpr uint32_t NO_LEVEL = std::numeric_limits<uint32_t>::max();
+
+// Sum of squared distances to planes as the symmetric matrix A, the vector b and the scalar c of
+// p^T A p + 2 b^T p + c, with the summed weight of the planes
+struct Quadric
+{
+    double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+    double b0 = 0, b1 = 0, b2 = 0;
+    double c = 0;
+    double weight = 0;
+
+    // the plane dot(normal, p) + d = 0, normal of unit length
+    void add_plane(glm::dvec3 normal, double d, double plane_weight)
+    {
+        a00 += plane_weight * normal.x * normal.x;
+        a01 += plane_weight * normal.x * normal.y;
+        a02 += plane_weight * normal.x * normal.z;
+        a11 += plane_weight * normal.y * normal.y;
+        a12 += plane_weight * normal.y * normal.z;
+        a22 += plane_weight * normal.z * normal.z;
+        b0 += plane_weight * d * normal.x;
+        b1 += plane_weight * d * normal.y;
+        b2 += plane_weight * d * normal.z;
+        c += plane_weight * d * d;
+        weight += plane_weight;
+    }
+
+    Quadric& operator+=(Quadric const& other)
+    {
+        a00 += other.a00;
+        a01 += other.a01;
+        a02 += other.a02;
+        a11 += other.a11;
+        a12 += other.a12;
+        a22 += other.a22;
+        b0 += other.b0;
+        b1 += other.b1;
+        b2 += other.b2;
+        c += other.c;
+        weight += other.weight;
+        return *this;
+    }
+
+    double error(glm::dvec3 p) const
+    {
+        return p.x * (a00 * p.x + 2.0 * (a01 * p.y + a02 * p.z + b0)) +
+               p.y * (a11 * p.y + 2.0 * (a12 * p.z + b1)) + p.z * (a22 * p.z + 2.0 * b2) + c;
+    }
+
+    // The point of least error, false if A is close to singular, e.g. for a flat neighbourhood
+    bool optimum(glm::dvec3& p) const
+    {
+        double c00 = a11 * a22 - a12 * a12;
+        double c01 = a02 * a12 - a01 * a22;
+        double c02 = a01 * a12 - a02 * a11;
+        double det = a00 * c00 + a01 * c01 + a02 * c02;
+        double scale = std::max({std::abs(a00), std::abs(a11), std::abs(a22)});
+        if (std::abs(det) <= 1e-9 * scale * scale * scale) return false;
+        double c11 = a00 * a22 - a02 * a02;
+        double c12 = a01 * a02 - a00 * a12;
+        double c22 = a00 * a11 - a01 * a01;
+        // A p = -b with the adjugate, A is symmetric
+        p = -glm::dvec3(c00 * b0 + c01 * b1 + c02 * b2, c01 * b0 + c11 * b1 + c12 * b2,
+                        c02 * b0 + c12 * b1 + c22 * b2) /
+            det;
+        return true;
+    }
+};
+
+// An edge of a triangle between two welded positions, lower position first, with the vertices
+// the triangle uses at them
+struct EdgeReference
+{
+    uint32_t low;
+    uint32_t high;
+    uint32_t face;
+    uint32_t low_vertex;
+    uint32_t high_vertex;
+};
+
+struct Collapse
+{
+    float cost;
+    uint32_t kept;
+    uint32_t removed;
+    // sum of the versions of both positions when the cost was computed, both only ever grow
+    uint32_t stamp;
+
+    bool operator>(Collapse const& other) const { return cost > other.cost; }
+};
+
+bool bits_less(glm::vec3 const& a, glm::vec3 const& b)
+{
+    uint32_t x[3], y[3];
+    std::memcpy(x, &a, sizeof(x));
+    std::memcpy(y, &b, sizeof(y));
+    return std::tie(x[0], x[1], x[2]) < std::tie(y[0], y[1], y[2]);
+}
+
+float max_scale(glm::mat4 const& transform)
+{
+    return std::max({glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])),
+                     glm::length(glm::vec3(transform[2]))});
+}
+
+float distance_to(AABB const& bounds, glm::vec3 point)
+{
+    glm::vec3 closest = glm::clamp(point, bounds.min, bounds.max);
+    return glm::length(point - closest);
+}
+
+uint32_t select_level(LodChain const& chain, float distance, float scale, LodView const& view,
+                      float pixel_error)
+{
+    // from inside the bounds an error can come arbitrarily close
+    if (!view.orthographic && distance <= 0.0f) return 0;
+    for (size_t level = chain.meshes.size() - 1; level > 0; level--)
+    {
+        float error = chain.errors[level] * scale;
+        float pixels = view.orthographic ? error * view.pixels_per_unit
+                                         : error / distance * view.pixels_per_unit;
+        if (pixels < pixel_error) return static_cast<uint32_t>(level);
+    }
+    return 0;
+}
+}  // namespace
+
+Mesh simplify_mesh(Mesh const& mesh, size_t target_triangles, float& error)
+{
+    assert(!mesh.quantized());
+    error = 0.0f;
+    Mesh result;
+    result.material_id = mesh.material_id;
+
+    // weld vertices with the same position, the simplification only sees the positions
+    std::vector<uint32_t> order(mesh.vertices.size());
+    for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return bits_less(mesh.vertices[a].position, mesh.vertices[b].position);
+    });
+    std::vector<uint32_t> vertex_positions(mesh.vertices.size());
+    std::vector<glm::dvec3> positions;
+    // vertices with the same position and attributes are one, e.g. from unindexed sources
+    std::vector<uint32_t> unique_vertices(mesh.vertices.size());
+    // the one vertex at every position, NO_VERTEX if it has several, i.e. lies on a seam
+    std::vector<uint32_t> position_vertices;
+    size_t group_start = 0;
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        Vertex const& vertex = mesh.vertices[order[i]];
+        if (i == 0 || bits_less(mesh.vertices[order[i - 1]].position, vertex.position))
+        {
+            positions.emplace_back(vertex.position);
+            position_vertices.push_back(order[i]);
+            group_start = i;
+        }
+        vertex_positions[order[i]] = static_cast<uint32_t>(positions.size() - 1);
+        unique_vertices[order[i]] = order[i];
+        for (size_t j = group_start; j < i; j++)
+        {
+            Vertex const& other = mesh.vertices[order[j]];
+            if (other.normal == vertex.normal && other.u == vertex.u && other.v == vertex.v)
+            {
+                unique_vertices[order[i]] = unique_vertices[order[j]];
+                break;
+            }
+        }
+        if (unique_vertices[order[i]] != position_vertices.back())
+            position_vertices.back() = NO_VERTEX;
+    }
+    std::vector<uint32_t>().swap(order);
+
+    // triangles over the positions, the ones that are already degenerate are dropped
+    std::vector<std::array<uint32_t, 3>> faces;
+    std::vector<uint32_t> face_vertices;  // the mesh vertices of the corners, three per face
+    faces.reserve(mesh.triangle_count());
+    face_vertices.reserve(mesh.indices.size());
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+    {
+        std::array<uint32_t, 3> face;
+        for (int k = 0; k < 3; k++) face[k] = vertex_positions[mesh.indices[i + k]];
+        if (face[0] == face[1] || face[1] == face[2] || face[0] == face[2]) continue;
+        faces.push_back(face);
+        for (int k = 0; k < 3; k++) face_vertices.push_back(unique_vertices[mesh.indices[i + k]]);
+    }
+    auto face_normal = [&](std::array<uint32_t, 3> const& face) {
+        return glm::cross(positions[face[1]] - positions[face[0]],
+                          positions[face[2]] - positions[face[0]]);
+    };
+
+    std::vector<Quadric> quadrics(positions.size());
+    for (auto const& face : faces)
+    {
+        glm::dvec3 normal = face_normal(face);
+        double length = glm::length(normal);
+        if (length == 0.0) continue;
+        normal /= length;
+        double d = -glm::dot(normal, positions[face[0]]);
+        for (uint32_t position : face) quadrics[position].add_plane(normal, d, 0.5 * length);
+    }
+
+    // Edges used by one triangle are borders. Edges whose triangles use other vertices at their
+    // ends are normal or uv seams, and edges of more than two triangles are not manifold. All of
+    // them get planes through them, perpendicular to their triangles.
+    std::vector<EdgeReference> edges;
+    edges.reserve(3 * faces.size());
+    for (uint32_t f = 0; f < faces.size(); f++)
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t a = faces[f][k], b = faces[f][(k + 1) % 3];
+            uint32_t va = face_vertices[3 * f + k], vb = face_vertices[3 * f + (k + 1) % 3];
+            if (a < b)
+                edges.push_back(EdgeReference{a, b, f, va, vb});
+            else
+                edges.push_back(EdgeReference{b, a, f, vb, va});
+        }
+    std::sort(edges.begin(), edges.end(), [](EdgeReference const& a, EdgeReference const& b) {
+        return std::tie(a.low, a.high) < std::tie(b.low, b.high);
+    });
+    std::vector<std::pair<uint32_t, uint32_t>> unique_edges;
+    for (size_t first = 0, last; first < edges.size(); first = last)
+    {
+        EdgeReference const& edge = edges[first];
+        for (last = first + 1; last < edges.size(); last++)
+            if (edges[last].low != edge.low || edges[last].high != edge.high) break;
+        unique_edges.emplace_back(edge.low, edge.high);
+        bool constrained = last - first != 2 || edges[first + 1].low_vertex != edge.low_vertex ||
+                           edges[first + 1].high_vertex != edge.high_vertex;
+        if (!constrained) continue;
+        for (size_t i = first; i < last; i++)
+        {
+            glm::dvec3 along = positions[edge.high] - positions[edge.low];
+            glm::dvec3 normal = glm::cross(along, face_normal(faces[edges[i].face]));
+            double length = glm::length(normal);
+            if (length == 0.0) continue;
+            normal /= length;
+            double d = -glm::dot(normal, positions[edge.low]);
+            double weight = BORDER_WEIGHT * glm::dot(along, along);
+            quadrics[edge.low].add_plane(normal, d, weight);
+            quadrics[edge.high].add_plane(normal, d, weight);
+        }
+    }
+    std::vector<EdgeReference>().swap(edges);
+
+    std::vector<std::vector<uint32_t>> position_faces(positions.size());
+    for (uint32_t f = 0; f < faces.size(); f++)
+        for (uint32_t position : faces[f]) position_faces[position].push_back(f);
+    std::vector<uint8_t> face_removed(faces.size(), 0);
+    std::vector<uint8_t> position_removed(positions.size(), 0);
+    std::vector<uint32_t> versions(positions.size(), 0);
+    size_t live_faces = faces.size();
+
+    // the cheapest of the optimum, the ends and the midpoint. The optimum of a nearly flat
+    // neighbourhood can lie far away along the flat directions, so it has to stay near the edge.
+    auto evaluate = [&](uint32_t a, uint32_t b, glm::dvec3& target) {
+        Quadric quadric = quadrics[a];
+        quadric += quadrics[b];
+        glm::dvec3 middle = 0.5 * (positions[a] + positions[b]);
+        glm::dvec3 along = positions[b] - positions[a];
+        target = middle;
+        double cost = quadric.error(middle);
+        auto consider = [&](glm::dvec3 candidate) {
+            double candidate_cost = quadric.error(candidate);
+            if (candidate_cost >= cost) return;
+            cost = candidate_cost;
+            target = candidate;
+        };
+        consider(positions[a]);
+        consider(positions[b]);
+        glm::dvec3 optimum;
+        if (quadric.optimum(optimum) &&
+            glm::dot(optimum - middle, optimum - middle) <= glm::dot(along, along))
+            consider(optimum);
+        return std::max(cost, 0.0);
+    };
+    std::vector<Collapse> heap;
+    heap.reserve(unique_edges.size());
+    auto push = [&](uint32_t a, uint32_t b) {
+        glm::dvec3 target;
+        heap.push_back(Collapse{static_cast<float>(evaluate(a, b, target)), a, b,
+                                versions[a] + versions[b]});
+        std::push_heap(heap.begin(), heap.end(), std::greater<>());
+    };
+    for (auto [a, b] : unique_edges)
+    {
+        glm::dvec3 target;
+        heap.push_back(Collapse{static_cast<float>(evaluate(a, b, target)), a, b, 0});
+    }
+    std::vector<std::pair<uint32_t, uint32_t>>().swap(unique_edges);
+    std::make_heap(heap.begin(), heap.end(), std::greater<>());
+
+    auto contains = [&](uint32_t f, uint32_t position) {
+        return faces[f][0] == position || faces[f][1] == position || faces[f][2] == position;
+    };
+    auto neighbours = [&](uint32_t position, std::vector<uint32_t>& out) {
+        out.clear();
+        for (uint32_t f : position_faces[position])
+            if (!face_removed[f])
+                for (uint32_t other : faces[f])
+                    if (other != position) out.push_back(other);
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    };
+    // whether moving position to target turns one of its faces without the other end too far
+    auto folds = [&](uint32_t position, uint32_t other, glm::dvec3 target) {
+        for (uint32_t f : position_faces[position])
+        {
+            if (face_removed[f] || contains(f, other)) continue;
+            glm::dvec3 before = face_normal(faces[f]);
+            glm::dvec3 saved = positions[position];
+            positions[position] = target;
+            glm::dvec3 after = face_normal(faces[f]);
+            positions[position] = saved;
+            double lengths = glm::length(before) * glm::length(after);
+            if (lengths > 0.0 && glm::dot(before, after) <= MIN_NORMAL_COSINE * lengths)
+                return true;
+            // or flattens it into a line
+            if (lengths == 0.0 && glm::length(before) > 0.0) return true;
+        }
+        return false;
+    };
+
+    std::vector<uint32_t> kept_neighbours, removed_neighbours, common;
+    double max_error = 0.0;
+    while (live_faces > target_triangles && !heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end(), std::greater<>());
+        Collapse collapse = heap.back();
+        heap.pop_back();
+        uint32_t a = collapse.kept, b = collapse.removed;
+        if (position_removed[a] || position_removed[b] ||
+            collapse.stamp != versions[a] + versions[b])
+            continue;
+
+        // The ends may only share the neighbours of the faces on the edge, otherwise the
+        // collapse would pinch the surface into an edge with more than two faces
+        neighbours(a, kept_neighbours);
+        neighbours(b, removed_neighbours);
+        common.clear();
+        std::set_intersection(kept_neighbours.begin(), kept_neighbours.end(),
+                              removed_neighbours.begin(), removed_neighbours.end(),
+                              std::back_inserter(common));
+        size_t shared_faces = 0;
+        for (uint32_t f : position_faces[a])
+            if (!face_removed[f] && contains(f, b)) shared_faces++;
+        if (shared_faces == 0 || common.size() != shared_faces) continue;
+
+        glm::dvec3 target;
+        double cost = evaluate(a, b, target);
+        if (folds(a, b, target) || folds(b, a, target)) continue;
+
+        // Off seams the faces of b take the vertex of a, on seams every corner keeps its own so
+        // the seam stays
+        uint32_t removed_vertex = position_vertices[b];
+        uint32_t kept_vertex = position_vertices[a];
+        if (removed_vertex == NO_VERTEX || kept_vertex == NO_VERTEX)
+            position_vertices[a] = NO_VERTEX;
+        positions[a] = target;
+        quadrics[a] += quadrics[b];
+        position_removed[b] = 1;
+        versions[a]++;
+        versions[b]++;
+        for (uint32_t f : position_faces[b])
+        {
+            if (face_removed[f]) continue;
+            if (contains(f, a))
+            {
+                face_removed[f] = 1;
+                live_faces--;
+                continue;
+            }
+            for (int k = 0; k < 3; k++)
+            {
+                if (faces[f][k] != b) continue;
+                faces[f][k] = a;
+                if (removed_vertex != NO_VERTEX && kept_vertex != NO_VERTEX)
+                    face_vertices[3 * f + k] = kept_vertex;
+            }
+            position_faces[a].push_back(f);
+        }
+        std::vector<uint32_t>().swap(position_faces[b]);
+        auto& kept_faces = position_faces[a];
+        kept_faces.erase(std::remove_if(kept_faces.begin(), kept_faces.end(),
+                                        [&](uint32_t f) { return face_removed[f] != 0; }),
+                         kept_faces.end());
+        if (quadrics[a].weight > 0.0)
+            max_error = std::max(max_error, std::sqrt(cost / quadrics[a].weight));
+
+        neighbours(a, kept_neighbours);
+        for (uint32_t neighbour : kept_neighbours) push(a, neighbour);
+    }
+    error = static_cast<float>(max_error);
+
+    // every vertex left keeps its normal and uv and takes the position it collapsed into
+    std::vector<uint32_t> new_vertices(mesh.vertices.size(), NO_VERTEX);
+    result.indices.reserve(3 * live_faces);
+    for (uint32_t f = 0; f < faces.size(); f++)
+    {
+        if (face_removed[f]) continue;
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t vertex = face_vertices[3 * f + k];
+            if (new_vertices[vertex] == NO_VERTEX)
+            {
+                new_vertices[vertex] = static_cast<uint32_t>(result.vertices.size());
+                result.vertices.push_back(mesh.vertices[vertex]);
+                result.vertices.back().position = glm::vec3(positions[faces[f][k]]);
+            }
+            result.indices.push_back(new_vertices[vertex]);
+        }
+    }
+    return result;
+}
+
+std::vector<std::vector<LodLevel>> build_lods(std::vector<Mesh> const& meshes,
+                                              LodSettings const& settings,
+                                              BvhBuildSettings const& bvh_settings)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::vector<LodLevel>> levels(meshes.size());
+
+    // one job per level of every mesh, the largest first so the small ones fill in at the end
+    struct Job
+    {
+        size_t mesh;
+        uint32_t level;
+        size_t target;
+    };
+    std::vector<Job> jobs;
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        Mesh const& mesh = meshes[i];
+        if (mesh.quantized() || mesh.triangle_count() < settings.min_triangles) continue;
+        double target = static_cast<double>(mesh.triangle_count());
+        uint32_t level = 0;
+        for (; level < settings.levels; level++)
+        {
+            target *= settings.reduction;
+            if (target < settings.min_triangles) break;
+            jobs.push_back(Job{i, level, static_cast<size_t>(target)});
+        }
+        levels[i].resize(level);
+    }
+    std::sort(jobs.begin(), jobs.end(), [&](Job const& a, Job const& b) {
+        return meshes[a.mesh].triangle_count() > meshes[b.mesh].triangle_count();
+    });
+
+    // the jobs run side by side, so every BVH is built on the thread of its job
+    BvhBuildSettings level_settings = bvh_settings;
+    level_settings.thread_count = 1;
+    ThreadPool pool(settings.thread_count);
+    pool.parallel_for(jobs.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t j = begin; j < end; j++)
+        {
+            Job const& job = jobs[j];
+            LodLevel& level = levels[job.mesh][job.level];
+            level.mesh = simplify_mesh(meshes[job.mesh], job.target, level.error);
+            level.mesh.bvh.build(level.mesh.triangles(), level_settings);
+        }
+    });
+
+    // a simplification that got stuck, e.g. on a mesh made of borders, adds nothing
+    size_t level_count = 0;
+    size_t triangle_count = 0;
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        auto& mesh_levels = levels[i];
+        size_t previous = meshes[i].triangle_count();
+        auto last = std::remove_if(mesh_levels.begin(), mesh_levels.end(), [&](LodLevel& level) {
+            if (level.mesh.triangle_count() >= MIN_LEVEL_REDUCTION * previous) return true;
+            previous = level.mesh.triangle_count();
+            return false;
+        });
+        mesh_levels.erase(last, mesh_levels.end());
+        level_count += mesh_levels.size();
+        for (auto const& level : mesh_levels) triangle_count += level.mesh.triangle_count();
+    }
+
+    std::chrono::duration<double, std::milli> build_time =
+        std::chrono::high_resolution_clock::now() - start;
+    if (level_count > 0)
+        fmt::print("[{}: {}] {} levels of {} meshes with {} triangles in {:.2f} ms on {} threads\n",
+                   "INFO", "LOD", level_count, levels.size(), triangle_count, build_time.count(),
+                   pool.thread_count());
+    return levels;
+}
+
+std::vector<std::vector<LodLevel>> prepare_meshes(std::vector<Mesh>& meshes,
+                                                  LodSettings const& settings,
+                                                  BvhBuildSettings const& bvh_settings,
+                                                  bool quantize)
+{
+    // the levels are simplified from the full precision meshes
+    std::vector<std::vector<LodLevel>> levels(meshes.size());
+    if (settings.levels > 0) levels = build_lods(meshes, settings, bvh_settings);
+    if (quantize)
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            meshes[i].quantize();
+            for (auto& level : levels[i]) level.mesh.quantize();
+        }
+    return levels;
+}
+
+LodView make_lod_view(Camera& camera, float image_height)
+{
+    LodView view;
+    view.position = glm::vec3(camera.get_camera_matrix()[3]);
+    view.orthographic = camera.get_camera_mode() == 1;
+    if (view.orthographic)
+        // the image spans twice the scale vertically, see camera_ortho_ray
+        view.pixels_per_unit = image_height / (2.0f * camera.get_scale());
+    else if (camera.get_camera_mode() == 2)
+        // the image spans pi radians vertically, see camera_spherical_ray
+        view.pixels_per_unit = image_height / glm::pi<float>();
+    else
+        view.pixels_per_unit =
+            image_height / (2.0f * std::tan(0.5f * glm::radians(camera.get_fov())));
+    return view;
+}
+
+void LodSelector::set_instances(std::vector<LodChain> const& chains,
+                                std::vector<MeshInstance> const& mesh_instances)
+{
+    placed = mesh_instances;
+    base_meshes.clear();
+    world_bounds.clear();
+    world_scales.clear();
+    full_triangle_count = 0;
+    for (auto const& instance : mesh_instances)
+    {
+        base_meshes.push_back(instance.mesh);
+        LodChain const* chain = instance.mesh < chains.size() ? &chains[instance.mesh] : nullptr;
+        bool has_levels = chain && chain->meshes.size() > 1;
+        world_bounds.push_back(has_levels ? transform_bounds(chain->bounds, instance.transform)
+                                          : AABB{});
+        world_scales.push_back(max_scale(instance.transform));
+        if (chain && !chain->triangle_counts.empty())
+            full_triangle_count += chain->triangle_counts[0];
+    }
+    // every placement counts as changed on the next select()
+    levels.assign(mesh_instances.size(), NO_LEVEL);
+}
+
+bool LodSelector::select(std::vector<LodChain> const& chains, LodView const& view,
+                         float pixel_error)
+{
+    bool changed = false;
+    selected_triangle_count = 0;
+    for (size_t i = 0; i < placed.size(); i++)
+    {
+        uint32_t base = base_meshes[i];
+        LodChain const* chain = base < chains.size() ? &chains[base] : nullptr;
+        uint32_t level = 0;
+        if (chain && chain->meshes.size() > 1)
+            level = select_level(*chain, distance_to(world_bounds[i], view.position),
+                                 world_scales[i], view, pixel_error);
+        if (chain && !chain->triangle_counts.empty())
+            selected_triangle_count += chain->triangle_counts[level];
+        if (level == levels[i]) continue;
+        levels[i] = level;
+        placed[i].mesh = chain && chain->meshes.size() > 1 ? chain->meshes[level] : base;
+        changed = true;
+    }
+    return changed;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "camera.h"
+#include "geometry.h"
+#include "instancing.h"
+
+struct LodSettings
+{
+    // simplified levels built per mesh, 0 renders every mesh at full detail
+    uint32_t levels = 0;
+    // triangles of every level relative to the level before
+    float reduction = 0.25f;
+    // meshes with fewer triangles get no levels, and no level has fewer
+    uint32_t min_triangles = 256;
+    // a coarser level is used once its error covers fewer pixels than this
+    float pixel_error = 1.0f;
+    // threads the levels are built on, 0 uses every hardware thread
+    uint32_t thread_count = 0;
+};
+
+// Collapses the edges of mesh cheapest first by their quadric error (Garland and Heckbert) until
+// at most target_triangles remain, or no edge can collapse without folding a triangle over or
+// pinching the surface. Vertices with the same position are welded, so the surface stays closed
+// across normal and uv seams, and the corners keep their own normal and uv. Borders and seams are
+// held in place by planes through them. error receives the largest root mean square distance of
+// a collapsed vertex to the planes it replaced, in object space. The result has no BVH.
+Mesh simplify_mesh(Mesh const& mesh, size_t target_triangles, float& error);
+
+struct LodLevel
+{
+    Mesh mesh;
+    float error;  // object space, see simplify_mesh()
+};
+
+// Builds the levels of meshes with their BVHs, every level of every mesh at the same time on a
+// thread pool. Each level is simplified from the full mesh, so the errors do not add up. The
+// result holds the levels of every mesh finest first, none for meshes below
+// settings.min_triangles or quantized ones, and a level only if it has clearly fewer triangles
+// than the one before.
+std::vector<std::vector<LodLevel>> build_lods(std::vector<Mesh> const& meshes,
+                                              LodSettings const& settings,
+                                              BvhBuildSettings const& bvh_settings);
+
+// Builds the levels of meshes with settings.levels, then quantizes the meshes and their levels if
+// quantize is set, see Mesh::quantize(). The meshes must have their BVH. Returns the levels of
+// every mesh, as RVPT::add_scene() takes them, so the work can run on any thread.
+std::vector<std::vector<LodLevel>> prepare_meshes(std::vector<Mesh>& meshes,
+                                                  LodSettings const& settings,
+                                                  BvhBuildSettings const& bvh_settings,
+                                                  bool quantize);
+
+// The levels a mesh id is rendered with, the first is the mesh itself with no error. A mesh
+// without levels has a chain of only itself, the level meshes have an empty one.
+struct LodChain
+{
+    std::vector<uint32_t> meshes;
+    std::vector<float> errors;
+    std::vector<size_t> triangle_counts;
+    AABB bounds;  // of the full mesh in object space
+};
+
+// How many pixels an error at some distance from the camera covers, at the center of the image
+struct LodView
+{
+    glm::vec3 position;
+    bool orthographic;
+    // pixels per unit of error divided by its distance, or per unit of error for orthographic
+    float pixels_per_unit;
+};
+
+LodView make_lod_view(Camera& camera, float image_height);
+
+// Chooses the level of every placement, the coarsest whose error covers fewer than pixel_error
+// pixels at the point of the placement closest to the camera. Every ray of a placement, primary
+// or secondary, sees the level chosen for the camera.
+class LodSelector
+{
+public:
+    // chains holds the levels of every mesh id, the placements are those of the full meshes
+    void set_instances(std::vector<LodChain> const& chains,
+                       std::vector<MeshInstance> const& mesh_instances);
+    // Returns whether any placement changed its level, at least once after set_instances()
+    bool select(std::vector<LodChain> const& chains, LodView const& view, float pixel_error);
+
+    // the placements with the mesh of their level
+    std::vector<MeshInstance> const& instances() const { return placed; }
+    // summed over the placements, with their levels and at full detail
+    size_t selected_triangles() const { return selected_triangle_count; }
+    size_t full_triangles() const { return full_triangle_count; }
+
+private:
+    std::vector<MeshInstance> placed;
+    std::vector<uint32_t> base_meshes;  // of every placement, the mesh its chain belongs to
+    std::vector<uint32_t> levels;
+    std::vector<AABB> world_bounds;
+    std::vector<float> world_scales;  // how much the transform stretches an error at most
+    size_t selected_triangle_count = 0;
+    size_t full_triangle_count = 0;
+};
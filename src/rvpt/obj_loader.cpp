@@ -0,0 +1,546 @@
+#include "obj_loader.h"
+
+#include <cmath>
+#include <cstring>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+namespace
+{
+// uv or normal left out by a face corner
+constexpr uint32_t OBJ_NONE = 0xFFFFFFFFu;
+// corners are split into this many shards per thread to be deduplicated in parallel
+constexpr uint32_t SHARDS_PER_THREAD = 4;
+constexpr size_t PARALLEL_GRAIN_SIZE = size_t{1} << 16;
+
+// Indices of the position, uv and normal of a face corner, from 0
+struct Corner
+{
+    uint32_t position;
+    uint32_t texcoord;
+    uint32_t normal;
+
+    bool operator==(Corner const& other) const
+    {
+        return position == other.position && texcoord == other.texcoord && normal == other.normal;
+    }
+};
+
+struct CornerHash
+{
+    size_t operator()(Corner const& corner) const
+    {
+        uint64_t hash = corner.position * 0x9E3779B97F4A7C15ull;
+        hash ^= (corner.texcoord + (hash << 6) + (hash >> 2)) * 0xC2B2AE3D27D4EB4Full;
+        hash ^= (corner.normal + (hash << 6) + (hash >> 2)) * 0x165667B19E3779F9ull;
+        return static_cast<size_t>(hash ^ (hash >> 29));
+    }
+};
+
+struct ElementCounts
+{
+    size_t positions = 0;
+    size_t texcoords = 0;
+    size_t normals = 0;
+    size_t triangles = 0;
+};
+
+struct Chunk
+{
+    char const* begin;
+    char const* end;
+    ElementCounts counts;  // elements in the chunk
+    ElementCounts offsets;  // of the first element of the chunk in the arrays of the file
+    std::string error;  // first problem of the chunk, empty if it parsed
+};
+
+// the elements of the whole file, written by the chunks at their offsets
+struct ObjData
+{
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> texcoords;
+    std::vector<glm::vec3> normals;
+    std::vector<Corner> corners;  // three per triangle
+};
+
+bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+void skip_spaces(char const*& p, char const* end)
+{
+    while (p < end && is_space(*p)) p++;
+}
+
+void skip_token(char const*& p, char const* end)
+{
+    while (p < end && !is_space(*p)) p++;
+}
+
+bool parse_int(char const*& p, char const* end, int64_t& value)
+{
+    char const* start = p;
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) p++;
+    int64_t result = 0;
+    char const* digits = p;
+    while (p < end && is_digit(*p)) result = result * 10 + (*p++ - '0');
+    if (p == digits)
+    {
+        p = start;
+        return false;
+    }
+    value = negative ? -result : result;
+    return true;
+}
+
+// Decimal and scientific notation, not correctly rounded in the last bit but far more precise than
+// the float it ends up in. strtof would do, but it is locale dependent and several times slower.
+bool parse_float(char const*& p, char const* end, float& value)
+{
+    static std::array<double, 23> const powers = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    char const* start = p;
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) p++;
+    double mantissa = 0.0;
+    int exponent = 0;
+    bool digits = false;
+    for (; p < end && is_digit(*p); p++, digits = true) mantissa = mantissa * 10.0 + (*p - '0');
+    if (p < end && *p == '.')
+        for (p++; p < end && is_digit(*p); p++, digits = true, exponent--)
+            mantissa = mantissa * 10.0 + (*p - '0');
+    if (!digits)
+    {
+        p = start;
+        return false;
+    }
+    int64_t written_exponent = 0;
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        if (!parse_int(p, end, written_exponent)) written_exponent = 0;
+    }
+    exponent += static_cast<int>(std::clamp<int64_t>(written_exponent, -400, 400));
+
+    double scale = std::abs(exponent) < static_cast<int>(powers.size())
+                       ? powers[static_cast<size_t>(std::abs(exponent))]
+                       : std::pow(10.0, std::abs(exponent));
+    double result = exponent < 0 ? mantissa / scale : mantissa * scale;
+    value = static_cast<float>(negative ? -result : result);
+    return true;
+}
+
+// Reads up to N floats, the rest keep their value
+template <size_t N>
+void parse_floats(char const*& p, char const* end, float (&values)[N])
+{
+    for (float& value : values)
+    {
+        skip_spaces(p, end);
+        if (!parse_float(p, end, value)) return;
+    }
+}
+
+enum class LineType
+{
+    other,
+    position,
+    texcoord,
+    normal,
+    face,
+};
+
+// Finds the type of the line and moves p past the keyword
+LineType line_type(char const*& p, char const* end)
+{
+    skip_spaces(p, end);
+    if (end - p < 2) return LineType::other;
+    if (p[0] == 'f' && is_space(p[1]))
+    {
+        p += 2;
+        return LineType::face;
+    }
+    if (p[0] != 'v') return LineType::other;
+    if (is_space(p[1]))
+    {
+        p += 2;
+        return LineType::position;
+    }
+    if (end - p < 3 || !is_space(p[2])) return LineType::other;
+    p += 3;
+    if (p[-2] == 't') return LineType::texcoord;
+    if (p[-2] == 'n') return LineType::normal;
+    return LineType::other;
+}
+
+// Calls func(line_begin, line_end) for every line of the chunk
+template <typename Func>
+void for_each_line(Chunk const& chunk, Func const& func)
+{
+    char const* p = chunk.begin;
+    while (p < chunk.end)
+    {
+        auto line_end = static_cast<char const*>(std::memchr(p, '\n', chunk.end - p));
+        if (line_end == nullptr) line_end = chunk.end;
+        func(p, line_end);
+        p = line_end + 1;
+    }
+}
+
+size_t face_corner_count(char const* p, char const* end)
+{
+    size_t count = 0;
+    for (skip_spaces(p, end); p < end; skip_spaces(p, end), count++) skip_token(p, end);
+    return count;
+}
+
+void count_chunk(Chunk& chunk)
+{
+    for_each_line(chunk, [&](char const* p, char const* end) {
+        switch (line_type(p, end))
+        {
+            case LineType::position:
+                chunk.counts.positions++;
+                break;
+            case LineType::texcoord:
+                chunk.counts.texcoords++;
+                break;
+            case LineType::normal:
+                chunk.counts.normals++;
+                break;
+            case LineType::face:
+                chunk.counts.triangles += std::max<size_t>(face_corner_count(p, end), 2) - 2;
+                break;
+            default:
+                break;
+        }
+    });
+}
+
+// OBJ indices start at 1, negative ones count back from the last element defined so far. Indices
+// past the elements defined so far are checked once the whole file is parsed.
+bool resolve_index(int64_t index, size_t defined, uint32_t& resolved)
+{
+    if (index > 0 && index <= static_cast<int64_t>(OBJ_NONE))
+        resolved = static_cast<uint32_t>(index - 1);
+    else if (index < 0 && -index <= static_cast<int64_t>(defined))
+        resolved = static_cast<uint32_t>(static_cast<int64_t>(defined) + index);
+    else
+        return false;
+    return true;
+}
+
+// v, v/vt, v//vn or v/vt/vn
+bool parse_corner(char const*& p, char const* end, ElementCounts const& defined, Corner& corner)
+{
+    int64_t index;
+    corner.texcoord = OBJ_NONE;
+    corner.normal = OBJ_NONE;
+    if (!parse_int(p, end, index) || !resolve_index(index, defined.positions, corner.position))
+        return false;
+    if (p == end || *p != '/') return true;
+    p++;
+    if (p < end && *p != '/' &&
+        (!parse_int(p, end, index) || !resolve_index(index, defined.texcoords, corner.texcoord)))
+        return false;
+    if (p == end || *p != '/') return true;
+    p++;
+    return parse_int(p, end, index) && resolve_index(index, defined.normals, corner.normal);
+}
+
+void parse_chunk(Chunk& chunk, ObjData& data)
+{
+    // elements defined before the current line, from the start of the file
+    ElementCounts defined = chunk.offsets;
+    for_each_line(chunk, [&](char const* p, char const* end) {
+        char const* line_begin = p;
+        switch (line_type(p, end))
+        {
+            case LineType::position:
+            {
+                float xyz[3] = {0.0f, 0.0f, 0.0f};
+                parse_floats(p, end, xyz);
+                data.positions[defined.positions++] = glm::vec3(xyz[0], xyz[1], xyz[2]);
+                break;
+            }
+            case LineType::texcoord:
+            {
+                float uv[2] = {0.0f, 0.0f};
+                parse_floats(p, end, uv);
+                data.texcoords[defined.texcoords++] = glm::vec2(uv[0], uv[1]);
+                break;
+            }
+            case LineType::normal:
+            {
+                float xyz[3] = {0.0f, 0.0f, 0.0f};
+                parse_floats(p, end, xyz);
+                data.normals[defined.normals++] = glm::vec3(xyz[0], xyz[1], xyz[2]);
+                break;
+            }
+            case LineType::face:
+            {
+                // a fan around the first corner
+                Corner first{};
+                Corner previous{};
+                size_t corner_count = 0;
+                for (skip_spaces(p, end); p < end; skip_spaces(p, end), corner_count++)
+                {
+                    Corner corner;
+                    char const* token = p;
+                    skip_token(p, end);
+                    char const* cursor = token;
+                    if (!parse_corner(cursor, p, defined, corner) || cursor != p)
+                    {
+                        if (chunk.error.empty())
+                            chunk.error = fmt::format("invalid face corner '{}' in '{}'",
+                                                      std::string(token, p),
+                                                      std::string(line_begin, end));
+                        corner = first;
+                    }
+                    if (corner_count == 0) first = corner;
+                    if (corner_count >= 2)
+                    {
+                        Corner* triangle = &data.corners[3 * defined.triangles++];
+                        triangle[0] = first;
+                        triangle[1] = previous;
+                        triangle[2] = corner;
+                    }
+                    previous = corner;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    });
+}
+
+uint32_t shard_of(Corner const& corner, uint32_t shard_count)
+{
+    return static_cast<uint32_t>(CornerHash{}(corner) % shard_count);
+}
+}  // namespace
+
+bool load_obj(std::string const& path, int material_id, Mesh& mesh,
+              ObjLoadSettings const& settings)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    MappedFile file;
+    if (!file.open(path))
+    {
+        fmt::print("[{}: {}] unable to open {}\n", "ERROR", "MODEL-LOADING", path);
+        return false;
+    }
+    auto text = reinterpret_cast<char const*>(file.data());
+    char const* text_end = text + file.size();
+
+    ThreadPool pool(settings.thread_count);
+
+    // chunk boundaries are moved to the start of the next line
+    std::vector<Chunk> chunks;
+    size_t chunk_size = std::max<size_t>(settings.chunk_size, 1);
+    for (char const* begin = text; begin < text_end;)
+    {
+        char const* end = begin + std::min<size_t>(chunk_size, text_end - begin);
+        auto line_end = static_cast<char const*>(std::memchr(end, '\n', text_end - end));
+        end = line_end == nullptr ? text_end : line_end + 1;
+        chunks.push_back(Chunk{begin, end, {}, {}, {}});
+        begin = end;
+    }
+
+    pool.parallel_for(chunks.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) count_chunk(chunks[i]);
+    });
+
+    ElementCounts total;
+    for (auto& chunk : chunks)
+    {
+        chunk.offsets = total;
+        total.positions += chunk.counts.positions;
+        total.texcoords += chunk.counts.texcoords;
+        total.normals += chunk.counts.normals;
+        total.triangles += chunk.counts.triangles;
+    }
+    if (total.positions >= OBJ_NONE || 3 * total.triangles >= OBJ_NONE)
+    {
+        fmt::print("[{}: {}] {} has too many vertices or faces for 32 bit indices\n", "ERROR",
+                   "MODEL-LOADING", path);
+        return false;
+    }
+
+    ObjData data;
+    data.positions.resize(total.positions);
+    data.texcoords.resize(total.texcoords);
+    data.normals.resize(total.normals);
+    data.corners.resize(3 * total.triangles);
+    pool.parallel_for(chunks.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) parse_chunk(chunks[i], data);
+    });
+    for (auto& chunk : chunks)
+    {
+        if (chunk.error.empty()) continue;
+        fmt::print("[{}: {}] {}: {}\n", "ERROR", "MODEL-LOADING", path, chunk.error);
+        return false;
+    }
+    file.close();
+
+    // Every position becomes the vertex of the first corner that references it. Only corners that
+    // pair it with another uv or normal need a vertex of their own, which is rare outside of uv
+    // seams and hard edges. Positions no corner references are dropped.
+    size_t corner_count = data.corners.size();
+    // ~ of the first corner, so the zero initialized slots mean none and the largest value wins
+    std::vector<std::atomic<uint32_t>> first_corner(total.positions);
+    std::atomic<bool> out_of_range{false};
+    std::atomic<bool> missing_normals{false};
+    pool.parallel_for(corner_count, PARALLEL_GRAIN_SIZE, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            Corner const& corner = data.corners[i];
+            if (corner.position >= total.positions ||
+                (corner.texcoord != OBJ_NONE && corner.texcoord >= total.texcoords) ||
+                (corner.normal != OBJ_NONE && corner.normal >= total.normals))
+            {
+                out_of_range = true;
+                continue;
+            }
+            if (corner.normal == OBJ_NONE) missing_normals = true;
+            auto key = ~static_cast<uint32_t>(i);
+            auto& slot = first_corner[corner.position];
+            uint32_t current = slot.load(std::memory_order_relaxed);
+            while (current < key &&
+                   !slot.compare_exchange_weak(current, key, std::memory_order_relaxed))
+            {
+            }
+        }
+    });
+    if (out_of_range)
+    {
+        fmt::print("[{}: {}] {} references vertices it does not define\n", "ERROR",
+                   "MODEL-LOADING", path);
+        return false;
+    }
+    auto is_split = [&](Corner const& corner) {
+        return !(data.corners[~first_corner[corner.position].load(std::memory_order_relaxed)] ==
+                 corner);
+    };
+
+    // the positions that are used are numbered in parallel ranges
+    size_t range_count = (total.positions + PARALLEL_GRAIN_SIZE - 1) / PARALLEL_GRAIN_SIZE;
+    std::vector<uint32_t> range_offsets(range_count + 1, 0);
+    std::vector<uint32_t> position_vertex(total.positions);
+    pool.parallel_for(range_count, 1, [&](size_t begin, size_t end) {
+        for (size_t range = begin; range < end; range++)
+        {
+            size_t last = std::min(total.positions, (range + 1) * PARALLEL_GRAIN_SIZE);
+            for (size_t p = range * PARALLEL_GRAIN_SIZE; p < last; p++)
+                range_offsets[range + 1] += first_corner[p].load(std::memory_order_relaxed) != 0;
+        }
+    });
+    for (size_t range = 0; range < range_count; range++)
+        range_offsets[range + 1] += range_offsets[range];
+    uint32_t used_positions = range_offsets[range_count];
+
+    // the split corners are gathered by shard in corner order, and numbered within their shard
+    auto shard_count = pool.thread_count() * SHARDS_PER_THREAD;
+    size_t corner_range_count = (corner_count + PARALLEL_GRAIN_SIZE - 1) / PARALLEL_GRAIN_SIZE;
+    std::vector<std::vector<std::vector<uint32_t>>> split_corners(
+        corner_range_count, std::vector<std::vector<uint32_t>>(shard_count));
+    pool.parallel_for(corner_range_count, 1, [&](size_t begin, size_t end) {
+        for (size_t range = begin; range < end; range++)
+        {
+            size_t last = std::min(corner_count, (range + 1) * PARALLEL_GRAIN_SIZE);
+            for (size_t i = range * PARALLEL_GRAIN_SIZE; i < last; i++)
+                if (is_split(data.corners[i]))
+                    split_corners[range][shard_of(data.corners[i], shard_count)].push_back(
+                        static_cast<uint32_t>(i));
+        }
+    });
+
+    mesh = Mesh{};
+    mesh.material_id = material_id;
+    mesh.indices.resize(corner_count);
+    // the first corner of every distinct split triple, by shard
+    std::vector<std::vector<uint32_t>> split_vertices(shard_count);
+    pool.parallel_for(shard_count, 1, [&](size_t begin, size_t end) {
+        for (size_t shard = begin; shard < end; shard++)
+        {
+            std::unordered_map<Corner, uint32_t, CornerHash> vertex_of;
+            for (auto const& range : split_corners)
+                for (uint32_t i : range[shard])
+                {
+                    auto [it, inserted] = vertex_of.try_emplace(
+                        data.corners[i], static_cast<uint32_t>(split_vertices[shard].size()));
+                    if (inserted) split_vertices[shard].push_back(i);
+                    mesh.indices[i] = it->second;
+                }
+        }
+    });
+    std::vector<uint32_t> shard_offsets(shard_count + 1, used_positions);
+    for (uint32_t shard = 0; shard < shard_count; shard++)
+        shard_offsets[shard + 1] =
+            shard_offsets[shard] + static_cast<uint32_t>(split_vertices[shard].size());
+
+    auto make_vertex = [&](Corner const& corner) {
+        Vertex vertex;
+        vertex.position = data.positions[corner.position];
+        if (corner.normal != OBJ_NONE) vertex.normal = data.normals[corner.normal];
+        if (corner.texcoord != OBJ_NONE)
+        {
+            vertex.u = data.texcoords[corner.texcoord].x;
+            vertex.v = data.texcoords[corner.texcoord].y;
+        }
+        return vertex;
+    };
+    mesh.vertices.resize(shard_offsets[shard_count]);
+    pool.parallel_for(range_count, 1, [&](size_t begin, size_t end) {
+        for (size_t range = begin; range < end; range++)
+        {
+            uint32_t vertex = range_offsets[range];
+            size_t last = std::min(total.positions, (range + 1) * PARALLEL_GRAIN_SIZE);
+            for (size_t p = range * PARALLEL_GRAIN_SIZE; p < last; p++)
+            {
+                uint32_t first = first_corner[p].load(std::memory_order_relaxed);
+                if (first == 0) continue;
+                position_vertex[p] = vertex;
+                mesh.vertices[vertex++] = make_vertex(data.corners[~first]);
+            }
+        }
+    });
+    pool.parallel_for(shard_count, 1, [&](size_t begin, size_t end) {
+        for (size_t shard = begin; shard < end; shard++)
+            for (size_t i = 0; i < split_vertices[shard].size(); i++)
+                mesh.vertices[shard_offsets[shard] + i] =
+                    make_vertex(data.corners[split_vertices[shard][i]]);
+    });
+    pool.parallel_for(corner_count, PARALLEL_GRAIN_SIZE, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            Corner const& corner = data.corners[i];
+            if (is_split(corner))
+                mesh.indices[i] += shard_offsets[shard_of(corner, shard_count)];
+            else
+                mesh.indices[i] = position_vertex[corner.position];
+        }
+    });
+    if (missing_normals) mesh.compute_normals();
+
+    std::chrono::duration<double, std::milli> load_time =
+        std::chrono::high_resolution_clock::now() - start;
+    fmt::print("[{}: {}] {}: {} vertices, {} triangles, {} MiB in {:.2f} ms on {} threads\n",
+               "INFO", "MODEL-LOADING", path, mesh.vertices.size(), mesh.triangle_count(),
+               (text_end - text) >> 20, load_time.count(), pool.thread_count());
+    return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+
+#include "instancing.h"
+
+struct ObjLoadSettings
+{
+    // threads used by the parser, 0 uses every hardware thread
+    uint32_t thread_count = 0;
+    // the file is cut into chunks of about this many bytes, at line ends
+    size_t chunk_size = size_t{1} << 20;
+};
+
+// Parses the vertices and faces of a Wavefront OBJ file into an indexed mesh, groups, smoothing and
+// materials are ignored. The file is memory mapped and cut into line aligned chunks that are parsed
+// in parallel: a first pass counts the elements of every chunk, so the second one writes straight
+// into arrays sized for the whole file. Polygons are triangulated as fans. Corners with the same
+// position, uv and normal share a vertex, normals are computed if the file has none.
+// Returns false and prints the reason if the file cannot be read or references missing elements.
+bool load_obj(std::string const& path, int material_id, Mesh& mesh,
+              ObjLoadSettings const& settings = {});
@@ -0,0 +1,541 @@
+#include "ply_loader.h"
+
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+namespace
+{
+// faces per block of the serial pass over faces that are not all triangles
+constexpr size_t FACE_BLOCK_SIZE = size_t{1} << 16;
+constexpr size_t PARALLEL_GRAIN_SIZE = size_t{1} << 16;
+
+enum class PlyType
+{
+    int8,
+    uint8,
+    int16,
+    uint16,
+    int32,
+    uint32,
+    float32,
+    float64,
+};
+
+struct PlyProperty
+{
+    std::string name;
+    PlyType type;  // of the value, or of the items of a list
+    bool list = false;
+    PlyType count_type = PlyType::uint8;
+};
+
+struct PlyElement
+{
+    std::string name;
+    size_t count = 0;
+    std::vector<PlyProperty> properties;
+    size_t stride = 0;  // bytes per record, 0 if the records have lists and differ in size
+
+    // of the scalar property, or -1 if there is none or it comes after a list
+    int64_t offset(std::string const& property) const;
+};
+
+struct PlyHeader
+{
+    std::vector<PlyElement> elements;
+    size_t data_offset = 0;  // of the first record, right after end_header
+};
+
+// where the faces of a block start, in the records and in the triangles
+struct FaceBlock
+{
+    size_t first_face;
+    size_t byte_offset;
+    size_t first_triangle;
+};
+
+size_t type_size(PlyType type)
+{
+    switch (type)
+    {
+        case PlyType::int8:
+        case PlyType::uint8:
+            return 1;
+        case PlyType::int16:
+        case PlyType::uint16:
+            return 2;
+        case PlyType::int32:
+        case PlyType::uint32:
+        case PlyType::float32:
+            return 4;
+        case PlyType::float64:
+            return 8;
+    }
+    return 0;
+}
+
+bool parse_type(std::string const& name, PlyType& type)
+{
+    static const std::pair<char const*, PlyType> names[] = {
+        {"char", PlyType::int8},     {"int8", PlyType::int8},       {"uchar", PlyType::uint8},
+        {"uint8", PlyType::uint8},   {"short", PlyType::int16},     {"int16", PlyType::int16},
+        {"ushort", PlyType::uint16}, {"uint16", PlyType::uint16},   {"int", PlyType::int32},
+        {"int32", PlyType::int32},   {"uint", PlyType::uint32},     {"uint32", PlyType::uint32},
+        {"float", PlyType::float32}, {"float32", PlyType::float32}, {"double", PlyType::float64},
+        {"float64", PlyType::float64}};
+    for (auto const& [type_name, value] : names)
+    {
+        if (name != type_name) continue;
+        type = value;
+        return true;
+    }
+    return false;
+}
+
+template <typename T>
+T read(uint8_t const* p)
+{
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+// The records are little endian like every platform the path tracer runs on, so they are read as
+// they are. float32 comes first as it is by far the most common.
+float read_float(PlyType type, uint8_t const* p)
+{
+    if (type == PlyType::float32) return read<float>(p);
+    switch (type)
+    {
+        case PlyType::int8:
+            return read<int8_t>(p);
+        case PlyType::uint8:
+            return read<uint8_t>(p);
+        case PlyType::int16:
+            return read<int16_t>(p);
+        case PlyType::uint16:
+            return read<uint16_t>(p);
+        case PlyType::int32:
+            return static_cast<float>(read<int32_t>(p));
+        case PlyType::uint32:
+            return static_cast<float>(read<uint32_t>(p));
+        case PlyType::float64:
+            return static_cast<float>(read<double>(p));
+        default:
+            return 0.0f;
+    }
+}
+
+// Integers as they are, negative ones and floats as -1, which no count or index can be
+int64_t read_integer(PlyType type, uint8_t const* p)
+{
+    switch (type)
+    {
+        case PlyType::int8:
+            return read<int8_t>(p);
+        case PlyType::uint8:
+            return read<uint8_t>(p);
+        case PlyType::int16:
+            return read<int16_t>(p);
+        case PlyType::uint16:
+            return read<uint16_t>(p);
+        case PlyType::int32:
+            return std::max<int64_t>(read<int32_t>(p), -1);
+        case PlyType::uint32:
+            return read<uint32_t>(p);
+        default:
+            return -1;
+    }
+}
+
+int64_t PlyElement::offset(std::string const& property) const
+{
+    size_t offset = 0;
+    for (auto const& candidate : properties)
+    {
+        if (candidate.list) return -1;
+        if (candidate.name == property) return static_cast<int64_t>(offset);
+        offset += type_size(candidate.type);
+    }
+    return -1;
+}
+
+bool parse_header(uint8_t const* data, size_t size, PlyHeader& header, std::string& error)
+{
+    constexpr char END_HEADER[] = "end_header";
+    auto text = reinterpret_cast<char const*>(data);
+    char const* text_end = text + size;
+    bool first_line = true;
+    bool has_format = false;
+    for (char const* line = text; line < text_end;)
+    {
+        auto line_end = static_cast<char const*>(std::memchr(line, '\n', text_end - line));
+        if (line_end == nullptr) break;
+        std::string content(line, line_end);
+        line = line_end + 1;
+        if (!content.empty() && content.back() == '\r') content.pop_back();
+
+        if (first_line)
+        {
+            if (content != "ply") break;
+            first_line = false;
+            continue;
+        }
+        std::istringstream words(content);
+        std::string keyword;
+        words >> keyword;
+        if (keyword == END_HEADER)
+        {
+            if (!has_format)
+            {
+                error = "the header has no format line";
+                return false;
+            }
+            header.data_offset = static_cast<size_t>(line - text);
+            return true;
+        }
+        if (keyword == "format")
+        {
+            std::string format;
+            std::string version;
+            words >> format >> version;
+            if (format != "binary_little_endian")
+            {
+                error = fmt::format("{} files are not supported, only binary_little_endian",
+                                    format);
+                return false;
+            }
+            if (version != "1.0")
+            {
+                error = fmt::format("PLY version '{}' is not supported, only 1.0", version);
+                return false;
+            }
+            has_format = true;
+            continue;
+        }
+        if (keyword == "element")
+        {
+            PlyElement element;
+            words >> element.name >> element.count;
+            if (!words)
+            {
+                error = fmt::format("invalid element '{}'", content);
+                return false;
+            }
+            header.elements.push_back(std::move(element));
+            continue;
+        }
+        if (keyword == "property")
+        {
+            if (header.elements.empty())
+            {
+                error = "a property comes before any element";
+                return false;
+            }
+            PlyProperty property;
+            std::string type;
+            words >> type;
+            bool valid = true;
+            if (type == "list")
+            {
+                std::string count_type;
+                words >> count_type >> type;
+                property.list = true;
+                valid = parse_type(count_type, property.count_type) &&
+                        property.count_type != PlyType::float32 &&
+                        property.count_type != PlyType::float64;
+            }
+            words >> property.name;
+            if (!valid || !words || !parse_type(type, property.type))
+            {
+                error = fmt::format("invalid property '{}'", content);
+                return false;
+            }
+            header.elements.back().properties.push_back(std::move(property));
+            continue;
+        }
+        // comment, obj_info and anything unknown carry nothing the mesh needs
+    }
+    error = first_line ? "not a PLY file" : "the header has no end_header";
+    return false;
+}
+
+// End of the value of property at p, or nullptr if it does not fit before end
+uint8_t const* skip_property(PlyProperty const& property, uint8_t const* p, uint8_t const* end)
+{
+    size_t size = type_size(property.type);
+    if (!property.list) return static_cast<size_t>(end - p) >= size ? p + size : nullptr;
+    if (static_cast<size_t>(end - p) < type_size(property.count_type)) return nullptr;
+    int64_t count = read_integer(property.count_type, p);
+    if (count < 0) return nullptr;
+    p += type_size(property.count_type);
+    if (static_cast<size_t>(end - p) / size < static_cast<size_t>(count)) return nullptr;
+    return p + static_cast<size_t>(count) * size;
+}
+
+// End of the record of element at p, or nullptr if it does not fit before end
+uint8_t const* skip_record(PlyElement const& element, uint8_t const* p, uint8_t const* end)
+{
+    for (auto const& property : element.properties)
+        if (!(p = skip_property(property, p, end))) return nullptr;
+    return p;
+}
+
+// Bytes of all records of element at p, or SIZE_MAX if they do not fit before end
+size_t element_size(PlyElement const& element, uint8_t const* p, uint8_t const* end)
+{
+    if (element.stride != 0)
+        return element.count <= static_cast<size_t>(end - p) / element.stride
+                   ? element.count * element.stride
+                   : SIZE_MAX;
+    uint8_t const* record = p;
+    for (size_t i = 0; i < element.count && record; i++) record = skip_record(element, record, end);
+    return record ? static_cast<size_t>(record - p) : SIZE_MAX;
+}
+}  // namespace
+
+bool load_ply(std::string const& path, int material_id, Mesh& mesh,
+              PlyLoadSettings const& settings)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    auto fail = [&](std::string const& reason) {
+        fmt::print("[{}: {}] {}: {}\n", "ERROR", "MODEL-LOADING", path, reason);
+        return false;
+    };
+
+    MappedFile file;
+    if (!file.open(path))
+    {
+        fmt::print("[{}: {}] unable to open {}\n", "ERROR", "MODEL-LOADING", path);
+        return false;
+    }
+    PlyHeader header;
+    std::string error;
+    if (!parse_header(file.data(), file.size(), header, error)) return fail(error);
+
+    // the records of the elements follow each other, the ones before the faces are skipped over
+    uint8_t const* data_end = file.data() + file.size();
+    uint8_t const* p = file.data() + header.data_offset;
+    PlyElement const* vertex_element = nullptr;
+    PlyElement const* face_element = nullptr;
+    uint8_t const* vertex_data = nullptr;
+    uint8_t const* face_data = nullptr;
+    for (auto& element : header.elements)
+    {
+        bool has_list = std::any_of(element.properties.begin(), element.properties.end(),
+                                    [](PlyProperty const& property) { return property.list; });
+        if (!has_list)
+            for (auto const& property : element.properties)
+                element.stride += type_size(property.type);
+
+        if (element.name == "vertex")
+        {
+            if (has_list) return fail("vertices with list properties are not supported");
+            vertex_element = &element;
+            vertex_data = p;
+        }
+        else if (element.name == "face")
+        {
+            // the records are read in order, so the vertices must be known by now
+            if (!vertex_element)
+            {
+                auto vertex = std::find_if(
+                    header.elements.begin(), header.elements.end(),
+                    [](PlyElement const& other) { return other.name == "vertex"; });
+                if (vertex == header.elements.end()) return fail("there is no vertex element");
+                return fail("the vertex element must precede the face element, the header "
+                            "lists 'face' before 'vertex'");
+            }
+            face_element = &element;
+            face_data = p;
+            break;
+        }
+        size_t size = element_size(element, p, data_end);
+        if (size == SIZE_MAX)
+            return fail(fmt::format("the {} records are cut short", element.name));
+        p += size;
+    }
+    if (!vertex_element) return fail("there is no vertex element");
+    if (!face_element) return fail("there is no face element");
+
+    // vertices, only the properties the mesh needs
+    auto property_of = [&](std::initializer_list<char const*> names) -> PlyProperty const* {
+        for (auto const* name : names)
+            for (auto const& property : vertex_element->properties)
+                if (property.name == name) return &property;
+        return nullptr;
+    };
+    PlyProperty const* position[3] = {property_of({"x"}), property_of({"y"}), property_of({"z"})};
+    PlyProperty const* normal[3] = {property_of({"nx"}), property_of({"ny"}),
+                                    property_of({"nz"})};
+    PlyProperty const* texcoord[2] = {property_of({"u", "s", "texture_u"}),
+                                      property_of({"v", "t", "texture_v"})};
+    if (!position[0] || !position[1] || !position[2]) return fail("the vertices have no position");
+    bool has_normals = normal[0] && normal[1] && normal[2];
+    bool has_texcoords = texcoord[0] && texcoord[1];
+    size_t vertex_count = vertex_element->count;
+    if (vertex_count >= UINT32_MAX) return fail("too many vertices for 32 bit indices");
+
+    auto offset = [&](PlyProperty const* property) {
+        return static_cast<size_t>(vertex_element->offset(property->name));
+    };
+    size_t position_offsets[3] = {offset(position[0]), offset(position[1]), offset(position[2])};
+    size_t normal_offsets[3] = {};
+    size_t texcoord_offsets[2] = {};
+    if (has_normals)
+        for (int axis = 0; axis < 3; axis++) normal_offsets[axis] = offset(normal[axis]);
+    if (has_texcoords)
+        for (int axis = 0; axis < 2; axis++) texcoord_offsets[axis] = offset(texcoord[axis]);
+
+    ThreadPool pool(settings.thread_count);
+    mesh = Mesh{};
+    mesh.material_id = material_id;
+    mesh.vertices.resize(vertex_count);
+    size_t vertex_stride = vertex_element->stride;
+    pool.parallel_for(vertex_count, PARALLEL_GRAIN_SIZE, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            uint8_t const* record = vertex_data + i * vertex_stride;
+            Vertex& vertex = mesh.vertices[i];
+            for (int axis = 0; axis < 3; axis++)
+                vertex.position[axis] =
+                    read_float(position[axis]->type, record + position_offsets[axis]);
+            if (has_normals)
+                for (int axis = 0; axis < 3; axis++)
+                    vertex.normal[axis] =
+                        read_float(normal[axis]->type, record + normal_offsets[axis]);
+            if (has_texcoords)
+            {
+                vertex.u = read_float(texcoord[0]->type, record + texcoord_offsets[0]);
+                vertex.v = read_float(texcoord[1]->type, record + texcoord_offsets[1]);
+            }
+        }
+    });
+
+    // faces
+    auto indices = std::find_if(face_element->properties.begin(), face_element->properties.end(),
+                                [](PlyProperty const& property) {
+                                    return property.list && (property.name == "vertex_indices" ||
+                                                             property.name == "vertex_index");
+                                });
+    if (indices == face_element->properties.end()) return fail("the faces have no vertex indices");
+    if (indices->type == PlyType::float32 || indices->type == PlyType::float64)
+        return fail("the vertex indices are not integers");
+    size_t face_count = face_element->count;
+    size_t count_size = type_size(indices->count_type);
+    size_t index_size = type_size(indices->type);
+
+    std::vector<FaceBlock> blocks;
+    size_t triangle_count = 0;
+    // with nothing but the index list, faces that are all triangles have a fixed stride. If the
+    // count at every stride is 3, every record is a triangle by induction.
+    size_t triangle_stride = count_size + 3 * index_size;
+    bool fixed_stride = face_element->properties.size() == 1 &&
+                        face_count <= static_cast<size_t>(data_end - face_data) / triangle_stride;
+    if (fixed_stride)
+    {
+        std::atomic<bool> polygons{false};
+        pool.parallel_for(face_count, PARALLEL_GRAIN_SIZE, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end && !polygons.load(std::memory_order_relaxed); i++)
+                if (read_integer(indices->count_type, face_data + i * triangle_stride) != 3)
+                    polygons = true;
+        });
+        fixed_stride = !polygons;
+    }
+    if (fixed_stride)
+    {
+        for (size_t first = 0; first < face_count; first += FACE_BLOCK_SIZE)
+            blocks.push_back(FaceBlock{first, first * triangle_stride, first});
+        triangle_count = face_count;
+    }
+    else
+    {
+        // only the list counts are read, to find where the blocks start
+        uint8_t const* record = face_data;
+        for (size_t i = 0; i < face_count; i++)
+        {
+            if (i % FACE_BLOCK_SIZE == 0)
+                blocks.push_back(
+                    FaceBlock{i, static_cast<size_t>(record - face_data), triangle_count});
+            uint8_t const* list = record;
+            for (auto it = face_element->properties.begin(); it != indices && list; ++it)
+                list = skip_property(*it, list, data_end);
+            record = list ? skip_record(*face_element, record, data_end) : nullptr;
+            if (!record) return fail("the face records are cut short");
+            triangle_count += std::max<int64_t>(read_integer(indices->count_type, list) - 2, 0);
+        }
+    }
+    if (3 * triangle_count >= UINT32_MAX) return fail("too many faces for 32 bit indices");
+
+    // every block writes its triangles at their offset, polygons as fans around their first corner
+    mesh.indices.resize(3 * triangle_count);
+    std::atomic<bool> out_of_range{false};
+    pool.parallel_for(blocks.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t b = begin; b < end; b++)
+        {
+            FaceBlock const& block = blocks[b];
+            size_t last = std::min(face_count, block.first_face + FACE_BLOCK_SIZE);
+            uint8_t const* record = face_data + block.byte_offset;
+            uint32_t* out = mesh.indices.data() + 3 * block.first_triangle;
+            bool invalid = false;
+            auto index = [&](uint8_t const* list, int64_t corner) {
+                int64_t value =
+                    read_integer(indices->type, list + count_size + corner * index_size);
+                if (value < 0 || static_cast<size_t>(value) >= vertex_count)
+                {
+                    invalid = true;
+                    return uint32_t{0};
+                }
+                return static_cast<uint32_t>(value);
+            };
+            for (size_t i = block.first_face; i < last; i++)
+            {
+                uint8_t const* list = record;
+                if (fixed_stride)
+                {
+                    record += triangle_stride;
+                }
+                else
+                {
+                    // the records were checked by the serial pass
+                    for (auto it = face_element->properties.begin(); it != indices; ++it)
+                        list = skip_property(*it, list, data_end);
+                    record = skip_record(*face_element, record, data_end);
+                }
+                int64_t corners = read_integer(indices->count_type, list);
+                if (corners < 3) continue;
+                uint32_t first = index(list, 0);
+                uint32_t previous = index(list, 1);
+                for (int64_t corner = 2; corner < corners; corner++)
+                {
+                    uint32_t current = index(list, corner);
+                    *out++ = first;
+                    *out++ = previous;
+                    *out++ = current;
+                    previous = current;
+                }
+            }
+            if (invalid) out_of_range = true;
+        }
+    });
+    if (out_of_range) return fail("the faces reference vertices the file does not define");
+    if (!has_normals) mesh.compute_normals();
+
+    std::chrono::duration<double, std::milli> load_time =
+        std::chrono::high_resolution_clock::now() - start;
+    fmt::print("[{}: {}] {}: {} vertices, {} triangles{}, {} MiB in {:.2f} ms on {} threads\n",
+               "INFO", "MODEL-LOADING", path, mesh.vertices.size(), mesh.triangle_count(),
+               fixed_stride ? "" : " from polygons", file.size() >> 20, load_time.count(),
+               pool.thread_count());
+    return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+
+#include "instancing.h"
+
+struct PlyLoadSettings
+{
+    // threads used by the parser, 0 uses every hardware thread
+    uint32_t thread_count = 0;
+};
+
+// Reads the vertex and face elements of a binary little endian PLY file into an indexed mesh, e.g.
+// a photogrammetry or LiDAR scan. Positions are x, y and z, normals nx, ny and nz and uvs u and v
+// (or s and t, texture_u and texture_v), other properties and elements are skipped. Faces are the
+// vertex_indices (or vertex_index) list, polygons are triangulated as fans.
+//
+// The file is memory mapped and the records are read in place. Vertices have a fixed stride and
+// are read in parallel. Faces have a fixed stride too if they only hold their index list and every
+// face is a triangle, which is checked at every stride in parallel. Otherwise a serial pass only
+// reads the list counts to find where blocks of faces start, and the blocks are read in parallel.
+// Normals are computed if the file has none. Returns false and prints the reason if the file
+// cannot be read, is ASCII or big endian, is cut short or references missing vertices.
+bool load_ply(std::string const& path, int material_id, Mesh& mesh,
+              PlyLoadSettings const& settings = {});
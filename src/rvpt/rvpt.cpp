@@ -1,8 +1,10 @@
 #include "rvpt.h"
 
 #include <cstdlib>
+#include <cstring>
 
 #include <algorithm>
+#include <chrono>
 #include <fstream>
 
 #include <glm/glm.hpp>
@@ -13,6 +15,7 @@
 
 #include "imgui_helpers.h"
 #include "imgui_internal.h"
+#include "thread_pool.h"
 
 struct DebugVertex
 {
@@ -28,7 +31,9 @@ bool RVPT::PreviousFrameState::operator==(RVPT::PreviousFrameState const& right)
            settings.top_right_render_mode == right.settings.top_right_render_mode &&
            settings.bottom_left_render_mode == right.settings.bottom_left_render_mode &&
            settings.bottom_right_render_mode == right.settings.bottom_right_render_mode &&
-           settings.camera_mode == right.settings.camera_mode && camera_data == right.camera_data;
+           settings.camera_mode == right.settings.camera_mode &&
+           settings.traversal_mode == right.settings.traversal_mode &&
+           camera_data == right.camera_data;
 }
 
 RVPT::RVPT(Window& window)
@@ -50,7 +55,11 @@ RVPT::RVPT(Window& window)
     random_numbers.resize(20480);
 }
 
-RVPT::~RVPT() {}
+RVPT::~RVPT()
+{
+    if (sdf_bake) sdf_bake->cancelled = true;
+    sdf_pool.wait(sdf_bakes);
+}
 
 bool RVPT::initialize()
 {
@@ -75,10 +84,71 @@ bool RVPT::initialize()
     imgui_impl.emplace(vk_device, *graphics_queue, pipeline_builder, memory_allocator,
                        fullscreen_tri_render_pass, vkb_swapchain.extent, MAX_FRAMES_IN_FLIGHT);
 
+    if (stream_meshes && scene_file.has_bvh())
+    {
+        // its mesh buffers are filled straight from the file, there are no meshes to cluster
+        fmt::print("[{}: {}] meshes of a scene file with a prebuilt BVH are not streamed\n",
+                   "WARNING", "STREAMING");
+        stream_meshes = false;
+    }
+    // the array size is compiled into the pipeline
+    upload_textures();
     rendering_resources = create_rendering_resources();
 
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(context.device.physical_device.physical_device, &properties);
+    timestamp_period = properties.limits.timestampPeriod;
+
     create_framebuffers();
 
+    if (gpu_bvh_build)
+    {
+        gpu_bvh_builder.emplace(vk_device, pipeline_builder, memory_allocator,
+                                MAX_FRAMES_IN_FLIGHT);
+        // the GPU builder only outputs the binary layout, the UI does not offer the wide one
+        if (render_settings.traversal_mode == TRAVERSAL_WIDE)
+        {
+            fmt::print("[{}: {}] the GPU BVH builder has no wide BVH, traversing the binary one\n",
+                       "WARNING", "BVH");
+            render_settings.traversal_mode = TRAVERSAL_BINARY;
+        }
+    }
+    else
+    {
+        build_bvh();
+    }
+    sphere_grid.emplace(vk_device, pipeline_builder, memory_allocator, MAX_FRAMES_IN_FLIGHT);
+
+    size_t mesh_count = meshes.size();
+    size_t instance_count = mesh_instances.size();
+    if (scene_file.has_bvh())
+    {
+        // the buffers are filled straight from the mapped file
+        mesh_geometry = scene_file.instance_geometry();
+        mesh_count = scene_file.mesh_count();
+        instance_count = scene_file.instance_count();
+        // only over the world primitives, the meshes stay in the file
+        bake_distance_field();
+    }
+    else
+    {
+        build_instance_bvh();
+    }
+    sphere_hits = make_sphere_hits(spheres);
+    triangle_hits = make_triangle_hits(triangles);
+    if (instance_count > 0 && stream_meshes)
+        fmt::print("[{}: {}] {} instances of {} meshes in {} clusters, {} KiB of geometry, a pool "
+                   "of {} clusters\n",
+                   "INFO", "STREAMING", instance_count, mesh_count,
+                   cluster_streamer.cluster_count(), cluster_streamer.geometry_memory() / 1024,
+                   cluster_streamer.slots().size());
+    else if (instance_count > 0)
+        fmt::print("[{}: {}] {} instances of {} meshes with {} triangles, {} KiB of {} geometry\n",
+                   "INFO", "BVH", instance_count, mesh_count,
+                   mesh_geometry.indices.size / (3 * sizeof(uint32_t)),
+                   mesh_geometry.geometry_memory() / 1024,
+                   quantize_meshes ? "quantized" : "full precision");
+
     for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
         add_per_frame_data(i);
@@ -103,10 +173,52 @@ bool RVPT::update()
         render_settings.current_frame++;
     }
 
+    if (instances_changed)
+    {
+        build_instance_bvh();
+        geometry_version++;
+        // the accumulated samples miss the new meshes
+        render_settings.current_frame = 0;
+    }
+    else if (lod_settings.levels > 0 &&
+             lod_selector.select(mesh_lods, lod_view(), lod_settings.pixel_error))
+    {
+        place_instances();
+        // the accumulated samples show the previous levels
+        render_settings.current_frame = 0;
+    }
+
+    if (triangles_moved)
+    {
+        triangles_moved = false;
+        geometry_version++;
+        triangle_hits = make_triangle_hits(triangles);
+        // the accumulated samples show the old geometry
+        render_settings.current_frame = 0;
+
+        // the GPU builder rebuilds every frame anyway
+        if (!gpu_bvh_builder)
+        {
+            if (scene_bvh.refit(triangles, spheres))
+            {
+                fmt::print("[{}: {}] SAH cost grew past {}x, rebuilt with cost {:.2f}\n", "INFO",
+                           "BVH", scene_bvh.settings.max_sah_growth, scene_bvh.sah_cost());
+                scene_bvh_parents = bvh_parents(scene_bvh.nodes);
+            }
+            // the quantized boxes are relative to the parents, so they are collapsed again
+            wide_bvh.build(scene_bvh);
+        }
+        // the triangles may move again before a bake gets done
+        bake_distance_field(false);
+    }
+    update_distance_field();
+
     for (auto& r : random_numbers) r = (distribution(random_generator));
 
     per_frame_data[current_frame_index].raytrace_work_fence.wait();
     per_frame_data[current_frame_index].raytrace_work_fence.reset();
+    read_ray_stats();
+    if (stream_meshes) stream_clusters();
 
     per_frame_data[current_frame_index].settings_uniform.copy_to(render_settings);
     per_frame_data[current_frame_index].random_buffer.copy_to(random_numbers);
@@ -114,9 +226,110 @@ bool RVPT::update()
 
     float delta = static_cast<float>(time.since_last_frame());
 
-    per_frame_data[current_frame_index].sphere_buffer.copy_to(spheres);
-    per_frame_data[current_frame_index].triangle_buffer.copy_to(triangles);
-    per_frame_data[current_frame_index].material_buffer.copy_to(materials);
+    if (per_frame_data[current_frame_index].geometry_version != geometry_version)
+    {
+        auto& frame = per_frame_data[current_frame_index];
+        frame.sphere_buffer.copy_to(spheres);
+        frame.triangle_buffer.copy_to(triangles);
+        frame.sphere_hit_buffer.copy_to(sphere_hits);
+        frame.triangle_hit_buffer.copy_to(triangle_hits);
+
+        // a rebuild or a new collapse after a refit can change the number of nodes, and meshes
+        // added after initialize() grow the mesh buffers
+        bool resized = false;
+        if (!gpu_bvh_builder)
+        {
+            resized |= fit_buffer(frame.bvh_node_buffer, "bvh_nodes_buffer_",
+                                  sizeof(BvhNode) * scene_bvh.nodes.size());
+            resized |= fit_buffer(frame.bvh_index_buffer, "bvh_indices_buffer_",
+                                  sizeof(uint32_t) * scene_bvh.primitive_indices.size());
+            resized |= fit_buffer(frame.wide_bvh_node_buffer, "wide_bvh_nodes_buffer_",
+                                  sizeof(WideBvhNode) * wide_bvh.nodes.size());
+            resized |= fit_buffer(frame.wide_bvh_index_buffer, "wide_bvh_indices_buffer_",
+                                  sizeof(uint32_t) * wide_bvh.primitive_indices.size());
+            resized |= fit_buffer(frame.bvh_parent_buffer, "bvh_parents_buffer_",
+                                  sizeof(uint32_t) * scene_bvh_parents.size());
+        }
+        resized |= fit_buffer(frame.material_buffer, "materials_buffer_",
+                              sizeof(Material) * materials.size());
+        // streamed meshes live in the pool, see stream_clusters()
+        if (!stream_meshes)
+        {
+            resized |= fit_buffer(frame.mesh_vertex_buffer, "mesh_vertices_buffer_",
+                                  mesh_geometry.vertices.size);
+            resized |= fit_buffer(frame.mesh_index_buffer, "mesh_indices_buffer_",
+                                  mesh_geometry.indices.size);
+            resized |= fit_buffer(frame.mesh_triangle_hit_buffer, "mesh_triangle_hits_buffer_",
+                                  mesh_geometry.triangle_hits.size);
+            resized |= fit_buffer(frame.mesh_quantized_vertex_buffer,
+                                  "mesh_quantized_vertices_buffer_",
+                                  mesh_geometry.quantized_vertices.size);
+            resized |= fit_buffer(frame.blas_node_buffer, "blas_nodes_buffer_",
+                                  mesh_geometry.blas_nodes.size);
+            resized |= fit_buffer(frame.blas_index_buffer, "blas_indices_buffer_",
+                                  mesh_geometry.blas_indices.size);
+            resized |= fit_buffer(frame.blas_parent_buffer, "blas_parents_buffer_",
+                                  mesh_geometry.blas_parents.size);
+            resized |= fit_buffer(frame.tlas_node_buffer, "tlas_nodes_buffer_",
+                                  mesh_geometry.tlas_nodes.size);
+            resized |= fit_buffer(frame.instance_buffer, "instances_buffer_",
+                                  mesh_geometry.instances.size);
+        }
+        if (resized) write_raytrace_descriptors(current_frame_index);
+
+        if (!gpu_bvh_builder)
+        {
+            frame.bvh_node_buffer.copy_to(scene_bvh.nodes);
+            frame.bvh_index_buffer.copy_to(scene_bvh.primitive_indices);
+            frame.wide_bvh_node_buffer.copy_to(wide_bvh.nodes);
+            frame.wide_bvh_index_buffer.copy_to(wide_bvh.primitive_indices);
+            frame.bvh_parent_buffer.copy_to(scene_bvh_parents);
+        }
+        frame.material_buffer.copy_to(materials);
+        if (!stream_meshes)
+        {
+            frame.mesh_vertex_buffer.copy_bytes(mesh_geometry.vertices.data,
+                                                mesh_geometry.vertices.size);
+            frame.mesh_index_buffer.copy_bytes(mesh_geometry.indices.data,
+                                               mesh_geometry.indices.size);
+            frame.mesh_triangle_hit_buffer.copy_bytes(mesh_geometry.triangle_hits.data,
+                                                      mesh_geometry.triangle_hits.size);
+            frame.mesh_quantized_vertex_buffer.copy_bytes(mesh_geometry.quantized_vertices.data,
+                                                          mesh_geometry.quantized_vertices.size);
+            frame.blas_node_buffer.copy_bytes(mesh_geometry.blas_nodes.data,
+                                              mesh_geometry.blas_nodes.size);
+            frame.blas_index_buffer.copy_bytes(mesh_geometry.blas_indices.data,
+                                               mesh_geometry.blas_indices.size);
+            frame.blas_parent_buffer.copy_bytes(mesh_geometry.blas_parents.data,
+                                                mesh_geometry.blas_parents.size);
+            frame.tlas_node_buffer.copy_bytes(mesh_geometry.tlas_nodes.data,
+                                              mesh_geometry.tlas_nodes.size);
+            frame.instance_buffer.copy_bytes(mesh_geometry.instances.data,
+                                             mesh_geometry.instances.size);
+        }
+        frame.geometry_version = geometry_version;
+        frame.instance_version = instance_version;
+    }
+    // streamed instances are copied by stream_clusters()
+    if (per_frame_data[current_frame_index].instance_version != instance_version && !stream_meshes)
+    {
+        auto& frame = per_frame_data[current_frame_index];
+        bool resized = fit_buffer(frame.tlas_node_buffer, "tlas_nodes_buffer_",
+                                  mesh_geometry.tlas_nodes.size);
+        resized |= fit_buffer(frame.instance_buffer, "instances_buffer_",
+                              mesh_geometry.instances.size);
+        if (resized) write_raytrace_descriptors(current_frame_index);
+        frame.tlas_node_buffer.copy_bytes(mesh_geometry.tlas_nodes.data,
+                                          mesh_geometry.tlas_nodes.size);
+        frame.instance_buffer.copy_bytes(mesh_geometry.instances.data,
+                                         mesh_geometry.instances.size);
+        frame.instance_version = instance_version;
+    }
+    if (per_frame_data[current_frame_index].sdf_version != sdf_version)
+    {
+        upload_distance_field(current_frame_index);
+        per_frame_data[current_frame_index].sdf_version = sdf_version;
+    }
 
     if (debug_overlay_enabled)
     {
@@ -167,16 +380,20 @@ void RVPT::update_imgui()
     // imgui back end can't show 2 windows
     static bool show_stats = true;
     ImGui::SetNextWindowPos({0, 0}, ImGuiCond_Once);
-    ImGui::SetNextWindowSize({200, 65}, ImGuiCond_Once);
+    ImGui::SetNextWindowSize({200, 85}, ImGuiCond_Once);
     if (ImGui::Begin("Stats", &show_stats))
     {
         ImGui::Text("Frame Time %.4f", time.average_frame_time());
         ImGui::Text("FPS %.2f", 1.0 / time.average_frame_time());
+        ImGui::Text("Mrays/s %.2f", rays_per_second * 1e-6);
+        if (lod_settings.levels > 0)
+            ImGui::Text("LOD Mtris %.2f of %.2f", lod_selector.selected_triangles() * 1e-6,
+                        lod_selector.full_triangles() * 1e-6);
     }
     ImGui::End();
     static bool show_render_settings = true;
-    ImGui::SetNextWindowPos({0, 65}, ImGuiCond_Once);
-    ImGui::SetNextWindowSize({200, 190}, ImGuiCond_Once);
+    ImGui::SetNextWindowPos({0, 85}, ImGuiCond_Once);
+    ImGui::SetNextWindowSize({200, 230}, ImGuiCond_Once);
     if (ImGui::Begin("Render Settings", &show_stats))
     {
         ImGui::PushItemWidth(80);
@@ -211,6 +428,32 @@ void RVPT::update_imgui()
             ImGui::SameLine();
             if (ImGui::Checkbox("4-way", &vertical_split)) render_settings.split_ratio.y = 0.5f;
         }
+        ImGui::Text("Traversal");
+        ImGui::PushItemWidth(0);
+        dropdown_helper("traversal", render_settings.traversal_mode, TraversalModes,
+                        gpu_bvh_builder ? 1u << TRAVERSAL_WIDE : 0u);
+        int stack = static_cast<int>(traversal_stack);
+        dropdown_helper("traversal_stack", stack, TraversalStacks);
+        if (stack != static_cast<int>(traversal_stack))
+            set_traversal_stack(static_cast<TraversalStack>(stack));
+        if (ImGui::IsItemHovered())
+            ImGui::SetTooltip("Binary BVHs only, the wide BVH always keeps a local stack");
+        ImGui::PopItemWidth();
+        if (lod_settings.levels > 0)
+            ImGui::SliderFloat("LOD Pixel Error", &lod_settings.pixel_error, 0.25f, 16.0f);
+        if (!gpu_bvh_builder)
+        {
+            // rebuilds the scene BVH with or without the treelet passes, the throughput of the
+            // replaced one is logged
+            bool treelets = bvh_settings.treelet_passes > 0;
+            if (ImGui::Checkbox("Treelet restructuring", &treelets))
+            {
+                bvh_settings.treelet_passes = treelets ? BvhBuildSettings{}.treelet_passes : 0;
+                build_bvh();
+                geometry_version++;
+                render_settings.current_frame = 0;
+            }
+        }
         ImGui::Text("Render Mode");
         ImGui::PushItemWidth(0);
         dropdown_helper("top_left", render_settings.top_left_render_mode, RenderModes);
@@ -308,11 +551,14 @@ RVPT::draw_return RVPT::draw()
 
 void RVPT::shutdown()
 {
+    report_bvh_throughput();
     if (compute_queue) compute_queue->wait_idle();
     graphics_queue->wait_idle();
     present_queue->wait_idle();
 
     per_frame_data.clear();
+    gpu_bvh_builder.reset();
+    sphere_grid.reset();
     rendering_resources.reset();
 
     imgui_impl.reset();
@@ -385,6 +631,7 @@ bool RVPT::context_init()
     vkb::InstanceBuilder inst_builder;
     auto inst_ret =
         inst_builder.set_app_name(window_ref.get_settings().title)
+            .require_api_version(1, 1, 0)
             .request_validation_layers(use_validation)
             .set_debug_callback([](VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
                                    VkDebugUtilsMessageTypeFlagsEXT messageType,
@@ -416,19 +663,65 @@ bool RVPT::context_init()
     required_features.samplerAnisotropy = true;
     required_features.fillModeNonSolid = true;
 
-    vkb::PhysicalDeviceSelector selector(context.inst);
-    auto phys_ret = selector.set_surface(context.surf)
-                        .set_required_features(required_features)
-                        .set_minimum_version(1, 1)
-                        .select();
-
+    auto select_device = [&]() {
+        vkb::PhysicalDeviceSelector selector(context.inst);
+        selector.set_surface(context.surf)
+            .set_required_features(required_features)
+            .set_minimum_version(1, 1);
+        if (texture_indexing)
+            selector.add_required_extension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        return selector.select();
+    };
+    texture_indexing = false;
+    auto phys_ret = select_device();
     if (!phys_ret)
     {
         fmt::print(stderr, "Failed to find a physical device: \n", phys_ret.error().message());
         return false;
     }
 
-    vkb::DeviceBuilder dev_builder(phys_ret.value());
+    // neighbouring rays can hit materials with different textures, which needs the texture array
+    // indexed with a non uniform index
+    VkPhysicalDevice physical_device = phys_ret.value().physical_device;
+    uint32_t extension_count = 0;
+    vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &extension_count, nullptr);
+    std::vector<VkExtensionProperties> extensions(extension_count);
+    vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &extension_count,
+                                         extensions.data());
+    bool has_descriptor_indexing =
+        std::any_of(extensions.begin(), extensions.end(), [](VkExtensionProperties const& ext) {
+            return std::strcmp(ext.extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) == 0;
+        });
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptor_indexing{};
+    descriptor_indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    if (has_descriptor_indexing) features.pNext = &descriptor_indexing;
+    vkGetPhysicalDeviceFeatures2(physical_device, &features);
+    texture_indexing = has_descriptor_indexing &&
+                       features.features.shaderSampledImageArrayDynamicIndexing &&
+                       descriptor_indexing.shaderSampledImageArrayNonUniformIndexing;
+    required_features.shaderSampledImageArrayDynamicIndexing = texture_indexing;
+    if (!texture_indexing)
+    {
+        fmt::print("[{}: {}] the device does not support non uniform indexing of texture arrays "
+                   "(VK_EXT_descriptor_indexing), meshes are rendered without textures\n",
+                   "WARNING", "TEXTURES");
+    }
+    // selects the same device again, with the extension and features enabled if it has them
+    auto indexing_phys_ret = texture_indexing ? select_device() : phys_ret;
+    if (!indexing_phys_ret)
+    {
+        fmt::print(stderr, "Failed to find a physical device: {}\n",
+                   indexing_phys_ret.error().message());
+        return false;
+    }
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT enabled_indexing{};
+    enabled_indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    enabled_indexing.shaderSampledImageArrayNonUniformIndexing = true;
+
+    vkb::DeviceBuilder dev_builder(indexing_phys_ret.value());
+    if (texture_indexing) dev_builder.add_pNext(&enabled_indexing);
     auto dev_ret = dev_builder.build();
     if (!dev_ret)
     {
@@ -552,6 +845,32 @@ RVPT::RenderingResources RVPT::create_rendering_resources()
         {5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
         {6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
         {7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {9, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {10, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {11, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {12, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {13, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {14, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {15, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {16, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {17, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {18, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {19, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {20, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {21, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {22, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {23, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {24, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {25, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {26, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {27, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {28, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {29, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {30, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {31, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, static_cast<uint32_t>(textures.size()),
+         VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+        {32, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
     };
 
     auto raytrace_descriptor_pool = VK::DescriptorPool(
@@ -576,7 +895,9 @@ RVPT::RenderingResources RVPT::create_rendering_resources()
     VK::ComputePipelineDetails raytrace_details;
     raytrace_details.name = "raytrace_compute_pipeline";
     raytrace_details.pipeline_layout = raytrace_pipeline_layout;
-    raytrace_details.compute_shader = "compute_pass.comp.spv";
+    raytrace_details.compute_shader =
+        texture_indexing ? "compute_pass.comp.spv" : "compute_pass_single_texture.comp.spv";
+    raytrace_details.specialization_constants = raytrace_specialization_constants();
 
     auto raytrace_pipeline = pipeline_builder.create_pipeline(raytrace_details);
 
@@ -681,18 +1002,121 @@ void RVPT::add_per_frame_data(int index)
         VK::Buffer(vk_device, memory_allocator, "spheres_buffer_" + std::to_string(index),
                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(Sphere) * spheres.size(),
                    VK::MemoryUsage::cpu_to_gpu);
+    // a scene made only of instances has no world triangles
     auto triangle_buffer =
         VK::Buffer(vk_device, memory_allocator, "triangles_buffer_" + std::to_string(index),
-                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(Triangle) * triangles.size(),
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                   sizeof(Triangle) * std::max<size_t>(triangles.size(), 1),
                    VK::MemoryUsage::cpu_to_gpu);
+    // an empty scene, or a BVH built on the GPU, still needs non zero sized buffers
+    auto bvh_node_buffer = VK::Buffer(
+        vk_device, memory_allocator, "bvh_nodes_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        sizeof(BvhNode) * std::max<size_t>(scene_bvh.nodes.size(), 1),
+        VK::MemoryUsage::cpu_to_gpu);
+    auto bvh_index_buffer = VK::Buffer(
+        vk_device, memory_allocator, "bvh_indices_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        sizeof(uint32_t) * std::max<size_t>(scene_bvh.primitive_indices.size(), 1),
+        VK::MemoryUsage::cpu_to_gpu);
     auto material_buffer =
         VK::Buffer(vk_device, memory_allocator, "materials_buffer_" + std::to_string(index),
-                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(Material) * materials.size(),
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                   sizeof(Material) * std::max<size_t>(materials.size(), 1),
                    VK::MemoryUsage::cpu_to_gpu);
+    auto mesh_vertex_buffer = VK::Buffer(
+        vk_device, memory_allocator, "mesh_vertices_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        std::max(mesh_geometry.vertices.size, sizeof(Vertex)),
+        VK::MemoryUsage::cpu_to_gpu);
+    auto mesh_index_buffer = VK::Buffer(
+        vk_device, memory_allocator, "mesh_indices_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        std::max(mesh_geometry.indices.size, sizeof(uint32_t)),
+        VK::MemoryUsage::cpu_to_gpu);
+    auto sphere_hit_buffer = VK::Buffer(
+        vk_device, memory_allocator, "sphere_hits_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(SphereHit) * std::max<size_t>(spheres.size(), 1),
+        VK::MemoryUsage::cpu_to_gpu);
+    auto triangle_hit_buffer = VK::Buffer(
+        vk_device, memory_allocator, "triangle_hits_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        sizeof(TriangleHit) * std::max<size_t>(triangles.size(), 1), VK::MemoryUsage::cpu_to_gpu);
+    auto mesh_triangle_hit_buffer = VK::Buffer(
+        vk_device, memory_allocator, "mesh_triangle_hits_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        std::max(mesh_geometry.triangle_hits.size, sizeof(TriangleHit)),
+        VK::MemoryUsage::cpu_to_gpu);
+    auto mesh_quantized_vertex_buffer = VK::Buffer(
+        vk_device, memory_allocator, "mesh_quantized_vertices_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        std::max(mesh_geometry.quantized_vertices.size, sizeof(QuantizedVertex)),
+        VK::MemoryUsage::cpu_to_gpu);
+    auto blas_node_buffer = VK::Buffer(
+        vk_device, memory_allocator, "blas_nodes_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        std::max(mesh_geometry.blas_nodes.size, sizeof(BvhNode)),
+        VK::MemoryUsage::cpu_to_gpu);
+    auto blas_index_buffer = VK::Buffer(
+        vk_device, memory_allocator, "blas_indices_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        std::max(mesh_geometry.blas_indices.size, sizeof(uint32_t)),
+        VK::MemoryUsage::cpu_to_gpu);
+    auto tlas_node_buffer = VK::Buffer(
+        vk_device, memory_allocator, "tlas_nodes_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        std::max(mesh_geometry.tlas_nodes.size, sizeof(BvhNode)), VK::MemoryUsage::cpu_to_gpu);
+    auto instance_buffer = VK::Buffer(
+        vk_device, memory_allocator, "instances_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        std::max(mesh_geometry.instances.size, sizeof(Instance)),
+        VK::MemoryUsage::cpu_to_gpu);
+    // empty when the BVH is built on the GPU
+    auto wide_bvh_node_buffer = VK::Buffer(
+        vk_device, memory_allocator, "wide_bvh_nodes_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        sizeof(WideBvhNode) * std::max<size_t>(wide_bvh.nodes.size(), 1),
+        VK::MemoryUsage::cpu_to_gpu);
+    auto wide_bvh_index_buffer = VK::Buffer(
+        vk_device, memory_allocator, "wide_bvh_indices_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        sizeof(uint32_t) * std::max<size_t>(wide_bvh.primitive_indices.size(), 1),
+        VK::MemoryUsage::cpu_to_gpu);
+    auto ray_stats_buffer =
+        VK::Buffer(vk_device, memory_allocator, "ray_stats_buffer_" + std::to_string(index),
+                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(uint32_t), VK::MemoryUsage::cpu);
+    ray_stats_buffer.copy_to(uint32_t{0});
+    auto bvh_parent_buffer = VK::Buffer(
+        vk_device, memory_allocator, "bvh_parents_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        sizeof(uint32_t) * std::max<size_t>(scene_bvh_parents.size(), 1),
+        VK::MemoryUsage::cpu_to_gpu);
+    auto blas_parent_buffer = VK::Buffer(
+        vk_device, memory_allocator, "blas_parents_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        std::max(mesh_geometry.blas_parents.size, sizeof(uint32_t)),
+        VK::MemoryUsage::cpu_to_gpu);
+    auto sdf_grid_buffer = VK::Buffer(vk_device, memory_allocator,
+                                      "sdf_grid_buffer_" + std::to_string(index),
+                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                      sdf_bricks.grid_data().size(), VK::MemoryUsage::cpu_to_gpu);
+    auto sdf_atlas = create_sdf_atlas(static_cast<uint32_t>(index));
+    // written before and after the path tracer dispatch
+    auto raytrace_timestamps =
+        VK::QueryPool(vk_device, VK_QUERY_TYPE_TIMESTAMP, 2,
+                      "raytrace_timestamps_" + std::to_string(index));
     auto raytrace_command_buffer =
         VK::CommandBuffer(vk_device, compute_queue.has_value() ? *compute_queue : *graphics_queue,
                           "raytrace_command_buffer_" + std::to_string(index));
     auto raytrace_work_fence = VK::Fence(vk_device, "raytrace_work_fence_" + std::to_string(index));
+    // read back like the ray stats
+    auto cluster_feedback_buffer = VK::Buffer(
+        vk_device, memory_allocator, "cluster_feedback_buffer_" + std::to_string(index),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        sizeof(uint32_t) * std::max<size_t>(cluster_streamer.cluster_count(), 1),
+        VK::MemoryUsage::cpu);
+    cluster_feedback_buffer.copy_to(
+        std::vector<uint32_t>(std::max<size_t>(cluster_streamer.cluster_count(), 1), 0));
 
     // descriptor sets
     auto image_descriptor_set = rendering_resources->image_pool.allocate(
@@ -707,20 +1131,6 @@ void RVPT::add_per_frame_data(int index)
     image_descriptors.push_back(std::vector{output_image.descriptor_info()});
     rendering_resources->image_pool.update_descriptor_sets(image_descriptor_set, image_descriptors);
 
-    std::vector<VK::DescriptorUseVector> raytracing_descriptors;
-    raytracing_descriptors.push_back(std::vector{settings_uniform.descriptor_info()});
-    raytracing_descriptors.push_back(std::vector{output_image.descriptor_info()});
-    raytracing_descriptors.push_back(
-        std::vector{rendering_resources->temporal_storage_image.descriptor_info()});
-    raytracing_descriptors.push_back(std::vector{random_buffer.descriptor_info()});
-    raytracing_descriptors.push_back(std::vector{camera_uniform.descriptor_info()});
-    raytracing_descriptors.push_back(std::vector{sphere_buffer.descriptor_info()});
-    raytracing_descriptors.push_back(std::vector{triangle_buffer.descriptor_info()});
-    raytracing_descriptors.push_back(std::vector{material_buffer.descriptor_info()});
-
-    rendering_resources->raytrace_descriptor_pool.update_descriptor_sets(raytracing_descriptor_set,
-                                                                         raytracing_descriptors);
-
     // Debug vis
     auto debug_camera_uniform = VK::Buffer(
         vk_device, memory_allocator, "debug_camera_uniform_" + std::to_string(index),
@@ -740,9 +1150,101 @@ void RVPT::add_per_frame_data(int index)
     per_frame_data.push_back(RVPT::PerFrameData{
         std::move(settings_uniform), std::move(output_image), std::move(random_buffer),
         std::move(camera_uniform), std::move(sphere_buffer), std::move(triangle_buffer),
-        std::move(material_buffer), std::move(raytrace_command_buffer),
-        std::move(raytrace_work_fence), image_descriptor_set, raytracing_descriptor_set,
-        std::move(debug_camera_uniform), std::move(debug_vertex_buffer), debug_descriptor_set});
+        std::move(bvh_node_buffer), std::move(bvh_index_buffer), std::move(material_buffer),
+        std::move(mesh_vertex_buffer), std::move(mesh_index_buffer), std::move(sphere_hit_buffer),
+        std::move(triangle_hit_buffer), std::move(mesh_triangle_hit_buffer),
+        std::move(mesh_quantized_vertex_buffer),
+        std::move(blas_node_buffer), std::move(blas_index_buffer), std::move(tlas_node_buffer),
+        std::move(instance_buffer), std::move(wide_bvh_node_buffer),
+        std::move(wide_bvh_index_buffer), std::move(ray_stats_buffer), std::move(bvh_parent_buffer),
+        std::move(blas_parent_buffer), std::move(sdf_grid_buffer), std::move(sdf_atlas),
+        std::move(raytrace_timestamps),
+        std::move(raytrace_command_buffer), std::move(raytrace_work_fence), image_descriptor_set,
+        raytracing_descriptor_set, std::move(debug_camera_uniform), std::move(debug_vertex_buffer),
+        debug_descriptor_set, std::move(cluster_feedback_buffer)});
+
+    if (gpu_bvh_builder)
+        gpu_bvh_builder->add_frame(per_frame_data.back().triangle_buffer,
+                                   static_cast<uint32_t>(triangles.size()),
+                                   per_frame_data.back().sphere_buffer,
+                                   static_cast<uint32_t>(spheres.size()));
+    sphere_grid->add_frame(per_frame_data.back().sphere_buffer,
+                           static_cast<uint32_t>(spheres.size()));
+    write_raytrace_descriptors(static_cast<uint32_t>(index));
+}
+
+bool RVPT::fit_buffer(VK::Buffer& buffer, std::string const& name, size_t size,
+                      VK::MemoryUsage memory_usage)
+{
+    if (buffer.size() >= size) return false;
+    buffer = VK::Buffer(vk_device, memory_allocator, name + std::to_string(current_frame_index),
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, size, memory_usage);
+    return true;
+}
+
+void RVPT::write_raytrace_descriptors(uint32_t index)
+{
+    auto& frame = per_frame_data[index];
+    std::vector<VK::DescriptorUseVector> raytracing_descriptors;
+    raytracing_descriptors.push_back(std::vector{frame.settings_uniform.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.output_image.descriptor_info()});
+    raytracing_descriptors.push_back(
+        std::vector{rendering_resources->temporal_storage_image.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.random_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.camera_uniform.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.sphere_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.triangle_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.material_buffer.descriptor_info()});
+    if (gpu_bvh_builder)
+    {
+        raytracing_descriptors.push_back(
+            std::vector{gpu_bvh_builder->node_buffer(index).descriptor_info()});
+        raytracing_descriptors.push_back(
+            std::vector{gpu_bvh_builder->index_buffer(index).descriptor_info()});
+    }
+    else
+    {
+        raytracing_descriptors.push_back(std::vector{frame.bvh_node_buffer.descriptor_info()});
+        raytracing_descriptors.push_back(std::vector{frame.bvh_index_buffer.descriptor_info()});
+    }
+    raytracing_descriptors.push_back(std::vector{frame.mesh_vertex_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.blas_node_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.blas_index_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.tlas_node_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.instance_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.wide_bvh_node_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.wide_bvh_index_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.ray_stats_buffer.descriptor_info()});
+    if (gpu_bvh_builder)
+        raytracing_descriptors.push_back(
+            std::vector{gpu_bvh_builder->parent_buffer(index).descriptor_info()});
+    else
+        raytracing_descriptors.push_back(std::vector{frame.bvh_parent_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.blas_parent_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.sdf_grid_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.sdf_atlas.descriptor_info()});
+    raytracing_descriptors.push_back(
+        std::vector{sphere_grid->grid_buffer(index).descriptor_info()});
+    raytracing_descriptors.push_back(
+        std::vector{sphere_grid->start_buffer(index).descriptor_info()});
+    raytracing_descriptors.push_back(
+        std::vector{sphere_grid->count_buffer(index).descriptor_info()});
+    raytracing_descriptors.push_back(
+        std::vector{sphere_grid->reference_buffer(index).descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.mesh_index_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.sphere_hit_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(std::vector{frame.triangle_hit_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(
+        std::vector{frame.mesh_triangle_hit_buffer.descriptor_info()});
+    raytracing_descriptors.push_back(
+        std::vector{frame.mesh_quantized_vertex_buffer.descriptor_info()});
+    std::vector<VkDescriptorImageInfo> texture_infos;
+    for (auto const& texture : textures) texture_infos.push_back(texture.descriptor_info());
+    raytracing_descriptors.push_back(texture_infos);
+    raytracing_descriptors.push_back(std::vector{frame.cluster_feedback_buffer.descriptor_info()});
+
+    rendering_resources->raytrace_descriptor_pool.update_descriptor_sets(
+        frame.raytracing_descriptor_sets, raytracing_descriptors);
 }
 
 void RVPT::record_command_buffer(VK::SyncResources& current_frame, uint32_t swapchain_image_index)
@@ -831,6 +1333,11 @@ void RVPT::record_compute_command_buffer()
     command_buffer.begin();
     VkCommandBuffer cmd_buf = command_buffer.get();
 
+    // the path tracer reads the BVH, so it has to be rebuilt first
+    if (gpu_bvh_builder) gpu_bvh_builder->record(cmd_buf, current_frame_index);
+    if (render_settings.traversal_mode == TRAVERSAL_GRID)
+        sphere_grid->record(cmd_buf, current_frame_index);
+
     VkImageMemoryBarrier in_temporal_image_barrier = {};
     in_temporal_image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     in_temporal_image_barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
@@ -855,18 +1362,535 @@ void RVPT::record_compute_command_buffer()
         cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, rendering_resources->raytrace_pipeline_layout, 0,
         1, &per_frame_data[current_frame_index].raytracing_descriptor_sets.set, 0, 0);
 
+    auto& timestamps = per_frame_data[current_frame_index].raytrace_timestamps;
+    timestamps.reset(cmd_buf);
+    vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamps.get(), 0);
     vkCmdDispatch(cmd_buf, per_frame_data[current_frame_index].output_image.width / 16,
                   per_frame_data[current_frame_index].output_image.height / 16, 1);
+    vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamps.get(), 1);
 
     command_buffer.end();
 }
 
+void RVPT::build_bvh()
+{
+    report_bvh_throughput();
+    auto start = std::chrono::high_resolution_clock::now();
+    scene_bvh.build(triangles, spheres, bvh_settings);
+    std::chrono::duration<double, std::milli> build_time =
+        std::chrono::high_resolution_clock::now() - start;
+
+    if (bvh_settings.quality == BvhQuality::high)
+        fmt::print("[{}: {}] {} nodes over {} triangles and {} spheres ({} references) in "
+                   "{:.2f} ms with spatial splits, SAH cost {:.2f}\n",
+                   "INFO", "BVH", scene_bvh.nodes.size(), triangles.size(), spheres.size(),
+                   scene_bvh.primitive_indices.size(), build_time.count(),
+                   scene_bvh.sah_cost());
+    else
+        fmt::print("[{}: {}] {} nodes over {} triangles and {} spheres in {:.2f} ms on {} "
+                   "threads, SAH cost {:.2f}\n",
+                   "INFO", "BVH", scene_bvh.nodes.size(), triangles.size(), spheres.size(),
+                   build_time.count(), ThreadPool::resolve_thread_count(bvh_settings.thread_count),
+                   scene_bvh.sah_cost());
+    if (bvh_settings.treelet_passes > 0)
+        fmt::print("[{}: {}] {} treelet passes lowered the SAH cost from {:.2f} to {:.2f}\n",
+                   "INFO", "BVH", bvh_settings.treelet_passes, scene_bvh.initial_sah_cost,
+                   scene_bvh.sah_cost());
+
+    scene_bvh_parents = bvh_parents(scene_bvh.nodes);
+    wide_bvh.build(scene_bvh);
+    fmt::print("[{}: {}] collapsed into {} {} wide nodes, {} KiB instead of {} KiB\n", "INFO",
+               "BVH", wide_bvh.nodes.size(), WIDE_BVH_WIDTH, wide_bvh.node_memory() / 1024,
+               scene_bvh.nodes.size() * sizeof(BvhNode) / 1024);
+}
+
+void RVPT::build_instance_bvh()
+{
+    instances_changed = false;
+    // the meshes arrive with their levels and quantized, see add_prepared_mesh()
+    lod_selector.set_instances(mesh_lods, mesh_instances);
+    lod_selector.select(mesh_lods, lod_view(), lod_settings.pixel_error);
+    if (stream_meshes)
+    {
+        // the clusters keep the only copy of the geometry, a mesh added later is clustered once
+        cluster_streamer.settings = streaming_settings;
+        cluster_streamer.add_meshes(meshes);
+        cluster_streamer.set_instances(lod_selector.instances(), bvh_settings);
+        // the bakes read sdf_meshes instead
+        for (auto& mesh : meshes)
+        {
+            std::vector<Vertex>().swap(mesh.vertices);
+            std::vector<QuantizedVertex>().swap(mesh.quantized_vertices);
+            std::vector<uint32_t>().swap(mesh.indices);
+            mesh.bvh = BVH{};
+        }
+    }
+    else
+    {
+        instance_bvh.build(meshes, lod_selector.instances(), bvh_settings);
+        mesh_geometry = instance_geometry(instance_bvh);
+    }
+    // a bake of the previous instances is of no use anymore
+    bake_distance_field();
+}
+
+void RVPT::place_instances()
+{
+    if (stream_meshes)
+    {
+        cluster_streamer.set_instances(lod_selector.instances(), bvh_settings);
+        return;
+    }
+    instance_bvh.set_instances(meshes, lod_selector.instances(), bvh_settings);
+    mesh_geometry = instance_geometry(instance_bvh);
+    instance_version++;
+}
+
+LodView RVPT::lod_view()
+{
+    return make_lod_view(scene_camera, static_cast<float>(vkb_swapchain.extent.height));
+}
+
+void RVPT::stream_clusters()
+{
+    auto& frame = per_frame_data[current_frame_index];
+    // the flags of the last frame that used these buffers, it has finished
+    if (frame.geometry_version != 0)
+    {
+        std::vector<uint32_t> reached(frame.cluster_feedback_buffer.size() / sizeof(uint32_t));
+        frame.cluster_feedback_buffer.copy_from(reached);
+        // the accumulated samples miss the clusters that were paged in
+        if (cluster_streamer.update(reached.data(), reached.size()))
+            render_settings.current_frame = 0;
+        std::fill(reached.begin(), reached.end(), 0);
+        frame.cluster_feedback_buffer.copy_to(reached);
+    }
+    if (frame.stream_version == cluster_streamer.version()) return;
+
+    // every slot has room for the largest cluster
+    ClusterSlotLayout const& layout = cluster_streamer.layout();
+    auto const& slots = cluster_streamer.slots();
+    size_t vertex_size = cluster_streamer.quantized() ? sizeof(QuantizedVertex) : sizeof(Vertex);
+    size_t hit_size = cluster_streamer.quantized() ? 0 : sizeof(TriangleHit);
+    VK::Buffer& vertex_buffer = cluster_streamer.quantized() ? frame.mesh_quantized_vertex_buffer
+                                                             : frame.mesh_vertex_buffer;
+    bool pool_resized = false;
+    pool_resized |= fit_buffer(vertex_buffer,
+                               cluster_streamer.quantized() ? "mesh_quantized_vertices_buffer_"
+                                                            : "mesh_vertices_buffer_",
+                               slots.size() * layout.vertices * vertex_size);
+    pool_resized |= fit_buffer(frame.mesh_index_buffer, "mesh_indices_buffer_",
+                               slots.size() * layout.triangles * 3 * sizeof(uint32_t));
+    pool_resized |= fit_buffer(frame.mesh_triangle_hit_buffer, "mesh_triangle_hits_buffer_",
+                               slots.size() * layout.triangles * hit_size);
+    pool_resized |= fit_buffer(frame.blas_node_buffer, "blas_nodes_buffer_",
+                               slots.size() * layout.nodes * sizeof(BvhNode));
+    pool_resized |= fit_buffer(frame.blas_index_buffer, "blas_indices_buffer_",
+                               slots.size() * layout.primitive_indices * sizeof(uint32_t));
+    pool_resized |= fit_buffer(frame.blas_parent_buffer, "blas_parents_buffer_",
+                               slots.size() * layout.nodes * sizeof(uint32_t));
+    bool resized = pool_resized;
+    resized |= fit_buffer(frame.tlas_node_buffer, "tlas_nodes_buffer_",
+                          sizeof(BvhNode) * cluster_streamer.tlas().nodes.size());
+    resized |= fit_buffer(frame.instance_buffer, "instances_buffer_",
+                          sizeof(Instance) * cluster_streamer.instances().size());
+    size_t flag_count = cluster_streamer.cluster_count();
+    if (fit_buffer(frame.cluster_feedback_buffer, "cluster_feedback_buffer_",
+                   sizeof(uint32_t) * flag_count, VK::MemoryUsage::cpu))
+    {
+        frame.cluster_feedback_buffer.copy_to(std::vector<uint32_t>(flag_count, 0));
+        resized = true;
+    }
+    if (resized) write_raytrace_descriptors(current_frame_index);
+
+    // a grown layout moves every slot, new buffers start out empty
+    if (pool_resized || frame.pool_layout_version != cluster_streamer.layout_version())
+    {
+        frame.pool_slots.assign(slots.size(), CLUSTER_NONE);
+        frame.pool_layout_version = cluster_streamer.layout_version();
+    }
+    // only the slots that changed since this frame's buffers were last written, nothing points
+    // into an emptied slot once the instances below are written
+    for (uint32_t slot = 0; slot < slots.size(); slot++)
+    {
+        if (slots[slot] == frame.pool_slots[slot] || slots[slot] == CLUSTER_NONE) continue;
+        Cluster const& cluster = cluster_streamer.cluster(slots[slot]);
+        ClusterSlotData data = cluster_streamer.slot_data(slot);
+        if (cluster_streamer.quantized())
+            vertex_buffer.copy_bytes(cluster.quantized_vertices.data(),
+                                     cluster.quantized_vertices.size() * vertex_size,
+                                     size_t{slot} * layout.vertices * vertex_size);
+        else
+            vertex_buffer.copy_bytes(cluster.vertices.data(), cluster.vertices.size() * vertex_size,
+                                     size_t{slot} * layout.vertices * vertex_size);
+        frame.mesh_index_buffer.copy_bytes(data.indices.data(),
+                                           data.indices.size() * sizeof(uint32_t),
+                                           size_t{slot} * layout.triangles * 3 * sizeof(uint32_t));
+        frame.mesh_triangle_hit_buffer.copy_bytes(cluster.triangle_hits.data(),
+                                                  cluster.triangle_hits.size() * hit_size,
+                                                  size_t{slot} * layout.triangles * hit_size);
+        frame.blas_node_buffer.copy_bytes(data.nodes.data(), data.nodes.size() * sizeof(BvhNode),
+                                          size_t{slot} * layout.nodes * sizeof(BvhNode));
+        frame.blas_index_buffer.copy_bytes(
+            data.primitive_indices.data(), data.primitive_indices.size() * sizeof(uint32_t),
+            size_t{slot} * layout.primitive_indices * sizeof(uint32_t));
+        frame.blas_parent_buffer.copy_bytes(data.parents.data(),
+                                            data.parents.size() * sizeof(uint32_t),
+                                            size_t{slot} * layout.nodes * sizeof(uint32_t));
+    }
+    frame.pool_slots = slots;
+    frame.tlas_node_buffer.copy_to(cluster_streamer.tlas().nodes);
+    frame.instance_buffer.copy_to(cluster_streamer.instances());
+    frame.stream_version = cluster_streamer.version();
+}
+
+void RVPT::upload_textures()
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<TextureImage> images = texture_loader.finish();
+    // without texture_indexing the shader only reads the first texture
+    if (!texture_indexing) images.clear();
+    if (images.empty()) images.push_back(white_texture());
+
+    // the textures are copied in batches that fit the staging buffer, one submit per batch
+    constexpr size_t STAGING_SIZE = size_t{64} << 20;
+    size_t staging_size = STAGING_SIZE;
+    for (auto const& image : images) staging_size = std::max(staging_size, image.texels.size());
+    auto staging = VK::Buffer(vk_device, memory_allocator, "texture_staging_buffer",
+                              VK_BUFFER_USAGE_TRANSFER_SRC_BIT, staging_size,
+                              VK::MemoryUsage::cpu_to_gpu);
+    std::vector<VK::ImageUpload> batch;
+    size_t batch_size = 0;
+    size_t total_size = 0;
+    auto upload_batch = [&]() {
+        VK::upload_images(*graphics_queue, staging, batch,
+                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        batch.clear();
+        batch_size = 0;
+    };
+
+    // the batches point into textures
+    textures.reserve(images.size());
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        TextureImage& image = images[i];
+        if (batch_size + image.texels.size() > staging_size) upload_batch();
+
+        textures.emplace_back(vk_device, memory_allocator, *graphics_queue,
+                              "texture_" + std::to_string(i), VK_FORMAT_R8G8B8A8_SRGB,
+                              VK_IMAGE_TILING_OPTIMAL, image.width(), image.height(),
+                              VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                              VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_ASPECT_COLOR_BIT,
+                              image.texels.size(), VK::MemoryUsage::gpu,
+                              static_cast<uint32_t>(image.mips.size()));
+        staging.copy_bytes(image.texels.data(), image.texels.size(), batch_size);
+        VK::ImageUpload upload{&textures.back(), {}};
+        for (uint32_t level = 0; level < image.mips.size(); level++)
+        {
+            VkBufferImageCopy region{};
+            region.bufferOffset = batch_size + image.mips[level].offset;
+            region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+            region.imageExtent = {image.mips[level].width, image.mips[level].height, 1};
+            upload.regions.push_back(region);
+        }
+        batch.push_back(std::move(upload));
+        batch_size += image.texels.size();
+        total_size += image.texels.size();
+        std::vector<uint8_t>().swap(image.texels);
+    }
+    upload_batch();
+
+    fmt::print("[{}: {}] {} textures, {} KiB with mip levels, in {:.2f} ms\n", "INFO", "TEXTURES",
+               textures.size(), total_size / 1024,
+               std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() -
+                                                         start)
+                   .count());
+}
+
+void RVPT::read_ray_stats()
+{
+    // the frame that last used these resources has finished, unless there was none yet
+    auto& frame = per_frame_data[current_frame_index];
+    if (frame.geometry_version == 0) return;
+
+    uint32_t ray_count = 0;
+    frame.ray_stats_buffer.copy_from(ray_count);
+    frame.ray_stats_buffer.copy_to(uint32_t{0});
+
+    std::vector<uint64_t> timestamps;
+    if (frame.raytrace_timestamps.get_results(timestamps) && timestamps[1] > timestamps[0])
+    {
+        double seconds =
+            static_cast<double>(timestamps[1] - timestamps[0]) * timestamp_period * 1e-9;
+        rays_per_second = ray_count / seconds;
+        bvh_rays_per_second_sum += rays_per_second;
+        bvh_frame_count++;
+    }
+}
+
+void RVPT::report_bvh_throughput()
+{
+    if (bvh_frame_count == 0) return;
+    fmt::print("[{}: {}] {:.2f} Mrays/s over {} frames with the BVH of SAH cost {:.2f}\n", "INFO",
+               "BVH", bvh_rays_per_second_sum / bvh_frame_count * 1e-6, bvh_frame_count,
+               scene_bvh.sah_cost());
+    bvh_rays_per_second_sum = 0.0;
+    bvh_frame_count = 0;
+}
+
+void RVPT::bake_distance_field(bool supersede)
+{
+    if (sdf_bake && !supersede)
+    {
+        sdf_outdated = true;
+        return;
+    }
+    // its task keeps it alive until the loops noticed
+    if (sdf_bake) sdf_bake->cancelled = true;
+    sdf_outdated = false;
+    sdf_bake = std::make_shared<SdfBake>();
+    SdfScene& scene = sdf_bake->scene;
+    scene.triangles = triangles;
+    scene.spheres = spheres;
+    // the GPU builder leaves no BVH on the CPU, the bake builds one then
+    if (!gpu_bvh_builder) scene.bvh = scene_bvh;
+    if (!scene_file.has_bvh() && sdf_settings.resolution > 0)
+    {
+        assert(sdf_meshes.size() == meshes.size());
+        scene.meshes = sdf_meshes;
+        scene.instances = lod_selector.instances();
+        // streamed instances have no instance_bvh, the bake builds a top level then
+        if (!stream_meshes) scene.tlas = instance_bvh.tlas;
+    }
+    sdf_settings.thread_count = bvh_settings.thread_count;
+    sdf_pool.run(sdf_bakes, [bake = sdf_bake, settings = sdf_settings] {
+        if (bake->bricks.bake(bake->scene, settings, &bake->cancelled)) bake->done = true;
+    });
+}
+
+void RVPT::update_distance_field()
+{
+    if (sdf_bake && sdf_bake->done)
+    {
+        sdf_bricks = std::move(sdf_bake->bricks);
+        sdf_bake.reset();
+        sdf_version++;
+        // the sphere tracer steps through the new field
+        render_settings.current_frame = 0;
+    }
+    if (sdf_outdated) bake_distance_field(false);
+}
+
+VK::Image RVPT::create_sdf_atlas(uint32_t index)
+{
+    glm::uvec3 extent = sdf_bricks.atlas_extent();
+    return VK::Image(vk_device, memory_allocator, *graphics_queue,
+                     "sdf_atlas_" + std::to_string(index), VK_FORMAT_R16_SFLOAT,
+                     VK_IMAGE_TILING_OPTIMAL, VkExtent3D{extent.x, extent.y, extent.z},
+                     VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                     VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT,
+                     static_cast<VkDeviceSize>(extent.x) * extent.y * extent.z * sizeof(uint16_t),
+                     VK::MemoryUsage::gpu);
+}
+
+void RVPT::upload_distance_field(uint32_t index)
+{
+    auto& frame = per_frame_data[index];
+    std::vector<uint8_t> grid = sdf_bricks.grid_data();
+    glm::uvec3 extent = sdf_bricks.atlas_extent();
+
+    // a new bake can need more cells or atlas layers
+    bool resized = false;
+    if (frame.sdf_grid_buffer.size() < grid.size())
+    {
+        frame.sdf_grid_buffer = VK::Buffer(
+            vk_device, memory_allocator, "sdf_grid_buffer_" + std::to_string(index),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, grid.size(), VK::MemoryUsage::cpu_to_gpu);
+        resized = true;
+    }
+    if (frame.sdf_atlas.depth != extent.z)
+    {
+        frame.sdf_atlas = create_sdf_atlas(index);
+        resized = true;
+    }
+    if (resized) write_raytrace_descriptors(index);
+
+    frame.sdf_grid_buffer.copy_bytes(grid.data(), grid.size());
+    if (sdf_bricks.empty()) return;
+
+    auto staging = VK::Buffer(vk_device, memory_allocator, "sdf_atlas_staging_buffer",
+                              VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                              sizeof(uint16_t) * sdf_bricks.atlas.size(),
+                              VK::MemoryUsage::cpu_to_gpu);
+    staging.copy_to(sdf_bricks.atlas);
+    frame.sdf_atlas.upload(*graphics_queue, staging);
+}
+
+std::vector<uint32_t> RVPT::raytrace_specialization_constants() const
+{
+    // BVH_STACK_MODE, BVH_SHORT_STACK_SIZE, MESH_QUANTIZED, TEXTURE_COUNT and MESH_STREAMING in
+    // compute_pass.comp
+    constexpr uint32_t SHORT_STACK_SIZE = 8;
+    return {static_cast<uint32_t>(traversal_stack),
+            traversal_stack == TraversalStack::shared ? SHORT_STACK_SIZE : 1,
+            quantize_meshes ? 1u : 0u, static_cast<uint32_t>(textures.size()),
+            stream_meshes ? 1u : 0u};
+}
+
+void RVPT::set_traversal_stack(TraversalStack stack)
+{
+    traversal_stack = stack;
+    if (!rendering_resources) return;
+
+    if (compute_queue) compute_queue->wait_idle();
+    graphics_queue->wait_idle();
+    pipeline_builder.set_specialization_constants(rendering_resources->raytrace_pipeline,
+                                                  raytrace_specialization_constants());
+}
+
 void RVPT::add_material(Material material) { materials.emplace_back(material); }
 
 void RVPT::add_sphere(Sphere sphere) { spheres.emplace_back(sphere); }
 
 void RVPT::add_triangle(Triangle triangle) { triangles.emplace_back(triangle); }
 
+uint32_t RVPT::add_mesh(std::vector<Triangle> const& mesh_triangles, BvhQuality quality)
+{
+    return add_mesh(make_mesh(mesh_triangles), quality);
+}
+
+uint32_t RVPT::add_mesh(Mesh mesh, BvhQuality quality)
+{
+    assert(!scene_file.has_bvh());
+    if (mesh.bvh.nodes.empty())
+    {
+        BvhBuildSettings mesh_settings = bvh_settings;
+        mesh_settings.quality = quality;
+        mesh.bvh.build(mesh.triangles(), mesh_settings);
+    }
+    std::vector<Mesh> added(1);
+    added[0] = std::move(mesh);
+    auto levels = prepare_meshes(added, lod_settings, bvh_settings, quantize_meshes);
+    return add_prepared_mesh(std::move(added[0]), std::move(levels[0]));
+}
+
+uint32_t RVPT::add_prepared_mesh(Mesh mesh, std::vector<LodLevel> levels)
+{
+    auto id = static_cast<uint32_t>(meshes.size());
+    LodChain chain;
+    chain.meshes.push_back(id);
+    chain.errors.push_back(0.0f);
+    chain.triangle_counts.push_back(mesh.triangle_count());
+    if (!mesh.bvh.nodes.empty())
+        chain.bounds = transform_bounds(mesh.bvh.nodes[0].bounds(), mesh.quantization);
+    meshes.push_back(std::move(mesh));
+    // the levels are meshes of their own with an empty chain, right after the full mesh
+    for (auto& level : levels)
+    {
+        chain.meshes.push_back(static_cast<uint32_t>(meshes.size()));
+        chain.errors.push_back(level.error);
+        chain.triangle_counts.push_back(level.mesh.triangle_count());
+        meshes.push_back(std::move(level.mesh));
+    }
+    if (sdf_settings.resolution > 0)
+        for (size_t i = id; i < meshes.size(); i++)
+            sdf_meshes.push_back(std::make_shared<Mesh const>(meshes[i]));
+    mesh_lods.resize(meshes.size());
+    mesh_lods[id] = std::move(chain);
+    instances_changed = true;
+    return id;
+}
+
+void RVPT::add_instance(uint32_t mesh, glm::mat4 const& transform, int material_override)
+{
+    assert(mesh < meshes.size());
+    assert(!scene_file.has_bvh());
+    mesh_instances.push_back(MeshInstance{mesh, transform, material_override});
+    instances_changed = true;
+}
+
+bool RVPT::load_scene(std::string const& path)
+{
+    assert(materials.empty() && meshes.empty() && mesh_instances.empty());
+    if (!scene_file.open(path)) return false;
+    size_t mesh_count = scene_file.mesh_count();
+
+    SceneData scene;
+    scene.materials = scene_file.copy_section<Material>(SceneSection::materials);
+    scene.spheres = scene_file.copy_section<Sphere>(SceneSection::spheres);
+    size_t material_count = scene.materials.size();
+    size_t sphere_count = scene.spheres.size();
+    if (scene_file.has_bvh())
+    {
+        materials = std::move(scene.materials);
+        spheres.insert(spheres.end(), scene.spheres.begin(), scene.spheres.end());
+        quantize_meshes = scene_file.quantized();
+    }
+    else
+    {
+        // the meshes get their BVHs and levels like any other scene, the file is not needed
+        // afterwards
+        scene.meshes = scene_file.meshes();
+        scene.mesh_instances = scene_file.copy_section<MeshInstance>(SceneSection::mesh_instances);
+        scene_file.close();
+        add_scene(std::move(scene));
+    }
+    fmt::print("[{}: {}] {}: {} materials, {} spheres, {} meshes{}\n", "INFO", "SCENE-LOADING",
+               path, material_count, sphere_count, mesh_count,
+               scene_file.has_bvh() ? " with a prebuilt BVH" : "");
+    return true;
+}
+
+void RVPT::add_scene(SceneData scene, std::vector<std::vector<LodLevel>> mesh_levels)
+{
+    assert(!scene_file.has_bvh());
+    assert(mesh_levels.empty() || mesh_levels.size() == scene.meshes.size());
+    auto material_base = static_cast<int>(materials.size());
+    materials.insert(materials.end(), scene.materials.begin(), scene.materials.end());
+    // the sphere buffers keep the size they got in initialize()
+    assert(per_frame_data.empty() || scene.spheres.empty());
+    for (auto& sphere : scene.spheres)
+    {
+        sphere.material_id.x += static_cast<float>(material_base);
+        spheres.push_back(sphere);
+    }
+    if (mesh_levels.empty())
+    {
+        for (auto& mesh : scene.meshes)
+            if (mesh.bvh.nodes.empty()) mesh.bvh.build(mesh.triangles(), bvh_settings);
+        mesh_levels = prepare_meshes(scene.meshes, lod_settings, bvh_settings, quantize_meshes);
+    }
+    // the levels of a mesh take the ids after it
+    std::vector<uint32_t> mesh_ids;
+    for (size_t i = 0; i < scene.meshes.size(); i++)
+    {
+        Mesh& mesh = scene.meshes[i];
+        mesh.material_id += material_base;
+        for (auto& level : mesh_levels[i]) level.mesh.material_id += material_base;
+        mesh_ids.push_back(add_prepared_mesh(std::move(mesh), std::move(mesh_levels[i])));
+    }
+    for (auto instance : scene.mesh_instances)
+    {
+        instance.mesh = mesh_ids[instance.mesh];
+        if (instance.material_override >= 0) instance.material_override += material_base;
+        add_instance(instance.mesh, instance.transform, instance.material_override);
+    }
+}
+
+uint32_t RVPT::add_texture(std::string const& path)
+{
+    assert(!rendering_resources);
+    return texture_loader.add(path);
+}
+
+void RVPT::update_triangles(size_t first, std::vector<Triangle> const& new_triangles)
+{
+    assert(first + new_triangles.size() <= triangles.size());
+    std::copy(new_triangles.begin(), new_triangles.end(),
+              triangles.begin() + static_cast<std::ptrdiff_t>(first));
+    triangles_moved = true;
+}
+
 void RVPT::get_asset_path(std::string& asset_path)
 {
     // I'm 99% sure this method can be made a lot faster, which it 100% can.
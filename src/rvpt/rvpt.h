@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 #include <optional>
@@ -19,6 +21,18 @@
 #include "timer.h"
 #include "geometry.h"
 #include "material.h"
+#include "bvh.h"
+#include "cluster_streamer.h"
+#include "gpu_bvh_builder.h"
+#include "gpu_sphere_grid.h"
+#include "instancing.h"
+#include "mesh_lod.h"
+#include "wide_bvh.h"
+#include "hit_geometry.h"
+#include "sdf_brick_map.h"
+#include "scene_file.h"
+#include "texture_loader.h"
+#include "thread_pool.h"
 
 const uint32_t MAX_FRAMES_IN_FLIGHT = 2;
 
@@ -27,6 +41,21 @@ static const char* RenderModes[] = {"binary",       "color",          "depth",
                                     "Arthur Appel", "Turner Whitted", "Robert Cook",
                                     "James Kajiya", "John Hart"};
 
+static const char* TraversalModes[] = {"linear scan", "binary BVH", "wide BVH",
+                                      "sphere grid"};
+// the indices into TraversalModes, the same as the TRAVERSAL_ defines of compute_pass.comp
+enum TraversalMode
+{
+    TRAVERSAL_LINEAR,
+    TRAVERSAL_BINARY,
+    TRAVERSAL_WIDE,
+    TRAVERSAL_GRID,
+};
+
+// Only the binary BVHs use these, the world one and those of the instanced meshes. The wide BVH
+// and the instance hierarchy always keep a local stack.
+static const char* TraversalStacks[] = {"local stack", "stackless", "shared short stack"};
+
 class RVPT
 {
 public:
@@ -62,11 +91,84 @@ public:
     void add_material(Material material);
     void add_sphere(Sphere sphere);
     void add_triangle(Triangle triangle);
+    // Replaces the triangles starting at first, e.g. with the next frame of an animated mesh. The
+    // BVH is refit during the next update() and only rebuilt if its quality degraded too much.
+    void update_triangles(size_t first, std::vector<Triangle> const& new_triangles);
+    // Adds triangles in object space, which can then be placed any number of times with
+    // add_instance(). Returns the id of the mesh. BvhQuality::high spends more build time on a
+    // hierarchy with spatial splits, which pays off for static meshes with long thin triangles.
+    // The triangles are indexed with make_mesh().
+    uint32_t add_mesh(std::vector<Triangle> const& mesh_triangles,
+                      BvhQuality quality = BvhQuality::fast);
+    // Same, for an indexed mesh, its BVH is built unless it already has one, e.g. from a BvhCache.
+    // Its levels are built and it is quantized on the calling thread, with lod_settings and
+    // quantize_meshes, the levels take the mesh ids after it.
+    uint32_t add_mesh(Mesh mesh, BvhQuality quality = BvhQuality::fast);
+    void add_instance(uint32_t mesh, glm::mat4 const& transform, int material_override = -1);
+    // Adds the materials, spheres and meshes of a file written by write_scene_file(), before any
+    // other material or mesh, as its material ids are those of its own materials. With a prebuilt
+    // BVH the mesh buffers are filled straight from the mapped file and no further meshes can be
+    // added. Returns false if the file could not be read. Must be called before initialize().
+    bool load_scene(std::string const& path);
+    // Adds the materials, spheres and meshes of scene, e.g. from load_glb(). Its material ids are
+    // those of scene.materials, which are moved behind the materials added so far. Materials,
+    // meshes and instances can also be added after initialize(), e.g. while a scene streams in,
+    // the instance BVH is then rebuilt in the next update(). Spheres cannot. mesh_levels are the
+    // levels of every mesh from prepare_meshes() with lod_settings and quantize_meshes, the meshes
+    // are then added as they are. Without them the missing BVHs, the levels and the quantization
+    // are done here, on the calling thread.
+    void add_scene(SceneData scene, std::vector<std::vector<LodLevel>> mesh_levels = {});
+    // Starts decoding an image file on a thread pool and returns its index for Material. The
+    // textures are decoded and get their mip chains while the device is created, initialize()
+    // waits for them and uploads them in batches. All of them are sampled through one array, so
+    // they must be added before initialize().
+    uint32_t add_texture(std::string const& path);
 
     void get_asset_path(std::string& asset_path);
 
     Camera scene_camera;
     Timer time;
+    BvhBuildSettings bvh_settings;
+    // rebuild the BVH with compute shaders every frame instead of once on the CPU, must be set
+    // before initialize()
+    bool gpu_bvh_build = false;
+    // distance field the sphere tracing integrator steps through, over the world primitives and
+    // the mesh instances. Baked in the background once initialize() built the BVHs, and again
+    // whenever the geometry moves or instances are added, the frames use the previous field until
+    // it is done. A resolution of 0 skips the bake, which suits animated scenes, the sphere tracer
+    // then measures the distance to every primitive. The bakes keep a copy of the meshes, which is
+    // made as they are added, so the resolution must not be raised from 0 once meshes are added.
+    SdfBakeSettings sdf_settings;
+    // store the meshes with 16 bit positions, octahedral normals and half float uvs, see
+    // Mesh::quantize(). Costs some precision for less than half the memory of their geometry.
+    // The meshes are quantized as they are added, so it must be set before any mesh is added.
+    // Compiled into the pipeline as a specialization constant.
+    bool quantize_meshes = false;
+    // Keep the meshes as clusters in host memory and page them into a fixed pool of GPU slots as
+    // the traversal reaches them, for scenes whose geometry does not fit the GPU, see
+    // ClusterStreamer. Compiled into the pipeline as a specialization constant, must be set before
+    // initialize(). Scene files with a prebuilt BVH are not streamed.
+    bool stream_meshes = false;
+    ClusterStreamingSettings streaming_settings;
+    // Simplified levels of every mesh with lod_settings.levels, built from the full precision
+    // meshes as they are added, see prepare_meshes(). Every placement renders the coarsest level
+    // whose error covers fewer than pixel_error pixels seen from scene_camera, only the instance
+    // hierarchy is rebuilt when one switches. Set before the meshes are added.
+    LodSettings lod_settings;
+
+    // Where binary BVH traversals keep the far children, an index into TraversalStacks. The wide
+    // BVH traversal ignores it, its nodes have no parent links to climb. A per invocation stack
+    // costs registers, the other two trade them for parent link lookups, which one is fastest
+    // depends on the device. Compiled into the pipeline as a specialization constant, set before
+    // initialize() or through set_traversal_stack().
+    enum class TraversalStack
+    {
+        local,
+        stackless,
+        shared,
+    };
+    TraversalStack traversal_stack = TraversalStack::local;
+    void set_traversal_stack(TraversalStack stack);
 
     struct RenderSettings
     {
@@ -79,6 +181,9 @@ public:
         int bottom_left_render_mode = 9;
         int bottom_right_render_mode = 9;
         glm::vec2 split_ratio = glm::vec2(0.5, 0.5);
+        // how world triangles are intersected, a TraversalMode. The GPU BVH builder only outputs
+        // the binary layout, so wide is switched to binary once in initialize() with it.
+        int traversal_mode = TRAVERSAL_WIDE;
 
     } render_settings;
 
@@ -105,6 +210,79 @@ private:
     std::vector<Sphere> spheres;
     std::vector<Triangle> triangles;
     std::vector<Material> materials;
+    // spheres and triangles in the form the hit tests read, the shading reads the ones above
+    std::vector<SphereHit> sphere_hits;
+    std::vector<TriangleHit> triangle_hits;
+
+    // acceleration structure over the spheres and triangles, built in initialize() and refit when
+    // the triangles move
+    BVH scene_bvh;
+    // scene_bvh collapsed into compressed wide nodes, which is what the path tracer traverses
+    WideBVH wide_bvh;
+    // parent links of scene_bvh for traversals without a full stack
+    std::vector<uint32_t> scene_bvh_parents;
+    SdfBrickMap sdf_bricks;
+    struct SdfBake
+    {
+        SdfScene scene;
+        SdfBrickMap bricks;
+        // set when a newer bake supersedes this one, its loops then stop at their next chunk
+        std::atomic<bool> cancelled{false};
+        std::atomic<bool> done{false};
+    };
+    // one worker for the bakes, which run their loops on a pool of their own
+    ThreadPool sdf_pool{2};
+    ThreadPool::TaskGroup sdf_bakes;
+    // the newest bake, if it is not adopted yet. Shared with its task, so a superseded bake is
+    // dropped here without waiting for it.
+    std::shared_ptr<SdfBake> sdf_bake;
+    // the triangles moved after the running bake copied them
+    bool sdf_outdated = false;
+    // bumped when a bake is done, the frames upload the new field when theirs is outdated
+    uint32_t sdf_version = 1;
+
+    // meshes in object space and their placements, flattened into instance_bvh in initialize()
+    std::vector<Mesh> meshes;
+    // what the bakes read of meshes, the streamed meshes keep no geometry of their own. Empty
+    // with a sdf_settings.resolution of 0.
+    std::vector<std::shared_ptr<Mesh const>> sdf_meshes;
+    std::vector<MeshInstance> mesh_instances;
+    InstanceBvh instance_bvh;
+    // mapped while its prebuilt mesh buffers are in use, instead of meshes and instance_bvh
+    SceneFile scene_file;
+    // what the mesh buffers are filled from, instance_bvh or the sections of scene_file
+    InstanceGeometry mesh_geometry;
+    // instead of instance_bvh with stream_meshes, the mesh buffers then hold its pool
+    ClusterStreamer cluster_streamer;
+    // the levels of every mesh id, and the placements of mesh_instances with their level
+    std::vector<LodChain> mesh_lods;
+    LodSelector lod_selector;
+
+    TextureLoader texture_loader;
+    // sRGB with all mip levels, shared by the frames in flight. Never empty, a white texel stands
+    // in if no texture was added.
+    std::vector<VK::Image> textures;
+    // whether the device indexes texture arrays per ray (VK_EXT_descriptor_indexing), set by
+    // context_init(). Without it only the white texel is bound and the raytrace pipeline uses
+    // compute_pass.comp built with SINGLE_TEXTURE.
+    bool texture_indexing = false;
+
+    // set by update_triangles(), the BVH is refit in update()
+    bool triangles_moved = false;
+    // set when meshes or instances are added, instance_bvh is rebuilt in update()
+    bool instances_changed = false;
+
+    // rays traced per second by the last finished frame, from the ray counter and timestamps
+    double rays_per_second = 0.0;
+    // rays_per_second summed over the frames traced with the current scene BVH, logged once it is
+    // replaced, so its SAH cost can be compared with the throughput it achieved
+    double bvh_rays_per_second_sum = 0.0;
+    uint32_t bvh_frame_count = 0;
+    float timestamp_period = 1.0f;  // nanoseconds per timestamp tick
+    // bumped whenever the geometry changes, per frame buffers are only rewritten when outdated
+    uint32_t geometry_version = 1;
+    // bumped when only the instance hierarchy changes, e.g. when a placement switches its level
+    uint32_t instance_version = 0;
 
     struct PreviousFrameState
     {
@@ -144,6 +322,10 @@ private:
 
     std::optional<ImguiImpl> imgui_impl;
 
+    std::optional<GpuBvhBuilder> gpu_bvh_builder;
+    // built on the GPU every frame while the traversal mode is the sphere grid
+    std::optional<GpuSphereGrid> sphere_grid;
+
     std::vector<VK::Framebuffer> framebuffers;
 
     struct RenderingResources
@@ -176,7 +358,27 @@ private:
         VK::Buffer camera_uniform;
         VK::Buffer sphere_buffer;
         VK::Buffer triangle_buffer;
+        VK::Buffer bvh_node_buffer;
+        VK::Buffer bvh_index_buffer;
         VK::Buffer material_buffer;
+        VK::Buffer mesh_vertex_buffer;
+        VK::Buffer mesh_index_buffer;
+        VK::Buffer sphere_hit_buffer;
+        VK::Buffer triangle_hit_buffer;
+        VK::Buffer mesh_triangle_hit_buffer;
+        VK::Buffer mesh_quantized_vertex_buffer;
+        VK::Buffer blas_node_buffer;
+        VK::Buffer blas_index_buffer;
+        VK::Buffer tlas_node_buffer;
+        VK::Buffer instance_buffer;
+        VK::Buffer wide_bvh_node_buffer;
+        VK::Buffer wide_bvh_index_buffer;
+        VK::Buffer ray_stats_buffer;
+        VK::Buffer bvh_parent_buffer;
+        VK::Buffer blas_parent_buffer;
+        VK::Buffer sdf_grid_buffer;
+        VK::Image sdf_atlas;
+        VK::QueryPool raytrace_timestamps;
         VK::CommandBuffer raytrace_command_buffer;
         VK::Fence raytrace_work_fence;
         VK::DescriptorSet image_descriptor_set;
@@ -185,6 +387,18 @@ private:
         VK::Buffer debug_camera_uniform;
         VK::Buffer debug_vertex_buffer;
         VK::DescriptorSet debug_descriptor_sets;
+
+        // one flag per cluster with stream_meshes
+        VK::Buffer cluster_feedback_buffer;
+
+        // the fields below start at their defaults, so add_per_frame_data() does not list them
+        uint32_t geometry_version = 0;
+        uint32_t instance_version = 0;
+        uint32_t sdf_version = 0;
+        // what the pool in the mesh buffers holds, see ClusterStreamer::slots()
+        std::vector<uint32_t> pool_slots;
+        uint32_t pool_layout_version = 0;
+        uint32_t stream_version = 0;
     };
     std::vector<PerFrameData> per_frame_data;
 
@@ -195,8 +409,33 @@ private:
     bool swapchain_get_images();
     void create_framebuffers();
 
+    void build_bvh();
+    void build_instance_bvh();
+    // Appends mesh and its levels, which are already built and quantized, with their LodChain
+    uint32_t add_prepared_mesh(Mesh mesh, std::vector<LodLevel> levels);
+    // the instance hierarchy over the placements with their current level
+    void place_instances();
+    LodView lod_view();
+    void stream_clusters();
+    void upload_textures();
+    void read_ray_stats();
+    void report_bvh_throughput();
+    // Starts baking sdf_bricks from a copy of the scene. A running bake is cancelled, or with
+    // supersede false finished first and followed by this one, so triangles that move every frame
+    // still get a field now and then.
+    void bake_distance_field(bool supersede = true);
+    // adopts a bake that is done and starts the next one if the triangles moved since
+    void update_distance_field();
+    VK::Image create_sdf_atlas(uint32_t index);
+    void upload_distance_field(uint32_t index);
     RenderingResources create_rendering_resources();
     void add_per_frame_data(int index);
+    void write_raytrace_descriptors(uint32_t index);
+    // Replaces buffer of the current frame with one of size if it is smaller, returns whether it
+    // did, the descriptors then need to be written again
+    bool fit_buffer(VK::Buffer& buffer, std::string const& name, size_t size,
+                    VK::MemoryUsage memory_usage = VK::MemoryUsage::cpu_to_gpu);
+    std::vector<uint32_t> raytrace_specialization_constants() const;
 
     void record_command_buffer(VK::SyncResources& current_frame, uint32_t swapchain_image_index);
     void record_compute_command_buffer();
@@ -0,0 +1,400 @@
+#include "scene_file.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
+#include <fmt/core.h>
+
+namespace
+{
+constexpr char SCENE_MAGIC[8] = {'R', 'V', 'P', 'T', 'S', 'C', 'N', '\0'};
+// bump whenever the layout of the file or of a stored struct changes
+constexpr uint32_t SCENE_VERSION = 2;
+// the largest minStorageBufferOffsetAlignment Vulkan allows
+constexpr size_t SECTION_ALIGNMENT = 256;
+constexpr size_t SECTION_COUNT = static_cast<size_t>(SceneSection::count);
+
+constexpr uint32_t FLAG_BVH = 1u << 0;
+constexpr uint32_t FLAG_QUANTIZED = 1u << 1;
+
+struct SectionEntry
+{
+    uint64_t offset;  // from the start of the file
+    uint64_t size;  // in bytes
+};
+
+struct SceneHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t section_count;
+    uint32_t padding[3];
+    SectionEntry sections[SECTION_COUNT];
+};
+static_assert(sizeof(SceneHeader) <= SECTION_ALIGNMENT, "the first section starts after it");
+
+// of the elements of every section, the size of a valid section is a multiple of it
+constexpr std::array<size_t, SECTION_COUNT> ELEMENT_SIZES = {
+    sizeof(Material),        sizeof(Sphere),       sizeof(MeshRange),
+    sizeof(MeshInstance),    sizeof(Vertex),       sizeof(QuantizedVertex),
+    sizeof(uint32_t),        sizeof(TriangleHit),  sizeof(BvhNode),
+    sizeof(uint32_t),        sizeof(uint32_t),     sizeof(BvhNode),
+    sizeof(Instance)};
+
+template <typename T>
+ByteSpan byte_span(std::vector<T> const& elements)
+{
+    return ByteSpan{elements.data(), elements.size() * sizeof(T)};
+}
+
+size_t align_section(size_t offset)
+{
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+ByteSpan& section_span(std::array<ByteSpan, SECTION_COUNT>& spans, SceneSection section)
+{
+    return spans[static_cast<size_t>(section)];
+}
+
+template <typename T>
+struct SectionView
+{
+    T const* data;
+    size_t count;
+
+    T const* begin() const { return data; }
+    T const* end() const { return data + count; }
+    T const& operator[](size_t i) const { return data[i]; }
+};
+
+template <typename T>
+SectionView<T> view_section(SceneFile const& file, SceneSection section)
+{
+    ByteSpan bytes = file.section(section);
+    return SectionView<T>{static_cast<T const*>(bytes.data), bytes.size / sizeof(T)};
+}
+
+// Nodes reference children behind them, so no traversal loops, and leaves a range of
+// primitive_count primitives
+bool valid_nodes(SectionView<BvhNode> nodes, size_t primitive_count)
+{
+    for (uint32_t i = 0; i < nodes.count; i++)
+    {
+        BvhNode const& node = nodes[i];
+        if (node.is_leaf())
+        {
+            if (size_t{node.left_or_first} + node.primitive_count() > primitive_count)
+                return false;
+        }
+        else if (node.left_or_first <= i || node.left_or_first >= nodes.count ||
+                 node.right_or_count <= i || node.right_or_count >= nodes.count)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Checks every index and material id the path tracer follows without a bounds check, so a
+// damaged file cannot make it read outside of its buffers. Returns what is wrong, or nullptr.
+char const* check_references(SceneFile const& file)
+{
+    size_t material_count = view_section<Material>(file, SceneSection::materials).count;
+    auto valid_material = [&](int material) {
+        return material >= 0 && static_cast<size_t>(material) < material_count;
+    };
+    for (auto const& sphere : view_section<Sphere>(file, SceneSection::spheres))
+        if (!valid_material(static_cast<int>(sphere.material_id.x)))
+            return "a sphere references a missing material";
+    auto ranges = view_section<MeshRange>(file, SceneSection::mesh_ranges);
+    for (auto const& range : ranges)
+        if (!valid_material(range.material_id)) return "a mesh references a missing material";
+    for (auto const& instance : view_section<MeshInstance>(file, SceneSection::mesh_instances))
+        if (instance.mesh >= ranges.count ||
+            (instance.material_override >= 0 && !valid_material(instance.material_override)))
+            return "an instance references a missing mesh or material";
+    if (!file.has_bvh()) return nullptr;
+
+    // the prebuilt buffers are bound as they are
+    size_t vertex_count =
+        file.quantized()
+            ? view_section<QuantizedVertex>(file, SceneSection::mesh_quantized_vertices).count
+            : view_section<Vertex>(file, SceneSection::mesh_vertices).count;
+    auto indices = view_section<uint32_t>(file, SceneSection::mesh_indices);
+    size_t triangle_count = indices.count / 3;
+    if (indices.count % 3 != 0) return "the mesh indices are not triangles";
+    for (auto index : indices)
+        if (index >= vertex_count) return "a mesh index references a missing vertex";
+    size_t hit_count = view_section<TriangleHit>(file, SceneSection::mesh_triangle_hits).count;
+    if (hit_count != (file.quantized() ? 0 : triangle_count))
+        return "the triangle hit data does not match the triangles";
+
+    auto blas_nodes = view_section<BvhNode>(file, SceneSection::blas_nodes);
+    auto blas_indices = view_section<uint32_t>(file, SceneSection::blas_indices);
+    if (!valid_nodes(blas_nodes, blas_indices.count)) return "the mesh BVHs are damaged";
+    for (auto index : blas_indices)
+        if (index >= triangle_count) return "a mesh BVH references a missing triangle";
+    // the stackless traversals climb them up to the root they started from
+    auto blas_parents = view_section<uint32_t>(file, SceneSection::blas_parents);
+    if (blas_parents.count != blas_nodes.count)
+        return "the parents of the mesh BVHs do not match them";
+    for (uint32_t i = 0; i < blas_nodes.count; i++)
+    {
+        BvhNode const& node = blas_nodes[i];
+        uint32_t parent = blas_parents[i];
+        if ((!node.is_leaf() && (blas_parents[node.left_or_first] != i ||
+                                 blas_parents[node.right_or_count] != i)) ||
+            (parent != BVH_NONE &&
+             (parent >= blas_nodes.count || blas_nodes[parent].is_leaf() ||
+              (blas_nodes[parent].left_or_first != i && blas_nodes[parent].right_or_count != i))))
+            return "the parents of the mesh BVHs do not match them";
+    }
+
+    auto instances = view_section<Instance>(file, SceneSection::instances);
+    if (!valid_nodes(view_section<BvhNode>(file, SceneSection::tlas_nodes), instances.count))
+        return "the instance BVH is damaged";
+    for (auto const& instance : instances)
+        if (instance.blas_root >= blas_nodes.count || !valid_material(instance.material))
+            return "an instance references a missing mesh BVH or material";
+    return nullptr;
+}
+}  // namespace
+
+size_t InstanceGeometry::geometry_memory() const
+{
+    return vertices.size + quantized_vertices.size + indices.size + triangle_hits.size;
+}
+
+InstanceGeometry instance_geometry(InstanceBvh const& instance_bvh)
+{
+    InstanceGeometry geometry;
+    geometry.vertices = byte_span(instance_bvh.mesh_vertices);
+    geometry.quantized_vertices = byte_span(instance_bvh.mesh_quantized_vertices);
+    geometry.indices = byte_span(instance_bvh.mesh_indices);
+    geometry.triangle_hits = byte_span(instance_bvh.mesh_triangle_hits);
+    geometry.blas_nodes = byte_span(instance_bvh.blas_nodes);
+    geometry.blas_indices = byte_span(instance_bvh.blas_indices);
+    geometry.blas_parents = byte_span(instance_bvh.blas_parents);
+    geometry.tlas_nodes = byte_span(instance_bvh.tlas.nodes);
+    geometry.instances = byte_span(instance_bvh.instances);
+    return geometry;
+}
+
+bool write_scene_file(std::string const& path, SceneData const& scene, bool include_bvh,
+                      BvhBuildSettings const& settings)
+{
+    std::vector<MeshRange> ranges;
+    uint32_t vertex_count = 0;
+    uint32_t index_count = 0;
+    bool quantized = false;
+    for (auto const& mesh : scene.meshes)
+    {
+        auto mesh_vertex_count =
+            static_cast<uint32_t>(mesh.vertices.size() + mesh.quantized_vertices.size());
+        auto mesh_index_count = static_cast<uint32_t>(mesh.indices.size());
+        ranges.push_back(MeshRange{vertex_count, mesh_vertex_count, index_count, mesh_index_count,
+                                   mesh.material_id, {}});
+        vertex_count += mesh_vertex_count;
+        index_count += mesh_index_count;
+        quantized |= mesh.quantized();
+        assert(!include_bvh || !mesh.bvh.nodes.empty());
+    }
+    assert(include_bvh || !quantized);
+
+    std::array<ByteSpan, SECTION_COUNT> spans{};
+    section_span(spans, SceneSection::materials) = byte_span(scene.materials);
+    section_span(spans, SceneSection::spheres) = byte_span(scene.spheres);
+    section_span(spans, SceneSection::mesh_ranges) = byte_span(ranges);
+    section_span(spans, SceneSection::mesh_instances) = byte_span(scene.mesh_instances);
+
+    // the same arrays the path tracer builds in initialize()
+    InstanceBvh instance_bvh;
+    if (include_bvh)
+    {
+        instance_bvh.build(scene.meshes, scene.mesh_instances, settings);
+    }
+    else
+    {
+        for (auto const& mesh : scene.meshes)
+        {
+            auto vertex_base = static_cast<uint32_t>(instance_bvh.mesh_vertices.size());
+            instance_bvh.mesh_vertices.insert(instance_bvh.mesh_vertices.end(),
+                                              mesh.vertices.begin(), mesh.vertices.end());
+            for (auto index : mesh.indices)
+                instance_bvh.mesh_indices.push_back(index + vertex_base);
+        }
+    }
+    InstanceGeometry geometry = instance_geometry(instance_bvh);
+    section_span(spans, SceneSection::mesh_vertices) = geometry.vertices;
+    section_span(spans, SceneSection::mesh_quantized_vertices) = geometry.quantized_vertices;
+    section_span(spans, SceneSection::mesh_indices) = geometry.indices;
+    section_span(spans, SceneSection::mesh_triangle_hits) = geometry.triangle_hits;
+    section_span(spans, SceneSection::blas_nodes) = geometry.blas_nodes;
+    section_span(spans, SceneSection::blas_indices) = geometry.blas_indices;
+    section_span(spans, SceneSection::blas_parents) = geometry.blas_parents;
+    section_span(spans, SceneSection::tlas_nodes) = geometry.tlas_nodes;
+    section_span(spans, SceneSection::instances) = geometry.instances;
+
+    SceneHeader header{};
+    std::memcpy(header.magic, SCENE_MAGIC, sizeof(SCENE_MAGIC));
+    header.version = SCENE_VERSION;
+    header.flags = (include_bvh ? FLAG_BVH : 0u) | (quantized ? FLAG_QUANTIZED : 0u);
+    header.section_count = static_cast<uint32_t>(SECTION_COUNT);
+    size_t offset = align_section(sizeof(SceneHeader));
+    for (size_t i = 0; i < SECTION_COUNT; i++)
+    {
+        header.sections[i] = SectionEntry{offset, spans[i].size};
+        offset = align_section(offset + spans[i].size);
+    }
+
+    // written next to the file and renamed, so a reader never maps half a scene
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        std::array<char, SECTION_ALIGNMENT> zeros{};
+        size_t written = 0;
+        auto write = [&](void const* data, size_t size) {
+            out.write(static_cast<char const*>(data), static_cast<std::streamsize>(size));
+            written += size;
+        };
+        write(&header, sizeof(header));
+        for (size_t i = 0; i < SECTION_COUNT; i++)
+        {
+            write(zeros.data(), header.sections[i].offset - written);
+            write(spans[i].data, spans[i].size);
+        }
+        write(zeros.data(), align_section(written) - written);
+        if (!out) return false;
+    }
+    std::error_code error;
+    std::filesystem::rename(temp_path, path, error);
+    if (error)
+    {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+    return true;
+}
+
+bool SceneFile::open(std::string const& path)
+{
+    close();
+    if (!file.open(path))
+    {
+        fmt::print("[{}: {}] unable to open {}\n", "ERROR", "SCENE-LOADING", path);
+        return false;
+    }
+
+    SceneHeader header;
+    bool valid = file.size() >= sizeof(SceneHeader);
+    if (valid) std::memcpy(&header, file.data(), sizeof(SceneHeader));
+    valid = valid && std::memcmp(header.magic, SCENE_MAGIC, sizeof(SCENE_MAGIC)) == 0 &&
+            header.version == SCENE_VERSION && header.section_count == SECTION_COUNT;
+    for (size_t i = 0; valid && i < SECTION_COUNT; i++)
+    {
+        SectionEntry const& entry = header.sections[i];
+        valid = entry.offset % SECTION_ALIGNMENT == 0 && entry.offset <= file.size() &&
+                entry.size <= file.size() - entry.offset && entry.size % ELEMENT_SIZES[i] == 0;
+    }
+    if (!valid)
+    {
+        fmt::print("[{}: {}] {} is not a scene file of version {} or is damaged\n", "ERROR",
+                   "SCENE-LOADING", path, SCENE_VERSION);
+        close();
+        return false;
+    }
+    flags = header.flags;
+    if (char const* error = check_references(*this))
+    {
+        fmt::print("[{}: {}] {} is damaged, {}\n", "ERROR", "SCENE-LOADING", path, error);
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SceneFile::close()
+{
+    file.close();
+    flags = 0;
+}
+
+bool SceneFile::has_bvh() const { return (flags & FLAG_BVH) != 0; }
+
+bool SceneFile::quantized() const { return (flags & FLAG_QUANTIZED) != 0; }
+
+size_t SceneFile::mesh_count() const
+{
+    return section(SceneSection::mesh_ranges).size / sizeof(MeshRange);
+}
+
+size_t SceneFile::instance_count() const
+{
+    return section(SceneSection::mesh_instances).size / sizeof(MeshInstance);
+}
+
+ByteSpan SceneFile::section(SceneSection section) const
+{
+    if (!file.is_open()) return ByteSpan{};
+    SectionEntry entry;
+    std::memcpy(&entry,
+                file.data() + offsetof(SceneHeader, sections) +
+                    static_cast<size_t>(section) * sizeof(SectionEntry),
+                sizeof(SectionEntry));
+    return ByteSpan{file.data() + entry.offset, static_cast<size_t>(entry.size)};
+}
+
+InstanceGeometry SceneFile::instance_geometry() const
+{
+    InstanceGeometry geometry;
+    geometry.vertices = section(SceneSection::mesh_vertices);
+    geometry.quantized_vertices = section(SceneSection::mesh_quantized_vertices);
+    geometry.indices = section(SceneSection::mesh_indices);
+    geometry.triangle_hits = section(SceneSection::mesh_triangle_hits);
+    geometry.blas_nodes = section(SceneSection::blas_nodes);
+    geometry.blas_indices = section(SceneSection::blas_indices);
+    geometry.blas_parents = section(SceneSection::blas_parents);
+    geometry.tlas_nodes = section(SceneSection::tlas_nodes);
+    geometry.instances = section(SceneSection::instances);
+    return geometry;
+}
+
+std::vector<Mesh> SceneFile::meshes() const
+{
+    std::vector<MeshRange> ranges = copy_section<MeshRange>(SceneSection::mesh_ranges);
+    ByteSpan vertex_bytes = section(SceneSection::mesh_vertices);
+    ByteSpan index_bytes = section(SceneSection::mesh_indices);
+    auto vertices = static_cast<Vertex const*>(vertex_bytes.data);
+    auto indices = static_cast<uint32_t const*>(index_bytes.data);
+    size_t vertex_count = vertex_bytes.size / sizeof(Vertex);
+    size_t index_count = index_bytes.size / sizeof(uint32_t);
+
+    std::vector<Mesh> result;
+    for (auto const& range : ranges)
+    {
+        Mesh mesh;
+        mesh.material_id = range.material_id;
+        // a mesh outside of the sections stays empty rather than reading past them
+        if (size_t{range.first_vertex} + range.vertex_count <= vertex_count &&
+            size_t{range.first_index} + range.index_count <= index_count)
+        {
+            mesh.vertices.assign(vertices + range.first_vertex,
+                                 vertices + range.first_vertex + range.vertex_count);
+            for (uint32_t i = 0; i < range.index_count && range.vertex_count > 0; i++)
+            {
+                uint32_t index = indices[range.first_index + i] - range.first_vertex;
+                mesh.indices.push_back(index < range.vertex_count ? index : 0);
+            }
+        }
+        result.push_back(std::move(mesh));
+    }
+    return result;
+}
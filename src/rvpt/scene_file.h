@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "geometry.h"
+#include "instancing.h"
+#include "mapped_file.h"
+#include "material.h"
+
+// Sections of a scene file, in the order they are stored
+enum class SceneSection : uint32_t
+{
+    materials,
+    spheres,
+    mesh_ranges,
+    mesh_instances,
+    // the rest is laid out exactly like the mesh buffers of the path tracer, see InstanceBvh
+    mesh_vertices,
+    mesh_quantized_vertices,
+    mesh_indices,
+    mesh_triangle_hits,
+    blas_nodes,
+    blas_indices,
+    blas_parents,
+    tlas_nodes,
+    instances,
+    count,
+};
+
+struct ByteSpan
+{
+    void const* data = nullptr;
+    size_t size = 0;
+};
+
+// The contents of the mesh buffers the path tracer reads, wherever they live
+struct InstanceGeometry
+{
+    ByteSpan vertices;
+    ByteSpan quantized_vertices;
+    ByteSpan indices;
+    ByteSpan triangle_hits;
+    ByteSpan blas_nodes;
+    ByteSpan blas_indices;
+    ByteSpan blas_parents;
+    ByteSpan tlas_nodes;
+    ByteSpan instances;
+
+    // Bytes of the vertices, indices and hit data, like InstanceBvh::geometry_memory()
+    size_t geometry_memory() const;
+};
+
+InstanceGeometry instance_geometry(InstanceBvh const& instance_bvh);
+
+// Where one mesh lies in the mesh_vertices and mesh_indices sections. Its indices are offset by
+// first_vertex, like in InstanceBvh::mesh_indices.
+struct MeshRange
+{
+    uint32_t first_vertex;
+    uint32_t vertex_count;
+    uint32_t first_index;
+    uint32_t index_count;
+    int32_t material_id;
+    uint32_t padding[3];
+};
+
+struct SceneData
+{
+    std::vector<Material> materials;
+    std::vector<Sphere> spheres;
+    std::vector<Mesh> meshes;
+    std::vector<MeshInstance> mesh_instances;
+};
+
+// Writes a scene file. With include_bvh the meshes must have their BVH built, the instance
+// hierarchy is then built with settings and stored too, so loading the file skips every build.
+// Quantized meshes are only stored with their BVH. Returns false if the file could not be written.
+bool write_scene_file(std::string const& path, SceneData const& scene, bool include_bvh,
+                      BvhBuildSettings const& settings = {});
+
+// Read only view of a scene file: a header with a table of sections, followed by the sections,
+// each aligned to 256 bytes and stored exactly as the GPU buffers expect. The file is memory
+// mapped, so the sections cost IO once they are copied into the buffers, no parsing and no
+// conversion per element.
+class SceneFile
+{
+public:
+    // Returns false and prints the reason if the file is missing, from another version or damaged.
+    // Every index and material id the path tracer follows is checked once against the sections it
+    // points into, which reads the index, node and instance sections but not the vertices.
+    bool open(std::string const& path);
+    void close();
+
+    bool is_open() const { return file.is_open(); }
+    // whether the BVH sections are stored, otherwise they are empty and the meshes need a build
+    bool has_bvh() const;
+    bool quantized() const;
+    size_t mesh_count() const;
+    size_t instance_count() const;
+
+    ByteSpan section(SceneSection section) const;
+    // The mesh buffers straight from the mapping, only valid while the file is open
+    InstanceGeometry instance_geometry() const;
+
+    template <typename T>
+    std::vector<T> copy_section(SceneSection section) const
+    {
+        ByteSpan bytes = this->section(section);
+        auto first = static_cast<T const*>(bytes.data);
+        return std::vector<T>(first, first + bytes.size / sizeof(T));
+    }
+    // The meshes as separate Mesh objects without a BVH, for files that have none
+    std::vector<Mesh> meshes() const;
+
+private:
+    MappedFile file;
+    uint32_t flags = 0;
+};
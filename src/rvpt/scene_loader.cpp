@@ -0,0 +1,337 @@
+#include "scene_loader.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include <fmt/core.h>
+#include <glm/ext.hpp>
+#include <nlohmann/json.hpp>
+
+#include "gltf_loader.h"
+#include "mapped_file.h"
+#include "obj_loader.h"
+#include "ply_loader.h"
+
+namespace
+{
+using json = nlohmann::json;
+
+struct SceneError : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+struct ModelDescription
+{
+    std::string path;
+    glm::mat4 transform{1.0f};
+    int material = -1;  // into the materials of the description
+    BvhQuality quality = BvhQuality::fast;
+};
+
+glm::vec3 read_vec3(json const& object, char const* key, glm::vec3 fallback)
+{
+    if (!object.contains(key)) return fallback;
+    json const& value = object.at(key);
+    if (value.is_number()) return glm::vec3(value.get<float>());
+    if (!value.is_array() || value.size() != 3)
+        throw SceneError(fmt::format("'{}' is not a number or an array of 3 numbers", key));
+    return glm::vec3(value[0].get<float>(), value[1].get<float>(), value[2].get<float>());
+}
+
+// a mode either by its name or by its index
+template <size_t N>
+int read_mode(json const& object, char const* key, char const* const (&names)[N], int fallback)
+{
+    if (!object.contains(key)) return fallback;
+    json const& value = object.at(key);
+    if (value.is_string())
+    {
+        auto name = value.get<std::string>();
+        for (size_t i = 0; i < N; i++)
+            if (name == names[i]) return static_cast<int>(i);
+        throw SceneError(fmt::format("unknown {} '{}'", key, name));
+    }
+    int index = value.get<int>();
+    if (index < 0 || index >= static_cast<int>(N))
+        throw SceneError(fmt::format("{} {} is out of range", key, index));
+    return index;
+}
+
+int read_material(json const& object, size_t material_count)
+{
+    if (!object.contains("material")) return -1;
+    int material = object.at("material").get<int>();
+    if (material < 0 || material >= static_cast<int>(material_count))
+        throw SceneError(fmt::format("material {} is out of range", material));
+    return material;
+}
+
+// Texture files are relative to directory and added to rvpt
+Material read_material_description(json const& object, std::filesystem::path const& directory,
+                                   RVPT& rvpt)
+{
+    auto type = Material::Type::LAMBERT;
+    auto type_name = object.value("type", std::string("lambert"));
+    if (type_name == "mirror")
+        type = Material::Type::MIRROR;
+    else if (type_name == "dielectric")
+        type = Material::Type::DIELECTRIC;
+    else if (type_name != "lambert")
+        throw SceneError(fmt::format("unknown material type '{}'", type_name));
+    glm::vec3 albedo = read_vec3(object, "albedo", glm::vec3(1.0f));
+    glm::vec3 emission = read_vec3(object, "emission", glm::vec3(0.0f));
+    auto texture = [&](char const* key) {
+        if (!object.contains(key)) return -1;
+        auto path = (directory / object.at(key).get<std::string>()).string();
+        return static_cast<int>(rvpt.add_texture(path));
+    };
+    int albedo_texture = texture("albedo_texture");
+    int emission_texture = texture("emission_texture");
+    return Material(glm::vec4(albedo, object.value("ior", 1.5f)), glm::vec4(emission, 0.0f), type,
+                    albedo_texture, emission_texture);
+}
+
+glm::mat4 read_transform(json const& object)
+{
+    glm::vec3 rotation = read_vec3(object, "rotation", glm::vec3(0.0f));
+    auto transform = glm::translate(glm::mat4(1.0f), read_vec3(object, "position", glm::vec3(0)));
+    transform = glm::rotate(transform, glm::radians(rotation.y), glm::vec3(0, 1, 0));
+    transform = glm::rotate(transform, glm::radians(rotation.x), glm::vec3(1, 0, 0));
+    transform = glm::rotate(transform, glm::radians(rotation.z), glm::vec3(0, 0, 1));
+    return glm::scale(transform, read_vec3(object, "scale", glm::vec3(1.0f)));
+}
+
+void apply_camera(json const& camera, Camera& scene_camera)
+{
+    scene_camera.set_position(read_vec3(camera, "position", glm::vec3(0.0f)));
+    scene_camera.set_rotation(read_vec3(camera, "rotation", glm::vec3(0.0f)));
+    if (camera.contains("fov")) scene_camera.set_fov(camera.at("fov").get<float>());
+    if (camera.contains("mode"))
+        scene_camera.set_camera_mode(read_mode(camera, "mode", CameraModes, 0));
+}
+
+void apply_settings(json const& settings, RVPT::RenderSettings& render_settings)
+{
+    render_settings.max_bounces = settings.value("max_bounces", render_settings.max_bounces);
+    render_settings.aa = settings.value("aa", render_settings.aa);
+    int render_mode =
+        read_mode(settings, "render_mode", RenderModes, render_settings.top_left_render_mode);
+    render_settings.top_left_render_mode = render_mode;
+    render_settings.top_right_render_mode = render_mode;
+    render_settings.bottom_left_render_mode = render_mode;
+    render_settings.bottom_right_render_mode = render_mode;
+    render_settings.traversal_mode =
+        read_mode(settings, "traversal_mode", TraversalModes, render_settings.traversal_mode);
+}
+
+void apply_lod(json const& lod, RVPT& rvpt)
+{
+    auto& settings = rvpt.lod_settings;
+    settings.levels = lod.value("levels", 3u);
+    settings.reduction = lod.value("reduction", settings.reduction);
+    settings.min_triangles = lod.value("min_triangles", settings.min_triangles);
+    settings.pixel_error = lod.value("pixel_error", settings.pixel_error);
+    if (settings.reduction <= 0.0f || settings.reduction >= 1.0f)
+        throw SceneError("the lod reduction must lie between 0 and 1");
+    if (settings.pixel_error <= 0.0f) throw SceneError("the lod pixel error must be positive");
+}
+
+void apply_streaming(json const& streaming, RVPT& rvpt)
+{
+    auto& settings = rvpt.streaming_settings;
+    settings.cluster_triangles = streaming.value("cluster_triangles", settings.cluster_triangles);
+    settings.pool_slots = streaming.value("pool_clusters", settings.pool_slots);
+    settings.uploads_per_frame = streaming.value("uploads_per_frame", settings.uploads_per_frame);
+    if (settings.cluster_triangles == 0 || settings.pool_slots == 0 ||
+        settings.uploads_per_frame == 0)
+        throw SceneError("the streaming settings must not be 0");
+    rvpt.stream_meshes = streaming.value("enabled", true);
+}
+
+// The mesh of an .obj or .ply file, from the cache if the file and the build settings are the same
+bool load_mesh(std::string const& path, BvhBuildSettings const& settings,
+               BvhCache const* cache, Mesh& mesh)
+{
+    uint64_t key = 0;
+    if (cache)
+    {
+        MappedFile source;
+        if (!source.open(path))
+        {
+            fmt::print("[{}: {}] unable to open {}\n", "ERROR", "MODEL-LOADING", path);
+            return false;
+        }
+        key = BvhCache::make_key(hash_bytes(source.data(), source.size()), settings);
+        if (cache->load(key, settings, mesh)) return true;
+    }
+
+    bool loaded = has_extension(path, ".ply") ? load_ply(path, 0, mesh) : load_obj(path, 0, mesh);
+    if (!loaded) return false;
+    mesh.bvh.build(mesh.triangles(), settings);
+    if (cache && !cache->store(key, mesh))
+        fmt::print("[{}: {}] unable to write {}\n", "WARNING", "BVH-CACHE", cache->entry_path(key));
+    return true;
+}
+
+// Loads a model into scene, with mesh BVHs so the path tracer only has to build the instance BVH.
+// The material ids are those of scene.materials.
+bool load_model(ModelDescription const& model, std::vector<Material> const& materials,
+                BvhBuildSettings settings, BvhCache const* cache, SceneData& scene)
+{
+    settings.quality = model.quality;
+    if (has_extension(model.path, ".obj") || has_extension(model.path, ".ply"))
+    {
+        Mesh mesh;
+        if (!load_mesh(model.path, settings, cache, mesh)) return false;
+        scene.materials.push_back(materials[model.material]);
+        scene.meshes.push_back(std::move(mesh));
+        scene.mesh_instances.push_back(MeshInstance{0, model.transform, -1});
+    }
+    else
+    {
+        if (!load_glb(model.path, scene)) return false;
+        for (auto& mesh : scene.meshes) mesh.bvh.build(mesh.triangles(), settings);
+        int material_override = -1;
+        if (model.material >= 0)
+        {
+            material_override = static_cast<int>(scene.materials.size());
+            scene.materials.push_back(materials[model.material]);
+        }
+        for (auto& instance : scene.mesh_instances)
+        {
+            instance.transform = model.transform * instance.transform;
+            if (material_override >= 0) instance.material_override = material_override;
+        }
+    }
+    return true;
+}
+}  // namespace
+
+SceneLoader::SceneLoader(BvhCache const* cache, uint32_t concurrent_models)
+    : cache(cache), pool(concurrent_models + 1)
+{
+}
+
+SceneLoader::~SceneLoader() { pool.wait(models); }
+
+bool SceneLoader::load(RVPT& rvpt, std::string const& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        fmt::print("[{}: {}] unable to open {}\n", "ERROR", "SCENE-LOADING", path);
+        return false;
+    }
+
+    SceneData scene;
+    std::vector<ModelDescription> model_descriptions;
+    try
+    {
+        json description = json::parse(file);
+        if (description.contains("camera"))
+            apply_camera(description.at("camera"), rvpt.scene_camera);
+        if (description.contains("settings"))
+            apply_settings(description.at("settings"), rvpt.render_settings);
+        if (description.contains("streaming"))
+            apply_streaming(description.at("streaming"), rvpt);
+        if (description.contains("lod")) apply_lod(description.at("lod"), rvpt);
+
+        auto directory = std::filesystem::path(path).parent_path();
+        for (auto const& material : description.value("materials", json::array()))
+            scene.materials.push_back(read_material_description(material, directory, rvpt));
+        for (auto const& sphere : description.value("spheres", json::array()))
+        {
+            int material = read_material(sphere, scene.materials.size());
+            if (material < 0) throw SceneError("a sphere has no material");
+            scene.spheres.emplace_back(read_vec3(sphere, "center", glm::vec3(0.0f)),
+                                       sphere.value("radius", 1.0f), material);
+        }
+
+        for (auto const& model : description.value("models", json::array()))
+        {
+            ModelDescription model_description;
+            model_description.path = (directory / model.at("file").get<std::string>()).string();
+            model_description.transform = read_transform(model);
+            model_description.material = read_material(model, scene.materials.size());
+            auto quality = model.value("quality", std::string("fast"));
+            if (quality != "fast" && quality != "high")
+                throw SceneError(fmt::format("unknown quality '{}'", quality));
+            model_description.quality = quality == "high" ? BvhQuality::high : BvhQuality::fast;
+
+            bool single_mesh = has_extension(model_description.path, ".obj") ||
+                               has_extension(model_description.path, ".ply");
+            if (!single_mesh && !has_extension(model_description.path, ".glb"))
+                throw SceneError(fmt::format("{} is not an .obj, .ply or .glb file",
+                                             model_description.path));
+            if (single_mesh && model_description.material < 0)
+                throw SceneError(fmt::format("{} has no material", model_description.path));
+            model_descriptions.push_back(std::move(model_description));
+        }
+    }
+    catch (std::exception const& error)
+    {
+        fmt::print("[{}: {}] {} is not a valid scene description: {}\n", "ERROR", "SCENE-LOADING",
+                   path, error.what());
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(loaded_mutex);
+        pending_models += model_descriptions.size();
+    }
+    auto materials = scene.materials;
+    rvpt.add_scene(std::move(scene));
+
+    BvhBuildSettings settings = rvpt.bvh_settings;
+    LodSettings lod_settings = rvpt.lod_settings;
+    bool quantize = rvpt.quantize_meshes;
+    for (auto& model : model_descriptions)
+    {
+        pool.run(models, [this, model = std::move(model), materials, settings, lod_settings,
+                          quantize]() {
+            auto start = std::chrono::high_resolution_clock::now();
+            LoadedModel loaded_model;
+            bool success = load_model(model, materials, settings, cache, loaded_model.scene);
+            // the levels and the quantization are done here, the path tracer only places them
+            if (success)
+                loaded_model.mesh_levels =
+                    prepare_meshes(loaded_model.scene.meshes, lod_settings, settings, quantize);
+
+            std::lock_guard<std::mutex> lock(loaded_mutex);
+            if (!success)
+            {
+                fmt::print("[{}: {}] skipped {}\n", "WARNING", "SCENE-LOADING", model.path);
+                pending_models--;
+                return;
+            }
+            fmt::print("[{}: {}] {} loaded in {:.2f} ms\n", "INFO", "SCENE-LOADING", model.path,
+                       std::chrono::duration<double, std::milli>(
+                           std::chrono::high_resolution_clock::now() - start)
+                           .count());
+            loaded.push_back(std::move(loaded_model));
+        });
+    }
+    return true;
+}
+
+void SceneLoader::add_loaded(RVPT& rvpt)
+{
+    std::vector<LoadedModel> finished;
+    {
+        std::lock_guard<std::mutex> lock(loaded_mutex);
+        finished.swap(loaded);
+        pending_models -= finished.size();
+    }
+    // the instance BVH is rebuilt once in the next update(), however many models arrived
+    for (auto& model : finished)
+        rvpt.add_scene(std::move(model.scene), std::move(model.mesh_levels));
+}
+
+bool SceneLoader::done() const
+{
+    std::lock_guard<std::mutex> lock(loaded_mutex);
+    return pending_models == 0;
+}
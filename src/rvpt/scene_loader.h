@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "bvh_cache.h"
+#include "rvpt.h"
+#include "scene_file.h"
+#include "thread_pool.h"
+
+// Loads a JSON scene description:
+//
+//  {
+//      "camera": {"position": [0, 1, -5], "rotation": [0, 0, 0], "fov": 90, "mode": "perspective"},
+//      "settings": {"max_bounces": 8, "aa": 1, "render_mode": "James Kajiya",
+//                   "traversal_mode": "wide BVH"},
+//      "streaming": {"enabled": true, "cluster_triangles": 4096, "pool_clusters": 256,
+//                    "uploads_per_frame": 32},
+//      "lod": {"levels": 3, "reduction": 0.25, "min_triangles": 256, "pixel_error": 1},
+//      "materials": [{"type": "dielectric", "albedo": [1, 1, 1], "emission": [0, 0, 0],
+//                     "ior": 1.5, "albedo_texture": "wood.png", "emission_texture": "glow.png"}],
+//      "spheres": [{"center": [0, 1, 0], "radius": 1, "material": 0}],
+//      "models": [{"file": "bunny.obj", "material": 0, "position": [0, 0, 0],
+//                  "rotation": [0, 90, 0], "scale": 1, "quality": "high"}]
+//  }
+//
+// Every key but the file of a model is optional. Modes are the names of CameraModes, RenderModes
+// and TraversalModes or their index. Rotations are in degrees, yaw and pitch for the camera like
+// Camera::rotate() and euler angles about x, y and z for models. Model files are .obj, .ply or
+// .glb, relative to the description, so are textures. An .obj or .ply model needs a material, for
+// a .glb one it replaces the file's materials. Streaming pages the meshes into a fixed pool of GPU
+// memory, see RVPT::stream_meshes. Lod builds simplified levels of every mesh, see
+// RVPT::lod_settings.
+//
+// The description itself, its materials and its spheres are applied right away, as the sphere
+// buffers are sized in initialize(). The textures start decoding with RVPT::add_texture(). The
+// models are parsed, their BVHs and levels built and their meshes quantized on worker threads
+// while the device comes up and the first frames render, every finished model is handed to the
+// path tracer by add_loaded(), so the time to the first frame does not depend on the scene size.
+class SceneLoader
+{
+public:
+    // .obj and .ply models are looked up in cache and stored to it after a build, if there is one.
+    // concurrent_models is how many models are loaded at the same time, each one parses with
+    // every hardware thread.
+    explicit SceneLoader(BvhCache const* cache = nullptr, uint32_t concurrent_models = 2);
+    // waits for the models that are still loading
+    ~SceneLoader();
+
+    SceneLoader(SceneLoader const& other) = delete;
+    SceneLoader& operator=(SceneLoader const& other) = delete;
+    SceneLoader(SceneLoader&& other) = delete;
+    SceneLoader& operator=(SceneLoader&& other) = delete;
+
+    // Must be called before rvpt.initialize(), the BVH, level and quantization settings of rvpt
+    // are captured for the models. Returns false and prints the reason if the description could
+    // not be read, models that fail to load are reported and skipped.
+    bool load(RVPT& rvpt, std::string const& path);
+
+    // Adds the models that finished loading since the last call, e.g. once per frame
+    void add_loaded(RVPT& rvpt);
+
+    // whether every model was added
+    bool done() const;
+
+private:
+    BvhCache const* cache;
+    ThreadPool pool;
+    ThreadPool::TaskGroup models;
+
+    // a model with the levels of its meshes, see prepare_meshes()
+    struct LoadedModel
+    {
+        SceneData scene;
+        std::vector<std::vector<LodLevel>> mesh_levels;
+    };
+
+    mutable std::mutex loaded_mutex;
+    std::vector<LoadedModel> loaded;
+    size_t pending_models = 0;  // started and not yet added, guarded by loaded_mutex
+};
@@ -0,0 +1,343 @@
+#include "sdf_brick_map.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <limits>
+
+#include <fmt/core.h>
+#include <glm/gtc/packing.hpp>
+
+#include "thread_pool.h"
+
+namespace
+{
+constexpr size_t PARALLEL_GRAIN_SIZE = 64;
+// pushes of distance_bvh, one per level at most, so twice the deepest BvhBuildSettings::max_depth
+constexpr size_t DISTANCE_STACK_SIZE = 128;
+constexpr float SQRT_3 = 1.7320508f;
+
+float dot2(glm::vec3 v) { return glm::dot(v, v); }
+
+float sign(float x) { return static_cast<float>((x > 0.0f) - (x < 0.0f)); }
+
+float distance_box(glm::vec3 p, AABB const& box)
+{
+    return glm::length(glm::max(glm::max(box.min - p, p - box.max), glm::vec3(0.0f)));
+}
+
+float distance_primitive(std::vector<Triangle> const& triangles,
+                         std::vector<Sphere> const& spheres, uint32_t prim, glm::vec3 p)
+{
+    if ((prim & BVH_SPHERE_BIT) != 0)
+    {
+        Sphere const& sphere = spheres[prim & ~BVH_SPHERE_BIT];
+        return glm::length(p - sphere.origin) - sphere.radius;
+    }
+    Triangle const& tri = triangles[prim];
+    return distance_triangle(p, glm::vec3(tri.vertex0), glm::vec3(tri.vertex1),
+                             glm::vec3(tri.vertex2));
+}
+
+// Smallest of closest and leaf_distance(primitive, closest so far) over the primitives of bvh.
+// node_bounds(node) gives the box of a node in the space of p, leaves farther than the closest
+// primitive so far are skipped.
+template <typename NodeBounds, typename LeafDistance>
+float closest_distance(BVH const& bvh, glm::vec3 p, float closest, NodeBounds const& node_bounds,
+                       LeafDistance const& leaf_distance)
+{
+    if (bvh.nodes.empty()) return closest;
+
+    // boxes are only a bound of the unsigned distance, inside a sphere every box around p counts
+    auto bound = [&] { return std::max(closest, 0.0f); };
+
+    std::array<std::pair<uint32_t, float>, DISTANCE_STACK_SIZE> stack;
+    size_t stack_size = 0;
+    uint32_t node_index = 0;
+    while (true)
+    {
+        BvhNode const& node = bvh.nodes[node_index];
+        if (node.is_leaf())
+        {
+            for (uint32_t i = 0; i < node.primitive_count(); i++)
+            {
+                uint32_t prim = bvh.primitive_indices[node.left_or_first + i];
+                closest = std::min(closest, leaf_distance(prim, closest));
+            }
+        }
+        else
+        {
+            uint32_t near = node.left_or_first;
+            uint32_t far = node.right_or_count;
+            float near_distance = distance_box(p, node_bounds(near));
+            float far_distance = distance_box(p, node_bounds(far));
+            if (far_distance < near_distance)
+            {
+                std::swap(near, far);
+                std::swap(near_distance, far_distance);
+            }
+            if (near_distance <= bound())
+            {
+                if (far_distance <= bound())
+                {
+                    assert(stack_size < DISTANCE_STACK_SIZE);
+                    stack[stack_size++] = {far, far_distance};
+                }
+                node_index = near;
+                continue;
+            }
+        }
+
+        // entries pushed before closest shrank may be out of reach by now
+        while (stack_size > 0 && stack[stack_size - 1].second > bound()) stack_size--;
+        if (stack_size == 0) break;
+        node_index = stack[--stack_size].first;
+    }
+    return closest;
+}
+}  // namespace
+
+float distance_triangle(glm::vec3 p, glm::vec3 a, glm::vec3 b, glm::vec3 c)
+{
+    glm::vec3 ba = b - a;
+    glm::vec3 pa = p - a;
+    glm::vec3 cb = c - b;
+    glm::vec3 pb = p - b;
+    glm::vec3 ac = a - c;
+    glm::vec3 pc = p - c;
+    glm::vec3 nor = glm::cross(ba, ac);
+
+    // outside of the prism over the triangle the closest point is on an edge
+    if (sign(glm::dot(glm::cross(ba, nor), pa)) + sign(glm::dot(glm::cross(cb, nor), pb)) +
+            sign(glm::dot(glm::cross(ac, nor), pc)) <
+        2.0f)
+        return std::sqrt(std::min(
+            std::min(dot2(ba * glm::clamp(glm::dot(ba, pa) / dot2(ba), 0.0f, 1.0f) - pa),
+                     dot2(cb * glm::clamp(glm::dot(cb, pb) / dot2(cb), 0.0f, 1.0f) - pb)),
+            dot2(ac * glm::clamp(glm::dot(ac, pc) / dot2(ac), 0.0f, 1.0f) - pc)));
+    return std::sqrt(glm::dot(nor, pa) * glm::dot(nor, pa) / dot2(nor));
+}
+
+float distance_bvh(BVH const& bvh, std::vector<Triangle> const& triangles,
+                   std::vector<Sphere> const& spheres, glm::vec3 p)
+{
+    return closest_distance(
+        bvh, p, std::numeric_limits<float>::infinity(),
+        [&](uint32_t node) { return bvh.nodes[node].bounds(); },
+        [&](uint32_t prim, float) { return distance_primitive(triangles, spheres, prim, p); });
+}
+
+float distance_instances(SdfScene const& scene, BVH const& tlas, glm::vec3 p, float closest)
+{
+    if (scene.meshes.empty()) return closest;
+    auto instance_distance = [&](uint32_t instance, float instance_closest) {
+        MeshInstance const& placement = scene.instances[instance];
+        Mesh const& mesh = *scene.meshes[placement.mesh];
+        // the BVH and the positions of a quantized mesh are on its grid
+        glm::mat4 to_world = placement.transform * mesh.quantization;
+        auto position = [&](uint32_t vertex) {
+            glm::vec3 local = mesh.quantized()
+                                  ? glm::vec3(mesh.quantized_vertices[vertex].position[0],
+                                              mesh.quantized_vertices[vertex].position[1],
+                                              mesh.quantized_vertices[vertex].position[2])
+                                  : mesh.vertices[vertex].position;
+            return glm::vec3(to_world * glm::vec4(local, 1.0f));
+        };
+        return closest_distance(
+            mesh.bvh, p, instance_closest,
+            [&](uint32_t node) {
+                return transform_bounds(mesh.bvh.nodes[node].bounds(), to_world);
+            },
+            [&](uint32_t tri, float) {
+                return distance_triangle(p, position(mesh.indices[3 * tri]),
+                                         position(mesh.indices[3 * tri + 1]),
+                                         position(mesh.indices[3 * tri + 2]));
+            });
+    };
+    return closest_distance(
+        tlas, p, closest, [&](uint32_t node) { return tlas.nodes[node].bounds(); },
+        instance_distance);
+}
+
+bool SdfBrickMap::bake(SdfScene const& scene, SdfBakeSettings const& settings,
+                       std::atomic<bool> const* cancel)
+{
+    auto clear = [this] {
+        header = SdfGridHeader{};
+        cells.clear();
+        atlas.clear();
+        brick_count = 0;
+    };
+    clear();
+    bool has_primitives = !scene.triangles.empty() || !scene.spheres.empty();
+    bool has_instances = !scene.meshes.empty() && !scene.instances.empty();
+    if (settings.resolution == 0 || (!has_primitives && !has_instances)) return true;
+    auto cancelled = [cancel] {
+        return cancel != nullptr && cancel->load(std::memory_order_relaxed);
+    };
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // only what the renderer has no BVH for is built
+    BvhBuildSettings bvh_settings;
+    bvh_settings.thread_count = settings.thread_count;
+    BVH built_bvh;
+    if (has_primitives && scene.bvh.nodes.empty())
+        built_bvh.build(scene.triangles, scene.spheres, bvh_settings);
+    BVH const& bvh = scene.bvh.nodes.empty() ? built_bvh : scene.bvh;
+    BVH built_tlas;
+    if (has_instances && scene.tlas.nodes.empty())
+    {
+        std::vector<AABB> instance_bounds;
+        for (auto const& placement : scene.instances)
+        {
+            Mesh const& mesh = *scene.meshes[placement.mesh];
+            instance_bounds.push_back(
+                mesh.bvh.nodes.empty()
+                    ? AABB{}
+                    : transform_bounds(mesh.bvh.nodes[0].bounds(),
+                                       placement.transform * mesh.quantization));
+        }
+        built_tlas.build(instance_bounds, bvh_settings);
+    }
+    BVH const& tlas = scene.tlas.nodes.empty() ? built_tlas : scene.tlas;
+    auto scene_distance = [&](glm::vec3 p) {
+        return distance_instances(scene, tlas, p,
+                                  distance_bvh(bvh, scene.triangles, scene.spheres, p));
+    };
+
+    AABB bounds;
+    if (!bvh.nodes.empty()) bounds.expand(bvh.nodes[0].bounds());
+    if (has_instances && !tlas.nodes.empty()) bounds.expand(tlas.nodes[0].bounds());
+    if (bounds.empty()) return true;
+    glm::vec3 extent = bounds.extent();
+    float longest = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-3f));
+
+    ThreadPool pool(settings.thread_count);
+    constexpr uint32_t max_bricks = SDF_ATLAS_BRICKS * SDF_ATLAS_BRICKS * SDF_MAX_ATLAS_LAYERS;
+    uint32_t resolution = settings.resolution;
+    float brick_extent = 0.0f;
+    glm::vec3 origin;
+    glm::ivec3 dims;
+    while (true)
+    {
+        float voxel = longest / static_cast<float>(resolution);
+        brick_extent = voxel * static_cast<float>(SDF_BRICK_SIZE - 1);
+        // one brick of margin keeps the geometry that far from the faces of the grid, rays
+        // outside of it step by their distance to the grid plus that margin
+        origin = bounds.min - glm::vec3(brick_extent);
+        glm::vec3 size = (extent + glm::vec3(2.0f * brick_extent)) / brick_extent;
+        dims = glm::ivec3(static_cast<int>(std::ceil(size.x)), static_cast<int>(std::ceil(size.y)),
+                          static_cast<int>(std::ceil(size.z)));
+
+        cells.assign(static_cast<size_t>(dims.x) * dims.y * dims.z, SdfCell{});
+        float half_diagonal = 0.5f * SQRT_3 * brick_extent;
+        float band = settings.band_voxels * voxel;
+        pool.parallel_for(cells.size(), PARALLEL_GRAIN_SIZE, [&](size_t begin, size_t end) {
+            if (cancelled()) return;
+            for (size_t i = begin; i < end; i++)
+            {
+                glm::ivec3 cell(static_cast<int>(i % dims.x),
+                                static_cast<int>(i / dims.x % dims.y),
+                                static_cast<int>(i / dims.x / dims.y));
+                glm::vec3 center = origin + (glm::vec3(cell) + glm::vec3(0.5f)) * brick_extent;
+                float distance = scene_distance(center);
+                // no point of the cell is farther from its center than half_diagonal
+                if (std::abs(distance) - half_diagonal < band)
+                    cells[i].brick = 0;
+                else
+                    cells[i].distance =
+                        distance > 0.0f ? distance - half_diagonal : distance + half_diagonal;
+            }
+        });
+        if (cancelled())
+        {
+            clear();
+            return false;
+        }
+
+        brick_count = 0;
+        for (auto& cell : cells)
+            if (cell.brick != SDF_EMPTY_BRICK) cell.brick = brick_count++;
+        if (brick_count <= max_bricks) break;
+
+        uint32_t lower = resolution * 3 / 4;
+        fmt::print("[{}: {}] {} bricks at {} voxels do not fit into the atlas, trying {}\n",
+                   "WARNING", "SDF", brick_count, resolution, lower);
+        resolution = lower;
+    }
+
+    header.origin = origin;
+    header.brick_extent = brick_extent;
+    header.dims = dims;
+    header.atlas_layers = (brick_count + SDF_ATLAS_BRICKS * SDF_ATLAS_BRICKS - 1) /
+                          (SDF_ATLAS_BRICKS * SDF_ATLAS_BRICKS);
+
+    std::vector<uint32_t> brick_cells(brick_count);
+    for (uint32_t i = 0; i < cells.size(); i++)
+        if (cells[i].brick != SDF_EMPTY_BRICK) brick_cells[cells[i].brick] = i;
+
+    glm::uvec3 texels = atlas_extent();
+    atlas.assign(static_cast<size_t>(texels.x) * texels.y * texels.z, 0);
+    float sample_step = 1.0f / static_cast<float>(SDF_BRICK_SIZE - 1);
+    pool.parallel_for(brick_count, 1, [&](size_t begin, size_t end) {
+        if (cancelled()) return;
+        for (size_t brick = begin; brick < end; brick++)
+        {
+            uint32_t i = brick_cells[brick];
+            glm::vec3 cell(static_cast<float>(i % dims.x), static_cast<float>(i / dims.x % dims.y),
+                           static_cast<float>(i / dims.x / dims.y));
+            glm::uvec3 slot(static_cast<uint32_t>(brick) % SDF_ATLAS_BRICKS,
+                            static_cast<uint32_t>(brick) / SDF_ATLAS_BRICKS % SDF_ATLAS_BRICKS,
+                            static_cast<uint32_t>(brick) / (SDF_ATLAS_BRICKS * SDF_ATLAS_BRICKS));
+            glm::uvec3 base = slot * SDF_BRICK_SIZE;
+            for (uint32_t z = 0; z < SDF_BRICK_SIZE; z++)
+                for (uint32_t y = 0; y < SDF_BRICK_SIZE; y++)
+                    for (uint32_t x = 0; x < SDF_BRICK_SIZE; x++)
+                    {
+                        glm::vec3 local = glm::vec3(static_cast<float>(x), static_cast<float>(y),
+                                                    static_cast<float>(z)) *
+                                          sample_step;
+                        glm::vec3 p = origin + (cell + local) * brick_extent;
+                        size_t texel = (static_cast<size_t>(base.z + z) * texels.y + base.y + y) *
+                                           texels.x +
+                                       base.x + x;
+                        atlas[texel] =
+                            static_cast<uint16_t>(glm::packHalf1x16(scene_distance(p)));
+                    }
+        }
+    });
+    if (cancelled())
+    {
+        clear();
+        return false;
+    }
+
+    std::chrono::duration<double, std::milli> bake_time =
+        std::chrono::high_resolution_clock::now() - start;
+    fmt::print("[{}: {}] {} of {} cells hold bricks at {} voxels, {} KiB in {:.2f} ms\n", "INFO",
+               "SDF", brick_count, cells.size(), resolution,
+               (atlas.size() * sizeof(uint16_t) + cells.size() * sizeof(SdfCell)) / 1024,
+               bake_time.count());
+    return true;
+}
+
+glm::uvec3 SdfBrickMap::atlas_extent() const
+{
+    return glm::uvec3(SDF_ATLAS_BRICKS * SDF_BRICK_SIZE, SDF_ATLAS_BRICKS * SDF_BRICK_SIZE,
+                      std::max(header.atlas_layers, 1u) * SDF_BRICK_SIZE);
+}
+
+std::vector<uint8_t> SdfBrickMap::grid_data() const
+{
+    std::vector<uint8_t> data(sizeof(SdfGridHeader) + cells.size() * sizeof(SdfCell));
+    std::memcpy(data.data(), &header, sizeof(SdfGridHeader));
+    if (!cells.empty())
+        std::memcpy(data.data() + sizeof(SdfGridHeader), cells.data(),
+                    cells.size() * sizeof(SdfCell));
+    return data;
+}
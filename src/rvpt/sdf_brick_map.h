@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "geometry.h"
+#include "instancing.h"
+
+// Samples per brick along each axis. Neighbouring bricks share their border samples, so a brick
+// spans SDF_BRICK_SIZE - 1 voxels and is filtered without reading its neighbours. Must match
+// SDF_BRICK_SIZE in compute_pass.comp
+constexpr uint32_t SDF_BRICK_SIZE = 8;
+// Bricks along x and y of the atlas, it grows along z. Must match SDF_ATLAS_BRICKS in
+// compute_pass.comp
+constexpr uint32_t SDF_ATLAS_BRICKS = 32;
+// Bricks along z of the atlas, keeps it within the 256 texels every device supports for 3D images
+constexpr uint32_t SDF_MAX_ATLAS_LAYERS = 32;
+// SdfCell::brick of cells without a brick
+constexpr uint32_t SDF_EMPTY_BRICK = 0xFFFFFFFFu;
+
+struct SdfBakeSettings
+{
+    // voxels along the longest axis of the scene, 0 disables the bake
+    uint32_t resolution = 128;
+    // bricks are stored where the surface is closer than this many voxels
+    float band_voxels = 2.0f;
+    // threads used by the bake, 0 uses every hardware thread
+    uint32_t thread_count = 0;
+};
+
+// Laid out to match the header of SdfBricks in compute_pass.comp (32 bytes)
+struct SdfGridHeader
+{
+    glm::vec3 origin{};
+    float brick_extent = 0.0f;  // size of a brick in world units
+    glm::ivec3 dims{};  // bricks per axis, all 0 if nothing was baked
+    uint32_t atlas_layers = 0;
+};
+
+// Laid out to match the SdfCell struct in structs.glsl (8 bytes)
+struct SdfCell
+{
+    uint32_t brick = SDF_EMPTY_BRICK;  // slot in the atlas
+    float distance = 0.0f;  // without a brick: a bound of the distance anywhere in the cell
+};
+
+// Unsigned distance from p to the triangle (a, b, c), same formula as distance_triangle
+float distance_triangle(glm::vec3 p, glm::vec3 a, glm::vec3 b, glm::vec3 c);
+
+// Distance from p to the closest primitive of a BVH built over triangles and spheres, signed inside
+// spheres like intersect_scene_st. Leaves farther than the closest primitive so far are skipped.
+float distance_bvh(BVH const& bvh, std::vector<Triangle> const& triangles,
+                   std::vector<Sphere> const& spheres, glm::vec3 p);
+
+// What a field is baked from, a copy so the scene can change while it bakes. The BVHs are the ones
+// the renderer built, bvh is only built by the bake if it is empty, e.g. when the scene BVH is
+// built on the GPU, and tlas if it is empty while there are instances. The meshes are shared
+// instead of copied, nothing changes a mesh once it is shared.
+struct SdfScene
+{
+    std::vector<Triangle> triangles;
+    std::vector<Sphere> spheres;
+    BVH bvh;  // over triangles and spheres
+    // indexed by MeshInstance::mesh, with their own BVHs
+    std::vector<std::shared_ptr<Mesh const>> meshes;
+    std::vector<MeshInstance> instances;
+    BVH tlas;  // over the world bounds of instances, leaves index them
+};
+
+// Distance from p to the closest triangle of the placed meshes, or closest if that is closer.
+// The node boxes are transformed to world space as they are visited, so it is exact for any
+// transform.
+float distance_instances(SdfScene const& scene, BVH const& tlas, glm::vec3 p, float closest);
+
+// Sparse narrow band distance field of the world primitives and instances for the sphere tracer.
+// The bounds are cut into a grid of bricks. Cells whose center is far from the surface only store
+// a bound of the distance, which is a safe step for any point inside them. The others get a brick
+// of SDF_BRICK_SIZE^3 samples in a 3D atlas that is filtered by the texture unit, the exact
+// distance is only evaluated once the filtered one is within a voxel of the surface.
+class SdfBrickMap
+{
+public:
+    // Bakes the field, the distances are evaluated through the BVHs of scene. The resolution is
+    // lowered until the bricks fit into the atlas. Returns false with an empty field once cancel
+    // is set, which is checked between chunks of the loops.
+    bool bake(SdfScene const& scene, SdfBakeSettings const& settings = {},
+              std::atomic<bool> const* cancel = nullptr);
+
+    bool empty() const { return brick_count == 0; }
+    // Texels of the atlas, at least one brick so it can always be bound
+    glm::uvec3 atlas_extent() const;
+    // Contents of the SdfBricks buffer, the header followed by the cells
+    std::vector<uint8_t> grid_data() const;
+
+    SdfGridHeader header;
+    std::vector<SdfCell> cells;
+    // half float distances, x fastest, atlas_extent() texels
+    std::vector<uint16_t> atlas;
+    uint32_t brick_count = 0;
+};
@@ -0,0 +1,140 @@
+#include "texture_loader.h"
+
+#include <cmath>
+#include <cstring>
+
+#include <algorithm>
+#include <array>
+
+#include <fmt/core.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb/stb_image.h>
+
+namespace
+{
+constexpr uint32_t CHANNELS = 4;
+
+std::array<float, 256> make_srgb_to_linear()
+{
+    std::array<float, 256> table{};
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        float c = static_cast<float>(i) / 255.0f;
+        table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    return table;
+}
+
+uint8_t linear_to_srgb(float c)
+{
+    c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+    return static_cast<uint8_t>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+// Fills the level after source from source. Odd sizes repeat their last row or column.
+void downsample(std::vector<uint8_t>& texels, TextureMip const& source, TextureMip const& target)
+{
+    static const std::array<float, 256> srgb_to_linear = make_srgb_to_linear();
+    uint8_t const* src = texels.data() + source.offset;
+    uint8_t* dst = texels.data() + target.offset;
+    for (uint32_t y = 0; y < target.height; y++)
+    {
+        uint32_t y0 = std::min(2 * y, source.height - 1);
+        uint32_t y1 = std::min(2 * y + 1, source.height - 1);
+        for (uint32_t x = 0; x < target.width; x++)
+        {
+            uint32_t x0 = std::min(2 * x, source.width - 1);
+            uint32_t x1 = std::min(2 * x + 1, source.width - 1);
+            std::array<uint8_t const*, 4> corners = {
+                src + (size_t{y0} * source.width + x0) * CHANNELS,
+                src + (size_t{y0} * source.width + x1) * CHANNELS,
+                src + (size_t{y1} * source.width + x0) * CHANNELS,
+                src + (size_t{y1} * source.width + x1) * CHANNELS};
+            uint8_t* out = dst + (size_t{y} * target.width + x) * CHANNELS;
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                float sum = 0.0f;
+                for (auto corner : corners) sum += srgb_to_linear[corner[c]];
+                out[c] = linear_to_srgb(0.25f * sum);
+            }
+            // alpha is stored linearly
+            uint32_t alpha = 0;
+            for (auto corner : corners) alpha += corner[3];
+            out[3] = static_cast<uint8_t>((alpha + 2) / 4);
+        }
+    }
+}
+}  // namespace
+
+TextureImage white_texture()
+{
+    TextureImage image;
+    image.texels.assign(CHANNELS, 255);
+    image.mips = {TextureMip{0, 1, 1}};
+    return image;
+}
+
+bool load_texture(std::string const& path, TextureImage& image)
+{
+    int width = 0;
+    int height = 0;
+    int file_channels = 0;
+    stbi_uc* pixels = stbi_load(path.c_str(), &width, &height, &file_channels, CHANNELS);
+    if (!pixels)
+    {
+        fmt::print("[{}: {}] unable to load {}: {}\n", "ERROR", "TEXTURE-LOADING", path,
+                   stbi_failure_reason());
+        return false;
+    }
+
+    image.mips.clear();
+    size_t size = 0;
+    auto mip_width = static_cast<uint32_t>(width);
+    auto mip_height = static_cast<uint32_t>(height);
+    while (true)
+    {
+        image.mips.push_back(TextureMip{size, mip_width, mip_height});
+        size += size_t{mip_width} * mip_height * CHANNELS;
+        if (mip_width == 1 && mip_height == 1) break;
+        mip_width = std::max(mip_width / 2, 1u);
+        mip_height = std::max(mip_height / 2, 1u);
+    }
+    image.texels.resize(size);
+    std::memcpy(image.texels.data(), pixels, size_t{image.width()} * image.height() * CHANNELS);
+    stbi_image_free(pixels);
+
+    for (size_t level = 1; level < image.mips.size(); level++)
+        downsample(image.texels, image.mips[level - 1], image.mips[level]);
+    return true;
+}
+
+TextureLoader::TextureLoader(uint32_t thread_count) : pool(thread_count) {}
+
+TextureLoader::~TextureLoader() { pool.wait(group); }
+
+uint32_t TextureLoader::add(std::string const& path)
+{
+    auto known = indices.find(path);
+    if (known != indices.end()) return known->second;
+
+    auto index = static_cast<uint32_t>(images.size());
+    indices.emplace(path, index);
+    images.push_back(std::make_unique<TextureImage>());
+    TextureImage* image = images.back().get();
+    pool.run(group, [path, image]() {
+        if (!load_texture(path, *image)) *image = white_texture();
+    });
+    return index;
+}
+
+std::vector<TextureImage> TextureLoader::finish()
+{
+    pool.wait(group);
+    std::vector<TextureImage> result;
+    result.reserve(images.size());
+    for (auto& image : images) result.push_back(std::move(*image));
+    images.clear();
+    indices.clear();
+    return result;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "thread_pool.h"
+
+struct TextureMip
+{
+    size_t offset;  // into TextureImage::texels
+    uint32_t width;
+    uint32_t height;
+};
+
+// RGBA8 texels of a texture in sRGB, its mip levels are stored one after the other
+struct TextureImage
+{
+    std::vector<uint8_t> texels;
+    std::vector<TextureMip> mips;
+
+    uint32_t width() const { return mips.empty() ? 0 : mips[0].width; }
+    uint32_t height() const { return mips.empty() ? 0 : mips[0].height; }
+};
+
+// A single white texel, e.g. in place of a texture that failed to load
+TextureImage white_texture();
+
+// Decodes a PNG, JPEG, TGA, BMP or HDR file with stb_image and generates its full mip chain, every
+// level averages 2x2 texels of the previous one in linear space. Returns false and prints the
+// reason if the file could not be decoded.
+bool load_texture(std::string const& path, TextureImage& image);
+
+// Decodes textures on a thread pool while the caller goes on, e.g. with creating the device. Each
+// texture is decoded and gets its mip chain in a task of its own, so many textures load on every
+// hardware thread instead of one after the other.
+class TextureLoader
+{
+public:
+    // thread_count includes the thread calling finish(), 0 uses every hardware thread
+    explicit TextureLoader(uint32_t thread_count = 0);
+    // waits for the textures that are still decoding
+    ~TextureLoader();
+
+    TextureLoader(TextureLoader const& other) = delete;
+    TextureLoader& operator=(TextureLoader const& other) = delete;
+    TextureLoader(TextureLoader&& other) = delete;
+    TextureLoader& operator=(TextureLoader&& other) = delete;
+
+    // Starts decoding the file and returns the index of its texture, a file that was added before
+    // keeps its index
+    uint32_t add(std::string const& path);
+    size_t size() const { return images.size(); }
+
+    // Waits for every texture and hands them over in the order they were added. A texture that
+    // failed to load is a single white texel, so the indices of the others stay valid.
+    std::vector<TextureImage> finish();
+
+private:
+    ThreadPool pool;
+    ThreadPool::TaskGroup group;
+    // stable addresses for the tasks to write to
+    std::vector<std::unique_ptr<TextureImage>> images;
+    std::unordered_map<std::string, uint32_t> indices;
+};
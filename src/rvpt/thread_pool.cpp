@@ -0,0 +1,144 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace
+{
+// lets run() and wait() find the queue owned by the calling worker
+thread_local ThreadPool const* current_pool = nullptr;
+thread_local uint32_t current_worker_queue = 0;
+}  // namespace
+
+ThreadPool::ThreadPool(uint32_t thread_count)
+{
+    uint32_t worker_count = resolve_thread_count(thread_count) - 1;
+    for (uint32_t i = 0; i < worker_count + 1; i++) queues.push_back(std::make_unique<WorkQueue>());
+    for (uint32_t i = 0; i < worker_count; i++) workers.emplace_back([this, i] { worker_loop(i); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    stopping = true;
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+    }
+    wake_condition.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+void ThreadPool::run(TaskGroup& group, std::function<void()> task)
+{
+    group.pending.fetch_add(1, std::memory_order_relaxed);
+
+    auto& queue = *queues[current_queue_index()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(Task{std::move(task), &group});
+    }
+    queued_tasks.fetch_add(1);
+
+    // taking the lock prevents the wake up from slipping in before a worker starts waiting
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+    }
+    wake_condition.notify_one();
+}
+
+void ThreadPool::wait(TaskGroup& group)
+{
+    uint32_t queue_index = current_queue_index();
+    while (group.pending.load(std::memory_order_acquire) > 0)
+    {
+        if (try_run_task(queue_index)) continue;
+
+        // nothing to steal, sleep until a task is queued or the last one of the group finished
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake_condition.wait(lock, [this, &group] {
+            return queued_tasks > 0 || group.pending.load(std::memory_order_acquire) == 0;
+        });
+    }
+}
+
+void ThreadPool::parallel_for(size_t count, size_t grain_size,
+                              std::function<void(size_t, size_t)> const& func)
+{
+    grain_size = std::max<size_t>(grain_size, 1);
+    TaskGroup group;
+    for (size_t begin = 0; begin < count; begin += grain_size)
+    {
+        size_t end = std::min(count, begin + grain_size);
+        run(group, [&func, begin, end] { func(begin, end); });
+    }
+    wait(group);
+}
+
+uint32_t ThreadPool::thread_count() const { return static_cast<uint32_t>(workers.size()) + 1; }
+
+uint32_t ThreadPool::resolve_thread_count(uint32_t thread_count)
+{
+    if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+    return std::max(thread_count, 1u);
+}
+
+void ThreadPool::worker_loop(uint32_t queue_index)
+{
+    current_pool = this;
+    current_worker_queue = queue_index;
+    while (!stopping)
+    {
+        if (try_run_task(queue_index)) continue;
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake_condition.wait(lock, [this] { return stopping || queued_tasks > 0; });
+    }
+}
+
+uint32_t ThreadPool::current_queue_index() const
+{
+    if (current_pool == this) return current_worker_queue;
+    return static_cast<uint32_t>(queues.size()) - 1;
+}
+
+std::optional<ThreadPool::Task> ThreadPool::pop_task(uint32_t queue_index)
+{
+    {
+        auto& own = *queues[queue_index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            Task task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return task;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+        auto& victim = *queues[(queue_index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            Task task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return task;
+        }
+    }
+    return {};
+}
+
+bool ThreadPool::try_run_task(uint32_t queue_index)
+{
+    auto task = pop_task(queue_index);
+    if (!task) return false;
+
+    queued_tasks.fetch_sub(1);
+    task->func();
+    // the group can be gone once its waiter sees the count drop, so it is not touched afterwards
+    if (task->group->pending.fetch_sub(1, std::memory_order_release) == 1)
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+        }
+        wake_condition.notify_all();
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Work stealing thread pool. Every worker owns a queue, takes its newest task first and steals
+// the oldest task of another queue when its own runs dry. Threads waiting on a TaskGroup help
+// executing tasks, so tasks are free to spawn and wait on more tasks, and sleep once there is
+// nothing left to steal.
+class ThreadPool
+{
+public:
+    // thread_count includes the thread waiting on the pool, 0 uses every hardware thread
+    explicit ThreadPool(uint32_t thread_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const& other) = delete;
+    ThreadPool& operator=(ThreadPool const& other) = delete;
+    ThreadPool(ThreadPool&& other) = delete;
+    ThreadPool& operator=(ThreadPool&& other) = delete;
+
+    class TaskGroup
+    {
+        friend class ThreadPool;
+        std::atomic<size_t> pending{0};
+    };
+
+    void run(TaskGroup& group, std::function<void()> task);
+    void wait(TaskGroup& group);
+
+    // Calls func(begin, end) over [0, count) in chunks of grain_size and waits for all of them
+    void parallel_for(size_t count, size_t grain_size,
+                      std::function<void(size_t, size_t)> const& func);
+
+    uint32_t thread_count() const;
+
+    static uint32_t resolve_thread_count(uint32_t thread_count);
+
+private:
+    struct Task
+    {
+        std::function<void()> func;
+        TaskGroup* group;
+    };
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // one queue per worker, the last one is shared by threads outside of the pool
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake_condition;
+    std::atomic<size_t> queued_tasks{0};
+    std::atomic<bool> stopping{false};
+
+    void worker_loop(uint32_t queue_index);
+    uint32_t current_queue_index() const;
+    std::optional<Task> pop_task(uint32_t queue_index);
+    bool try_run_task(uint32_t queue_index);
+};
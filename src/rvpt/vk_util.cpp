@@ -118,6 +118,41 @@ Semaphore::Semaphore(VkDevice device, std::string const& name) : semaphore(creat
 
 VkSemaphore Semaphore::get() const { return semaphore.handle; }
 
+// QueryPool
+
+auto create_query_pool(VkDevice device, VkQueryType type, uint32_t count)
+{
+    VkQueryPoolCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    info.queryType = type;
+    info.queryCount = count;
+    VkQueryPool pool;
+    VK_CHECK_RESULT(vkCreateQueryPool(device, &info, nullptr, &pool));
+    return HandleWrapper(device, pool, vkDestroyQueryPool);
+}
+
+QueryPool::QueryPool(VkDevice device, VkQueryType type, uint32_t count, std::string const& name)
+    : pool(create_query_pool(device, type, count)), count(count)
+{
+    debug_utils_helper.set_debug_object_name(VK_OBJECT_TYPE_QUERY_POOL, pool.handle, name);
+}
+
+void QueryPool::reset(VkCommandBuffer command_buffer) const
+{
+    vkCmdResetQueryPool(command_buffer, pool.handle, 0, count);
+}
+
+bool QueryPool::get_results(std::vector<uint64_t>& results) const
+{
+    results.resize(count);
+    VkResult res = vkGetQueryPoolResults(pool.device, pool.handle, 0, count,
+                                         sizeof(uint64_t) * count, results.data(), sizeof(uint64_t),
+                                         VK_QUERY_RESULT_64_BIT);
+    return res == VK_SUCCESS;
+}
+
+VkQueryPool QueryPool::get() const { return pool.handle; }
+
 // Queue
 
 Queue::Queue(VkDevice device, uint32_t queue_family, std::string const& name, uint32_t queue_index)
@@ -618,6 +653,15 @@ ComputePipelineHandle PipelineBuilder::create_pipeline(ComputePipelineDetails co
     return {index};
 }
 
+void PipelineBuilder::set_specialization_constants(ComputePipelineHandle const& handle,
+                                                   std::vector<uint32_t> const& constants)
+{
+    auto& details = compute_pipelines.at(handle.index);
+    vkDestroyPipeline(device, details.pipeline, nullptr);
+    details.specialization_constants = constants;
+    details.pipeline = create_immutable_pipeline(details);
+}
+
 VkPipeline PipelineBuilder::create_immutable_pipeline(GraphicsPipelineDetails const& details)
 
 {
@@ -785,6 +829,16 @@ VkPipeline PipelineBuilder::create_immutable_pipeline(ComputePipelineDetails con
         compute_module.module.handle,
         "main"};
 
+    std::vector<VkSpecializationMapEntry> map_entries;
+    for (uint32_t i = 0; i < details.specialization_constants.size(); i++)
+        map_entries.push_back({i, i * static_cast<uint32_t>(sizeof(uint32_t)), sizeof(uint32_t)});
+    VkSpecializationInfo specialization_info{};
+    specialization_info.mapEntryCount = static_cast<uint32_t>(map_entries.size());
+    specialization_info.pMapEntries = map_entries.data();
+    specialization_info.dataSize = details.specialization_constants.size() * sizeof(uint32_t);
+    specialization_info.pData = details.specialization_constants.data();
+    if (!map_entries.empty()) compute_shader_create_info.pSpecializationInfo = &specialization_info;
+
     VkComputePipelineCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
     create_info.stage = compute_shader_create_info;
@@ -1004,13 +1058,13 @@ MemoryAllocator::Pool::Pool(VkDevice device, VkDeviceMemory device_memory, VkDev
 // Image
 
 auto create_image(VkDevice device, VkFormat format, VkImageTiling image_tiling, VkExtent3D extent,
-                  VkImageUsageFlags usage)
+                  VkImageUsageFlags usage, uint32_t mip_levels)
 {
     VkImageCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    create_info.imageType = VK_IMAGE_TYPE_2D;
+    create_info.imageType = extent.depth > 1 ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D;
     create_info.extent = extent;
-    create_info.mipLevels = 1;
+    create_info.mipLevels = mip_levels;
     create_info.arrayLayers = 1;
     create_info.format = format;
     create_info.tiling = image_tiling;
@@ -1024,16 +1078,17 @@ auto create_image(VkDevice device, VkFormat format, VkImageTiling image_tiling,
     return HandleWrapper(device, image, vkDestroyImage);
 }
 
-auto create_image_view(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspects)
+auto create_image_view(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspects,
+                       VkImageViewType view_type, uint32_t mip_levels)
 {
     VkImageViewCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     create_info.image = image;
-    create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    create_info.viewType = view_type;
     create_info.format = format;
     create_info.subresourceRange.aspectMask = aspects;
     create_info.subresourceRange.baseMipLevel = 0;
-    create_info.subresourceRange.levelCount = 1;
+    create_info.subresourceRange.levelCount = mip_levels;
     create_info.subresourceRange.baseArrayLayer = 0;
     create_info.subresourceRange.layerCount = 1;
 
@@ -1042,7 +1097,7 @@ auto create_image_view(VkDevice device, VkImage image, VkFormat format, VkImageA
     return HandleWrapper(device, image_view, vkDestroyImageView);
 }
 
-auto create_sampler(VkDevice device)
+auto create_sampler(VkDevice device, uint32_t mip_levels)
 {
     VkSamplerCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -1058,6 +1113,7 @@ auto create_sampler(VkDevice device)
     create_info.compareEnable = VK_FALSE;
     create_info.compareOp = VK_COMPARE_OP_ALWAYS;
     create_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    create_info.maxLod = static_cast<float>(mip_levels - 1);
 
     VkSampler sampler;
     VK_CHECK_RESULT(vkCreateSampler(device, &create_info, nullptr, &sampler))
@@ -1067,33 +1123,46 @@ auto create_sampler(VkDevice device)
 Image::Image(VkDevice device, MemoryAllocator& memory, Queue& queue, std::string const& name,
              VkFormat format, VkImageTiling tiling, uint32_t width, uint32_t height,
              VkImageUsageFlags usage, VkImageLayout layout, VkImageAspectFlags aspects,
-             VkDeviceSize size, MemoryUsage memory_usage)
+             VkDeviceSize size, MemoryUsage memory_usage, uint32_t mip_levels)
+    : Image(device, memory, queue, name, format, tiling, VkExtent3D{width, height, 1}, usage,
+            layout, aspects, size, memory_usage, mip_levels)
+{
+}
+
+Image::Image(VkDevice device, MemoryAllocator& memory, Queue& queue, std::string const& name,
+             VkFormat format, VkImageTiling tiling, VkExtent3D extent, VkImageUsageFlags usage,
+             VkImageLayout layout, VkImageAspectFlags aspects, VkDeviceSize size,
+             MemoryUsage memory_usage, uint32_t mip_levels)
     : memory_ptr(&memory),
-      image(create_image(device, format, tiling, {width, height, 1}, usage)),
+      image(create_image(device, format, tiling, extent, usage, mip_levels)),
       image_allocation(memory.allocate_image(image.handle, size, memory_usage)),
-      image_view(create_image_view(device, image.handle, format, aspects)),
-      sampler(create_sampler(device)),
+      image_view(create_image_view(
+          device, image.handle, format, aspects,
+          extent.depth > 1 ? VK_IMAGE_VIEW_TYPE_3D : VK_IMAGE_VIEW_TYPE_2D, mip_levels)),
+      sampler(create_sampler(device, mip_levels)),
       format(format),
       layout(layout),
-      width(width),
-      height(height)
+      width(extent.width),
+      height(extent.height),
+      depth(extent.depth),
+      mip_levels(mip_levels)
 {
+    debug_utils_helper.set_debug_object_name(VK_OBJECT_TYPE_IMAGE, image.handle, name);
+    debug_utils_helper.set_debug_object_name(VK_OBJECT_TYPE_SAMPLER, sampler.handle,
+                                             name + "_sampler");
+    debug_utils_helper.set_debug_object_name(VK_OBJECT_TYPE_IMAGE_VIEW, image_view.handle,
+                                             name + "_view");
+
     // no need to change layout
     if (layout == VK_IMAGE_LAYOUT_UNDEFINED) return;
     Fence fence(device, "image" + name + "_upload_fence");
     CommandBuffer cmd_buf(device, queue, "image" + name + "_upload_cmd_buf");
     cmd_buf.begin();
     set_image_layout(cmd_buf.get(), image.handle, VK_IMAGE_LAYOUT_UNDEFINED, layout,
-                     {aspects, 0, 1, 0, 1});
+                     {aspects, 0, mip_levels, 0, 1});
     cmd_buf.end();
     queue.submit(cmd_buf, fence);
     fence.wait();
-
-    debug_utils_helper.set_debug_object_name(VK_OBJECT_TYPE_IMAGE, image.handle, name);
-    debug_utils_helper.set_debug_object_name(VK_OBJECT_TYPE_SAMPLER, sampler.handle,
-                                             name + "_sampler");
-    debug_utils_helper.set_debug_object_name(VK_OBJECT_TYPE_IMAGE_VIEW, image_view.handle,
-                                             name + "_view");
 }
 
 VkDescriptorImageInfo Image::descriptor_info() const
@@ -1101,6 +1170,54 @@ VkDescriptorImageInfo Image::descriptor_info() const
     return {sampler.handle, image_view.handle, layout};
 }
 
+void Image::upload(Queue& queue, Buffer const& staging)
+{
+    Fence fence(image.device, "image_upload_fence");
+    CommandBuffer cmd_buf(image.device, queue, "image_upload_cmd_buf");
+    cmd_buf.begin();
+    VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    // the old contents are overwritten completely
+    set_image_layout(cmd_buf.get(), image.handle, VK_IMAGE_LAYOUT_UNDEFINED,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, range);
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {width, height, depth};
+    vkCmdCopyBufferToImage(cmd_buf.get(), staging.get(), image.handle,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    set_image_layout(cmd_buf.get(), image.handle, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout,
+                     range);
+    cmd_buf.end();
+    queue.submit(cmd_buf, fence);
+    fence.wait();
+}
+
+void upload_images(Queue& queue, Buffer const& staging, std::vector<ImageUpload> const& uploads,
+                   VkImageLayout layout)
+{
+    if (uploads.empty()) return;
+    VkDevice device = uploads.front().image->image.device;
+    Fence fence(device, "images_upload_fence");
+    CommandBuffer cmd_buf(device, queue, "images_upload_cmd_buf");
+    cmd_buf.begin();
+    for (auto const& upload : uploads)
+    {
+        Image& image = *upload.image;
+        VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, 0, image.mip_levels, 0, 1};
+        set_image_layout(cmd_buf.get(), image.get(), VK_IMAGE_LAYOUT_UNDEFINED,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, range);
+        vkCmdCopyBufferToImage(cmd_buf.get(), staging.get(), image.get(),
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               static_cast<uint32_t>(upload.regions.size()),
+                               upload.regions.data());
+        set_image_layout(cmd_buf.get(), image.get(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout,
+                         range);
+        image.layout = layout;
+    }
+    cmd_buf.end();
+    queue.submit(cmd_buf, fence);
+    fence.wait();
+}
+
 // Buffer
 
 auto create_buffer(VkDevice device, VkDeviceSize size, VkBufferUsageFlags usage)
@@ -1136,16 +1253,31 @@ void Buffer::unmap()
     memory_ptr->unmap(buffer.handle);
     is_mapped = false;
 }
+// Copies never go past the end of the buffer, data that grew past the size the buffer was created
+// with has to be fit first, e.g. RVPT::fit_buffer(), or it is cut off.
 void Buffer::copy_to(void const* pData, size_t size)
 {
+    assert(size <= buf_size && "copy larger than the buffer");
+    size = std::min(size, static_cast<size_t>(buf_size));
     if (!is_mapped) map();
 
     if (mapped_ptr != nullptr) memcpy(mapped_ptr, pData, size);
 }
-void Buffer::copy_bytes(unsigned char* data, size_t size)
+void Buffer::copy_from(void* pData, size_t size)
+{
+    assert(size <= buf_size && "copy larger than the buffer");
+    size = std::min(size, static_cast<size_t>(buf_size));
+    if (!is_mapped) map();
+
+    if (mapped_ptr != nullptr) memcpy(pData, mapped_ptr, size);
+}
+void Buffer::copy_bytes(void const* data, size_t size, size_t offset)
 {
+    assert(offset + size <= buf_size && "copy larger than the buffer");
+    if (offset >= buf_size) return;
+    size = std::min(size, static_cast<size_t>(buf_size) - offset);
     if (!is_mapped) map();
-    if (mapped_ptr != nullptr) memcpy(mapped_ptr, data, size);
+    if (mapped_ptr != nullptr) memcpy(static_cast<char*>(mapped_ptr) + offset, data, size);
 }
 void Buffer::flush() { memory_ptr->flush(buffer.handle); }
 
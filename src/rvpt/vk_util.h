@@ -135,7 +135,24 @@ private:
     HandleWrapper<VkSemaphore, PFN_vkDestroySemaphore> semaphore;
 };
 
+class QueryPool
+{
+public:
+    explicit QueryPool(VkDevice device, VkQueryType type, uint32_t count, std::string const& name);
+
+    void reset(VkCommandBuffer command_buffer) const;
+    // Returns false while any of the queries has not been written yet
+    bool get_results(std::vector<uint64_t>& results) const;
+
+    VkQueryPool get() const;
+
+private:
+    HandleWrapper<VkQueryPool, PFN_vkDestroyQueryPool> pool;
+    uint32_t count;
+};
+
 class CommandBuffer;
+class Buffer;
 
 class Queue
 {
@@ -330,6 +347,8 @@ struct ComputePipelineDetails
     VkPipelineLayout pipeline_layout;
 
     std::string compute_shader;
+    // uint32_t specialization constants, constant_id i gets the value at index i
+    std::vector<uint32_t> specialization_constants;
 };
 
 struct GraphicsPipelineHandle
@@ -357,6 +376,9 @@ struct PipelineBuilder
 
     GraphicsPipelineHandle create_pipeline(GraphicsPipelineDetails const& details);
     ComputePipelineHandle create_pipeline(ComputePipelineDetails const& details);
+    // Recreates the pipeline with new specialization constants, it must not be in use
+    void set_specialization_constants(ComputePipelineHandle const& handle,
+                                      std::vector<uint32_t> const& constants);
 
     VkPipeline create_immutable_pipeline(GraphicsPipelineDetails const& details);
     VkPipeline create_immutable_pipeline(ComputePipelineDetails const& details);
@@ -493,11 +515,21 @@ public:
     explicit Image(VkDevice device, MemoryAllocator& memory, Queue& queue, std::string const& name,
                    VkFormat format, VkImageTiling tiling, uint32_t width, uint32_t height,
                    VkImageUsageFlags usage, VkImageLayout layout, VkImageAspectFlags aspects,
-                   VkDeviceSize size, MemoryUsage memory_usage);
+                   VkDeviceSize size, MemoryUsage memory_usage, uint32_t mip_levels = 1);
+    // 3D image if extent.depth is larger than 1
+    explicit Image(VkDevice device, MemoryAllocator& memory, Queue& queue, std::string const& name,
+                   VkFormat format, VkImageTiling tiling, VkExtent3D extent,
+                   VkImageUsageFlags usage, VkImageLayout layout, VkImageAspectFlags aspects,
+                   VkDeviceSize size, MemoryUsage memory_usage, uint32_t mip_levels = 1);
 
     VkImage get() const { return image.handle; }
     VkDescriptorImageInfo descriptor_info() const;
 
+    // Copies the whole color image from a buffer created with VK_BUFFER_USAGE_TRANSFER_SRC_BIT and
+    // waits for it. The image has to be created with VK_IMAGE_USAGE_TRANSFER_DST_BIT and is left
+    // in its layout.
+    void upload(Queue& queue, Buffer const& staging);
+
     MemoryAllocator* memory_ptr;
     HandleWrapper<VkImage, PFN_vkDestroyImage> image;
     MemoryAllocator::Allocation<VkImage, MemoryCategory::Image> image_allocation;
@@ -508,8 +540,23 @@ public:
     VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
     uint32_t width;
     uint32_t height;
+    uint32_t depth = 1;
+    uint32_t mip_levels = 1;
 };
 
+// One image of upload_images(), with the regions of the staging buffer that fill its mip levels
+struct ImageUpload
+{
+    Image* image;
+    std::vector<VkBufferImageCopy> regions;
+};
+
+// Copies the regions of all uploads from staging with a single command buffer and waits for it,
+// instead of a submit per image. The images have to be created with
+// VK_IMAGE_USAGE_TRANSFER_DST_BIT, their old contents are discarded and they are left in layout.
+void upload_images(Queue& queue, Buffer const& staging, std::vector<ImageUpload> const& uploads,
+                   VkImageLayout layout);
+
 class Buffer
 {
 public:
@@ -533,7 +580,19 @@ public:
         copy_to(reinterpret_cast<void const*>(&data), sizeof(T));
     }
 
-    void copy_bytes(unsigned char* data, size_t size);
+    template <typename T>
+    void copy_from(std::vector<T>& data)
+    {
+        copy_from(reinterpret_cast<void*>(data.data()), sizeof(T) * data.size());
+    }
+
+    template <typename T>
+    void copy_from(T& data)
+    {
+        copy_from(reinterpret_cast<void*>(&data), sizeof(T));
+    }
+
+    void copy_bytes(void const* data, size_t size, size_t offset = 0);
 
     void flush();
 
@@ -550,6 +609,7 @@ private:
     void* mapped_ptr = nullptr;
 
     void copy_to(void const* pData, size_t size);
+    void copy_from(void* pData, size_t size);
 };
 
 void bind_vertex_buffer(VkCommandBuffer command_buffer, Buffer const& buffer);
@@ -0,0 +1,239 @@
+#include "wide_bvh.h"
+
+#include <cassert>
+#include <cmath>
+
+#include <algorithm>
+
+namespace
+{
+constexpr uint32_t QUANTIZED_MAX = 255;
+constexpr int MIN_EXPONENT = -126;
+constexpr int MAX_EXPONENT = 127;
+constexpr uint8_t INTERIOR_CHILD = 0x80;
+
+// A child slot of a wide node, either a node of the binary BVH or a range of its primitives
+struct Child
+{
+    AABB bounds;
+    bool binary_interior;
+    uint32_t binary_node;
+    uint32_t first;  // range in BVH::primitive_indices when !binary_interior
+    uint32_t count;
+
+    // leaves too large for one slot get a node of their own
+    bool is_interior() const { return binary_interior || count > WIDE_BVH_MAX_LEAF_SIZE; }
+};
+
+Child make_child(BVH const& bvh, uint32_t node_index)
+{
+    BvhNode const& node = bvh.nodes[node_index];
+    if (node.is_leaf())
+        return Child{node.bounds(), false, node_index, node.left_or_first, node.primitive_count()};
+    return Child{node.bounds(), true, node_index, 0, 0};
+}
+
+// The slots of the wide node that replaces child
+std::vector<Child> expand(BVH const& bvh, Child const& child)
+{
+    std::vector<Child> children;
+    if (!child.binary_interior)
+    {
+        // split the range over the slots, recursing if it does not fit into one node
+        uint32_t chunk = child.count <= WIDE_BVH_WIDTH * WIDE_BVH_MAX_LEAF_SIZE
+                             ? WIDE_BVH_MAX_LEAF_SIZE
+                             : (child.count + WIDE_BVH_WIDTH - 1) / WIDE_BVH_WIDTH;
+        for (uint32_t first = 0; first < child.count; first += chunk)
+        {
+            children.push_back(Child{child.bounds, false, child.binary_node, child.first + first,
+                                     std::min(chunk, child.count - first)});
+        }
+        return children;
+    }
+
+    // open the largest interior child until the node is full, which removes the levels of the
+    // binary tree that are least likely to cull anything
+    BvhNode const& node = bvh.nodes[child.binary_node];
+    children.push_back(make_child(bvh, node.left_or_first));
+    children.push_back(make_child(bvh, node.right_or_count));
+    while (children.size() < WIDE_BVH_WIDTH)
+    {
+        auto largest = children.end();
+        for (auto it = children.begin(); it != children.end(); ++it)
+        {
+            if (it->binary_interior &&
+                (largest == children.end() ||
+                 it->bounds.surface_area() > largest->bounds.surface_area()))
+                largest = it;
+        }
+        if (largest == children.end()) break;
+
+        BvhNode const& opened = bvh.nodes[largest->binary_node];
+        *largest = make_child(bvh, opened.left_or_first);
+        children.insert(largest + 1, make_child(bvh, opened.right_or_count));
+    }
+    return children;
+}
+
+// Smallest cell size exponent along one axis for which the outward rounded planes of every child
+// still fit into 8 bits
+int choose_exponent(float origin, float extent, std::vector<Child> const& children, int axis)
+{
+    int exponent = MIN_EXPONENT;
+    if (extent > 0.0f)
+        exponent = std::clamp(
+            static_cast<int>(std::ceil(std::log2(extent / static_cast<float>(QUANTIZED_MAX)))),
+            MIN_EXPONENT, MAX_EXPONENT);
+
+    // the float rounding of origin + q * scale can push a plane one cell further
+    for (; exponent < MAX_EXPONENT; exponent++)
+    {
+        float scale = std::ldexp(1.0f, exponent);
+        bool fits = true;
+        for (auto const& child : children)
+        {
+            float hi = std::ceil((child.bounds.max[axis] - origin) / scale);
+            while (origin + hi * scale < child.bounds.max[axis]) hi += 1.0f;
+            fits &= hi <= static_cast<float>(QUANTIZED_MAX);
+        }
+        if (fits) break;
+    }
+    return exponent;
+}
+
+uint32_t quantize_min(float value, float origin, float scale)
+{
+    float q = std::max(std::floor((value - origin) / scale), 0.0f);
+    while (q > 0.0f && origin + q * scale > value) q -= 1.0f;
+    return static_cast<uint32_t>(q);
+}
+
+uint32_t quantize_max(float value, float origin, float scale)
+{
+    float q = std::max(std::ceil((value - origin) / scale), 0.0f);
+    while (origin + q * scale < value) q += 1.0f;
+    return std::min(static_cast<uint32_t>(q), QUANTIZED_MAX);
+}
+
+void set_byte(uint32_t* words, uint32_t index, uint32_t value)
+{
+    uint32_t shift = (index % 4) * 8;
+    words[index / 4] = (words[index / 4] & ~(0xFFu << shift)) | (value << shift);
+}
+
+uint32_t get_byte(uint32_t const* words, uint32_t index)
+{
+    return (words[index / 4] >> ((index % 4) * 8)) & 0xFFu;
+}
+
+float exponent_scale(uint32_t exponents, int axis)
+{
+    return std::ldexp(1.0f, static_cast<int>((exponents >> (axis * 8)) & 0xFFu) - 127);
+}
+
+class Collapser
+{
+public:
+    Collapser(BVH const& bvh, WideBVH& wide) : bvh(bvh), wide(wide) {}
+
+    void emit(uint32_t wide_index, std::vector<Child> const& children)
+    {
+        assert(children.size() <= WIDE_BVH_WIDTH);
+        WideBvhNode node;
+
+        AABB parent;
+        for (auto const& child : children) parent.expand(child.bounds);
+        if (children.empty()) parent = AABB{glm::vec3(0.0f), glm::vec3(0.0f)};
+
+        node.origin = parent.min;
+        glm::vec3 scale;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            int exponent = choose_exponent(parent.min[axis], parent.max[axis] - parent.min[axis],
+                                           children, axis);
+            node.exponents |= static_cast<uint32_t>(exponent + 127) << (axis * 8);
+            scale[axis] = std::ldexp(1.0f, exponent);
+        }
+
+        // interior children are stored together, they are emitted once this node is done
+        std::vector<Child> interior;
+        node.child_base = static_cast<uint32_t>(wide.nodes.size());
+        node.prim_base = static_cast<uint32_t>(wide.primitive_indices.size());
+        for (uint32_t i = 0; i < children.size(); i++)
+        {
+            Child const& child = children[i];
+            if (child.is_interior())
+            {
+                set_byte(node.child_meta, i,
+                         INTERIOR_CHILD | static_cast<uint32_t>(interior.size()));
+                interior.push_back(child);
+            }
+            else
+            {
+                set_byte(node.child_meta, i, child.count);
+                wide.primitive_indices.insert(
+                    wide.primitive_indices.end(), bvh.primitive_indices.begin() + child.first,
+                    bvh.primitive_indices.begin() + child.first + child.count);
+            }
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                set_byte(node.bounds, axis * WIDE_BVH_WIDTH + i,
+                         quantize_min(child.bounds.min[axis], node.origin[axis], scale[axis]));
+                set_byte(node.bounds, (axis + 3) * WIDE_BVH_WIDTH + i,
+                         quantize_max(child.bounds.max[axis], node.origin[axis], scale[axis]));
+            }
+        }
+
+        wide.nodes.resize(wide.nodes.size() + interior.size());
+        wide.nodes[wide_index] = node;
+        for (uint32_t i = 0; i < interior.size(); i++)
+            emit(node.child_base + i, expand(bvh, interior[i]));
+    }
+
+private:
+    BVH const& bvh;
+    WideBVH& wide;
+};
+}  // namespace
+
+uint8_t WideBvhNode::meta(uint32_t child) const
+{
+    return static_cast<uint8_t>(get_byte(child_meta, child));
+}
+
+AABB WideBvhNode::child_bounds(uint32_t child) const
+{
+    AABB box;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float scale = exponent_scale(exponents, axis);
+        uint32_t lo = get_byte(bounds, axis * WIDE_BVH_WIDTH + child);
+        uint32_t hi = get_byte(bounds, (axis + 3) * WIDE_BVH_WIDTH + child);
+        box.min[axis] = origin[axis] + static_cast<float>(lo) * scale;
+        box.max[axis] = origin[axis] + static_cast<float>(hi) * scale;
+    }
+    return box;
+}
+
+void WideBVH::build(BVH const& bvh)
+{
+    nodes.clear();
+    primitive_indices.clear();
+    primitive_indices.reserve(bvh.primitive_indices.size());
+
+    nodes.emplace_back();
+    if (bvh.nodes.empty()) return;
+
+    Collapser collapser(bvh, *this);
+    Child root = make_child(bvh, 0);
+    if (root.binary_interior)
+        collapser.emit(0, expand(bvh, root));
+    else if (root.count > 0)
+        collapser.emit(0, root.count > WIDE_BVH_MAX_LEAF_SIZE ? expand(bvh, root)
+                                                              : std::vector<Child>{root});
+    else
+        collapser.emit(0, {});
+}
+
+size_t WideBVH::node_memory() const { return nodes.size() * sizeof(WideBvhNode); }
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+
+// Children per node, 4 or 8. Must match WIDE_BVH_WIDTH in compute_pass.comp
+constexpr uint32_t WIDE_BVH_WIDTH = 4;
+// Largest leaf a single child slot can reference, larger leaves are split over several slots
+constexpr uint32_t WIDE_BVH_MAX_LEAF_SIZE = 127;
+
+// Compressed node, laid out to match the WideBvhNode struct in structs.glsl (64 bytes for 4 wide,
+// 80 bytes for 8 wide).
+// The child boxes are stored with 8 bits per plane on a grid starting at origin, with a power of
+// two cell size per axis. The grid is rounded outwards so the decoded boxes always contain the
+// exact ones. Byte i of every packed word belongs to child i.
+struct alignas(16) WideBvhNode
+{
+    glm::vec3 origin{};
+    uint32_t exponents = 0;  // biased float exponents of the cell sizes, 8 bits per axis
+    uint32_t child_base = 0;  // interior children are stored consecutively from here
+    uint32_t prim_base = 0;  // primitives of the leaf children are stored consecutively from here
+    // 0: empty slot, 0x80 | n: the n-th interior child, 1-127: leaf with that many primitives
+    uint32_t child_meta[WIDE_BVH_WIDTH / 4]{};
+    // min x, min y, min z, max x, max y, max z planes, WIDE_BVH_WIDTH / 4 words each
+    uint32_t bounds[WIDE_BVH_WIDTH * 6 / 4]{};
+
+    uint8_t meta(uint32_t child) const;
+    AABB child_bounds(uint32_t child) const;
+};
+
+// Collapses a binary BVH into a WIDE_BVH_WIDTH-ary one that is traversed by testing all children of
+// a node at once. The primitives are renumbered so every node references them as one range.
+class WideBVH
+{
+public:
+    void build(BVH const& bvh);
+
+    // Memory of the nodes in bytes
+    size_t node_memory() const;
+
+    std::vector<WideBvhNode> nodes;
+    std::vector<uint32_t> primitive_indices;
+};
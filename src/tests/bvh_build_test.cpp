@@ -0,0 +1,118 @@
+// The SAH build over triangles and spheres: every primitive is referenced by one leaf, every node
+// bounds its children and primitives, and the result does not depend on the thread count.
+
+#include <random>
+#include <vector>
+
+#include "bvh.h"
+#include "check.h"
+
+namespace
+{
+bool contains(AABB const& outer, AABB const& inner)
+{
+    for (int axis = 0; axis < 3; axis++)
+        if (inner.min[axis] < outer.min[axis] || inner.max[axis] > outer.max[axis]) return false;
+    return true;
+}
+
+std::vector<Triangle> random_triangles(size_t count, uint32_t seed)
+{
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> edge(-0.5f, 0.5f);
+    std::vector<Triangle> triangles;
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::vec3 a(position(generator), position(generator), position(generator));
+        glm::vec3 e(edge(generator), edge(generator), edge(generator));
+        triangles.emplace_back(a, a + e, a + glm::vec3(e.y, e.z, -e.x), 0);
+    }
+    return triangles;
+}
+
+AABB primitive_bounds(std::vector<Triangle> const& triangles, std::vector<Sphere> const& spheres,
+                      uint32_t index)
+{
+    if (index & BVH_SPHERE_BIT) return sphere_bounds(spheres[index & ~BVH_SPHERE_BIT]);
+    return triangle_bounds(triangles[index]);
+}
+
+// walks the hierarchy from the root, counting how often each primitive is referenced
+void check_hierarchy(BVH const& bvh, std::vector<Triangle> const& triangles,
+                     std::vector<Sphere> const& spheres, std::vector<uint32_t>& references)
+{
+    std::vector<std::pair<uint32_t, uint32_t>> stack{{0, 1}};  // node and depth
+    while (!stack.empty())
+    {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+        CHECK(depth <= bvh.settings.max_depth);
+        BvhNode const& node = bvh.nodes[index];
+        if (node.is_leaf())
+        {
+            for (uint32_t i = 0; i < node.primitive_count(); i++)
+            {
+                uint32_t primitive = bvh.primitive_indices[node.left_or_first + i];
+                CHECK(contains(node.bounds(), primitive_bounds(triangles, spheres, primitive)));
+                uint32_t slot = primitive & BVH_SPHERE_BIT
+                                    ? static_cast<uint32_t>(triangles.size()) +
+                                          (primitive & ~BVH_SPHERE_BIT)
+                                    : primitive;
+                references[slot]++;
+            }
+            continue;
+        }
+        // children come after their parent, so the walk ends
+        CHECK(node.left_or_first > index && node.right_or_count > index);
+        CHECK(contains(node.bounds(), bvh.nodes[node.left_or_first].bounds()));
+        CHECK(contains(node.bounds(), bvh.nodes[node.right_or_count].bounds()));
+        stack.push_back({node.left_or_first, depth + 1});
+        stack.push_back({node.right_or_count, depth + 1});
+    }
+}
+}  // namespace
+
+int main()
+{
+    std::vector<Triangle> triangles = random_triangles(2000, 1);
+    std::vector<Sphere> spheres;
+    std::mt19937 generator(2);
+    std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+    for (int i = 0; i < 100; i++)
+        spheres.emplace_back(glm::vec3(position(generator), position(generator), 0.0f), 0.25f, 0);
+
+    BvhBuildSettings settings;
+    settings.thread_count = 1;
+    BVH serial;
+    serial.build(triangles, spheres, settings);
+    CHECK(serial.primitive_count == triangles.size() + spheres.size());
+    CHECK(serial.primitive_indices.size() == serial.primitive_count);
+    std::vector<uint32_t> references(serial.primitive_count, 0);
+    check_hierarchy(serial, triangles, spheres, references);
+    for (uint32_t count : references) CHECK(count == 1);
+    CHECK(serial.sah_cost() > 0.0f);
+    CHECK(serial.sah_cost() <= serial.initial_sah_cost);
+
+    settings.thread_count = 4;
+    BVH parallel;
+    parallel.build(triangles, spheres, settings);
+    CHECK(parallel.nodes.size() == serial.nodes.size());
+    CHECK(parallel.primitive_indices == serial.primitive_indices);
+    for (size_t i = 0; i < serial.nodes.size() && i < parallel.nodes.size(); i++)
+    {
+        CHECK(parallel.nodes[i].aabb_min == serial.nodes[i].aabb_min);
+        CHECK(parallel.nodes[i].aabb_max == serial.nodes[i].aabb_max);
+        CHECK(parallel.nodes[i].left_or_first == serial.nodes[i].left_or_first);
+        CHECK(parallel.nodes[i].right_or_count == serial.nodes[i].right_or_count);
+    }
+
+    // a single primitive is a leaf at the root
+    std::vector<Triangle> one = random_triangles(1, 3);
+    BVH single;
+    single.build(one);
+    CHECK(single.nodes[0].is_leaf() && single.nodes[0].primitive_count() == 1);
+    CHECK(contains(single.nodes[0].bounds(), triangle_bounds(one[0])));
+
+    return test_result();
+}
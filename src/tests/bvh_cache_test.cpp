@@ -0,0 +1,79 @@
+// The mesh cache: an entry loads back exactly what was stored, keys follow the settings that change
+// the build, and missing, truncated or foreign entries are misses.
+
+#include <cstring>
+
+#include <filesystem>
+#include <random>
+#include <vector>
+
+#include "bvh_cache.h"
+#include "check.h"
+
+namespace
+{
+template <typename T>
+bool same_bytes(std::vector<T> const& a, std::vector<T> const& b)
+{
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0;
+}
+}  // namespace
+
+int main()
+{
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<float> position(-5.0f, 5.0f);
+    std::vector<Triangle> triangles;
+    for (int i = 0; i < 200; i++)
+    {
+        glm::vec3 a(position(generator), position(generator), position(generator));
+        triangles.emplace_back(a, a + glm::vec3(0.3f, 0.0f, 0.1f), a + glm::vec3(0.0f, 0.4f, 0.0f),
+                               3);
+    }
+    Mesh mesh = make_mesh(triangles);
+    BvhBuildSettings settings;
+    mesh.bvh.build(mesh.triangles(), settings);
+
+    std::string directory = "bvh_cache_test";
+    std::filesystem::remove_all(directory);
+    BvhCache cache(directory);
+    uint64_t content = hash_bytes(triangles.data(), triangles.size() * sizeof(Triangle));
+    uint64_t key = BvhCache::make_key(content, settings);
+
+    Mesh loaded;
+    CHECK(!cache.load(key, settings, loaded));
+    CHECK(cache.store(key, mesh));
+    CHECK(cache.load(key, settings, loaded));
+    CHECK(same_bytes(loaded.vertices, mesh.vertices));
+    CHECK(loaded.indices == mesh.indices);
+    CHECK(same_bytes(loaded.bvh.nodes, mesh.bvh.nodes));
+    CHECK(loaded.bvh.primitive_indices == mesh.bvh.primitive_indices);
+    CHECK(loaded.bvh.primitive_count == mesh.bvh.primitive_count);
+    CHECK(loaded.bvh.build_sah_cost == mesh.bvh.build_sah_cost);
+    CHECK(loaded.material_id == 3);
+
+    // only what changes the result changes the key
+    BvhBuildSettings other = settings;
+    other.thread_count = 3;
+    other.max_sah_growth = 2.0f;
+    CHECK(BvhCache::make_key(content, other) == key);
+    other.max_leaf_size = settings.max_leaf_size + 1;
+    CHECK(BvhCache::make_key(content, other) != key);
+    CHECK(BvhCache::make_key(content, settings, 1) != key);
+    CHECK(BvhCache::make_key(content + 1, settings) != key);
+    CHECK(hash_bytes(triangles.data(), sizeof(Triangle)) !=
+          hash_bytes(triangles.data() + 1, sizeof(Triangle)));
+
+    // an entry copied to another key does not belong to it
+    uint64_t other_key = key + 1;
+    std::filesystem::copy_file(cache.entry_path(key), cache.entry_path(other_key));
+    CHECK(!cache.load(other_key, settings, loaded));
+
+    // a truncated entry is ignored instead of read past its end
+    std::filesystem::resize_file(cache.entry_path(key),
+                                 std::filesystem::file_size(cache.entry_path(key)) - 4);
+    CHECK(!cache.load(key, settings, loaded));
+
+    std::filesystem::remove_all(directory);
+    return test_result();
+}
@@ -0,0 +1,130 @@
+// The node layout after the treelet passes: the root is followed by padding, siblings share a
+// cache line, the hot levels come first breadth first, every subtree below them is contiguous and
+// the leaves read primitive_indices in node order. The treelet passes keep the primitives and the
+// depth limit and never raise the SAH cost.
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "bvh.h"
+#include "check.h"
+
+namespace
+{
+std::vector<Triangle> random_triangles(size_t count, uint32_t seed)
+{
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> edge(-0.5f, 0.5f);
+    std::vector<Triangle> triangles;
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::vec3 a(position(generator), position(generator), position(generator));
+        glm::vec3 e(edge(generator), edge(generator), edge(generator));
+        triangles.emplace_back(a, a + e, a + glm::vec3(e.y, e.z, -e.x), 0);
+    }
+    return triangles;
+}
+
+// depth of every node reached from the root, unreached nodes stay at BVH_NONE
+std::vector<uint32_t> node_depths(BVH const& bvh)
+{
+    std::vector<uint32_t> depths(bvh.nodes.size(), BVH_NONE);
+    depths[0] = 0;
+    for (size_t i = 0; i < bvh.nodes.size(); i++)
+    {
+        BvhNode const& node = bvh.nodes[i];
+        if (depths[i] == BVH_NONE || node.is_leaf()) continue;
+        depths[node.left_or_first] = depths[i] + 1;
+        depths[node.right_or_count] = depths[i] + 1;
+    }
+    return depths;
+}
+
+// nodes of the subtree below index, without index itself
+void collect_subtree(BVH const& bvh, uint32_t index, std::vector<uint32_t>& subtree)
+{
+    BvhNode const& node = bvh.nodes[index];
+    if (node.is_leaf()) return;
+    for (uint32_t child : {node.left_or_first, node.right_or_count})
+    {
+        subtree.push_back(child);
+        collect_subtree(bvh, child, subtree);
+    }
+}
+}  // namespace
+
+int main()
+{
+    std::vector<Triangle> triangles = random_triangles(3000, 8);
+    BvhBuildSettings settings;
+    settings.hot_levels = 4;
+    BVH bvh;
+    bvh.build(triangles, settings);
+
+    CHECK(!bvh.nodes[0].is_leaf());
+    CHECK(bvh.nodes[1].is_leaf() && bvh.nodes[1].primitive_count() == 0);
+    std::vector<uint32_t> depths = node_depths(bvh);
+    for (size_t i = 0; i < bvh.nodes.size(); i++)
+    {
+        BvhNode const& node = bvh.nodes[i];
+        if (depths[i] == BVH_NONE || node.is_leaf()) continue;
+        // children after the parent, side by side with the left one at an even index
+        CHECK(node.left_or_first > i);
+        CHECK(node.left_or_first % 2 == 0);
+        CHECK(node.right_or_count == node.left_or_first + 1);
+    }
+    // only the padding is unreached
+    CHECK(std::count(depths.begin(), depths.end(), BVH_NONE) == 1);
+
+    // breadth first within the hot levels, which come before everything else
+    for (size_t i = 1; i < bvh.nodes.size(); i++)
+    {
+        if (depths[i] == BVH_NONE) continue;
+        for (size_t k = i + 1; k < bvh.nodes.size(); k++)
+        {
+            if (depths[k] == BVH_NONE) continue;
+            if (depths[i] < settings.hot_levels) CHECK(depths[k] >= depths[i]);
+            if (depths[i] >= settings.hot_levels) CHECK(depths[k] >= settings.hot_levels);
+        }
+    }
+    // depth first below them
+    for (uint32_t i = 0; i < bvh.nodes.size(); i++)
+    {
+        if (depths[i] != settings.hot_levels - 1) continue;
+        std::vector<uint32_t> subtree;
+        collect_subtree(bvh, i, subtree);
+        if (subtree.empty()) continue;
+        auto [low, high] = std::minmax_element(subtree.begin(), subtree.end());
+        CHECK(*high - *low + 1 == subtree.size());
+    }
+    // the leaves in node order read primitive_indices front to back
+    uint32_t next_index = 0;
+    for (auto const& node : bvh.nodes)
+    {
+        if (!node.is_leaf() || node.primitive_count() == 0) continue;
+        CHECK(node.left_or_first == next_index);
+        next_index += node.primitive_count();
+    }
+    CHECK(next_index == bvh.primitive_indices.size());
+
+    // the treelet passes on their own, over a hierarchy limited in depth
+    settings.treelet_passes = 0;
+    settings.max_depth = 12;
+    BVH unoptimized;
+    unoptimized.build(triangles, settings);
+    BVH optimized = unoptimized;
+    optimized.optimize(3);
+    CHECK(optimized.sah_cost() <= unoptimized.sah_cost());
+    std::vector<uint32_t> before = unoptimized.primitive_indices;
+    std::vector<uint32_t> after = optimized.primitive_indices;
+    std::sort(before.begin(), before.end());
+    std::sort(after.begin(), after.end());
+    CHECK(before == after);
+    std::vector<uint32_t> optimized_depths = node_depths(optimized);
+    for (uint32_t depth : optimized_depths)
+        if (depth != BVH_NONE) CHECK(depth + 1 <= settings.max_depth);
+
+    return test_result();
+}
@@ -0,0 +1,97 @@
+// Refitting to moved triangles: the topology is kept and every node is refit to the exact union of
+// what it holds, until the SAH cost grows too much or the triangle count changes, which rebuilds.
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "bvh.h"
+#include "check.h"
+
+namespace
+{
+bool same_bounds(AABB const& a, AABB const& b) { return a.min == b.min && a.max == b.max; }
+
+std::vector<Triangle> random_triangles(size_t count, uint32_t seed)
+{
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> edge(-0.5f, 0.5f);
+    std::vector<Triangle> triangles;
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::vec3 a(position(generator), position(generator), position(generator));
+        glm::vec3 e(edge(generator), edge(generator), edge(generator));
+        triangles.emplace_back(a, a + e, a + glm::vec3(e.y, e.z, -e.x), 0);
+    }
+    return triangles;
+}
+
+// every node reached from the root bounds exactly its primitives or children
+void check_tight(BVH const& bvh, std::vector<Triangle> const& triangles)
+{
+    std::vector<uint32_t> stack{0};
+    while (!stack.empty())
+    {
+        BvhNode const& node = bvh.nodes[stack.back()];
+        stack.pop_back();
+        AABB expected;
+        if (node.is_leaf())
+        {
+            for (uint32_t i = 0; i < node.primitive_count(); i++)
+                expected.expand(
+                    triangle_bounds(triangles[bvh.primitive_indices[node.left_or_first + i]]));
+        }
+        else
+        {
+            expected = bvh.nodes[node.left_or_first].bounds();
+            expected.expand(bvh.nodes[node.right_or_count].bounds());
+            stack.push_back(node.left_or_first);
+            stack.push_back(node.right_or_count);
+        }
+        CHECK(same_bounds(node.bounds(), expected));
+    }
+}
+}  // namespace
+
+int main()
+{
+    std::vector<Triangle> triangles = random_triangles(1000, 4);
+    BVH bvh;
+    bvh.build(triangles);
+    std::vector<BvhNode> built_nodes = bvh.nodes;
+    std::vector<uint32_t> built_indices = bvh.primitive_indices;
+
+    // moving everything by the same offset keeps the cost, so the topology stays
+    for (auto& triangle : triangles)
+    {
+        triangle.vertex0 += glm::vec4(3.0f, -1.0f, 0.5f, 0.0f);
+        triangle.vertex1 += glm::vec4(3.0f, -1.0f, 0.5f, 0.0f);
+        triangle.vertex2 += glm::vec4(3.0f, -1.0f, 0.5f, 0.0f);
+    }
+    CHECK(!bvh.refit(triangles));
+    CHECK(bvh.primitive_indices == built_indices);
+    CHECK(bvh.nodes.size() == built_nodes.size());
+    for (size_t i = 0; i < bvh.nodes.size() && i < built_nodes.size(); i++)
+    {
+        CHECK(bvh.nodes[i].left_or_first == built_nodes[i].left_or_first);
+        CHECK(bvh.nodes[i].right_or_count == built_nodes[i].right_or_count);
+    }
+    check_tight(bvh, triangles);
+    CHECK(bvh.nodes[0].aabb_min.x > built_nodes[0].aabb_min.x);
+
+    // shuffled triangles leave every leaf spanning the scene, the cost grows past the limit
+    std::mt19937 generator(5);
+    std::shuffle(triangles.begin(), triangles.end(), generator);
+    CHECK(bvh.refit(triangles));
+    CHECK(bvh.sah_cost() <= bvh.build_sah_cost * bvh.settings.max_sah_growth);
+    check_tight(bvh, triangles);
+
+    // a changed triangle count is always rebuilt
+    triangles.push_back(triangles.front());
+    CHECK(bvh.refit(triangles));
+    CHECK(bvh.primitive_count == triangles.size());
+    check_tight(bvh, triangles);
+
+    return test_result();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <fmt/core.h>
+
+// The tests are plain executables run by ctest. CHECK reports a failed condition and carries on,
+// main returns test_result() so any failure fails the test.
+
+inline int check_failures = 0;
+
+#define CHECK(condition)                                                                        \
+    do                                                                                          \
+    {                                                                                           \
+        if (!(condition))                                                                       \
+        {                                                                                       \
+            fmt::print("[{}: {}] {}:{}: {}\n", "ERROR", "TEST", __FILE__, __LINE__, #condition); \
+            check_failures++;                                                                   \
+        }                                                                                       \
+    } while (false)
+
+inline int test_result()
+{
+    if (check_failures > 0)
+        fmt::print("[{}: {}] {} checks failed\n", "ERROR", "TEST", check_failures);
+    return check_failures > 0 ? 1 : 0;
+}
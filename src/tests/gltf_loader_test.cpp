@@ -0,0 +1,160 @@
+// The glTF loader on small .glb files built by the test: interleaved accessors, indexed and
+// unindexed primitives, materials, the node hierarchy, and the files it rejects without touching
+// the scene.
+
+#include <cstring>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "gltf_loader.h"
+
+namespace
+{
+template <typename T>
+void append(std::vector<uint8_t>& bytes, T value)
+{
+    size_t size = bytes.size();
+    bytes.resize(size + sizeof(T));
+    std::memcpy(bytes.data() + size, &value, sizeof(T));
+}
+
+// the header, the JSON chunk padded with spaces and the binary chunk padded with zeros
+std::string write_glb(std::string const& name, std::string json, std::vector<uint8_t> bin = {})
+{
+    while (json.size() % 4 != 0) json += ' ';
+    while (bin.size() % 4 != 0) bin.push_back(0);
+    std::vector<uint8_t> bytes;
+    auto total = static_cast<uint32_t>(12 + 8 + json.size() + (bin.empty() ? 0 : 8 + bin.size()));
+    append(bytes, uint32_t{0x46546C67});  // glTF
+    append(bytes, uint32_t{2});
+    append(bytes, total);
+    append(bytes, static_cast<uint32_t>(json.size()));
+    append(bytes, uint32_t{0x4E4F534A});  // JSON
+    bytes.insert(bytes.end(), json.begin(), json.end());
+    if (!bin.empty())
+    {
+        append(bytes, static_cast<uint32_t>(bin.size()));
+        append(bytes, uint32_t{0x004E4942});  // BIN
+        bytes.insert(bytes.end(), bin.begin(), bin.end());
+    }
+    std::ofstream(name, std::ios::binary)
+        .write(reinterpret_cast<char const*>(bytes.data()),
+               static_cast<std::streamsize>(bytes.size()));
+    return name;
+}
+
+bool near(glm::vec3 a, glm::vec3 b) { return glm::length(a - b) < 1e-5f; }
+
+// a quad with positions and uvs interleaved, then its 16 bit indices
+std::vector<uint8_t> quad_bin(uint16_t last_index)
+{
+    std::vector<uint8_t> bin;
+    float corners[4][5] = {{0, 0, 0, 0, 0}, {1, 0, 0, 1, 0}, {1, 1, 0, 1, 1}, {0, 1, 0, 0, 1}};
+    for (auto const& corner : corners)
+        for (float value : corner) append(bin, value);
+    uint16_t indices[6] = {0, 1, 2, 0, 2, last_index};
+    for (uint16_t index : indices) append(bin, index);
+    return bin;
+}
+
+std::string quad_json(int position_count)
+{
+    return R"({"asset": {"version": "2.0"},
+        "buffers": [{"byteLength": 92}],
+        "bufferViews": [{"buffer": 0, "byteOffset": 0, "byteLength": 80, "byteStride": 20},
+                        {"buffer": 0, "byteOffset": 80, "byteLength": 12}],
+        "accessors": [{"bufferView": 0, "componentType": 5126, "type": "VEC3", "count": )" +
+           std::to_string(position_count) + R"(},
+                      {"bufferView": 0, "byteOffset": 12, "componentType": 5126, "type": "VEC2",
+                       "count": 4},
+                      {"bufferView": 1, "componentType": 5123, "type": "SCALAR", "count": 6}],
+        "materials": [{"pbrMetallicRoughness": {"metallicFactor": 1.0, "roughnessFactor": 0.1}},
+                      {"extensions": {"KHR_materials_transmission": {"transmissionFactor": 1.0},
+                                      "KHR_materials_ior": {"ior": 1.33}}}],
+        "meshes": [{"primitives": [
+            {"attributes": {"POSITION": 0, "TEXCOORD_0": 1}, "indices": 2, "material": 1},
+            {"attributes": {"POSITION": 0}, "mode": 1},
+            {"attributes": {"POSITION": 0}}]}],
+        "nodes": [{"mesh": 0, "translation": [1, 2, 3], "children": [1]},
+                  {"mesh": 0, "scale": [2, 2, 2]}],
+        "scene": 0,
+        "scenes": [{"nodes": [0]}]})";
+}
+}  // namespace
+
+int main()
+{
+    // the loaded scene is appended to what is there
+    SceneData scene;
+    scene.materials.emplace_back(glm::vec4(1.0f), glm::vec4(0.0f), Material::Type::LAMBERT);
+    scene.meshes.emplace_back();
+    CHECK(load_glb(write_glb("gltf_loader_test_quad.glb", quad_json(4), quad_bin(3)), scene));
+
+    // the line primitive is skipped, the unindexed one gets the default material
+    CHECK(scene.meshes.size() == 3);
+    CHECK(scene.materials.size() == 4);
+    if (scene.meshes.size() == 3 && scene.materials.size() == 4)
+    {
+        Mesh const& quad = scene.meshes[1];
+        CHECK(quad.vertices.size() == 4);
+        CHECK((quad.indices == std::vector<uint32_t>{0, 1, 2, 0, 2, 3}));
+        CHECK(near(quad.vertices[2].position, {1, 1, 0}));
+        CHECK(quad.vertices[2].u == 1.0f && quad.vertices[2].v == 1.0f);
+        CHECK(quad.vertices[1].u == 1.0f && quad.vertices[1].v == 0.0f);
+        // normals are computed, the quad faces +z
+        CHECK(near(quad.vertices[0].normal, {0, 0, 1}));
+        CHECK(quad.material_id == 2);
+        CHECK(scene.meshes[2].triangle_count() == 1);
+        CHECK(scene.meshes[2].material_id == 3);
+
+        CHECK(scene.materials[1].data.x == static_cast<float>(Material::Type::MIRROR));
+        CHECK(scene.materials[2].data.x == static_cast<float>(Material::Type::DIELECTRIC));
+        CHECK(scene.materials[2].albedo.w == 1.33f);
+        CHECK(scene.materials[3].data.x == static_cast<float>(Material::Type::LAMBERT));
+    }
+
+    // both nodes place both primitives, the child below the translation of its parent
+    CHECK(scene.mesh_instances.size() == 4);
+    if (scene.mesh_instances.size() == 4)
+    {
+        MeshInstance const& parent = scene.mesh_instances[0];
+        MeshInstance const& child = scene.mesh_instances[2];
+        CHECK(parent.mesh == 1 && scene.mesh_instances[1].mesh == 2);
+        CHECK(near(glm::vec3(parent.transform * glm::vec4(1, 1, 0, 1)), {2, 3, 3}));
+        CHECK(near(glm::vec3(child.transform * glm::vec4(1, 1, 0, 1)), {3, 4, 3}));
+    }
+
+    // a node may have two parents, only a cycle is rejected below
+    SceneData shared;
+    CHECK(load_glb(write_glb("gltf_loader_test_shared.glb",
+                             R"({"asset": {"version": "2.0"}, "scene": 0,
+                                 "scenes": [{"nodes": [0, 2]}],
+                                 "nodes": [{"children": [1]}, {}, {"children": [1]}]})"),
+                   shared));
+
+    // broken files fail and leave the scene as it was
+    size_t mesh_count = scene.meshes.size();
+    size_t material_count = scene.materials.size();
+    CHECK(!load_glb(write_glb("gltf_loader_test_cycle.glb",
+                              R"({"asset": {"version": "2.0"}, "scene": 0,
+                                  "scenes": [{"nodes": [0]}],
+                                  "nodes": [{"children": [1]}, {"children": [0]}]})"),
+                    scene));
+    CHECK(!load_glb(write_glb("gltf_loader_test_index.glb", quad_json(4), quad_bin(9)), scene));
+    CHECK(!load_glb(write_glb("gltf_loader_test_range.glb", quad_json(5), quad_bin(3)), scene));
+    CHECK(!load_glb(write_glb("gltf_loader_test_json.glb", "{\"asset\": "), scene));
+    std::ofstream("gltf_loader_test_text.glb") << "not a glb file at all";
+    CHECK(!load_glb("gltf_loader_test_text.glb", scene));
+    CHECK(!load_glb("gltf_loader_test_missing.glb", scene));
+    CHECK(scene.meshes.size() == mesh_count && scene.materials.size() == material_count);
+    CHECK(scene.mesh_instances.size() == 4);
+
+    for (auto const& entry : std::filesystem::directory_iterator("."))
+        if (entry.path().filename().string().rfind("gltf_loader_test_", 0) == 0)
+            std::filesystem::remove(entry.path());
+    return test_result();
+}
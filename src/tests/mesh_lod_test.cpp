@@ -0,0 +1,145 @@
+// Mesh simplification on small grids: the triangle budget is met without folding triangles over or
+// moving the border of a flat grid, the levels get fewer triangles and larger errors, and the
+// selector picks coarser levels further away.
+
+#include <cmath>
+
+#include <vector>
+
+#include "check.h"
+#include "mesh_lod.h"
+
+namespace
+{
+// a grid of size by size quads facing +y, bumpy unless flat
+Mesh make_grid(int size, bool flat)
+{
+    Mesh mesh;
+    for (int z = 0; z <= size; z++)
+        for (int x = 0; x <= size; x++)
+        {
+            Vertex vertex{};
+            float height = flat ? 0.0f : 0.1f * static_cast<float>((x * z) % 7);
+            vertex.position = glm::vec3(x, height, z);
+            vertex.normal = glm::vec3(0, 1, 0);
+            mesh.vertices.push_back(vertex);
+        }
+    for (int z = 0; z < size; z++)
+        for (int x = 0; x < size; x++)
+        {
+            auto a = static_cast<uint32_t>(z * (size + 1) + x);
+            uint32_t b = a + 1;
+            uint32_t c = a + size + 1;
+            uint32_t d = c + 1;
+            for (uint32_t index : {a, c, b, b, c, d}) mesh.indices.push_back(index);
+        }
+    mesh.bvh.build(mesh.triangles());
+    return mesh;
+}
+
+AABB bounds_of(Mesh const& mesh)
+{
+    AABB bounds;
+    for (auto const& vertex : mesh.vertices) bounds.expand(vertex.position);
+    return bounds;
+}
+}  // namespace
+
+int main()
+{
+    // a flat grid keeps its outline and its facing, and costs nothing
+    Mesh flat = make_grid(32, true);
+    float error = -1.0f;
+    Mesh simplified = simplify_mesh(flat, 512, error);
+    CHECK(simplified.triangle_count() > 0 && simplified.triangle_count() <= 512);
+    CHECK(simplified.bvh.nodes.empty());
+    CHECK(error >= 0.0f && error < 1e-4f);
+    AABB before = bounds_of(flat);
+    AABB after = bounds_of(simplified);
+    for (int axis = 0; axis < 3; axis++)
+        CHECK(before.min[axis] == after.min[axis] && before.max[axis] == after.max[axis]);
+    for (size_t i = 0; i < simplified.indices.size(); i += 3)
+    {
+        CHECK(simplified.indices[i] < simplified.vertices.size());
+        CHECK(simplified.indices[i + 1] < simplified.vertices.size());
+        CHECK(simplified.indices[i + 2] < simplified.vertices.size());
+        if (simplified.indices[i + 2] >= simplified.vertices.size()) break;
+        glm::vec3 a = simplified.vertices[simplified.indices[i]].position;
+        glm::vec3 b = simplified.vertices[simplified.indices[i + 1]].position;
+        glm::vec3 c = simplified.vertices[simplified.indices[i + 2]].position;
+        CHECK(glm::cross(b - a, c - a).y > 0.0f);
+    }
+
+    // the levels of a bumpy grid, a small mesh gets none
+    std::vector<Mesh> meshes = {make_grid(48, false), make_grid(8, false)};
+    size_t full_triangles = meshes[0].triangle_count();
+    LodSettings settings;
+    settings.levels = 3;
+    settings.thread_count = 4;
+    std::vector<std::vector<LodLevel>> levels =
+        prepare_meshes(meshes, settings, BvhBuildSettings{}, true);
+    CHECK(levels.size() == 2);
+    CHECK(levels[0].size() == 2);
+    CHECK(levels[1].empty());
+    size_t previous_triangles = full_triangles;
+    float previous_error = 0.0f;
+    for (auto const& level : levels[0])
+    {
+        size_t triangles = level.mesh.triangle_count();
+        CHECK(triangles >= settings.min_triangles);
+        CHECK(triangles < 0.9 * static_cast<double>(previous_triangles));
+        CHECK(level.error > 0.0f && level.error >= previous_error);
+        CHECK(!level.mesh.bvh.nodes.empty());
+        CHECK(level.mesh.quantized());
+        previous_triangles = triangles;
+        previous_error = level.error;
+    }
+    CHECK(meshes[0].quantized() && meshes[1].quantized());
+
+    // no levels asked for, nothing simplified and nothing quantized
+    std::vector<Mesh> plain = {make_grid(16, false)};
+    levels = prepare_meshes(plain, LodSettings{}, BvhBuildSettings{}, false);
+    CHECK(levels.size() == 1 && levels[0].empty());
+    CHECK(!plain[0].quantized());
+
+    // a default camera at the origin with a fov of 90 degrees covers 500 pixels per unit of
+    // error at distance 1 in an image 1000 pixels high
+    Camera camera(1.0f);
+    LodView view = make_lod_view(camera, 1000.0f);
+    CHECK(!view.orthographic);
+    CHECK(std::abs(view.pixels_per_unit - 500.0f) < 1e-3f);
+
+    // mesh 0 has the levels 1 and 2, a placement further away gets a coarser one
+    std::vector<LodChain> chains(3);
+    chains[0].meshes = {0, 1, 2};
+    chains[0].errors = {0.0f, 0.01f, 0.1f};
+    chains[0].triangle_counts = {1000, 250, 60};
+    chains[0].bounds.expand(glm::vec3(-1.0f));
+    chains[0].bounds.expand(glm::vec3(1.0f));
+    std::vector<MeshInstance> instances = {MeshInstance{0, glm::mat4(1.0f), -1}};
+    LodSelector selector;
+    selector.set_instances(chains, instances);
+    CHECK(selector.full_triangles() == 1000);
+    uint32_t expected[3] = {0, 1, 2};
+    float distances[3] = {4.0f, 10.0f, 1000.0f};
+    for (int i = 0; i < 3; i++)
+    {
+        view.position = glm::vec3(0, 0, -1.0f - distances[i]);
+        CHECK(selector.select(chains, view, 1.0f));
+        CHECK(selector.instances()[0].mesh == expected[i]);
+        CHECK(selector.selected_triangles() == chains[0].triangle_counts[expected[i]]);
+        CHECK(!selector.select(chains, view, 1.0f));
+    }
+    // a placement scaled up shows its errors larger, inside the bounds only the full mesh is used
+    instances[0].transform = glm::mat4(10.0f);
+    instances[0].transform[3][3] = 1.0f;
+    selector.set_instances(chains, instances);
+    view.position = glm::vec3(0, 0, -110.0f);
+    selector.select(chains, view, 1.0f);
+    CHECK(selector.instances()[0].mesh == 1);
+    view.position = glm::vec3(0.0f);
+    selector.select(chains, view, 1.0f);
+    CHECK(selector.instances()[0].mesh == 0);
+
+    return test_result();
+}
@@ -0,0 +1,132 @@
+// The OBJ parser on small inline files: fans, relative indices, shared and split corners, computed
+// normals, the same result for any chunking and thread count, and the files it rejects.
+
+#include <cmath>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "obj_loader.h"
+
+namespace
+{
+std::string write_file(std::string const& name, std::string const& text)
+{
+    std::ofstream(name, std::ios::binary) << text;
+    return name;
+}
+
+bool near(glm::vec3 a, glm::vec3 b) { return glm::length(a - b) < 1e-5f; }
+
+// the vertex of every corner, which does not depend on how the vertices were numbered
+std::vector<Vertex> corners(Mesh const& mesh)
+{
+    std::vector<Vertex> result;
+    for (uint32_t index : mesh.indices) result.push_back(mesh.vertices[index]);
+    return result;
+}
+
+bool same_corners(Mesh const& a, Mesh const& b)
+{
+    std::vector<Vertex> corners_a = corners(a);
+    std::vector<Vertex> corners_b = corners(b);
+    if (corners_a.size() != corners_b.size()) return false;
+    for (size_t i = 0; i < corners_a.size(); i++)
+        if (corners_a[i].position != corners_b[i].position ||
+            corners_a[i].normal != corners_b[i].normal || corners_a[i].u != corners_b[i].u ||
+            corners_a[i].v != corners_b[i].v)
+            return false;
+    return true;
+}
+}  // namespace
+
+int main()
+{
+    // a quad as a fan, then a triangle with relative indices, other normals and a CRLF line
+    std::string quad = write_file("obj_loader_test_quad.obj",
+                                  "# test\n"
+                                  "v 0 0 0\n"
+                                  "v 1 0 0\n"
+                                  "v 1 1 0\n"
+                                  "v 0 1 0\n"
+                                  "vt 0 0\n"
+                                  "vt 1 0\n"
+                                  "vt 1 1\n"
+                                  "vn 0 0 1\n"
+                                  "vn 0 0 -1\n"
+                                  "g quad\n"
+                                  "f 1/1/1 2/2/1 3/3/1 4/3/1\n"
+                                  "v 2e0 +0 -2.5E-1\r\n"
+                                  "f -1//2 -4//2 -3//2\n");
+    Mesh mesh;
+    CHECK(load_obj(quad, 5, mesh));
+    CHECK(mesh.material_id == 5);
+    CHECK(mesh.triangle_count() == 3);
+    // every used position once, plus the corners of positions 2 and 3 with the other normal
+    CHECK(mesh.vertices.size() == 7);
+    std::vector<Vertex> quad_corners = corners(mesh);
+    if (quad_corners.size() == 9)
+    {
+        glm::vec3 expected[9] = {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 0, 0}, {1, 1, 0},
+                                 {0, 1, 0}, {2, 0, -0.25f}, {1, 0, 0}, {1, 1, 0}};
+        for (int i = 0; i < 9; i++) CHECK(near(quad_corners[i].position, expected[i]));
+        CHECK(quad_corners[5].u == 1.0f && quad_corners[5].v == 1.0f);
+        CHECK(quad_corners[1].u == 1.0f && quad_corners[1].v == 0.0f);
+        CHECK(near(quad_corners[0].normal, {0, 0, 1}));
+        CHECK(near(quad_corners[7].normal, {0, 0, -1}));
+    }
+
+    // normals are computed if the file has none
+    std::string flat =
+        write_file("obj_loader_test_flat.obj", "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n");
+    CHECK(load_obj(flat, 0, mesh));
+    CHECK(mesh.vertices.size() == 3);
+    for (auto const& vertex : mesh.vertices) CHECK(near(vertex.normal, {0, 0, 1}));
+
+    // a grid cut into many small chunks parses like one chunk on one thread
+    std::string grid_text = "vn 0 1 0\n";
+    int size = 20;
+    for (int z = 0; z <= size; z++)
+        for (int x = 0; x <= size; x++)
+            grid_text += "v " + std::to_string(x) + " " + std::to_string(0.1 * x * z) + " " +
+                         std::to_string(z) + "\n";
+    for (int z = 0; z < size; z++)
+        for (int x = 0; x < size; x++)
+        {
+            int corner = z * (size + 1) + x + 1;
+            grid_text += "f " + std::to_string(corner) + "//1 " + std::to_string(corner + 1) +
+                         "//1 " + std::to_string(corner + size + 2) + "//1 " +
+                         std::to_string(corner + size + 1) + "//1\n";
+        }
+    std::string grid = write_file("obj_loader_test_grid.obj", grid_text);
+    ObjLoadSettings serial;
+    serial.thread_count = 1;
+    Mesh one_chunk;
+    CHECK(load_obj(grid, 0, one_chunk, serial));
+    CHECK(one_chunk.triangle_count() == static_cast<size_t>(2 * size * size));
+    CHECK(one_chunk.vertices.size() == static_cast<size_t>((size + 1) * (size + 1)));
+    ObjLoadSettings chunked;
+    chunked.thread_count = 4;
+    chunked.chunk_size = 64;
+    Mesh many_chunks;
+    CHECK(load_obj(grid, 0, many_chunks, chunked));
+    CHECK(same_corners(one_chunk, many_chunks));
+
+    // references past the defined vertices, broken corners and missing files fail
+    CHECK(!load_obj(write_file("obj_loader_test_range.obj", "v 0 0 0\nv 1 0 0\nf 1 2 9\n"), 0,
+                    mesh));
+    CHECK(!load_obj(write_file("obj_loader_test_relative.obj", "v 0 0 0\nf 1 -2 -3\n"), 0, mesh));
+    CHECK(!load_obj(write_file("obj_loader_test_corner.obj", "v 0 0 0\nv 1 0 0\nf 1 2 x\n"), 0,
+                    mesh));
+    CHECK(!load_obj(write_file("obj_loader_test_normal.obj", "v 0 0 0\nf 1//1 1//1 1//1\n"), 0,
+                    mesh));
+    CHECK(!load_obj("obj_loader_test_missing.obj", 0, mesh));
+
+    for (auto const& entry : std::filesystem::directory_iterator("."))
+        if (entry.path().filename().string().rfind("obj_loader_test_", 0) == 0)
+            std::filesystem::remove(entry.path());
+    return test_result();
+}
@@ -0,0 +1,169 @@
+// The PLY loader on small binary files built by the test: fixed stride triangles with normals and
+// uvs, polygons and extra properties that need the serial pass, the same result on any thread
+// count, and every header and record error it reports.
+
+#include <cstring>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "ply_loader.h"
+
+namespace
+{
+template <typename T>
+void append(std::vector<uint8_t>& bytes, T value)
+{
+    size_t size = bytes.size();
+    bytes.resize(size + sizeof(T));
+    std::memcpy(bytes.data() + size, &value, sizeof(T));
+}
+
+std::string write_ply(std::string const& name, std::string const& header,
+                      std::vector<uint8_t> const& records)
+{
+    std::ofstream out(name, std::ios::binary);
+    out << "ply\n" << header << "end_header\n";
+    out.write(reinterpret_cast<char const*>(records.data()),
+              static_cast<std::streamsize>(records.size()));
+    return name;
+}
+
+bool near(glm::vec3 a, glm::vec3 b) { return glm::length(a - b) < 1e-5f; }
+
+constexpr char FORMAT[] = "format binary_little_endian 1.0\n";
+constexpr char XYZ[] = "property float x\nproperty float y\nproperty float z\n";
+constexpr char INDICES[] = "property list uchar int vertex_indices\n";
+
+// one triangle over three vertices, with the header lines before the elements replaced
+bool load_triangle(std::string const& format, std::string const& elements = "")
+{
+    std::vector<uint8_t> records;
+    for (float value : {0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f})
+        append(records, value);
+    append(records, uint8_t{3});
+    for (int32_t index : {0, 1, 2}) append(records, index);
+    std::string header = elements.empty() ? std::string("element vertex 3\n") + XYZ +
+                                                "element face 1\n" + INDICES
+                                          : elements;
+    Mesh mesh;
+    return load_ply(write_ply("ply_loader_test_triangle.ply", format + header, records), 0, mesh);
+}
+}  // namespace
+
+int main()
+{
+    // fixed stride: two triangles with normals, uvs and a skipped color, then a skipped element
+    std::vector<uint8_t> records;
+    float vertices[4][8] = {{0, 0, 0, 0, 0, 1, 0, 0},
+                            {1, 0, 0, 0, 0, 1, 1, 0},
+                            {1, 1, 0, 0, 0, 1, 1, 1},
+                            {0, 1, 0, 0, 0, 1, 0, 1}};
+    for (auto const& vertex : vertices)
+    {
+        for (int i = 0; i < 3; i++) append(records, vertex[i]);
+        append(records, uint8_t{255});
+        for (int i = 3; i < 8; i++) append(records, vertex[i]);
+    }
+    for (int32_t face : {0, 2})
+    {
+        append(records, uint8_t{3});
+        for (int32_t index : {0, 1 + face / 2, 2 + face / 2}) append(records, index);
+    }
+    append(records, int32_t{0});
+    append(records, int32_t{1});
+    std::string header = std::string(FORMAT) + "comment a test scan\nelement vertex 4\n" + XYZ +
+                         "property uchar red\nproperty float nx\nproperty float ny\n"
+                         "property float nz\nproperty float s\nproperty float t\n"
+                         "element face 2\n" + INDICES +
+                         "element edge 1\nproperty int vertex1\nproperty int vertex2\n";
+    Mesh mesh;
+    CHECK(load_ply(write_ply("ply_loader_test_quad.ply", header, records), 4, mesh));
+    CHECK(mesh.material_id == 4);
+    CHECK(mesh.vertices.size() == 4);
+    CHECK((mesh.indices == std::vector<uint32_t>{0, 1, 2, 0, 2, 3}));
+    if (mesh.vertices.size() == 4)
+    {
+        CHECK(near(mesh.vertices[2].position, {1, 1, 0}));
+        CHECK(near(mesh.vertices[3].normal, {0, 0, 1}));
+        CHECK(mesh.vertices[1].u == 1.0f && mesh.vertices[1].v == 0.0f);
+    }
+
+    // polygons and a property after the index list are read by blocks, doubles are converted
+    // and the normals are computed
+    int size = 40;
+    records.clear();
+    for (int z = 0; z <= size; z++)
+        for (int x = 0; x <= size; x++)
+            for (double value : {double(x), 0.0, double(z)}) append(records, value);
+    for (int z = 0; z < size; z++)
+        for (int x = 0; x < size; x++)
+        {
+            auto corner = static_cast<uint32_t>(z * (size + 1) + x);
+            append(records, uint8_t{4});
+            for (uint32_t index : {corner, corner + size + 1, corner + size + 2, corner + 1})
+                append(records, index);
+            append(records, int16_t{7});
+        }
+    header = std::string(FORMAT) + "element vertex " + std::to_string((size + 1) * (size + 1)) +
+             "\nproperty double x\nproperty double y\nproperty double z\n" +
+             "element face " + std::to_string(size * size) +
+             "\nproperty list uchar uint vertex_index\nproperty short flags\n";
+    std::string grid = write_ply("ply_loader_test_grid.ply", header, records);
+    PlyLoadSettings serial;
+    serial.thread_count = 1;
+    Mesh serial_mesh;
+    CHECK(load_ply(grid, 0, serial_mesh, serial));
+    CHECK(serial_mesh.triangle_count() == static_cast<size_t>(2 * size * size));
+    CHECK(serial_mesh.indices.size() >= 6 &&
+          (std::vector<uint32_t>(serial_mesh.indices.begin(), serial_mesh.indices.begin() + 6) ==
+           std::vector<uint32_t>{0, 41, 42, 0, 42, 1}));
+    CHECK(near(serial_mesh.vertices[42].position, {1, 0, 1}));
+    CHECK(near(serial_mesh.vertices[42].normal, {0, 1, 0}));
+    PlyLoadSettings parallel;
+    parallel.thread_count = 4;
+    Mesh parallel_mesh;
+    CHECK(load_ply(grid, 0, parallel_mesh, parallel));
+    CHECK(parallel_mesh.indices == serial_mesh.indices);
+
+    // the header
+    CHECK(load_triangle(FORMAT));
+    CHECK(load_triangle("format binary_little_endian 1.0\r\n"));
+    CHECK(!load_triangle("format ascii 1.0\n"));
+    CHECK(!load_triangle("format binary_big_endian 1.0\n"));
+    CHECK(!load_triangle("format binary_little_endian 2.0\n"));
+    CHECK(!load_triangle(""));
+    CHECK(!load_triangle(FORMAT, std::string("property float w\nelement vertex 3\n") + XYZ +
+                                     "element face 1\n" + INDICES));
+    CHECK(!load_triangle(FORMAT, std::string("element face 1\n") + INDICES +
+                                     "element vertex 3\n" + XYZ));
+    CHECK(!load_triangle(FORMAT, std::string("element vertex 3\n") + XYZ));
+    CHECK(!load_triangle(FORMAT, std::string("element vertex 3\n") + XYZ +
+                                     "element face 1\nproperty list uchar float vertex_indices\n"));
+    CHECK(!load_triangle(FORMAT, "element vertex 3\nproperty float x\nproperty float y\n"
+                                 "element face 1\n" + std::string(INDICES)));
+    // the records
+    CHECK(!load_triangle(FORMAT, std::string("element vertex 5\n") + XYZ + "element face 1\n" +
+                                     INDICES));
+    CHECK(!load_triangle(FORMAT, std::string("element vertex 3\n") + XYZ + "element face 2\n" +
+                                     INDICES));
+    records.clear();
+    for (int i = 0; i < 9; i++) append(records, 0.0f);
+    append(records, uint8_t{3});
+    for (int32_t index : {0, 1, 7}) append(records, index);
+    std::string range = write_ply("ply_loader_test_range.ply",
+                                  std::string(FORMAT) + "element vertex 3\n" + XYZ +
+                                      "element face 1\n" + INDICES,
+                                  records);
+    Mesh broken;
+    CHECK(!load_ply(range, 0, broken));
+    CHECK(!load_ply("ply_loader_test_missing.ply", 0, broken));
+
+    for (auto const& entry : std::filesystem::directory_iterator("."))
+        if (entry.path().filename().string().rfind("ply_loader_test_", 0) == 0)
+            std::filesystem::remove(entry.path());
+    return test_result();
+}
@@ -0,0 +1,63 @@
+// Spatial splits on long, thin triangles: they are referenced by several leaves, within the
+// reference budget, and the clipped bounds of their references still cover each of them.
+
+#include <random>
+#include <vector>
+
+#include "bvh.h"
+#include "check.h"
+
+int main()
+{
+    // long diagonal slivers crossing each other
+    std::mt19937 generator(6);
+    std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+    std::vector<Triangle> triangles;
+    for (int i = 0; i < 500; i++)
+    {
+        glm::vec3 a(position(generator), position(generator), position(generator));
+        glm::vec3 b(position(generator), position(generator), position(generator));
+        triangles.emplace_back(a, b, b + glm::vec3(0.01f, 0.02f, 0.0f), 0);
+    }
+
+    BvhBuildSettings settings;
+    settings.quality = BvhQuality::high;
+    BVH bvh;
+    bvh.build(triangles, settings);
+    auto count = static_cast<float>(triangles.size());
+    auto references = static_cast<float>(bvh.primitive_indices.size());
+    CHECK(references > count);
+    CHECK(references <= count * (1.0f + settings.spatial_split_budget));
+
+    BVH object_splits;
+    object_splits.build(triangles);
+    CHECK(bvh.sah_cost() < object_splits.sah_cost());
+
+    // the union of the leaves referencing a triangle bounds all of it
+    std::vector<AABB> covered(triangles.size());
+    std::vector<uint32_t> stack{0};
+    while (!stack.empty())
+    {
+        BvhNode const& node = bvh.nodes[stack.back()];
+        stack.pop_back();
+        if (!node.is_leaf())
+        {
+            stack.push_back(node.left_or_first);
+            stack.push_back(node.right_or_count);
+            continue;
+        }
+        for (uint32_t i = 0; i < node.primitive_count(); i++)
+            covered[bvh.primitive_indices[node.left_or_first + i]].expand(node.bounds());
+    }
+    for (size_t i = 0; i < triangles.size(); i++)
+    {
+        AABB bounds = triangle_bounds(triangles[i]);
+        bool inside = true;
+        for (int axis = 0; axis < 3; axis++)
+            inside = inside && covered[i].min[axis] <= bounds.min[axis] &&
+                     covered[i].max[axis] >= bounds.max[axis];
+        CHECK(inside);
+    }
+
+    return test_result();
+}
@@ -0,0 +1,155 @@
+// Scene files: what is written opens again with and without a BVH and quantized, and open() rejects
+// a damaged header and every index or material id the path tracer would follow out of range.
+
+#include <cstddef>
+#include <cstring>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "scene_file.h"
+
+namespace
+{
+// a strip of triangles, enough for a BVH with interior nodes
+Mesh make_strip(int material_id)
+{
+    std::vector<Triangle> triangles;
+    for (int i = 0; i < 32; i++)
+    {
+        auto x = static_cast<float>(i);
+        triangles.emplace_back(glm::vec3(x, 0, 0), glm::vec3(x + 1, 0, 0),
+                               glm::vec3(x, 1, 0.1f * x), material_id);
+    }
+    Mesh mesh = make_mesh(triangles);
+    mesh.bvh.build(mesh.triangles());
+    return mesh;
+}
+
+std::vector<char> read_file(std::string const& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(in), {});
+}
+
+bool open_bytes(std::vector<char> const& bytes)
+{
+    std::ofstream("scene_file_test_damaged.scene", std::ios::binary)
+        .write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    SceneFile file;
+    return file.open("scene_file_test_damaged.scene");
+}
+
+// the header is followed by the table of sections, an offset and a size for each
+size_t section_entry(SceneSection section) { return 32 + 16 * static_cast<size_t>(section); }
+
+size_t section_offset(std::vector<char> const& bytes, SceneSection section)
+{
+    uint64_t offset;
+    std::memcpy(&offset, bytes.data() + section_entry(section), sizeof(offset));
+    return static_cast<size_t>(offset);
+}
+
+template <typename T>
+bool opens_with(std::vector<char> bytes, SceneSection section, size_t byte, T value)
+{
+    std::memcpy(bytes.data() + section_offset(bytes, section) + byte, &value, sizeof(T));
+    return open_bytes(bytes);
+}
+}  // namespace
+
+int main()
+{
+    SceneData scene;
+    Material white(glm::vec4(1.0f), glm::vec4(0.0f), Material::Type::LAMBERT);
+    scene.materials = {white, white};
+    scene.spheres.emplace_back(glm::vec3(1, 2, 3), 4.0f, 1);
+    scene.meshes = {make_strip(0), make_strip(1)};
+    scene.mesh_instances.push_back(MeshInstance{0, glm::mat4(1.0f), -1});
+    scene.mesh_instances.push_back(MeshInstance{1, glm::mat4(1.0f), 0});
+
+    CHECK(write_scene_file("scene_file_test.scene", scene, true));
+    {
+        SceneFile file;
+        CHECK(file.open("scene_file_test.scene"));
+        CHECK(file.has_bvh() && !file.quantized());
+        CHECK(file.mesh_count() == 2 && file.instance_count() == 2);
+        CHECK(file.copy_section<Material>(SceneSection::materials).size() == 2);
+        CHECK(file.copy_section<Sphere>(SceneSection::spheres).size() == 1);
+    }
+    CHECK(write_scene_file("scene_file_test_no_bvh.scene", scene, false));
+    {
+        SceneFile file;
+        CHECK(file.open("scene_file_test_no_bvh.scene"));
+        CHECK(!file.has_bvh());
+        std::vector<Mesh> meshes = file.meshes();
+        CHECK(meshes.size() == 2);
+        if (meshes.size() == 2)
+        {
+            CHECK(meshes[1].indices == scene.meshes[1].indices);
+            CHECK(meshes[1].material_id == 1);
+        }
+    }
+    SceneData quantized = scene;
+    for (auto& mesh : quantized.meshes) mesh.quantize();
+    CHECK(write_scene_file("scene_file_test_quantized.scene", quantized, true));
+    {
+        SceneFile file;
+        CHECK(file.open("scene_file_test_quantized.scene") && file.quantized());
+    }
+
+    std::vector<char> bytes = read_file("scene_file_test.scene");
+    CHECK(open_bytes(bytes));
+    // the vertices are not checked, any value is fine for them
+    CHECK(opens_with(bytes, SceneSection::mesh_vertices, 0, 3.0f));
+
+    // the magic, the size and the section alignment
+    std::vector<char> damaged = bytes;
+    damaged[0] = 'X';
+    CHECK(!open_bytes(damaged));
+    CHECK(!open_bytes(std::vector<char>(bytes.begin(), bytes.begin() + bytes.size() / 2)));
+    damaged = bytes;
+    uint64_t misaligned = section_offset(bytes, SceneSection::spheres) + 4;
+    std::memcpy(damaged.data() + section_entry(SceneSection::spheres), &misaligned,
+                sizeof(misaligned));
+    CHECK(!open_bytes(damaged));
+
+    // indices into other sections
+    SceneFile file;
+    file.open("scene_file_test.scene");
+    std::vector<BvhNode> blas = file.copy_section<BvhNode>(SceneSection::blas_nodes);
+    file.close();
+    size_t leaf = 0;
+    while (leaf < blas.size() && !blas[leaf].is_leaf()) leaf++;
+    CHECK(!blas[0].is_leaf() && leaf < blas.size());
+    CHECK(!opens_with(bytes, SceneSection::mesh_indices, 4, uint32_t{99999}));
+    CHECK(!opens_with(bytes, SceneSection::blas_nodes, offsetof(BvhNode, left_or_first),
+                      uint32_t{1} << 30));
+    CHECK(!opens_with(bytes, SceneSection::blas_nodes,
+                      leaf * sizeof(BvhNode) + offsetof(BvhNode, left_or_first), uint32_t{5000}));
+    CHECK(!opens_with(bytes, SceneSection::blas_indices, 0, uint32_t{77777}));
+    CHECK(!opens_with(bytes, SceneSection::blas_parents, 2 * sizeof(uint32_t), uint32_t{5}));
+    CHECK(!opens_with(bytes, SceneSection::tlas_nodes, offsetof(BvhNode, right_or_count),
+                      uint32_t{123}));
+    CHECK(!opens_with(bytes, SceneSection::instances, offsetof(Instance, blas_root),
+                      uint32_t{1} << 20));
+    CHECK(!opens_with(bytes, SceneSection::instances, offsetof(Instance, material), int32_t{9}));
+    // material ids are checked against the two materials
+    CHECK(!opens_with(bytes, SceneSection::mesh_ranges, offsetof(MeshRange, material_id),
+                      int32_t{2}));
+    CHECK(!opens_with(bytes, SceneSection::mesh_instances, offsetof(MeshInstance, mesh),
+                      uint32_t{2}));
+    CHECK(!opens_with(bytes, SceneSection::spheres, offsetof(Sphere, material_id), 3.0f));
+
+    CHECK(!file.open("scene_file_test_missing.scene"));
+
+    for (auto const& entry : std::filesystem::directory_iterator("."))
+        if (entry.path().filename().string().rfind("scene_file_test", 0) == 0 &&
+            entry.path().extension() == ".scene")
+            std::filesystem::remove(entry.path());
+    return test_result();
+}
@@ -0,0 +1,87 @@
+// Converts a Wavefront OBJ, binary PLY or binary glTF model into a scene file, which
+// RVPT::load_scene() maps and uploads without parsing or building anything.
+//
+//     scene_converter <input.obj|input.ply|input.glb> <output scene> [--no-bvh] [--quantize]
+//                     [--high-quality]
+//
+// An OBJ or PLY model is placed once at its own coordinates with a single white lambert material,
+// a glTF model brings its nodes and materials along.
+
+#include <chrono>
+#include <cstring>
+#include <string>
+
+#include <fmt/core.h>
+
+#include "gltf_loader.h"
+#include "mapped_file.h"
+#include "obj_loader.h"
+#include "ply_loader.h"
+#include "scene_file.h"
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        fmt::print("usage: {} <input.obj|input.ply|input.glb> <output scene> [--no-bvh] "
+                   "[--quantize] [--high-quality]\n",
+                   argv[0]);
+        return 1;
+    }
+    bool include_bvh = true;
+    bool quantize = false;
+    BvhBuildSettings settings;
+    for (int i = 3; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--no-bvh") == 0)
+            include_bvh = false;
+        else if (std::strcmp(argv[i], "--quantize") == 0)
+            quantize = true;
+        else if (std::strcmp(argv[i], "--high-quality") == 0)
+            settings.quality = BvhQuality::high;
+        else
+        {
+            fmt::print("unknown option {}\n", argv[i]);
+            return 1;
+        }
+    }
+    if (quantize && !include_bvh)
+    {
+        fmt::print("quantized meshes are only stored with their BVH\n");
+        return 1;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    SceneData scene;
+    std::string input = argv[1];
+    if (has_extension(input, ".glb"))
+    {
+        if (!load_glb(input, scene)) return 1;
+    }
+    else
+    {
+        scene.materials.emplace_back(glm::vec4(1.0f, 1.0f, 1.0f, 0.0f), glm::vec4(0.0f),
+                                     Material::Type::LAMBERT);
+        Mesh mesh;
+        bool ply = has_extension(input, ".ply");
+        if (!(ply ? load_ply(input, 0, mesh) : load_obj(input, 0, mesh))) return 1;
+        scene.meshes.push_back(std::move(mesh));
+        scene.mesh_instances.push_back(MeshInstance{0, glm::mat4(1.0f), -1});
+    }
+    for (auto& mesh : scene.meshes)
+    {
+        if (include_bvh) mesh.bvh.build(mesh.triangles(), settings);
+        if (quantize) mesh.quantize();
+    }
+
+    if (!write_scene_file(argv[2], scene, include_bvh, settings))
+    {
+        fmt::print("[{}: {}] unable to write {}\n", "ERROR", "SCENE-CONVERTER", argv[2]);
+        return 1;
+    }
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::high_resolution_clock::now() - start;
+    fmt::print("[{}: {}] wrote {} in {:.2f} ms\n", "INFO", "SCENE-CONVERTER", argv[2],
+               elapsed.count());
+    return 0;
+}